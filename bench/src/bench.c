@@ -0,0 +1,1823 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "quiet-lwip/lwip-socket.h"
+
+#include "quiet-lwip-relay.h"
+#include "quiet-lwip-mux.h"
+
+#include "bench.h"
+
+const uint8_t client_mac[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+const uint8_t server_mac[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x08};
+const char *client_addr_s = "192.168.0.2";
+const char *server_addr_s = "192.168.0.8";
+const char *broadcast_addr_s = "192.168.0.255";
+const char *netmask_s = "255.255.255.0";
+const char *gateway_s = "192.168.0.1";
+
+const uint16_t bulk_port = 7001;
+const uint16_t rtt_port = 7002;
+const uint16_t flows_port = 7003;
+const uint16_t proxy_port = 7004;
+const uint16_t discovery_server_port = 3333;
+const uint16_t discovery_client_port = 3334;
+const uint16_t fanout_server_port = 7005;
+const uint16_t fanout_client_port = 7006;
+const uint16_t api_calls_port = 7010;
+const uint16_t mux_port = 7011;
+const uint16_t pmtu_server_port = 7012;
+const uint16_t pmtu_client_port = 7013;
+
+// a lost datagram shouldn't stall the run, so discovery gives up after this
+const long discovery_timeout_ms = 10000;
+
+const size_t flow_request_len = 64;
+const size_t max_flows = 32;
+
+#define fanout_batch 16
+const size_t fanout_datagram_len = 24;
+const long fanout_quiet_ms = 50;
+
+#define api_calls_threads 4
+
+#define mem_stress_threads 4
+
+// the ARP table is shrunk to this many entries while arp floods it
+const size_t arp_evict_limit = 20;
+// the flood's addresses count up from here; nothing answers for them
+const char *arp_flood_addr_s = "192.168.0.100";
+// long enough for an announcement to cross the link
+const double arp_announce_s = 1;
+
+#define mux_streams 8
+// a stream that goes this long without any of its echo coming back has
+//   been lost by the tunnel, and the run is reported as failed
+const long mux_stall_ms = 20000;
+
+/* ------------------------------------------------------------------------- */
+// clocks and results
+
+// lwip's clock, so that timings are in simulated time when the channel
+//   drives a virtual clock
+double bench_now() {
+    return quiet_lwip_now_us() * 1e-6;
+}
+
+// waits on lwip's clock, giving the link time to carry what is queued
+static void bench_sleep(double seconds) {
+    const struct timespec poll_interval = {0, 1000000};
+    double until = bench_now() + seconds;
+    while (bench_now() < until) {
+        nanosleep(&poll_interval, NULL);
+    }
+}
+
+// socket calls that never touch the link take no simulated time, so they
+//   are timed against the host's clock
+static double wall_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_result_add_latency(bench_result *res, double seconds) {
+    pthread_mutex_lock(&res->mutex);
+    if (res->num_latencies == res->latencies_cap) {
+        res->latencies_cap = res->latencies_cap ? 2 * res->latencies_cap : 16;
+        res->latencies = realloc(res->latencies, res->latencies_cap * sizeof(double));
+    }
+    res->latencies[res->num_latencies++] = seconds;
+    pthread_mutex_unlock(&res->mutex);
+}
+
+void bench_result_add_lost(bench_result *res) {
+    pthread_mutex_lock(&res->mutex);
+    res->lost++;
+    pthread_mutex_unlock(&res->mutex);
+}
+
+static int double_compare(const void *l, const void *r) {
+    double dl = *(const double*)l;
+    double dr = *(const double*)r;
+    return (dl > dr) - (dl < dr);
+}
+
+// nearest-rank percentile over sorted samples
+static double percentile(const double *sorted, size_t n, double p) {
+    if (!n) {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(p / 100.0 * n);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+// upper edge of the bucket holding the p'th percentile, which bounds it
+static uint64_t histogram_percentile(const quiet_lwip_latency_histogram *h, double p) {
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * h->count);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < QUIET_LWIP_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t edge = (uint64_t)1 << i;
+            return (edge < h->max_us) ? edge : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+static void bench_stages_json(FILE *f, bench_result *res) {
+    fprintf(f, "      \"stages_us\": {");
+    bool first = true;
+    for (size_t i = 0; i < quiet_lwip_num_stages; i++) {
+        const quiet_lwip_latency_histogram *h = res->stages + i;
+        if (!h->count) {
+            continue;
+        }
+        fprintf(f, "%s\n        \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}",
+                first ? "" : ",", quiet_lwip_stage_name(i), (unsigned long long)h->count,
+                (double)h->total_us / h->count,
+                (unsigned long long)histogram_percentile(h, 50),
+                (unsigned long long)histogram_percentile(h, 99),
+                (unsigned long long)h->max_us);
+        first = false;
+    }
+    fprintf(f, "\n      },\n");
+}
+
+static void bench_result_json(FILE *f, bench_result *res) {
+    qsort(res->latencies, res->num_latencies, sizeof(double), double_compare);
+
+    double goodput = (res->seconds > 0) ? (res->bytes * 8.0 / res->seconds) : 0;
+    double cpu_per_byte = res->bytes ? (res->cpu_seconds * 1e9 / res->bytes) : 0;
+
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"name\": \"%s\",\n", res->name);
+    fprintf(f, "      \"ok\": %s,\n", res->failed ? "false" : "true");
+    fprintf(f, "      \"bytes\": %llu,\n", (unsigned long long)res->bytes);
+    fprintf(f, "      \"seconds\": %.6f,\n", res->seconds);
+    fprintf(f, "      \"link_samples\": %llu,\n", (unsigned long long)res->link_samples);
+    fprintf(f, "      \"goodput_bps\": %.1f,\n", goodput);
+    fprintf(f, "      \"latency_ms\": {\"count\": %zu, \"lost\": %zu, \"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f},\n",
+            res->num_latencies, res->lost,
+            percentile(res->latencies, res->num_latencies, 50) * 1e3,
+            percentile(res->latencies, res->num_latencies, 99) * 1e3,
+            res->num_latencies ? res->latencies[res->num_latencies - 1] * 1e3 : 0);
+    fprintf(f, "      \"retransmissions\": %u,\n", res->retransmissions);
+    if (res->traced) {
+        bench_stages_json(f, res);
+    }
+    if (res->core_locked) {
+        fprintf(f, "      \"core_lock\": {\"acquisitions\": %llu, \"contended\": %llu, \"wait_ms\": %.3f},\n",
+                (unsigned long long)res->core_lock.acquisitions,
+                (unsigned long long)res->core_lock.contended,
+                res->core_lock.wait_ns * 1e-6);
+    }
+    if (res->memp_cached) {
+        fprintf(f, "      \"memp_cache\": {\"hits\": %llu, \"refills\": %llu, \"flushes\": %llu, \"xthread_frees\": %llu},\n",
+                (unsigned long long)res->memp_cache.hits,
+                (unsigned long long)res->memp_cache.refills,
+                (unsigned long long)res->memp_cache.flushes,
+                (unsigned long long)res->memp_cache.xthread_frees);
+    }
+    if (res->heap_reported) {
+        // internal: rounding and headers on what's allocated. external: how
+        //   much of the heap's remaining room can't go to a single request
+        size_t room = res->heap.limit - res->heap.reserved;
+        double internal = res->heap_requested ?
+            (double)res->heap.reserved / res->heap_requested - 1 : 0;
+        double external = room ? 1 - (double)res->heap.largest_free / room : 0;
+        fprintf(f, "      \"heap\": {\"limit\": %zu, \"size\": %zu, \"reserved\": %zu, \"requested\": %llu, "
+                   "\"largest_free\": %zu, \"internal_fragmentation\": %.3f, \"external_fragmentation\": %.3f},\n",
+                res->heap.limit, res->heap.size, res->heap.reserved,
+                (unsigned long long)res->heap_requested, res->heap.largest_free,
+                internal, external > 0 ? external : 0);
+    }
+    if (res->arp_reported) {
+        fprintf(f, "      \"arp\": {\"frames\": %llu, \"evictions\": %llu, \"used\": %zu, \"size\": %zu},\n",
+                (unsigned long long)res->arp.frames, (unsigned long long)res->arp.evictions,
+                res->arp.used, res->arp.size);
+    }
+    if (res->path_mtu) {
+        fprintf(f, "      \"path_mtu\": %zu,\n", res->path_mtu);
+    }
+    if (res->num_chksum) {
+        fprintf(f, "      \"chksum\": [\n");
+        for (size_t i = 0; i < res->num_chksum; i++) {
+            bench_chksum_row *row = res->chksum + i;
+            fprintf(f, "        {\"kernel\": \"%s\", \"size\": %zu, \"align\": %zu, "
+                       "\"chksum_gbps\": %.2f, \"copy_gbps\": %.2f}%s\n",
+                    row->kernel, row->size, row->align, row->chksum_gbps, row->copy_gbps,
+                    (i + 1 < res->num_chksum) ? "," : "");
+        }
+        fprintf(f, "      ],\n");
+    }
+    fprintf(f, "      \"cpu_ns_per_byte\": %.1f\n", cpu_per_byte);
+    fprintf(f, "    }");
+}
+
+/* ------------------------------------------------------------------------- */
+// socket helpers
+
+static struct lwip_sockaddr_in lwip_addr(const char *addr, uint16_t port) {
+    struct lwip_sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_len = sizeof(sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr(addr);
+    sa.sin_port = htons(port);
+    return sa;
+}
+
+static int open_listen(const char *addr, uint16_t port, int backlog) {
+    int socket_fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
+
+    if (socket_fd < 0) {
+        fprintf(stderr, "socket failed\n");
+        return -1;
+    }
+
+    struct lwip_sockaddr_in local = lwip_addr(addr, port);
+    if (lwip_bind(socket_fd, (struct lwip_sockaddr*)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "bind failed\n");
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    if (lwip_listen(socket_fd, backlog) < 0) {
+        fprintf(stderr, "listen failed\n");
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+static int open_connect(const char *addr, uint16_t port) {
+    int socket_fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
+
+    if (socket_fd < 0) {
+        fprintf(stderr, "socket failed\n");
+        return -1;
+    }
+
+    struct lwip_sockaddr_in remote = lwip_addr(addr, port);
+    if (lwip_connect(socket_fd, (struct lwip_sockaddr*)&remote, sizeof(remote)) < 0) {
+        fprintf(stderr, "connect failed\n");
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+static ssize_t write_all(int fd, const uint8_t *buf, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        int res = lwip_write(fd, buf + written, len - written);
+        if (res <= 0) {
+            return -1;
+        }
+        written += res;
+    }
+    return written;
+}
+
+static ssize_t read_all(int fd, uint8_t *buf, size_t len) {
+    size_t nread = 0;
+    while (nread < len) {
+        int res = lwip_read(fd, buf + nread, len - nread);
+        if (res <= 0) {
+            return -1;
+        }
+        nread += res;
+    }
+    return nread;
+}
+
+// wait for fd to become readable, returns false on timeout
+static bool wait_readable(int fd, long timeout_ms) {
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(fd, &read_fds);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return lwip_select(fd + 1, &read_fds, NULL, NULL, &tv) > 0;
+}
+
+/* ------------------------------------------------------------------------- */
+// tcp_bulk: one connection pushing as fast as it can
+
+typedef struct {
+    int listen_fd;
+    uint64_t received;
+    double finished;
+} bulk_server_args;
+
+static void *bulk_server(void *args_v) {
+    bulk_server_args *args = (bulk_server_args*)args_v;
+    int conn_fd = lwip_accept(args->listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+        return NULL;
+    }
+
+    uint8_t buf[4096];
+    for (;;) {
+        int res = lwip_read(conn_fd, buf, sizeof(buf));
+        if (res <= 0) {
+            break;
+        }
+        args->received += res;
+    }
+    args->finished = bench_now();
+    lwip_close(conn_fd);
+    return NULL;
+}
+
+static void scenario_tcp_bulk(bench_env *env, bench_result *res) {
+    size_t total = (size_t)(env->scale * 16384);
+
+    bulk_server_args args = {0};
+    args.listen_fd = open_listen(server_addr_s, bulk_port, 1);
+    if (args.listen_fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, bulk_server, &args);
+
+    uint8_t *payload = malloc(total);
+    for (size_t i = 0; i < total; i++) {
+        payload[i] = (uint8_t)i;
+    }
+
+    double start = bench_now();
+    int fd = open_connect(server_addr_s, bulk_port);
+    if (fd < 0 || write_all(fd, payload, total) < 0) {
+        res->failed = true;
+    }
+    if (fd >= 0) {
+        lwip_close(fd);
+    }
+    pthread_join(server, NULL);
+    lwip_close(args.listen_fd);
+    free(payload);
+
+    res->bytes = args.received;
+    res->seconds = args.finished - start;
+    if (args.received != total) {
+        res->failed = true;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// tcp_rtt: PING/PONG on one long-lived connection, like kv_client
+
+static const char *ping_str = "PING";
+static const char *pong_str = "PONG";
+
+static void *rtt_server(void *listen_fd_v) {
+    int listen_fd = *(int*)listen_fd_v;
+    int conn_fd = lwip_accept(listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+        return NULL;
+    }
+
+    uint8_t buf[4];
+    while (read_all(conn_fd, buf, sizeof(buf)) == sizeof(buf)) {
+        if (write_all(conn_fd, (const uint8_t*)pong_str, strlen(pong_str)) < 0) {
+            break;
+        }
+    }
+    lwip_close(conn_fd);
+    return NULL;
+}
+
+static void scenario_tcp_rtt(bench_env *env, bench_result *res) {
+    size_t count = (size_t)(env->scale * 20);
+
+    int listen_fd = open_listen(server_addr_s, rtt_port, 1);
+    if (listen_fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, rtt_server, &listen_fd);
+
+    double start = bench_now();
+    int fd = open_connect(server_addr_s, rtt_port);
+    if (fd < 0) {
+        res->failed = true;
+    }
+    uint8_t buf[4];
+    for (size_t i = 0; fd >= 0 && i < count; i++) {
+        double t0 = bench_now();
+        if (write_all(fd, (const uint8_t*)ping_str, strlen(ping_str)) < 0 ||
+                read_all(fd, buf, sizeof(buf)) < 0) {
+            res->failed = true;
+            break;
+        }
+        bench_result_add_latency(res, bench_now() - t0);
+        res->bytes += strlen(ping_str) + sizeof(buf);
+    }
+    res->seconds = bench_now() - start;
+    if (fd >= 0) {
+        lwip_close(fd);
+    }
+    pthread_join(server, NULL);
+    lwip_close(listen_fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// tcp_flows: many short connections at once, each one request and echo
+
+typedef struct {
+    int listen_fd;
+    size_t count;
+    _Atomic bool shutdown;
+} flows_server_args;
+
+static void *flows_echo(void *fd_v) {
+    int fd = (int)(intptr_t)fd_v;
+    uint8_t buf[flow_request_len];
+    if (read_all(fd, buf, sizeof(buf)) == sizeof(buf)) {
+        write_all(fd, buf, sizeof(buf));
+    }
+    lwip_close(fd);
+    return NULL;
+}
+
+static void *flows_server(void *args_v) {
+    flows_server_args *args = (flows_server_args*)args_v;
+    pthread_t echo_threads[max_flows];
+    size_t accepted = 0;
+    while (accepted < args->count && !atomic_load(&args->shutdown)) {
+        // poll so that flows which never connect can't wedge the scenario
+        if (!wait_readable(args->listen_fd, 100)) {
+            continue;
+        }
+        int fd = lwip_accept(args->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            break;
+        }
+        pthread_create(&echo_threads[accepted], NULL, flows_echo, (void*)(intptr_t)fd);
+        accepted++;
+    }
+    for (size_t i = 0; i < accepted; i++) {
+        pthread_join(echo_threads[i], NULL);
+    }
+    return NULL;
+}
+
+typedef struct {
+    bench_result *res;
+    size_t index;
+} flows_client_args;
+
+static void *flows_client(void *args_v) {
+    flows_client_args *args = (flows_client_args*)args_v;
+    uint8_t req[flow_request_len], resp[flow_request_len];
+    memset(req, (int)args->index, sizeof(req));
+
+    double t0 = bench_now();
+    int fd = open_connect(server_addr_s, flows_port);
+    if (fd < 0) {
+        bench_result_add_lost(args->res);
+        return NULL;
+    }
+    if (write_all(fd, req, sizeof(req)) < 0 || read_all(fd, resp, sizeof(resp)) < 0 ||
+            memcmp(req, resp, sizeof(req)) != 0) {
+        bench_result_add_lost(args->res);
+    } else {
+        bench_result_add_latency(args->res, bench_now() - t0);
+    }
+    lwip_close(fd);
+    return NULL;
+}
+
+static void scenario_tcp_flows(bench_env *env, bench_result *res) {
+    size_t count = (size_t)(env->scale * 8);
+    if (count > max_flows) {
+        count = max_flows;
+    }
+
+    flows_server_args server_args;
+    server_args.listen_fd = open_listen(server_addr_s, flows_port, count);
+    server_args.count = count;
+    atomic_init(&server_args.shutdown, false);
+    if (server_args.listen_fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, flows_server, &server_args);
+
+    pthread_t clients[max_flows];
+    flows_client_args client_args[max_flows];
+    double start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        client_args[i].res = res;
+        client_args[i].index = i;
+        pthread_create(&clients[i], NULL, flows_client, &client_args[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(clients[i], NULL);
+    }
+    res->seconds = bench_now() - start;
+    res->bytes = res->num_latencies * 2 * flow_request_len;
+    if (res->lost) {
+        res->failed = true;
+    }
+    atomic_store(&server_args.shutdown, true);
+    pthread_join(server, NULL);
+    lwip_close(server_args.listen_fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// udp_discovery: MARCO broadcast, POLO unicast reply
+
+static const char *marco_str = "MARCO";
+static const char *polo_str = "POLO";
+
+typedef struct {
+    int fd;
+    _Atomic bool shutdown;
+} discovery_server_args;
+
+static void *discovery_server(void *args_v) {
+    discovery_server_args *args = (discovery_server_args*)args_v;
+    uint8_t buf[64];
+    while (!atomic_load(&args->shutdown)) {
+        if (!wait_readable(args->fd, 100)) {
+            continue;
+        }
+        struct lwip_sockaddr_in from;
+        lwip_socklen_t from_len = sizeof(from);
+        int len = lwip_recvfrom(args->fd, buf, sizeof(buf), 0, (struct lwip_sockaddr*)&from, &from_len);
+        if (len != (int)strlen(marco_str) || memcmp(buf, marco_str, len) != 0) {
+            continue;
+        }
+        from.sin_port = htons(discovery_client_port);
+        lwip_sendto(args->fd, polo_str, strlen(polo_str), 0, (struct lwip_sockaddr*)&from, sizeof(from));
+    }
+    return NULL;
+}
+
+static int open_udp(const char *addr, uint16_t port) {
+    int fd = lwip_socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "socket failed\n");
+        return -1;
+    }
+    struct lwip_sockaddr_in local = lwip_addr(addr, port);
+    if (lwip_bind(fd, (struct lwip_sockaddr*)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "bind failed\n");
+        lwip_close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void scenario_udp_discovery(bench_env *env, bench_result *res) {
+    size_t count = (size_t)(env->scale * 10);
+
+    discovery_server_args server_args;
+    server_args.fd = open_udp(server_addr_s, discovery_server_port);
+    atomic_init(&server_args.shutdown, false);
+    int fd = open_udp(client_addr_s, discovery_client_port);
+    if (server_args.fd < 0 || fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, discovery_server, &server_args);
+
+    struct lwip_sockaddr_in broadcast = lwip_addr(broadcast_addr_s, discovery_server_port);
+    uint8_t buf[64];
+    double start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        double t0 = bench_now();
+        lwip_sendto(fd, marco_str, strlen(marco_str), 0, (struct lwip_sockaddr*)&broadcast, sizeof(broadcast));
+        if (!wait_readable(fd, discovery_timeout_ms)) {
+            res->lost++;
+            continue;
+        }
+        int len = lwip_recvfrom(fd, buf, sizeof(buf), 0, NULL, NULL);
+        if (len == (int)strlen(polo_str) && memcmp(buf, polo_str, len) == 0) {
+            bench_result_add_latency(res, bench_now() - t0);
+            res->bytes += strlen(marco_str) + len;
+        } else {
+            res->lost++;
+        }
+    }
+    res->seconds = bench_now() - start;
+    if (!res->num_latencies) {
+        res->failed = true;
+    }
+
+    atomic_store(&server_args.shutdown, true);
+    pthread_join(server, NULL);
+    lwip_close(server_args.fd);
+    lwip_close(fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// arp: MARCO/POLO unicast to the server, starting with the first packet the
+//   client sends it, so it runs ahead of the other scenarios. with the
+//   interfaces set to derived, table or snoop (-a), no ARP frame may be sent.
+//   then the ARP table is shrunk and the client sends to more peers than fit
+//   in it, and the server must still be reachable afterwards. outside of
+//   derived mode, those peers go through the table and must evict entries
+
+static bool arp_exchange(int fd, const struct lwip_sockaddr_in *to, bench_result *res) {
+    uint8_t buf[64];
+    double t0 = bench_now();
+    lwip_sendto(fd, marco_str, strlen(marco_str), 0, (const struct lwip_sockaddr*)to, sizeof(*to));
+    if (!wait_readable(fd, discovery_timeout_ms)) {
+        res->lost++;
+        return false;
+    }
+    int len = lwip_recvfrom(fd, buf, sizeof(buf), 0, NULL, NULL);
+    if (len != (int)strlen(polo_str) || memcmp(buf, polo_str, len) != 0) {
+        res->lost++;
+        return false;
+    }
+    bench_result_add_latency(res, bench_now() - t0);
+    res->bytes += strlen(marco_str) + len;
+    return true;
+}
+
+static void scenario_arp(bench_env *env, bench_result *res) {
+    size_t count = (size_t)(env->scale * 10);
+    bool derived = strcmp(env->arp_mode, "derived") == 0;
+    bool asks = strcmp(env->arp_mode, "dynamic") == 0;
+
+    discovery_server_args server_args;
+    server_args.fd = open_udp(server_addr_s, discovery_server_port);
+    atomic_init(&server_args.shutdown, false);
+    int fd = open_udp(client_addr_s, discovery_client_port);
+    if (server_args.fd < 0 || fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, discovery_server, &server_args);
+
+    struct lwip_sockaddr_in to = lwip_addr(server_addr_s, discovery_server_port);
+    bench_arp_stats start, contact;
+    bench_arp(&start);
+    double t0 = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        arp_exchange(fd, &to, res);
+    }
+    res->seconds = bench_now() - t0;
+    bench_arp(&contact);
+    if (res->lost || (!asks && contact.frames != start.frames)) {
+        res->failed = true;
+    }
+
+    size_t limit = bench_arp_limit(arp_evict_limit);
+    struct lwip_sockaddr_in peer = lwip_addr(arp_flood_addr_s, discovery_server_port);
+    uint32_t first_peer = ntohl(peer.sin_addr.s_addr);
+    for (size_t i = 0; i < 3 * arp_evict_limit; i++) {
+        peer.sin_addr.s_addr = htonl(first_peer + (uint32_t)i);
+        lwip_sendto(fd, marco_str, strlen(marco_str), 0, (struct lwip_sockaddr*)&peer, sizeof(peer));
+    }
+    if (!arp_exchange(fd, &to, res)) {
+        res->failed = true;
+    }
+    bench_arp(&res->arp);
+    bench_arp_limit(limit);
+    if (!derived && res->arp.evictions == start.evictions) {
+        res->failed = true;
+    }
+    // frames sent while the server was the only peer
+    res->arp.frames = contact.frames - start.frames;
+    res->arp.evictions -= start.evictions;
+    res->arp_reported = true;
+
+    atomic_store(&server_args.shutdown, true);
+    pthread_join(server, NULL);
+    lwip_close(server_args.fd);
+    lwip_close(fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// udp_fanout: batches of small telemetry datagrams sent with lwip_sendmmsg,
+//   drained with lwip_recvmmsg. each datagram starts with its batch number,
+//   and the server acks how many of the batch it got once the link goes
+//   quiet, so that the ack doesn't talk over the batch
+
+typedef struct {
+    int fd;
+    _Atomic bool shutdown;
+} fanout_server_args;
+
+static void *fanout_server(void *args_v) {
+    fanout_server_args *args = (fanout_server_args*)args_v;
+    uint8_t bufs[fanout_batch][64];
+    struct iovec iovs[fanout_batch];
+    struct lwip_mmsghdr msgs[fanout_batch];
+    struct lwip_sockaddr_in from;
+    uint32_t batch = 0;
+    uint32_t received = 0;
+    while (!atomic_load(&args->shutdown)) {
+        if (!wait_readable(args->fd, fanout_quiet_ms)) {
+            if (received) {
+                uint32_t ack[2] = {htonl(batch), htonl(received)};
+                from.sin_port = htons(fanout_client_port);
+                lwip_sendto(args->fd, ack, sizeof(ack), 0, (struct lwip_sockaddr*)&from, sizeof(from));
+                received = 0;
+            }
+            continue;
+        }
+        memset(msgs, 0, sizeof(msgs));
+        for (size_t i = 0; i < fanout_batch; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_iov = iovs + i;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        msgs[0].msg_hdr.msg_name = &from;
+        msgs[0].msg_hdr.msg_namelen = sizeof(from);
+        int n = lwip_recvmmsg(args->fd, msgs, fanout_batch, 0);
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_len != fanout_datagram_len) {
+                continue;
+            }
+            uint32_t b;
+            memcpy(&b, bufs[i], sizeof(b));
+            b = ntohl(b);
+            if (b != batch) {
+                batch = b;
+                received = 0;
+            }
+            received++;
+        }
+    }
+    return NULL;
+}
+
+static void scenario_udp_fanout(bench_env *env, bench_result *res) {
+    size_t batches = (size_t)(env->scale * 8);
+
+    fanout_server_args server_args;
+    server_args.fd = open_udp(server_addr_s, fanout_server_port);
+    atomic_init(&server_args.shutdown, false);
+    int fd = open_udp(client_addr_s, fanout_client_port);
+    if (server_args.fd < 0 || fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, fanout_server, &server_args);
+
+    // the batch number and the sample, as separate buffers
+    uint32_t header;
+    uint8_t samples[fanout_batch][fanout_datagram_len - sizeof(header)];
+    struct iovec iovs[fanout_batch][2];
+    struct lwip_mmsghdr msgs[fanout_batch];
+    struct lwip_sockaddr_in to = lwip_addr(server_addr_s, fanout_server_port);
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < fanout_batch; i++) {
+        memset(samples[i], (int)i, sizeof(samples[i]));
+        iovs[i][0].iov_base = &header;
+        iovs[i][0].iov_len = sizeof(header);
+        iovs[i][1].iov_base = samples[i];
+        iovs[i][1].iov_len = sizeof(samples[i]);
+        msgs[i].msg_hdr.msg_name = &to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(to);
+        msgs[i].msg_hdr.msg_iov = iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    double start = bench_now();
+    for (size_t b = 0; b < batches; b++) {
+        header = htonl((uint32_t)b);
+        double t0 = bench_now();
+        int n = lwip_sendmmsg(fd, msgs, fanout_batch, 0);
+        if (n <= 0) {
+            res->failed = true;
+            break;
+        }
+        uint32_t received = 0;
+        bool acked = false;
+        while (!acked && wait_readable(fd, discovery_timeout_ms)) {
+            uint32_t ack[2];
+            if (lwip_recv(fd, ack, sizeof(ack), 0) == sizeof(ack) && ntohl(ack[0]) == b) {
+                received = ntohl(ack[1]);
+                acked = true;
+            }
+        }
+        res->lost += n - received;
+        res->bytes += received * fanout_datagram_len;
+        if (received == (uint32_t)n) {
+            bench_result_add_latency(res, bench_now() - t0);
+        }
+    }
+    res->seconds = bench_now() - start;
+    if (!res->num_latencies) {
+        res->failed = true;
+    }
+
+    atomic_store(&server_args.shutdown, true);
+    pthread_join(server, NULL);
+    lwip_close(server_args.fd);
+    lwip_close(fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// udp_pmtu: a connected UDP socket with LWIP_IP_PMTUDISC_DO sends datagrams
+//   that just fill the path MTU it reports, then one byte more, which must
+//   fail with EMSGSIZE. with LWIP_IP_PMTUDISC_DONT, a datagram twice that
+//   size must be fragmented and arrive whole
+
+static bool pmtu_exchange(int fd, int server_fd, uint8_t *buf, size_t len, size_t cap, bench_result *res) {
+    double t0 = bench_now();
+    if (lwip_send(fd, buf, len, 0) != (int)len || !wait_readable(server_fd, discovery_timeout_ms)) {
+        res->lost++;
+        return false;
+    }
+    int received = lwip_recv(server_fd, buf, cap, 0);
+    if (received != (int)len) {
+        res->lost++;
+        return false;
+    }
+    bench_result_add_latency(res, bench_now() - t0);
+    res->bytes += len;
+    return true;
+}
+
+static void scenario_udp_pmtu(bench_env *env, bench_result *res) {
+    size_t count = (size_t)(env->scale * 10);
+    const size_t udp_ip_hlen = 28;
+
+    int server_fd = open_udp(server_addr_s, pmtu_server_port);
+    int fd = open_udp(client_addr_s, pmtu_client_port);
+    if (server_fd < 0 || fd < 0) {
+        res->failed = true;
+        return;
+    }
+    struct lwip_sockaddr_in to = lwip_addr(server_addr_s, pmtu_server_port);
+    int pmtudisc = LWIP_IP_PMTUDISC_DO;
+    int mtu = 0;
+    lwip_socklen_t mtu_len = sizeof(mtu);
+    if (lwip_connect(fd, (struct lwip_sockaddr*)&to, sizeof(to)) < 0 ||
+            lwip_setsockopt(fd, LWIP_IPPROTO_IP, LWIP_IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) < 0 ||
+            lwip_getsockopt(fd, LWIP_IPPROTO_IP, LWIP_IP_MTU, &mtu, &mtu_len) < 0 ||
+            mtu <= (int)udp_ip_hlen) {
+        fprintf(stderr, "could not get the path MTU\n");
+        res->failed = true;
+        lwip_close(server_fd);
+        lwip_close(fd);
+        return;
+    }
+    res->path_mtu = mtu;
+
+    size_t fit = mtu - udp_ip_hlen;
+    size_t cap = 2 * fit;
+    uint8_t *buf = calloc(cap, 1);
+    double start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        pmtu_exchange(fd, server_fd, buf, fit, cap, res);
+    }
+    if (lwip_send(fd, buf, fit + 1, 0) >= 0 || lwip_socket_errno(fd) != EMSGSIZE) {
+        fprintf(stderr, "a datagram over the path MTU was not refused\n");
+        res->failed = true;
+    }
+    pmtudisc = LWIP_IP_PMTUDISC_DONT;
+    lwip_setsockopt(fd, LWIP_IPPROTO_IP, LWIP_IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc));
+    pmtu_exchange(fd, server_fd, buf, cap, cap, res);
+    res->seconds = bench_now() - start;
+    if (res->lost) {
+        res->failed = true;
+    }
+
+    free(buf);
+    lwip_close(server_fd);
+    lwip_close(fd);
+}
+
+/* ------------------------------------------------------------------------- */
+// api_calls: several threads making socket calls that never reach the link,
+//   so the latency is all in getting the call to lwip and back. build with
+//   and without QUIET_LWIP_CORE_LOCKING to compare the two ways of doing that
+
+typedef struct {
+    int fd;
+    size_t calls;
+    bench_result *res;
+} api_calls_args;
+
+static void *api_calls_worker(void *args_v) {
+    api_calls_args *args = (api_calls_args*)args_v;
+    for (size_t i = 0; i < args->calls; i++) {
+        double t0 = wall_now();
+        int err;
+        if (i % 2) {
+            struct lwip_sockaddr_in local;
+            lwip_socklen_t len = sizeof(local);
+            err = lwip_getsockname(args->fd, (struct lwip_sockaddr*)&local, &len);
+        } else {
+            int type;
+            lwip_socklen_t len = sizeof(type);
+            err = lwip_getsockopt(args->fd, LWIP_SOL_SOCKET, LWIP_SO_TYPE, &type, &len);
+        }
+        double elapsed = wall_now() - t0;
+        if (err < 0) {
+            bench_result_add_lost(args->res);
+            continue;
+        }
+        bench_result_add_latency(args->res, elapsed);
+    }
+    return NULL;
+}
+
+static void scenario_api_calls(bench_env *env, bench_result *res) {
+    size_t calls = (size_t)(env->scale * 2000);
+
+    api_calls_args args[api_calls_threads];
+    pthread_t workers[api_calls_threads];
+    for (size_t i = 0; i < api_calls_threads; i++) {
+        args[i].fd = open_udp(client_addr_s, api_calls_port + i);
+        args[i].calls = calls;
+        args[i].res = res;
+        if (args[i].fd < 0) {
+            res->failed = true;
+            for (size_t j = 0; j < i; j++) {
+                lwip_close(args[j].fd);
+            }
+            return;
+        }
+    }
+
+    double start = wall_now();
+    for (size_t i = 0; i < api_calls_threads; i++) {
+        pthread_create(workers + i, NULL, api_calls_worker, args + i);
+    }
+    for (size_t i = 0; i < api_calls_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    res->seconds = wall_now() - start;
+    if (res->lost) {
+        res->failed = true;
+    }
+
+    for (size_t i = 0; i < api_calls_threads; i++) {
+        lwip_close(args[i].fd);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// mem_stress: several threads churning lwip's heap with the mix of sizes
+//   the stack asks it for, keeping about half of it allocated between them.
+//   build with and without QUIET_LWIP_MEM_SLAB to compare the allocators
+
+typedef struct {
+    unsigned int seed;
+    size_t ops;
+    size_t num_live;
+    void **live;
+    size_t *live_len;
+    // timed locally so that recording them doesn't line the threads up
+    double *latencies;
+    size_t num_latencies;
+    size_t lost;
+    uint64_t bytes;
+} mem_stress_args;
+
+// mostly small control structures, then DNS-sized messages, then TCP
+//   segments, some of them over the largest slab size
+static size_t mem_stress_size(unsigned int *seed) {
+    uint32_t r = (uint32_t)rand_r(seed);
+    uint32_t pick = r % 100;
+    r /= 100;
+    if (pick < 60) {
+        return 16 + r % 113;
+    }
+    if (pick < 85) {
+        return 256 + r % 257;
+    }
+    return 1000 + r % 601;
+}
+
+static void *mem_stress_worker(void *args_v) {
+    mem_stress_args *args = (mem_stress_args*)args_v;
+    for (size_t i = 0; i < args->ops; i++) {
+        size_t slot = (size_t)rand_r(&args->seed) % args->num_live;
+        if (args->live[slot]) {
+            bench_mem_free(args->live[slot]);
+            args->live[slot] = NULL;
+        }
+        size_t len = mem_stress_size(&args->seed);
+        double t0 = wall_now();
+        void *mem = bench_mem_malloc(len);
+        double elapsed = wall_now() - t0;
+        if (!mem) {
+            args->lost++;
+            continue;
+        }
+        // touch it, as a caller would
+        memset(mem, (int)i, len);
+        args->live[slot] = mem;
+        args->live_len[slot] = len;
+        args->latencies[args->num_latencies++] = elapsed;
+        args->bytes += len;
+    }
+    return NULL;
+}
+
+static void scenario_mem_stress(bench_env *env, bench_result *res) {
+    size_t ops = (size_t)(env->scale * 20000);
+
+    bench_heap_usage start;
+    bench_mem_usage(&start);
+    // ~330 bytes per allocation on average
+    size_t num_live = start.limit / 2 / 330 / mem_stress_threads;
+    if (num_live < 1) {
+        num_live = 1;
+    }
+
+    mem_stress_args args[mem_stress_threads];
+    pthread_t workers[mem_stress_threads];
+    for (size_t i = 0; i < mem_stress_threads; i++) {
+        memset(args + i, 0, sizeof(mem_stress_args));
+        args[i].seed = (unsigned int)(i + 1);
+        args[i].ops = ops;
+        args[i].num_live = num_live;
+        args[i].live = calloc(num_live, sizeof(void*));
+        args[i].live_len = calloc(num_live, sizeof(size_t));
+        args[i].latencies = calloc(ops ? ops : 1, sizeof(double));
+    }
+
+    double start_time = wall_now();
+    for (size_t i = 0; i < mem_stress_threads; i++) {
+        pthread_create(workers + i, NULL, mem_stress_worker, args + i);
+    }
+    for (size_t i = 0; i < mem_stress_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    res->seconds = wall_now() - start_time;
+
+    // the workers have exited, so whatever they kept back is in the heap
+    //   again and what's left allocated is their live sets
+    for (size_t i = 0; i < mem_stress_threads; i++) {
+        for (size_t j = 0; j < num_live; j++) {
+            if (args[i].live[j]) {
+                res->heap_requested += args[i].live_len[j];
+            }
+        }
+    }
+    res->heap_reported = true;
+    bench_mem_usage(&res->heap);
+
+    for (size_t i = 0; i < mem_stress_threads; i++) {
+        for (size_t j = 0; j < num_live; j++) {
+            if (args[i].live[j]) {
+                bench_mem_free(args[i].live[j]);
+            }
+        }
+        for (size_t j = 0; j < args[i].num_latencies; j++) {
+            bench_result_add_latency(res, args[i].latencies[j]);
+        }
+        res->lost += args[i].lost;
+        res->bytes += args[i].bytes;
+        free(args[i].live);
+        free(args[i].live_len);
+        free(args[i].latencies);
+    }
+    // a full heap turns requests away by design; only a heap that turns
+    //   all of them away is broken
+    if (!res->num_latencies) {
+        res->failed = true;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// chksum: every checksum kernel lwip was built with that this CPU can run,
+//   over payload sizes from a bare IP header to the largest pbuf, with the
+//   data starting at different offsets from a cache line
+
+static const char *chksum_kernels[] = {"scalar", "sse2", "avx2", "neon"};
+static const size_t chksum_sizes[] = {20, 64, 256, 576, 1460, 4096, 16384, 65535};
+static const size_t chksum_aligns[] = {0, 1, 2, 4};
+
+// native 16-bit words, the last odd byte as the first half of one
+static uint16_t chksum_reference(const uint8_t *data, size_t len) {
+    uint64_t acc = 0;
+    uint16_t word;
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        memcpy(&word, data + i, 2);
+        acc += word;
+    }
+    if (len & 1) {
+        word = 0;
+        memcpy(&word, data + len - 1, 1);
+        acc += word;
+    }
+    while (acc >> 16) {
+        acc = (acc >> 16) + (acc & 0xffff);
+    }
+    return (uint16_t)acc;
+}
+
+static void scenario_chksum(bench_env *env, bench_result *res) {
+    const size_t num_kernels = sizeof(chksum_kernels) / sizeof(chksum_kernels[0]);
+    const size_t num_sizes = sizeof(chksum_sizes) / sizeof(chksum_sizes[0]);
+    const size_t num_aligns = sizeof(chksum_aligns) / sizeof(chksum_aligns[0]);
+    // bytes each kernel runs over per size and alignment
+    double target = env->scale * (1 << 26);
+    // room for the largest size at the largest offset, whole cache lines
+    size_t max_len = (chksum_sizes[num_sizes - 1] + 64 + 63) & ~(size_t)63;
+
+    uint8_t *src_mem = aligned_alloc(64, max_len);
+    uint8_t *dst_mem = aligned_alloc(64, max_len);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < max_len; i++) {
+        src_mem[i] = (uint8_t)rand_r(&seed);
+    }
+
+    res->chksum = calloc(num_kernels * num_sizes * num_aligns, sizeof(bench_chksum_row));
+    volatile uint16_t sink = 0;
+    double start_time = wall_now();
+    for (size_t k = 0; k < num_kernels; k++) {
+        if (!bench_chksum_select(chksum_kernels[k])) {
+            continue;
+        }
+        for (size_t s = 0; s < num_sizes; s++) {
+            for (size_t a = 0; a < num_aligns; a++) {
+                size_t len = chksum_sizes[s];
+                const uint8_t *src = src_mem + chksum_aligns[a];
+                uint8_t *dst = dst_mem + chksum_aligns[a];
+                size_t iters = (size_t)(target / len) + 1;
+
+                uint16_t expected = chksum_reference(src, len);
+                memset(dst, 0, len);
+                if (bench_chksum(src, len) != expected ||
+                        bench_chksum_copy(dst, src, len) != expected ||
+                        memcmp(dst, src, len) != 0) {
+                    fprintf(stderr, "chksum: %s is wrong for %zu bytes at offset %zu\n",
+                            chksum_kernels[k], len, chksum_aligns[a]);
+                    res->failed = true;
+                }
+
+                bench_chksum_row *row = res->chksum + res->num_chksum++;
+                row->kernel = chksum_kernels[k];
+                row->size = len;
+                row->align = chksum_aligns[a];
+
+                double t0 = wall_now();
+                for (size_t i = 0; i < iters; i++) {
+                    sink ^= bench_chksum(src, len);
+                }
+                double elapsed = wall_now() - t0;
+                row->chksum_gbps = elapsed > 0 ? iters * len * 8.0 / elapsed * 1e-9 : 0;
+
+                t0 = wall_now();
+                for (size_t i = 0; i < iters; i++) {
+                    sink ^= bench_chksum_copy(dst, src, len);
+                }
+                elapsed = wall_now() - t0;
+                row->copy_gbps = elapsed > 0 ? iters * len * 8.0 / elapsed * 1e-9 : 0;
+
+                res->bytes += 2 * iters * len;
+            }
+        }
+    }
+    res->seconds = wall_now() - start_time;
+    (void)sink;
+
+    // back to what lwip picked for itself
+    bench_chksum_select(NULL);
+    free(src_mem);
+    free(dst_mem);
+}
+
+/* ------------------------------------------------------------------------- */
+// proxy_relay: lwip client <-> lwip server <-> relay <-> native peer, the
+//   same path proxy_server uses once a SOCKS connection is set up. data goes
+//   both ways at once, so both directions of the relay are measured
+
+typedef struct {
+    int fd;
+    const uint8_t *payload;
+    size_t payload_len;
+} native_writer_args;
+
+static void *native_writer(void *args_v) {
+    native_writer_args *args = (native_writer_args*)args_v;
+    size_t off = 0;
+    while (off < args->payload_len) {
+        ssize_t res = write(args->fd, args->payload + off, args->payload_len - off);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += res;
+    }
+    shutdown(args->fd, SHUT_WR);
+    return NULL;
+}
+
+typedef struct {
+    int listen_fd;
+    const uint8_t *payload;
+    size_t payload_len;
+    uint64_t received;
+    double finished;
+} native_peer_args;
+
+// reads until the relay passes on the client's end of stream, while sending
+//   payload back from a second thread
+static void *native_peer(void *args_v) {
+    native_peer_args *args = (native_peer_args*)args_v;
+    int fd = accept(args->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+    native_writer_args writer_args = {fd, args->payload, args->payload_len};
+    pthread_t writer;
+    pthread_create(&writer, NULL, native_writer, &writer_args);
+
+    uint8_t buf[4096];
+    for (;;) {
+        ssize_t res = read(fd, buf, sizeof(buf));
+        if (res <= 0) {
+            break;
+        }
+        args->received += res;
+    }
+    args->finished = bench_now();
+    pthread_join(writer, NULL);
+    close(fd);
+    return NULL;
+}
+
+typedef struct {
+    int listen_fd;
+    struct sockaddr_in sink_addr;
+    quiet_lwip_relay *relay;
+} proxy_server_args;
+
+static void *proxy_accept(void *args_v) {
+    proxy_server_args *args = (proxy_server_args*)args_v;
+    int conn_fd = lwip_accept(args->listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+        return NULL;
+    }
+
+    int remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(remote_fd, (struct sockaddr*)&args->sink_addr, sizeof(args->sink_addr)) < 0) {
+        fprintf(stderr, "sink connect failed\n");
+        close(remote_fd);
+        lwip_close(conn_fd);
+        return NULL;
+    }
+
+    quiet_lwip_relay_add(args->relay, remote_fd, conn_fd);
+    return NULL;
+}
+
+static void scenario_proxy_relay(bench_env *env, bench_result *res) {
+    size_t total = (size_t)(env->scale * 16384);
+
+    native_peer_args sink_args = {0};
+    sink_args.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sink_addr;
+    memset(&sink_addr, 0, sizeof(sink_addr));
+    sink_addr.sin_family = AF_INET;
+    sink_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sink_addr.sin_port = 0;
+    socklen_t sink_addr_len = sizeof(sink_addr);
+    if (bind(sink_args.listen_fd, (struct sockaddr*)&sink_addr, sizeof(sink_addr)) < 0 ||
+            listen(sink_args.listen_fd, 1) < 0 ||
+            getsockname(sink_args.listen_fd, (struct sockaddr*)&sink_addr, &sink_addr_len) < 0) {
+        fprintf(stderr, "sink setup failed\n");
+        close(sink_args.listen_fd);
+        res->failed = true;
+        return;
+    }
+
+    proxy_server_args server_args;
+    server_args.listen_fd = open_listen(server_addr_s, proxy_port, 1);
+    server_args.sink_addr = sink_addr;
+    if (server_args.listen_fd < 0) {
+        close(sink_args.listen_fd);
+        res->failed = true;
+        return;
+    }
+    quiet_lwip_relay_config relay_conf = {0};
+    server_args.relay = quiet_lwip_relay_create(&relay_conf);
+
+    pthread_t sink, server;
+    uint8_t *payload = malloc(total);
+    for (size_t i = 0; i < total; i++) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+    sink_args.payload = payload;
+    sink_args.payload_len = total;
+    pthread_create(&sink, NULL, native_peer, &sink_args);
+    pthread_create(&server, NULL, proxy_accept, &server_args);
+
+    double start = bench_now();
+    int fd = open_connect(server_addr_s, proxy_port);
+    if (fd < 0 || write_all(fd, payload, total) < 0) {
+        res->failed = true;
+    }
+    // the peer's data waits in the relay and lwip's windows meanwhile
+    uint64_t returned = 0;
+    double returned_at = start;
+    if (fd >= 0) {
+        lwip_shutdown(fd, SHUT_WR);
+        uint8_t buf[4096];
+        for (;;) {
+            int nread = lwip_read(fd, buf, sizeof(buf));
+            if (nread <= 0) {
+                break;
+            }
+            for (int i = 0; i < nread; i++) {
+                if (returned + i >= total || buf[i] != payload[returned + i]) {
+                    res->failed = true;
+                    break;
+                }
+            }
+            returned += nread;
+        }
+        returned_at = bench_now();
+        lwip_close(fd);
+    }
+    pthread_join(server, NULL);
+    pthread_join(sink, NULL);
+    quiet_lwip_relay_destroy(server_args.relay);
+    lwip_close(server_args.listen_fd);
+    close(sink_args.listen_fd);
+    free(payload);
+
+    res->bytes = sink_args.received + returned;
+    res->seconds = (sink_args.finished > returned_at ? sink_args.finished : returned_at) - start;
+    if (sink_args.received != total || returned != total) {
+        res->failed = true;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// mux_streams: many streams through one tunnel, each echoed back by the far
+//   side. native socketpairs stand in for the applications at both ends
+
+// echoes one stream until the tunnel passes on its end of stream
+static void *mux_echo(void *fd_v) {
+    int fd = (int)(intptr_t)fd_v;
+    uint8_t buf[4096];
+    for (;;) {
+        ssize_t nread = read(fd, buf, sizeof(buf));
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            break;
+        }
+        size_t off = 0;
+        while (off < (size_t)nread) {
+            ssize_t written = write(fd, buf + off, nread - off);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                close(fd);
+                return NULL;
+            }
+            off += written;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+    close(fd);
+    return NULL;
+}
+
+static void mux_echo_open(quiet_lwip_mux_stream *stream, const uint8_t *hdr, size_t hdr_len, void *arg) {
+    (void)hdr;
+    (void)hdr_len;
+    (void)arg;
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        quiet_lwip_mux_refuse(stream, NULL, 0);
+        return;
+    }
+    pthread_t echo;
+    pthread_create(&echo, NULL, mux_echo, (void*)(intptr_t)pair[1]);
+    pthread_detach(echo);
+    quiet_lwip_mux_accept(stream, pair[0], 0, NULL, 0);
+}
+
+typedef struct {
+    int listen_fd;
+    quiet_lwip_mux *mux;
+} mux_server_args;
+
+static void *mux_server(void *args_v) {
+    mux_server_args *args = (mux_server_args*)args_v;
+    int conn_fd = lwip_accept(args->listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+        return NULL;
+    }
+    args->mux = quiet_lwip_mux_create(conn_fd, false, NULL, mux_echo_open, NULL);
+    return NULL;
+}
+
+typedef struct {
+    int fd;
+    const uint8_t *payload;
+    size_t payload_len;
+    double start;
+    uint64_t returned;
+    bool mismatch;
+    bool stalled;
+    bench_result *res;
+} mux_stream_args;
+
+static void *mux_stream_reader(void *args_v) {
+    mux_stream_args *args = (mux_stream_args*)args_v;
+    uint8_t buf[4096];
+    for (;;) {
+        struct pollfd p = {args->fd, POLLIN, 0};
+        int ready = poll(&p, 1, mux_stall_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            // also wakes the writer on the same socket
+            args->stalled = true;
+            shutdown(args->fd, SHUT_RDWR);
+            break;
+        }
+        ssize_t nread = read(args->fd, buf, sizeof(buf));
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < nread; i++) {
+            if (args->returned + i >= args->payload_len ||
+                    buf[i] != args->payload[args->returned + i]) {
+                args->mismatch = true;
+                break;
+            }
+        }
+        args->returned += nread;
+    }
+    bench_result_add_latency(args->res, bench_now() - args->start);
+    return NULL;
+}
+
+static void scenario_mux_streams(bench_env *env, bench_result *res) {
+    size_t per_stream = (size_t)(env->scale * 16384) / mux_streams;
+
+    mux_server_args server_args = {0};
+    server_args.listen_fd = open_listen(server_addr_s, mux_port, 1);
+    if (server_args.listen_fd < 0) {
+        res->failed = true;
+        return;
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, mux_server, &server_args);
+
+    uint8_t *payload = malloc(per_stream);
+    for (size_t i = 0; i < per_stream; i++) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+
+    double start = bench_now();
+    int tunnel_fd = open_connect(server_addr_s, mux_port);
+    pthread_join(server, NULL);
+    if (tunnel_fd < 0 || !server_args.mux) {
+        if (tunnel_fd >= 0) {
+            lwip_close(tunnel_fd);
+        }
+        lwip_close(server_args.listen_fd);
+        free(payload);
+        res->failed = true;
+        return;
+    }
+    quiet_lwip_mux *mux = quiet_lwip_mux_create(tunnel_fd, true, NULL, NULL, NULL);
+
+    mux_stream_args args[mux_streams];
+    native_writer_args writer_args[mux_streams];
+    pthread_t readers[mux_streams], writers[mux_streams];
+    size_t num_started = 0;
+    for (size_t i = 0; i < mux_streams; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+            res->failed = true;
+            break;
+        }
+        args[i] = (mux_stream_args){pair[1], payload, per_stream, bench_now(), 0, false, false, res};
+        // later streams are lower priority, which only matters when the
+        //   tunnel is the bottleneck
+        if (quiet_lwip_mux_open(mux, pair[0], (uint8_t)i, "echo", 4) < 0) {
+            close(pair[0]);
+            close(pair[1]);
+            res->failed = true;
+            break;
+        }
+        writer_args[i] = (native_writer_args){pair[1], payload, per_stream};
+        pthread_create(&writers[i], NULL, native_writer, &writer_args[i]);
+        pthread_create(&readers[i], NULL, mux_stream_reader, &args[i]);
+        num_started++;
+    }
+
+    uint64_t returned = 0;
+    for (size_t i = 0; i < num_started; i++) {
+        pthread_join(writers[i], NULL);
+        pthread_join(readers[i], NULL);
+        close(args[i].fd);
+        returned += args[i].returned;
+        if (args[i].mismatch || args[i].stalled || args[i].returned != per_stream) {
+            res->failed = true;
+        }
+    }
+    double finished = bench_now();
+
+    quiet_lwip_mux_destroy(mux);
+    quiet_lwip_mux_destroy(server_args.mux);
+    lwip_close(server_args.listen_fd);
+    free(payload);
+
+    // payload both ways, as proxy_relay counts it
+    res->bytes = 2 * returned;
+    res->seconds = finished - start;
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    void (*run)(bench_env *env, bench_result *res);
+} bench_scenario;
+
+static const bench_scenario scenarios[] = {
+    // first, so that the server is a peer the client hasn't sent to yet
+    {"arp", scenario_arp},
+    {"tcp_bulk", scenario_tcp_bulk},
+    {"tcp_rtt", scenario_tcp_rtt},
+    {"tcp_flows", scenario_tcp_flows},
+    {"udp_discovery", scenario_udp_discovery},
+    {"udp_fanout", scenario_udp_fanout},
+    {"udp_pmtu", scenario_udp_pmtu},
+    {"api_calls", scenario_api_calls},
+    {"mem_stress", scenario_mem_stress},
+    {"chksum", scenario_chksum},
+    {"proxy_relay", scenario_proxy_relay},
+    {"mux_streams", scenario_mux_streams},
+};
+
+static const size_t num_scenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+static void run_scenario(bench_env *env, const bench_scenario *scenario, bench_result *res) {
+    memset(res, 0, sizeof(bench_result));
+    pthread_mutex_init(&res->mutex, NULL);
+    res->name = scenario->name;
+
+    fprintf(stderr, "running %s\n", scenario->name);
+
+    quiet_lwip_trace_reset();
+    uint32_t rexmit_start = bench_tcp_rexmit();
+    uint64_t samples_start = quiet_lwip_channel_elapsed(env->channel);
+    double cpu_start = cpu_now();
+    quiet_lwip_lock_stats lock_start;
+    res->core_locked = quiet_lwip_core_lock_stats(&lock_start);
+    bench_memp_cache_stats cache_start;
+    res->memp_cached = bench_memp_cache(&cache_start);
+
+    scenario->run(env, res);
+
+    res->cpu_seconds = cpu_now() - cpu_start;
+    res->link_samples = quiet_lwip_channel_elapsed(env->channel) - samples_start;
+    res->retransmissions = bench_tcp_rexmit() - rexmit_start;
+    res->traced = env->traced;
+    quiet_lwip_trace_histograms(res->stages);
+    if (res->core_locked) {
+        quiet_lwip_core_lock_stats(&res->core_lock);
+        res->core_lock.acquisitions -= lock_start.acquisitions;
+        res->core_lock.contended -= lock_start.contended;
+        res->core_lock.wait_ns -= lock_start.wait_ns;
+    }
+    if (res->memp_cached) {
+        bench_memp_cache(&res->memp_cache);
+        res->memp_cache.hits -= cache_start.hits;
+        res->memp_cache.refills -= cache_start.refills;
+        res->memp_cache.flushes -= cache_start.flushes;
+        res->memp_cache.xthread_frees -= cache_start.xthread_frees;
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-f profiles.json] [-p profile] [-r sample_rate] [-w] [-x speed] [-t]\n"
+                    "          [-n noise] [-l frame_loss] [-d drift_ppm] [-s seed]\n"
+                    "          [-m heap_bytes] [-k scale] [-a dynamic|derived|table|snoop]\n"
+                    "          [-o out.json] [scenario ...]\n", argv0);
+    fprintf(stderr, "scenarios:");
+    for (size_t i = 0; i < num_scenarios; i++) {
+        fprintf(stderr, " %s", scenarios[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *fname = "/usr/local/share/quiet/quiet-profiles.json";
+    const char *profile = "cable-64k";
+    const char *out_fname = NULL;
+    double sample_rate = 44100;
+    double speed = 1;
+    bool wall_clock = false;
+
+    bench_env env;
+    memset(&env, 0, sizeof(env));
+    env.scale = 1;
+    env.arp_mode = "dynamic";
+
+    quiet_lwip_channel_config channel_conf;
+    memset(&channel_conf, 0, sizeof(channel_conf));
+    channel_conf.seed = 1;
+
+    quiet_lwip_stack_config stack_conf;
+    memset(&stack_conf, 0, sizeof(stack_conf));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:p:r:wx:tn:l:d:s:m:k:a:o:h")) != -1) {
+        switch (opt) {
+        case 'f': fname = optarg; break;
+        case 'p': profile = optarg; break;
+        case 'r': sample_rate = atof(optarg); break;
+        case 'w': wall_clock = true; break;
+        case 'x': speed = atof(optarg); break;
+        case 't': env.traced = true; break;
+        case 'n': channel_conf.noise_amplitude = atof(optarg); break;
+        case 'l': channel_conf.frame_loss = atof(optarg); break;
+        case 'd': channel_conf.drift_ppm = atof(optarg); break;
+        case 's': channel_conf.seed = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'm': stack_conf.heap_size = (size_t)strtoul(optarg, NULL, 10); break;
+        case 'k': env.scale = atof(optarg); break;
+        case 'a': env.arp_mode = optarg; break;
+        case 'o': out_fname = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    quiet_lwip_driver_config conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.encoder_opt = quiet_encoder_profile_filename(fname, profile);
+    conf.decoder_opt = quiet_decoder_profile_filename(fname, profile);
+    if (!conf.encoder_opt || !conf.decoder_opt) {
+        fprintf(stderr, "could not load profile %s from %s\n", profile, fname);
+        return 1;
+    }
+    conf.encoder_rate = sample_rate;
+    conf.decoder_rate = sample_rate;
+    conf.stack = &stack_conf;
+
+    quiet_lwip_arp_entry arp_table[] = {
+        {inet_addr(client_addr_s), {0}},
+        {inet_addr(server_addr_s), {0}},
+    };
+    memcpy(arp_table[0].hardware_addr, client_mac, 6);
+    memcpy(arp_table[1].hardware_addr, server_mac, 6);
+    if (strcmp(env.arp_mode, "derived") == 0) {
+        conf.arp.mode = quiet_lwip_arp_derived;
+    } else if (strcmp(env.arp_mode, "table") == 0) {
+        conf.arp.table = arp_table;
+        conf.arp.table_len = sizeof(arp_table) / sizeof(arp_table[0]);
+    } else if (strcmp(env.arp_mode, "snoop") == 0) {
+        conf.arp.snoop = true;
+    } else if (strcmp(env.arp_mode, "dynamic") != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    quiet_lwip_trace_enable(env.traced);
+
+    memcpy(conf.hardware_addr, client_mac, 6);
+    env.client = quiet_lwip_create(&conf, inet_addr(client_addr_s),
+                                   inet_addr(netmask_s), inet_addr(gateway_s));
+    memcpy(conf.hardware_addr, server_mac, 6);
+    env.server = quiet_lwip_create(&conf, inet_addr(server_addr_s),
+                                   inet_addr(netmask_s), inet_addr(gateway_s));
+    if (!env.client || !env.server) {
+        fprintf(stderr, "could not create interfaces with the requested stack sizes\n");
+        return 1;
+    }
+
+    if (wall_clock) {
+        // speed 0 lets the channel run unpaced
+        channel_conf.sample_rate = sample_rate * speed;
+    } else {
+        // simulated time: run flat out and let the channel drive lwip's clock
+        channel_conf.sample_rate = 0;
+        channel_conf.clock_rate = sample_rate;
+    }
+    env.channel = quiet_lwip_channel_create(&channel_conf);
+    if (!env.channel) {
+        fprintf(stderr, "channel drift out of range\n");
+        return 1;
+    }
+    quiet_lwip_channel_attach(env.channel, env.client);
+    quiet_lwip_channel_attach(env.channel, env.server);
+    quiet_lwip_channel_start(env.channel);
+
+    if (conf.arp.snoop) {
+        // both interfaces came up before the channel ran, so their
+        //   announcements go out together and collide. once those have
+        //   played out, announce them again one at a time, as peers that
+        //   come up apart would be heard
+        bench_sleep(arp_announce_s);
+        bench_arp_announce(env.client);
+        bench_sleep(arp_announce_s);
+        bench_arp_announce(env.server);
+        bench_sleep(arp_announce_s);
+    }
+
+    bench_result *results = calloc(num_scenarios, sizeof(bench_result));
+    size_t num_results = 0;
+    for (size_t i = 0; i < num_scenarios; i++) {
+        bool selected = (optind == argc);
+        for (int a = optind; a < argc; a++) {
+            if (strcmp(argv[a], scenarios[i].name) == 0) {
+                selected = true;
+            }
+        }
+        if (selected) {
+            run_scenario(&env, scenarios + i, results + num_results);
+            num_results++;
+        }
+    }
+
+    FILE *out = out_fname ? fopen(out_fname, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "could not open %s\n", out_fname);
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"profile\": \"%s\",\n", profile);
+    fprintf(out, "  \"sample_rate\": %.0f,\n", sample_rate);
+    fprintf(out, "  \"clock\": \"%s\",\n", wall_clock ? "wall" : "virtual");
+    if (wall_clock) {
+        fprintf(out, "  \"speed\": %g,\n", speed);
+    }
+    fprintf(out, "  \"seed\": %u,\n", channel_conf.seed);
+    fprintf(out, "  \"arp\": \"%s\",\n", env.arp_mode);
+    quiet_lwip_lock_stats lock_stats;
+    fprintf(out, "  \"core_locking\": %s,\n", quiet_lwip_core_lock_stats(&lock_stats) ? "true" : "false");
+    fprintf(out, "  \"mem_allocator\": \"%s\",\n", bench_mem_allocator());
+    fprintf(out, "  \"chksum_kernel\": \"%s\",\n", bench_chksum_kernel());
+    fprintf(out, "  \"scenarios\": [\n");
+    bool all_ok = true;
+    for (size_t i = 0; i < num_results; i++) {
+        bench_result_json(out, results + i);
+        fprintf(out, (i + 1 < num_results) ? ",\n" : "\n");
+        all_ok = all_ok && !results[i].failed;
+        free(results[i].latencies);
+        free(results[i].chksum);
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(results);
+
+    quiet_lwip_channel_stop(env.channel);
+
+    return all_ok ? 0 : 1;
+}
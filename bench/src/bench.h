@@ -0,0 +1,128 @@
+#ifndef QUIET_LWIP_BENCH_H
+#define QUIET_LWIP_BENCH_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "quiet-lwip-channel.h"
+
+typedef struct {
+    quiet_lwip_interface *client;
+    quiet_lwip_interface *server;
+    quiet_lwip_channel *channel;
+    // multiplies the amount of work every scenario does
+    double scale;
+    // interfaces stamp frames at each stage of the stack
+    bool traced;
+    // how the interfaces find each other's hardware addresses: dynamic,
+    //   derived, table or snoop
+    const char *arp_mode;
+} bench_env;
+
+// lwip's heap (see struct mem_usage in lwip/mem.h)
+typedef struct {
+    size_t limit;
+    size_t size;
+    size_t reserved;
+    size_t largest_free;
+} bench_heap_usage;
+
+// lwip's per-thread pool caches, summed over the pools
+typedef struct {
+    uint64_t hits;
+    uint64_t refills;
+    uint64_t flushes;
+    uint64_t xthread_frees;
+} bench_memp_cache_stats;
+
+// ARP frames sent, and lwip's ARP table (see struct stats_etharp_cache in
+//   lwip/stats.h)
+typedef struct {
+    uint64_t frames;
+    uint64_t evictions;
+    size_t used;
+    size_t size;
+} bench_arp_stats;
+
+// one kernel checksumming one payload size at one alignment
+typedef struct {
+    const char *kernel;
+    size_t size;
+    size_t align;
+    double chksum_gbps;
+    double copy_gbps;
+} bench_chksum_row;
+
+typedef struct {
+    const char *name;
+    bool failed;
+    // application payload delivered end to end
+    uint64_t bytes;
+    double seconds;
+    // how much audio the channel carried while the scenario ran
+    uint64_t link_samples;
+    // per-operation latencies in seconds, and operations that never completed
+    double *latencies;
+    size_t num_latencies;
+    size_t latencies_cap;
+    size_t lost;
+    uint32_t retransmissions;
+    double cpu_seconds;
+    // per-stage latencies, when the run is traced
+    bool traced;
+    quiet_lwip_latency_histogram stages[quiet_lwip_num_stages];
+    // core lock traffic while the scenario ran, when built with core locking
+    bool core_locked;
+    quiet_lwip_lock_stats core_lock;
+    // pool cache traffic while the scenario ran, when built with MEMP_CACHE
+    bool memp_cached;
+    bench_memp_cache_stats memp_cache;
+    // lwip's heap as the scenario left it, for scenarios that look at it
+    bool heap_reported;
+    bench_heap_usage heap;
+    // bytes the scenario asked for that were still allocated
+    uint64_t heap_requested;
+    // ARP traffic and table, for the scenario that looks at them
+    bool arp_reported;
+    bench_arp_stats arp;
+    // the path MTU a connected socket reported, for the scenario that asks
+    size_t path_mtu;
+    // checksum throughput, for the scenario that measures it
+    bench_chksum_row *chksum;
+    size_t num_chksum;
+    pthread_mutex_t mutex;
+} bench_result;
+
+double bench_now();
+
+void bench_result_add_latency(bench_result *res, double seconds);
+// counts an operation that never completed; safe from several threads
+void bench_result_add_lost(bench_result *res);
+
+// lwip's stats are only visible through its own headers, which clash with
+//   the native socket headers the scenarios need
+uint32_t bench_tcp_rexmit();
+// false if lwip was built without pool caches
+bool bench_memp_cache(bench_memp_cache_stats *stats);
+
+// the same goes for lwip's heap
+const char *bench_mem_allocator();
+void *bench_mem_malloc(size_t size);
+void bench_mem_free(void *mem);
+void bench_mem_usage(bench_heap_usage *usage);
+
+// and for its ARP table. the limit is read on lwip's thread only as the
+//   table grows, so it may be lowered while the stack runs. returns the
+//   previous limit
+void bench_arp(bench_arp_stats *stats);
+size_t bench_arp_limit(size_t limit);
+// sends the gratuitous ARP an interface sends as it comes up
+void bench_arp_announce(quiet_lwip_interface *interface);
+
+// and for its checksum kernels
+const char *bench_chksum_kernel();
+bool bench_chksum_select(const char *kernel);
+uint16_t bench_chksum(const void *data, size_t len);
+uint16_t bench_chksum_copy(void *dst, const void *src, size_t len);
+#endif
@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "lwip/mem.h"
+#include "lwip/sizes.h"
+#include "lwip/stats.h"
+#include "lwip/tcpip.h"
+#include "netif/etharp.h"
+
+#include "bench.h"
+
+uint32_t bench_tcp_rexmit() {
+#if TCP_STATS
+    return lwip_stats.tcp.rexmit;
+#else
+    return 0;
+#endif
+}
+
+bool bench_memp_cache(bench_memp_cache_stats *stats) {
+#if MEMP_STATS && MEMP_CACHE
+    memset(stats, 0, sizeof(bench_memp_cache_stats));
+    for (size_t i = 0; i < MEMP_MAX; i++) {
+        stats->hits += lwip_stats.memp_cache[i].hits;
+        stats->refills += lwip_stats.memp_cache[i].refills;
+        stats->flushes += lwip_stats.memp_cache[i].flushes;
+        stats->xthread_frees += lwip_stats.memp_cache[i].xthread_frees;
+    }
+    return true;
+#else
+    (void)stats;
+    return false;
+#endif
+}
+
+const char *bench_mem_allocator() {
+#if MEM_LIBC_MALLOC
+    return "libc";
+#elif MEM_USE_POOLS
+    return "pools";
+#elif MEM_SLAB
+    return MEM_SLAB_CACHE ? "slab_cached" : "slab";
+#else
+    return "first_fit";
+#endif
+}
+
+void *bench_mem_malloc(size_t size) {
+    return mem_malloc((mem_size_t)size);
+}
+
+void bench_mem_free(void *mem) {
+    mem_free(mem);
+}
+
+void bench_mem_usage(bench_heap_usage *usage) {
+    struct mem_usage u;
+    mem_usage_get(&u);
+    usage->limit = u.limit;
+    usage->size = u.size;
+    usage->reserved = u.reserved;
+    usage->largest_free = u.largest_free;
+}
+
+void bench_arp(bench_arp_stats *stats) {
+    memset(stats, 0, sizeof(bench_arp_stats));
+#if ETHARP_STATS
+    stats->frames = lwip_stats.etharp.xmit;
+    stats->evictions = lwip_stats.etharp_cache.evictions;
+    stats->used = lwip_stats.etharp_cache.used;
+    stats->size = lwip_stats.etharp_cache.size;
+#endif
+}
+
+static void bench_arp_gratuitous(void *netif) {
+    etharp_gratuitous((struct netif*)netif);
+}
+
+void bench_arp_announce(quiet_lwip_interface *interface) {
+    tcpip_callback(bench_arp_gratuitous, interface);
+}
+
+size_t bench_arp_limit(size_t limit) {
+    size_t prev = lwip_sizes.arp_table_max;
+    lwip_sizes.arp_table_max = (u16_t)limit;
+    return prev;
+}
+
+const char *bench_chksum_kernel() {
+    return lwip_arch_chksum_kernel();
+}
+
+bool bench_chksum_select(const char *kernel) {
+    return lwip_arch_chksum_select(kernel);
+}
+
+uint16_t bench_chksum(const void *data, size_t len) {
+    return LWIP_CHKSUM(data, (int)len);
+}
+
+uint16_t bench_chksum_copy(void *dst, const void *src, size_t len) {
+    return LWIP_CHKSUM_COPY(dst, src, (u16_t)len);
+}
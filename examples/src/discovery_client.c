@@ -1,12 +1,19 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
 
 #include "quiet-lwip-portaudio.h"
 
-#include "lwip/sockets.h"
+#include "quiet-lwip/lwip-socket.h"
 
 const int remote_port = 3333;
 const int local_port = 3334;
@@ -17,76 +24,275 @@ const char *ipaddr_s = "192.168.0.2";
 const quiet_lwip_ipv4_addr netmask = (uint32_t)0xffffff00;  // 255.255.255.0
 const quiet_lwip_ipv4_addr gateway = (uint32_t)0xc0a80001;  // 192.168.0.1
 
+const char *group_s = "239.255.51.51";
+
 const char *send_str = "MARCO";
+const char *recv_str = "POLO";
+
+// servers found are kept here until their ttl runs out, so that looking
+//   again costs nothing
+const char *cache_path = "discovery.cache";
+
+// the query is sent this many times, each interval twice the last, so
+//   that servers whose responses were lost get another chance. each query
+//   lists the servers heard so far, and those stay quiet
+const int num_queries = 3;
+const long query_interval_ms = 1000;
+
+// time left after the last query for the slowest server to respond
+const long listen_ms = 2000;
+
+#define max_servers (32)
+
+typedef struct {
+    uint32_t addr;
+    // wall clock, so that it means the same to the next run
+    time_t expires;
+    uint32_t ttl;
+} server_entry;
+
+typedef struct {
+    server_entry entries[max_servers];
+    size_t num_entries;
+} server_cache;
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-int open_send() {
-    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+/* ------------------------------------------------------------------------- */
+// the cache, one line per server: address, expiry time, ttl
 
-    if (socket_fd < 0) {
-        printf("socket failed\n");
-        return -1;
+void cache_load(server_cache *cache, const char *path) {
+    cache->num_entries = 0;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
     }
 
-    int broadcast = 1;
-    int res = setsockopt(socket_fd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+    char addr_s[32];
+    long long expires;
+    unsigned long ttl;
+    time_t now = time(NULL);
+    while (cache->num_entries < max_servers &&
+           fscanf(f, "%31s %lld %lu", addr_s, &expires, &ttl) == 3) {
+        if (expires <= now) {
+            continue;
+        }
+        server_entry *entry = cache->entries + cache->num_entries++;
+        entry->addr = inet_addr(addr_s);
+        entry->expires = expires;
+        entry->ttl = ttl;
+    }
+    fclose(f);
+}
 
-    if (res < 0) {
-        printf("broadcast permission failed\n");
-        return -1;
+void cache_save(const server_cache *cache, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("couldn't write %s\n", path);
+        return;
     }
 
-    return socket_fd;
+    for (size_t i = 0; i < cache->num_entries; i++) {
+        const server_entry *entry = cache->entries + i;
+        struct in_addr addr;
+        addr.s_addr = entry->addr;
+        fprintf(f, "%s %lld %lu\n", inet_ntoa(addr), (long long)entry->expires,
+                (unsigned long)entry->ttl);
+    }
+    fclose(f);
 }
 
-int send_packet(int socket_fd, const uint8_t *packet, size_t packet_len) {
-    struct sockaddr_in remote_addr;
-    memset(&remote_addr, 0, sizeof(struct sockaddr_in));
-    remote_addr.sin_family = AF_INET;
-    //remote_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-    remote_addr.sin_addr.s_addr = htonl((uint32_t)0xc0a800ff);
-    remote_addr.sin_port = htons(remote_port);
-    int res = sendto(socket_fd, packet, packet_len, 0, (struct sockaddr *)&remote_addr, sizeof(remote_addr));
+// records a response. a ttl of 0 means the server is going away
+void cache_update(server_cache *cache, uint32_t addr, uint32_t ttl) {
+    size_t i;
+    for (i = 0; i < cache->num_entries; i++) {
+        if (cache->entries[i].addr == addr) {
+            break;
+        }
+    }
 
-    if (res < 0) {
-        printf("sendto failed\n");
-        return -1;
+    if (ttl == 0) {
+        if (i < cache->num_entries) {
+            cache->entries[i] = cache->entries[--cache->num_entries];
+        }
+        return;
     }
 
-    return 0;
+    if (i == cache->num_entries) {
+        if (cache->num_entries == max_servers) {
+            return;
+        }
+        cache->num_entries++;
+    }
+    cache->entries[i].addr = addr;
+    cache->entries[i].expires = time(NULL) + ttl;
+    cache->entries[i].ttl = ttl;
 }
 
-int open_recv(const char *addr) {
-    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+void cache_print(const server_cache *cache) {
+    time_t now = time(NULL);
+    for (size_t i = 0; i < cache->num_entries; i++) {
+        struct in_addr addr;
+        addr.s_addr = cache->entries[i].addr;
+        printf("server %s (expires in %llds)\n", inet_ntoa(addr),
+               (long long)(cache->entries[i].expires - now));
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+int open_socket(const char *addr) {
+    int socket_fd = lwip_socket(AF_INET, SOCK_DGRAM, 0);
 
     if (socket_fd < 0) {
         printf("socket failed\n");
         return -1;
     }
 
-    struct sockaddr_in *local_addr = calloc(1, sizeof(struct sockaddr_in));
-    local_addr->sin_family = AF_INET;
-    local_addr->sin_addr.s_addr = inet_addr(addr);
-    local_addr->sin_port = htons(local_port);
+    struct lwip_sockaddr_in local_addr;
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons(local_port);
 
-    int res = bind(socket_fd, (struct sockaddr *)local_addr, sizeof(struct sockaddr_in));
-    free(local_addr);
+    int res = lwip_bind(socket_fd, (struct lwip_sockaddr *)&local_addr, sizeof(local_addr));
 
     if (res < 0) {
         printf("bind failed\n");
+        lwip_close(socket_fd);
         return -1;
     }
 
+    // responses go to the group, so we hear those meant for other clients
+    //   as well as our own
+    struct lwip_ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = inet_addr(group_s);
+    mreq.imr_interface.s_addr = inet_addr(addr);
+    res = lwip_setsockopt(socket_fd, LWIP_IPPROTO_IP, LWIP_IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    if (res < 0) {
+        printf("joining %s failed\n", group_s);
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    struct lwip_in_addr interface;
+    interface.s_addr = inet_addr(addr);
+    lwip_setsockopt(socket_fd, LWIP_IPPROTO_IP, LWIP_IP_MULTICAST_IF, &interface, sizeof(interface));
+
     return socket_fd;
 }
 
-ssize_t recv_packet(int socket_fd, uint8_t *packet,
-                    size_t packet_len, struct sockaddr_in *recv_from) {
+// the query lists every server we know of that will still be known when
+//   the next query goes out, so they needn't answer
+int send_query(int socket_fd, const server_cache *cache) {
+    uint8_t packet[64 + 4 * max_servers];
+    size_t packet_len = strlen(send_str);
+    memcpy(packet, send_str, packet_len);
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < cache->num_entries; i++) {
+        const server_entry *entry = cache->entries + i;
+        if (entry->expires - now > entry->ttl / 2) {
+            memcpy(packet + packet_len, &entry->addr, 4);
+            packet_len += 4;
+        }
+    }
+
+    struct lwip_sockaddr_in remote_addr;
+    memset(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_addr.s_addr = inet_addr(group_s);
+    remote_addr.sin_port = htons(remote_port);
+    int res = lwip_sendto(socket_fd, packet, packet_len, 0,
+                          (struct lwip_sockaddr *)&remote_addr, sizeof(remote_addr));
 
-    socklen_t recv_from_len = sizeof(recv_from);
-    return recvfrom(socket_fd, packet, packet_len, 0, (struct sockaddr *)recv_from, &recv_from_len);
+    if (res < 0) {
+        printf("sendto failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void discover(int socket_fd, server_cache *cache) {
+    uint8_t buf[1024];
+    long next_query = now_ms();
+    long interval = query_interval_ms;
+    int queries_left = num_queries;
+    long done_at = -1;
+
+    for (;;) {
+        long now = now_ms();
+        if (queries_left > 0 && now >= next_query) {
+            send_query(socket_fd, cache);
+            queries_left--;
+            next_query = now + interval;
+            interval *= 2;
+            if (queries_left == 0) {
+                done_at = now + listen_ms;
+            }
+        }
+
+        long until = (queries_left > 0) ? next_query : done_at;
+        if (now >= until && queries_left == 0) {
+            return;
+        }
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(socket_fd, &read_fds);
+        long wait_ms = (until > now) ? until - now : 0;
+        struct timeval tv;
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+        if (lwip_select(socket_fd + 1, &read_fds, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+
+        struct lwip_sockaddr_in recv_from;
+        lwip_socklen_t recv_from_len = sizeof(recv_from);
+        int recv_len = lwip_recvfrom(socket_fd, buf, sizeof(buf), 0,
+                                     (struct lwip_sockaddr *)&recv_from, &recv_from_len);
+        size_t response_len = strlen(recv_str);
+        if (recv_len != (int)response_len + 4 || memcmp(buf, recv_str, response_len) != 0) {
+            continue;
+        }
+
+        const uint8_t *p = buf + response_len;
+        uint32_t ttl = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        struct in_addr from;
+        from.s_addr = recv_from.sin_addr.s_addr;
+        printf("received response from %s: %s (ttl %lus)\n", inet_ntoa(from), recv_str,
+               (unsigned long)ttl);
+        cache_update(cache, from.s_addr, ttl);
+    }
 }
 
 int main(int argc, char **argv) {
+    // -f looks again even if servers are cached
+    bool fresh = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        if (opt == 'f') {
+            fresh = true;
+        } else {
+            printf("usage: %s [-f]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    server_cache cache;
+    cache_load(&cache, cache_path);
+    if (!fresh && cache.num_entries > 0) {
+        cache_print(&cache);
+        return 0;
+    }
+
     PaError err = Pa_Initialize();
     if (err != paNoError) {
         printf("failed to initialize port audio, %s\n", Pa_GetErrorText(err));
@@ -124,24 +330,18 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    int recv_socket = open_recv(ipaddr_s);
-    int send_socket = open_send();
-
-    size_t buf_len = 4096;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
-    memcpy(buf, send_str, strlen(send_str));
-
-    send_packet(send_socket, buf, strlen(send_str));
-
-    memset(buf, 0, buf_len);
-
-    struct sockaddr_in *recv_from = calloc(1, sizeof(struct sockaddr_in));
-    size_t recv_len = recv_packet(recv_socket, buf, buf_len, recv_from);
-    printf("received response from %s: %.*s\n", inet_ntoa(recv_from->sin_addr.s_addr), (int)recv_len, buf);
+    int socket_fd = open_socket(ipaddr_s);
+    if (socket_fd >= 0) {
+        discover(socket_fd, &cache);
+        lwip_close(socket_fd);
+        cache_save(&cache, cache_path);
+        if (cache.num_entries == 0) {
+            printf("no servers found\n");
+        }
+        cache_print(&cache);
+    }
 
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
-    free(recv_from);
-    free(buf);
     quiet_lwip_portaudio_destroy(interface);
 
     Pa_Terminate();
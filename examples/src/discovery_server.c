@@ -1,12 +1,19 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
 
 #include "quiet-lwip-portaudio.h"
 
-#include "lwip/sockets.h"
+#include "quiet-lwip/lwip-socket.h"
 
 const int remote_port = 3334;
 const int local_port = 3333;
@@ -17,27 +24,88 @@ const char *ipaddr_s = "192.168.0.8";
 const quiet_lwip_ipv4_addr netmask = (uint32_t)0xffffff00;  // 255.255.255.0
 const quiet_lwip_ipv4_addr gateway = (uint32_t)0xc0a80001;  // 192.168.0.1
 
+// queries and responses both go to this group, so only nodes that take
+//   part in discovery hear them, and every client hears every response
+const char *group_s = "239.255.51.51";
+
 const char *recv_str = "MARCO";
 const char *send_str = "POLO";
 
-int open_send() {
-    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+// how long clients may remember us, in seconds
+const uint32_t response_ttl = 120;
+
+// a response waits a random time up to this long, so that servers
+//   answering the same query don't all transmit at once
+const long response_delay_max_ms = 1000;
+
+// a query arriving this soon after our last response is already answered:
+//   whoever sent it heard that response too
+const long response_interval_ms = 1000;
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int open_recv(const char *addr) {
+    int socket_fd = lwip_socket(AF_INET, SOCK_DGRAM, 0);
 
     if (socket_fd < 0) {
         printf("socket failed\n");
         return -1;
     }
 
+    // bound to any address, since queries are sent to the group rather
+    //   than to us
+    struct lwip_sockaddr_in local_addr;
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons(local_port);
+
+    int res = lwip_bind(socket_fd, (struct lwip_sockaddr *)&local_addr, sizeof(local_addr));
+
+    if (res < 0) {
+        printf("bind failed\n");
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    struct lwip_ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = inet_addr(group_s);
+    mreq.imr_interface.s_addr = inet_addr(addr);
+    res = lwip_setsockopt(socket_fd, LWIP_IPPROTO_IP, LWIP_IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    if (res < 0) {
+        printf("joining %s failed\n", group_s);
+        lwip_close(socket_fd);
+        return -1;
+    }
+
+    struct lwip_in_addr interface;
+    interface.s_addr = inet_addr(addr);
+    lwip_setsockopt(socket_fd, LWIP_IPPROTO_IP, LWIP_IP_MULTICAST_IF, &interface, sizeof(interface));
+
     return socket_fd;
 }
 
-int send_packet(int socket_fd, uint32_t remote_ip_addr, const uint8_t *packet, size_t packet_len) {
-    struct sockaddr_in remote_addr;
-    memset(&remote_addr, 0, sizeof(struct sockaddr_in));
+int send_response(int socket_fd) {
+    uint8_t packet[8];
+    size_t packet_len = strlen(send_str);
+    memcpy(packet, send_str, packet_len);
+    packet[packet_len++] = response_ttl >> 24;
+    packet[packet_len++] = response_ttl >> 16;
+    packet[packet_len++] = response_ttl >> 8;
+    packet[packet_len++] = response_ttl;
+
+    struct lwip_sockaddr_in remote_addr;
+    memset(&remote_addr, 0, sizeof(remote_addr));
     remote_addr.sin_family = AF_INET;
-    remote_addr.sin_addr.s_addr = remote_ip_addr;
+    remote_addr.sin_addr.s_addr = inet_addr(group_s);
     remote_addr.sin_port = htons(remote_port);
-    int res = sendto(socket_fd, packet, packet_len, 0, (struct sockaddr *)&remote_addr, sizeof(remote_addr));
+    int res = lwip_sendto(socket_fd, packet, packet_len, 0,
+                          (struct lwip_sockaddr *)&remote_addr, sizeof(remote_addr));
 
     if (res < 0) {
         printf("sendto failed\n");
@@ -47,38 +115,88 @@ int send_packet(int socket_fd, uint32_t remote_ip_addr, const uint8_t *packet, s
     return 0;
 }
 
-int open_recv(const char *addr) {
-    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-
-    if (socket_fd < 0) {
-        printf("socket failed\n");
-        return -1;
+// a query is recv_str followed by the addresses of servers the client
+//   already knows. returns true if it is a query and we aren't among them
+bool wants_response(const uint8_t *packet, size_t packet_len) {
+    size_t query_len = strlen(recv_str);
+    if (packet_len < query_len || memcmp(packet, recv_str, query_len) != 0) {
+        return false;
     }
 
-    struct sockaddr_in *local_addr = calloc(1, sizeof(struct sockaddr_in));
-    local_addr->sin_family = AF_INET;
-    local_addr->sin_addr.s_addr = inet_addr(addr);
-    local_addr->sin_port = htons(local_port);
+    uint32_t self = inet_addr(ipaddr_s);
+    for (size_t i = query_len; i + 4 <= packet_len; i += 4) {
+        uint32_t known;
+        memcpy(&known, packet + i, 4);
+        if (known == self) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    int res = bind(socket_fd, (struct sockaddr *)local_addr, sizeof(struct sockaddr_in));
-    free(local_addr);
+void serve(int socket_fd) {
+    uint8_t buf[1024];
+    long respond_at = -1;
+    long last_response = -response_interval_ms;
 
-    if (res < 0) {
-        printf("bind failed\n");
-        return -1;
-    }
+    for (;;) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(socket_fd, &read_fds);
+        struct timeval tv;
+        struct timeval *timeout = NULL;
+        if (respond_at >= 0) {
+            long wait_ms = respond_at - now_ms();
+            if (wait_ms < 0) {
+                wait_ms = 0;
+            }
+            tv.tv_sec = wait_ms / 1000;
+            tv.tv_usec = (wait_ms % 1000) * 1000;
+            timeout = &tv;
+        }
 
-    return socket_fd;
-}
+        int ready = lwip_select(socket_fd + 1, &read_fds, NULL, NULL, timeout);
+        if (ready < 0) {
+            printf("select failed\n");
+            return;
+        }
 
-ssize_t recv_packet(int socket_fd, uint8_t *packet,
-                    size_t packet_len, struct sockaddr_in *recv_from) {
+        if (ready > 0) {
+            struct lwip_sockaddr_in recv_from;
+            lwip_socklen_t recv_from_len = sizeof(recv_from);
+            int recv_len = lwip_recvfrom(socket_fd, buf, sizeof(buf), 0,
+                                         (struct lwip_sockaddr *)&recv_from, &recv_from_len);
+            if (recv_len < 0) {
+                continue;
+            }
+            struct in_addr from;
+            from.s_addr = recv_from.sin_addr.s_addr;
+
+            if (!wants_response(buf, recv_len)) {
+                printf("ignoring request from %s\n", inet_ntoa(from));
+                continue;
+            }
+
+            // one response answers every query that arrives while it waits
+            if (respond_at < 0 && now_ms() - last_response >= response_interval_ms) {
+                respond_at = now_ms() + rand() % response_delay_max_ms;
+                printf("received request from %s, responding in %ld ms\n",
+                       inet_ntoa(from), respond_at - now_ms());
+            }
+        }
 
-    socklen_t recv_from_len = sizeof(recv_from);
-    return recvfrom(socket_fd, packet, packet_len, 0, (struct sockaddr *)recv_from, &recv_from_len);
+        if (respond_at >= 0 && now_ms() >= respond_at) {
+            printf("sending response to %s port %d\n", group_s, remote_port);
+            send_response(socket_fd);
+            respond_at = -1;
+            last_response = now_ms();
+        }
+    }
 }
 
 int main(int argc, char **argv) {
+    srand(time(NULL) ^ ipaddr);
+
     PaError err = Pa_Initialize();
     if (err != paNoError) {
         printf("failed to initialize port audio, %s\n", Pa_GetErrorText(err));
@@ -116,27 +234,12 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    int recv_socket = open_recv(ipaddr_s);
-    int send_socket = open_send();
-
-    size_t buf_len = 4096;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
-    struct sockaddr_in *recv_from = calloc(1, sizeof(struct sockaddr_in));
-
-    for (;;) {
-        size_t recv_len = recv_packet(recv_socket, buf, buf_len, recv_from);
-        printf("received request from %s: %.*s\n", inet_ntoa(recv_from->sin_addr.s_addr), (int)recv_len, buf);
-
-        if (memcmp(buf, recv_str, recv_len) == 0) {
-            printf("sending response to %s port %d\n", inet_ntoa(recv_from->sin_addr.s_addr), remote_port);
-            memset(buf, 0, buf_len);
-            memcpy(buf, send_str, strlen(send_str));
-            send_packet(send_socket, recv_from->sin_addr.s_addr, buf, strlen(send_str));
-        }
+    int socket_fd = open_recv(ipaddr_s);
+    if (socket_fd >= 0) {
+        serve(socket_fd);
+        lwip_close(socket_fd);
     }
 
-    free(recv_from);
-    free(buf);
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
     quiet_lwip_portaudio_destroy(interface);
 
@@ -1,13 +1,20 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
 
 #include "quiet-lwip-portaudio.h"
 
-#include "lwip/sockets.h"
+#include "quiet-lwip/lwip-socket.h"
 
 const int remote_port = 7173;
 
@@ -17,28 +24,379 @@ const char *ipaddr_s = "192.168.0.2";
 const quiet_lwip_ipv4_addr netmask = (uint32_t)0xffffff00;  // 255.255.255.0
 const quiet_lwip_ipv4_addr gateway = (uint32_t)0xc0a80001;  // 192.168.0.1
 
-int open_send(const char *addr) {
-    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+const char *cmd_ping_str = "PING";
+const char *cmd_add_str = "ADD:";
+const uint8_t add_delim = '=';
+const char *cmd_get_str = "GET:";
+const char *get_notfound = " ** NOT FOUND **";
+
+// the protocol, as kv_server describes it
+enum {
+    kv_op_ping = 1,
+    kv_op_set = 2,
+    kv_op_get = 3,
+};
+
+enum {
+    kv_status_ok = 0,
+    kv_status_bad_request = 1,
+    kv_status_too_big = 2,
+    kv_status_failed = 3,
+};
+
+const uint8_t kv_not_found = 0xff;
+
+#define kv_header_len (6)
+#define kv_frame_max (1 << 14)
+#define kv_udp_max (512)
+
+#define key_len (32)
+#define value_len (32)
+
+// the most items one frame carries. a GET sent as a datagram is held to
+//   what the server can answer in one
+#define kv_items_max (255)
+#define kv_udp_items_max ((kv_udp_max - kv_header_len - 1) / (1 + value_len))
+
+// a datagram gets this long for an answer, this many times, before the
+//   lookup is given up
+const long kv_udp_timeout_ms = 3000;
+const int kv_udp_tries = 3;
+
+int open_send(const char *addr, int type) {
+    int socket_fd = lwip_socket(AF_INET, type, 0);
 
     if (socket_fd < 0) {
         printf("socket failed\n");
         return -1;
     }
 
-    struct sockaddr_in remote;
+    struct lwip_sockaddr_in remote;
+    memset(&remote, 0, sizeof(remote));
     remote.sin_family = AF_INET;
     remote.sin_addr.s_addr = inet_addr(addr);
     remote.sin_port = htons(remote_port);
-    int res = connect(socket_fd, (struct sockaddr*)&remote, sizeof(remote));
+    int res = lwip_connect(socket_fd, (struct lwip_sockaddr*)&remote, sizeof(remote));
 
     if (res < 0) {
         printf("connect failed\n");
+        lwip_close(socket_fd);
+        return -1;
     }
 
     return socket_fd;
 }
 
+/* ------------------------------------------------------------------------- */
+// requests. the commands on the command line are packed into as few frames
+//   as they fit in: a run of ADDs becomes one SET, and a run of GETs one GET
+
+typedef struct {
+    uint8_t op;
+    uint16_t id;
+    // the commands this frame carries, for printing the response
+    char **cmds;
+    size_t num_cmds;
+    uint8_t buf[2 + kv_frame_max];
+    size_t len;
+} kv_frame;
+
+void kv_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+uint16_t kv_get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint8_t kv_cmd_op(const char *cmd) {
+    if (strcmp(cmd, cmd_ping_str) == 0) {
+        return kv_op_ping;
+    }
+    if (strncmp(cmd, cmd_add_str, strlen(cmd_add_str)) == 0) {
+        return kv_op_set;
+    }
+    if (strncmp(cmd, cmd_get_str, strlen(cmd_get_str)) == 0) {
+        return kv_op_get;
+    }
+    return 0;
+}
+
+// appends a length-prefixed field, returning -1 if it is too long
+int kv_frame_field(kv_frame *frame, const char *field, size_t len, size_t limit) {
+    if (len > limit || frame->len + 1 + len > sizeof(frame->buf)) {
+        return -1;
+    }
+    frame->buf[frame->len++] = len;
+    memcpy(frame->buf + frame->len, field, len);
+    frame->len += len;
+    return 0;
+}
+
+int kv_frame_add(kv_frame *frame, char *cmd) {
+    if (frame->op == kv_op_set) {
+        const char *key = cmd + strlen(cmd_add_str);
+        const char *delim = strchr(key, add_delim);
+        if (!delim) {
+            return -1;
+        }
+        size_t len = frame->len;
+        if (kv_frame_field(frame, key, delim - key, key_len) < 0 ||
+                kv_frame_field(frame, delim + 1, strlen(delim + 1), value_len) < 0) {
+            frame->len = len;
+            return -1;
+        }
+    } else if (frame->op == kv_op_get) {
+        const char *key = cmd + strlen(cmd_get_str);
+        if (kv_frame_field(frame, key, strlen(key), key_len) < 0) {
+            return -1;
+        }
+    }
+
+    frame->cmds[frame->num_cmds++] = cmd;
+    if (frame->op != kv_op_ping) {
+        frame->buf[kv_header_len] = frame->num_cmds;
+    }
+    return 0;
+}
+
+// packs cmds into frames. returns how many, or -1 if a command is malformed
+ssize_t kv_frames(char **cmds, size_t num_cmds, bool datagram, kv_frame **frames) {
+    size_t items_max = datagram ? kv_udp_items_max : kv_items_max;
+    *frames = calloc(num_cmds, sizeof(kv_frame));
+    size_t num_frames = 0;
+    kv_frame *frame = NULL;
+
+    for (size_t i = 0; i < num_cmds; i++) {
+        uint8_t op = kv_cmd_op(cmds[i]);
+        if (!op || (datagram && op == kv_op_set)) {
+            printf("can't send %s%s\n", cmds[i], datagram ? " over udp" : "");
+            return -1;
+        }
+
+        // a frame of big fields could still run out of room, in which case
+        //   the command starts a frame of its own
+        if (!frame || frame->op != op || op == kv_op_ping || frame->num_cmds == items_max ||
+                kv_frame_add(frame, cmds[i]) < 0) {
+            frame = *frames + num_frames;
+            frame->op = op;
+            frame->id = num_frames++;
+            frame->cmds = cmds + i;
+            frame->buf[2] = op;
+            kv_put_u16(frame->buf + 4, frame->id);
+            frame->len = kv_header_len;
+            if (op != kv_op_ping) {
+                frame->buf[frame->len++] = 0;
+            }
+            if (kv_frame_add(frame, cmds[i]) < 0) {
+                printf("can't send %s\n", cmds[i]);
+                return -1;
+            }
+        }
+        kv_put_u16(frame->buf, frame->len - 2);
+    }
+
+    return num_frames;
+}
+
+// prints the response to frame, body being the response's body. returns
+//   false if it doesn't make sense
+bool kv_print_response(const kv_frame *frame, const uint8_t *body, size_t len) {
+    if (len < 4 || body[0] != frame->op || kv_get_u16(body + 2) != frame->id) {
+        return false;
+    }
+
+    if (body[1] != kv_status_ok) {
+        printf("request failed with status %d\n", body[1]);
+        return true;
+    }
+
+    if (frame->op == kv_op_ping) {
+        printf("PONG\n");
+        return true;
+    }
+
+    if (frame->op == kv_op_set) {
+        for (size_t i = 0; i < frame->num_cmds; i++) {
+            printf("ADDED\n");
+        }
+        return true;
+    }
+
+    const uint8_t *p = body + 4;
+    const uint8_t *end = body + len;
+    if (p == end || *p++ != frame->num_cmds) {
+        return false;
+    }
+    for (size_t i = 0; i < frame->num_cmds; i++) {
+        if (p == end) {
+            return false;
+        }
+        uint8_t value_size = *p++;
+        if (value_size == kv_not_found) {
+            printf("%s\n", get_notfound);
+            continue;
+        }
+        if (end - p < value_size) {
+            return false;
+        }
+        printf("%.*s\n", (int)value_size, p);
+        p += value_size;
+    }
+    return true;
+}
+
+// every frame goes out in one write, and then the responses are read back
+//   in the same order: one round trip, however many commands
+int kv_run_stream(const char *addr, kv_frame *frames, size_t num_frames) {
+    int socket_fd = open_send(addr, SOCK_STREAM);
+    if (socket_fd < 0) {
+        return -1;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        total += frames[i].len;
+    }
+    uint8_t *out = malloc(total);
+    size_t off = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        memcpy(out + off, frames[i].buf, frames[i].len);
+        off += frames[i].len;
+    }
+
+    int res = 0;
+    for (off = 0; off < total; ) {
+        int written = lwip_write(socket_fd, out + off, total - off);
+        if (written <= 0) {
+            printf("write to socket failed\n");
+            res = -1;
+            break;
+        }
+        off += written;
+    }
+    free(out);
+
+    uint8_t *in = malloc(2 + kv_frame_max);
+    size_t in_len = 0;
+    for (size_t i = 0; i < num_frames && res == 0; ) {
+        if (in_len >= 2 && in_len >= 2 + (size_t)kv_get_u16(in)) {
+            size_t body_len = kv_get_u16(in);
+            if (!kv_print_response(frames + i, in + 2, body_len)) {
+                printf("bad response\n");
+                res = -1;
+                break;
+            }
+            memmove(in, in + 2 + body_len, in_len - 2 - body_len);
+            in_len -= 2 + body_len;
+            i++;
+            continue;
+        }
+
+        int nread = lwip_read(socket_fd, in + in_len, 2 + kv_frame_max - in_len);
+        if (nread <= 0) {
+            printf("read from socket failed\n");
+            res = -1;
+            break;
+        }
+        in_len += nread;
+    }
+    free(in);
+
+    lwip_close(socket_fd);
+    return res;
+}
+
+// each frame is a datagram of its own. they all go out at once, and any
+//   still unanswered after the timeout are sent again
+int kv_run_datagrams(const char *addr, kv_frame *frames, size_t num_frames) {
+    int socket_fd = open_send(addr, SOCK_DGRAM);
+    if (socket_fd < 0) {
+        return -1;
+    }
+
+    bool *answered = calloc(num_frames, sizeof(bool));
+    size_t num_answered = 0;
+    uint8_t in[kv_udp_max];
+
+    for (int attempt = 0; attempt < kv_udp_tries && num_answered < num_frames; attempt++) {
+        for (size_t i = 0; i < num_frames; i++) {
+            if (!answered[i]) {
+                lwip_send(socket_fd, frames[i].buf, frames[i].len, 0);
+            }
+        }
+
+        for (;;) {
+            fd_set read_fds;
+            FD_ZERO(&read_fds);
+            FD_SET(socket_fd, &read_fds);
+            struct timeval tv;
+            tv.tv_sec = kv_udp_timeout_ms / 1000;
+            tv.tv_usec = (kv_udp_timeout_ms % 1000) * 1000;
+            if (num_answered == num_frames ||
+                    lwip_select(socket_fd + 1, &read_fds, NULL, NULL, &tv) <= 0) {
+                break;
+            }
+
+            int nread = lwip_recv(socket_fd, in, sizeof(in), 0);
+            if (nread < kv_header_len || kv_get_u16(in) != (size_t)nread - 2) {
+                continue;
+            }
+            // responses arrive in any order, and maybe more than once
+            uint16_t id = kv_get_u16(in + 4);
+            if (id >= num_frames || answered[id]) {
+                continue;
+            }
+            if (kv_print_response(frames + id, in + 2, nread - 2)) {
+                answered[id] = true;
+                num_answered++;
+            }
+        }
+    }
+
+    if (num_answered < num_frames) {
+        printf("%zu requests went unanswered\n", num_frames - num_answered);
+    }
+
+    free(answered);
+    lwip_close(socket_fd);
+    return (num_answered == num_frames) ? 0 : -1;
+}
+
+void usage(const char *argv0) {
+    printf("usage: %s [-u] server_addr command...\n"
+           "commands: PING, ADD:key=value, GET:key\n"
+           "-u sends PINGs and GETs as datagrams\n", argv0);
+}
+
 int main(int argc, char **argv) {
+    bool datagram = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "u")) != -1) {
+        if (opt == 'u') {
+            datagram = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *server_addr = argv[optind];
+    char **cmds = argv + optind + 1;
+    size_t num_cmds = argc - optind - 1;
+
+    kv_frame *frames;
+    ssize_t num_frames = kv_frames(cmds, num_cmds, datagram, &frames);
+    if (num_frames < 0) {
+        return 1;
+    }
+
     PaError err = Pa_Initialize();
     if (err != paNoError) {
         printf("failed to initialize port audio, %s\n", Pa_GetErrorText(err));
@@ -76,34 +434,16 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    size_t buf_len = 4096;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
-
-    int send_socket = open_send(argv[1]);
-
-    char *request = argv[2];
-
-    memcpy(buf, request, strlen(request));
-
-    ssize_t write_len = write(send_socket, buf, strlen(request));
-
-    if (write_len < 0) {
-        printf("write to socket failed\n");
-    }
-
-    memset(buf, 0, buf_len);
-
-    ssize_t recv_len = read(send_socket, buf, buf_len);
-    printf("%.*s\n", (int)recv_len, buf);
-    close(send_socket);
+    int res = datagram ? kv_run_datagrams(server_addr, frames, num_frames)
+                       : kv_run_stream(server_addr, frames, num_frames);
 
     sleep(1);
 
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
-    free(buf);
+    free(frames);
     quiet_lwip_portaudio_destroy(interface);
 
     Pa_Terminate();
 
-    return 0;
+    return (res == 0) ? 0 : 1;
 }
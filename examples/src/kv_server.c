@@ -1,12 +1,22 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include "quiet-lwip-portaudio.h"
 
-#include "lwip/sockets.h"
+#include "quiet-lwip/lwip-socket.h"
 
 const int local_port = 7173;
 
@@ -16,30 +26,61 @@ const char *ipaddr_s = "192.168.0.8";
 const quiet_lwip_ipv4_addr netmask = (uint32_t)0xffffff00;  // 255.255.255.0
 const quiet_lwip_ipv4_addr gateway = (uint32_t)0xc0a80001;  // 192.168.0.1
 
-const char *recv_ping_str = "PING";
-const char *send_ping_str = "PONG";
-
-const char *recv_add_str = "ADD:";
-const char *send_add_str = "ADDED";
-const uint8_t add_delim = '=';
-
-const char *recv_get_str = "GET:";
-const char *get_notfound = " ** NOT FOUND **";
-
-int open_recv(const char *addr) {
-    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+// the protocol. every message is a frame: a 2-byte length, then that many
+//   bytes of body. a body starts with an op, a status (0 in requests) and a
+//   2-byte id that the response echoes, all in network order. a client can
+//   send any number of requests on one connection without waiting, and the
+//   responses come back in the same order
+//
+//   PING  no payload either way
+//   SET   a count, then that many of {key length, key, value length, value}
+//   GET   a count, then that many of {key length, key}. the response has the
+//         count, then for each key its value length and value, or
+//         kv_not_found in place of the length
+//
+// the same frames can be sent to the same port over udp, one to a datagram,
+//   for lookups that shouldn't wait on a tcp handshake. only PING and GET
+//   are served that way, since datagrams can be lost, repeated or reordered
+enum {
+    kv_op_ping = 1,
+    kv_op_set = 2,
+    kv_op_get = 3,
+};
+
+enum {
+    kv_status_ok = 0,
+    kv_status_bad_request = 1,
+    // the response wouldn't fit in a datagram. ask again over tcp
+    kv_status_too_big = 2,
+    kv_status_failed = 3,
+};
+
+const uint8_t kv_not_found = 0xff;
+
+// length, op, status and id
+#define kv_header_len (6)
+// the longest body either side accepts
+#define kv_frame_max (1 << 14)
+// the longest datagram sent in reply to one
+#define kv_udp_max (512)
+
+// where pairs are kept across restarts, unless named on the command line
+const char *kv_log_path_default = "kv.log";
+
+int open_recv(const char *addr, int type) {
+    int socket_fd = lwip_socket(AF_INET, type, 0);
 
     if (socket_fd < 0) {
         printf("socket failed\n");
         return -1;
     }
 
-    struct sockaddr_in *local_addr = calloc(1, sizeof(struct sockaddr_in));
+    struct lwip_sockaddr_in *local_addr = calloc(1, sizeof(struct lwip_sockaddr_in));
     local_addr->sin_family = AF_INET;
     local_addr->sin_addr.s_addr = inet_addr(addr);
     local_addr->sin_port = htons(local_port);
 
-    int res = bind(socket_fd, (struct sockaddr *)local_addr, sizeof(struct sockaddr_in));
+    int res = lwip_bind(socket_fd, (struct lwip_sockaddr *)local_addr, sizeof(struct lwip_sockaddr_in));
     free(local_addr);
 
     if (res < 0) {
@@ -47,7 +88,12 @@ int open_recv(const char *addr) {
         return -1;
     }
 
-    res = listen(socket_fd, 1);
+    if (type == SOCK_DGRAM) {
+        return socket_fd;
+    }
+
+    // connections are served side by side, so several can be waiting
+    res = lwip_listen(socket_fd, 8);
 
     if (res < 0) {
         printf("listen failed\n");
@@ -57,101 +103,659 @@ int open_recv(const char *addr) {
     return socket_fd;
 }
 
-int recv_connection(int socket_fd, struct sockaddr_in *recv_from) {
-
-    socklen_t recv_from_len = sizeof(recv_from);
-    return accept(socket_fd, (struct sockaddr *)recv_from, &recv_from_len);
+int recv_connection(int socket_fd, struct lwip_sockaddr_in *recv_from) {
+    lwip_socklen_t recv_from_len = sizeof(*recv_from);
+    return lwip_accept(socket_fd, (struct lwip_sockaddr *)recv_from, &recv_from_len);
 }
 
-const size_t kv_num_items_init = 8;
-const size_t key_len = 32;
-const size_t value_len = 32;
+/* ------------------------------------------------------------------------- */
+// the store. keys and values are fixed-size, zero-padded records carved out
+//   of large blocks, and found through a hash index, so adding a pair costs
+//   the same however many there are. every add is also appended to a log
+//   that is mapped into memory, and replaying the log at startup brings the
+//   store back as it was
+
+#define key_len (32)
+#define value_len (32)
 
 typedef struct {
-    uint8_t *key;
-    uint8_t *value;
+    uint8_t key[key_len];
+    uint8_t value[value_len];
 } kv_t;
 
-int kv_compare(const void *lkv, const void *rkv) {
-    const kv_t *l = (const kv_t*)lkv;
-    const kv_t *r = (const kv_t*)rkv;
+// records are never freed one at a time: there is no delete, and an add to
+//   an existing key overwrites its record in place
+#define kv_block_len (1024)
 
-    return memcmp(l->key, r->key, key_len);
-}
+typedef struct kv_block kv_block;
+struct kv_block {
+    kv_block *next;
+    size_t used;
+    kv_t records[kv_block_len];
+};
+
+typedef struct {
+    // 0 marks an empty slot
+    uint32_t hash;
+    kv_t *record;
+} kv_slot;
+
+const size_t kv_num_slots_init = 64;
 
+// the log is a magic number followed by entries, each a record and a
+//   checksum of it. the file is grown ahead of the entries in large steps,
+//   so replay stops at the first entry whose checksum doesn't match: the
+//   zeroes past the end, or an entry cut short by a crash
 typedef struct {
-    kv_t *kv;
+    kv_t record;
+    uint32_t check;
+} kv_log_entry;
+
+const uint8_t kv_log_magic[8] = {'Q', 'K', 'V', 'L', 'O', 'G', '1', 0};
+#define kv_log_header_len (8)
+const size_t kv_log_len_init = 1 << 16;
+
+// once there are this many entries and fewer than half of them are still
+//   current, the log is rewritten with one entry per pair
+const size_t kv_compact_min = 4096;
+
+typedef struct {
+    kv_block *blocks;
+    kv_slot *slots;
+    size_t num_slots;
     size_t num_items;
-    size_t cap;
+
+    const char *log_path;
+    int log_fd;
+    uint8_t *log;
+    size_t log_len;
+    size_t log_entries;
+    // appended to since the last msync()
+    bool log_dirty;
 } key_value_t;
 
-key_value_t *key_value_init() {
-    key_value_t *kv = calloc(1, sizeof(key_value_t));
-    kv->kv = calloc(kv_num_items_init, sizeof(kv_t));
-    for (size_t i = 0; i < kv_num_items_init; i++) {
-        kv->kv[i].key = calloc(key_len, sizeof(uint8_t));
-        kv->kv[i].value = calloc(value_len, sizeof(uint8_t));
+uint32_t kv_hash(const uint8_t *key) {
+    // fnv-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_len; i++) {
+        hash ^= key[i];
+        hash *= 16777619u;
     }
-    kv->num_items = 0;
-    kv->cap = kv_num_items_init;
-    return kv;
+    return hash ? hash : 1;
 }
 
-const kv_t *key_value_find(key_value_t *kv, const kv_t *k) {
-    void *found = bsearch(k, kv->kv, kv->num_items, sizeof(kv_t), kv_compare);
+uint32_t kv_log_check(const kv_t *record) {
+    const uint8_t *p = (const uint8_t*)record;
+    uint32_t check = 2166136261u;
+    for (size_t i = 0; i < sizeof(kv_t); i++) {
+        check ^= p[i];
+        check *= 16777619u;
+    }
+    // so that an entry of zeroes never passes
+    return check ^ 0x9e3779b9u;
+}
 
-    if (!found) {
+kv_slot *key_value_slot(key_value_t *kv, const uint8_t *key, uint32_t hash) {
+    size_t mask = kv->num_slots - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        kv_slot *slot = kv->slots + i;
+        if (!slot->hash) {
+            return slot;
+        }
+        if (slot->hash == hash && memcmp(slot->record->key, key, key_len) == 0) {
+            return slot;
+        }
+    }
+}
+
+void key_value_grow(key_value_t *kv) {
+    kv_slot *old = kv->slots;
+    size_t old_num = kv->num_slots;
+
+    kv->num_slots *= 2;
+    kv->slots = calloc(kv->num_slots, sizeof(kv_slot));
+    for (size_t i = 0; i < old_num; i++) {
+        if (old[i].hash) {
+            *key_value_slot(kv, old[i].record->key, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+kv_t *key_value_alloc(key_value_t *kv) {
+    if (!kv->blocks || kv->blocks->used == kv_block_len) {
+        kv_block *block = calloc(1, sizeof(kv_block));
+        block->next = kv->blocks;
+        kv->blocks = block;
+    }
+    return kv->blocks->records + kv->blocks->used++;
+}
+
+// key and value are full, zero-padded records. returns the record now
+//   holding the pair
+kv_t *key_value_put(key_value_t *kv, const uint8_t *key, const uint8_t *value) {
+    // keep the index at most 3/4 full
+    if (4 * (kv->num_items + 1) > 3 * kv->num_slots) {
+        key_value_grow(kv);
+    }
+
+    uint32_t hash = kv_hash(key);
+    kv_slot *slot = key_value_slot(kv, key, hash);
+    if (!slot->hash) {
+        slot->hash = hash;
+        slot->record = key_value_alloc(kv);
+        memcpy(slot->record->key, key, key_len);
+        kv->num_items++;
+    }
+    memcpy(slot->record->value, value, value_len);
+    return slot->record;
+}
+
+const kv_t *key_value_find(key_value_t *kv, const uint8_t *key) {
+    kv_slot *slot = key_value_slot(kv, key, kv_hash(key));
+    return slot->hash ? slot->record : NULL;
+}
+
+kv_log_entry *kv_log_entry_at(key_value_t *kv, size_t i) {
+    return (kv_log_entry*)(kv->log + kv_log_header_len + i * sizeof(kv_log_entry));
+}
+
+// maps fd, growing the file to at least len first
+uint8_t *kv_log_map(int fd, size_t len) {
+    if (ftruncate(fd, len) < 0) {
+        perror("kv: ftruncate");
         return NULL;
     }
 
-    return (kv_t*)found;
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("kv: mmap");
+        return NULL;
+    }
+
+    return (uint8_t*)map;
 }
 
-void key_value_add(key_value_t *kv, const kv_t *pair) {
-    const kv_t *found = key_value_find(kv, pair);
-    if (found) {
-        ptrdiff_t offset = found - kv->kv;
-        kv_t *found_mut = kv->kv + offset;
-        memcpy(found_mut->value, pair->value, value_len - 1);
-        return;
-    }
-
-    if (kv->num_items == kv->cap) {
-        // resize
-        kv->kv = realloc(kv->kv, kv->cap * 2 * sizeof(kv_t));
-        for (size_t i = kv->cap; i < 2 * kv->cap; i++) {
-            kv->kv[i].key = calloc(key_len, sizeof(uint8_t));
-            kv->kv[i].value = calloc(value_len, sizeof(uint8_t));
+int kv_log_append(key_value_t *kv, const kv_t *record) {
+    size_t end = kv_log_header_len + (kv->log_entries + 1) * sizeof(kv_log_entry);
+    if (end > kv->log_len) {
+        size_t len = 2 * kv->log_len;
+        uint8_t *log = kv_log_map(kv->log_fd, len);
+        if (!log) {
+            return -1;
         }
-        kv->cap *= 2;
+        munmap(kv->log, kv->log_len);
+        kv->log = log;
+        kv->log_len = len;
+    }
+
+    kv_log_entry *entry = kv_log_entry_at(kv, kv->log_entries);
+    entry->record = *record;
+    entry->check = kv_log_check(record);
+    kv->log_entries++;
+    kv->log_dirty = true;
+    return 0;
+}
+
+// rewrites the log with just the current pairs, into a new file that
+//   replaces the old one only once it is complete
+int kv_log_compact(key_value_t *kv) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.compact", kv->log_path);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("kv: open");
+        return -1;
+    }
+
+    size_t len = kv_log_len_init;
+    while (len < kv_log_header_len + 2 * kv->num_items * sizeof(kv_log_entry)) {
+        len *= 2;
     }
 
-    memcpy(kv->kv[kv->num_items].key, pair->key, key_len - 1);
-    memcpy(kv->kv[kv->num_items].value, pair->value, value_len - 1);
-    kv->num_items++;
+    uint8_t *log = kv_log_map(fd, len);
+    if (!log) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
 
-    qsort(kv->kv, kv->num_items, sizeof(kv_t), kv_compare);
+    memcpy(log, kv_log_magic, kv_log_header_len);
+    kv_log_entry *entry = (kv_log_entry*)(log + kv_log_header_len);
+    for (size_t i = 0; i < kv->num_slots; i++) {
+        if (kv->slots[i].hash) {
+            entry->record = *kv->slots[i].record;
+            entry->check = kv_log_check(&entry->record);
+            entry++;
+        }
+    }
+
+    if (msync(log, len, MS_SYNC) < 0 || rename(path, kv->log_path) < 0) {
+        perror("kv: compact");
+        munmap(log, len);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
 
+    munmap(kv->log, kv->log_len);
+    close(kv->log_fd);
+    kv->log_fd = fd;
+    kv->log = log;
+    kv->log_len = len;
+    kv->log_entries = kv->num_items;
+    kv->log_dirty = false;
+    printf("compacted log to %zu entries\n", kv->log_entries);
+    return 0;
 }
 
-void key_value_print(key_value_t *kv) {
-    printf("key value contents:\n");
-    for (size_t i = 0; i < kv->num_items; i++) {
-        kv_t pair = kv->kv[i];
-        printf("%.*s: %.*s\n", (int)key_len, pair.key, (int)value_len, pair.value);
+// opens the log at path, creating it if need be, and replays it
+int kv_log_open(key_value_t *kv, const char *path) {
+    kv->log_path = path;
+    kv->log_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (kv->log_fd < 0) {
+        perror("kv: open");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(kv->log_fd, &st) < 0) {
+        perror("kv: fstat");
+        return -1;
+    }
+
+    bool fresh = (st.st_size == 0);
+    kv->log_len = fresh ? kv_log_len_init : (size_t)st.st_size;
+    if (kv->log_len < kv_log_header_len) {
+        printf("%s is not a log\n", path);
+        return -1;
+    }
+
+    kv->log = kv_log_map(kv->log_fd, kv->log_len);
+    if (!kv->log) {
+        return -1;
+    }
+
+    if (fresh) {
+        memcpy(kv->log, kv_log_magic, kv_log_header_len);
+        return 0;
+    }
+
+    if (memcmp(kv->log, kv_log_magic, kv_log_header_len) != 0) {
+        printf("%s is not a log\n", path);
+        return -1;
+    }
+
+    size_t max_entries = (kv->log_len - kv_log_header_len) / sizeof(kv_log_entry);
+    while (kv->log_entries < max_entries) {
+        kv_log_entry *entry = kv_log_entry_at(kv, kv->log_entries);
+        if (entry->check != kv_log_check(&entry->record)) {
+            break;
+        }
+        key_value_put(kv, entry->record.key, entry->record.value);
+        kv->log_entries++;
     }
-    printf("\n");
+
+    printf("replayed %zu entries, %zu pairs\n", kv->log_entries, kv->num_items);
+    return 0;
 }
 
 void key_value_destroy(key_value_t *kv) {
-    for (size_t i = 0; i < kv->cap; i++) {
-        free(kv->kv[i].value);
-        free(kv->kv[i].key);
+    if (kv->log) {
+        msync(kv->log, kv->log_len, MS_SYNC);
+        munmap(kv->log, kv->log_len);
+    }
+    if (kv->log_fd >= 0) {
+        close(kv->log_fd);
+    }
+    while (kv->blocks) {
+        kv_block *next = kv->blocks->next;
+        free(kv->blocks);
+        kv->blocks = next;
     }
-    free(kv->kv);
+    free(kv->slots);
     free(kv);
 }
 
+key_value_t *key_value_init(const char *log_path) {
+    key_value_t *kv = calloc(1, sizeof(key_value_t));
+    kv->num_slots = kv_num_slots_init;
+    kv->slots = calloc(kv->num_slots, sizeof(kv_slot));
+    kv->log_fd = -1;
+
+    if (kv_log_open(kv, log_path) < 0) {
+        key_value_destroy(kv);
+        return NULL;
+    }
+
+    if (kv->log_entries >= kv_compact_min && kv->log_entries > 2 * kv->num_items) {
+        kv_log_compact(kv);
+    }
+
+    return kv;
+}
+
+int key_value_add(key_value_t *kv, const uint8_t *key, const uint8_t *value) {
+    const kv_t *record = key_value_put(kv, key, value);
+
+    if (kv_log_append(kv, record) < 0) {
+        return -1;
+    }
+
+    if (kv->log_entries >= kv_compact_min && kv->log_entries > 2 * kv->num_items) {
+        kv_log_compact(kv);
+    }
+
+    return 0;
+}
+
+// hands what has been appended to the kernel to write back. the pages are
+//   already in the file's cache, so a crash of this process loses nothing
+void key_value_flush(key_value_t *kv) {
+    if (kv->log_dirty) {
+        msync(kv->log, kv->log_len, MS_ASYNC);
+        kv->log_dirty = false;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// requests
+
+void kv_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+uint16_t kv_get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// checks that a SET or GET payload holds count items, each a key and, for
+//   SET, a value, all within their limits
+bool kv_items_valid(const uint8_t *p, size_t len, bool with_values) {
+    if (len < 1) {
+        return false;
+    }
+
+    size_t count = p[0];
+    size_t off = 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t fields = with_values ? 2 : 1;
+        for (size_t f = 0; f < fields; f++) {
+            if (off >= len) {
+                return false;
+            }
+            size_t field_len = p[off];
+            size_t limit = (f == 0) ? key_len : value_len;
+            if (field_len > limit || off + 1 + field_len > len) {
+                return false;
+            }
+            off += 1 + field_len;
+        }
+    }
+
+    return off == len;
+}
+
+// answers one request body with a whole response frame in resp, which has
+//   room for cap bytes. returns the response's length
+size_t kv_request(key_value_t *kv, const uint8_t *req, size_t req_len, bool datagram,
+                  uint8_t *resp, size_t cap) {
+    uint8_t op = req[0];
+    const uint8_t *p = req + 4;
+    size_t len = req_len - 4;
+    uint8_t status = kv_status_ok;
+    size_t resp_len = kv_header_len;
+
+    if (op == kv_op_ping) {
+        // nothing to it
+    } else if (op == kv_op_set && !datagram && kv_items_valid(p, len, true)) {
+        size_t count = p[0];
+        size_t off = 1;
+        for (size_t i = 0; i < count; i++) {
+            uint8_t key[key_len] = {0};
+            uint8_t value[value_len] = {0};
+            memcpy(key, p + off + 1, p[off]);
+            off += 1 + p[off];
+            memcpy(value, p + off + 1, p[off]);
+            off += 1 + p[off];
+            if (key_value_add(kv, key, value) < 0) {
+                status = kv_status_failed;
+                break;
+            }
+        }
+    } else if (op == kv_op_get && kv_items_valid(p, len, false)) {
+        size_t count = p[0];
+        size_t off = 1;
+        // the most a reply can take
+        if (kv_header_len + 1 + count * (1 + value_len) > cap) {
+            status = kv_status_too_big;
+        } else {
+            resp[resp_len++] = count;
+            for (size_t i = 0; i < count; i++) {
+                uint8_t key[key_len] = {0};
+                memcpy(key, p + off + 1, p[off]);
+                off += 1 + p[off];
+
+                const kv_t *found = key_value_find(kv, key);
+                if (!found) {
+                    resp[resp_len++] = kv_not_found;
+                    continue;
+                }
+                size_t found_len = strnlen((const char*)found->value, value_len);
+                resp[resp_len++] = found_len;
+                memcpy(resp + resp_len, found->value, found_len);
+                resp_len += found_len;
+            }
+        }
+    } else {
+        status = kv_status_bad_request;
+    }
+
+    if (status != kv_status_ok) {
+        resp_len = kv_header_len;
+    }
+    kv_put_u16(resp, resp_len - 2);
+    resp[2] = op;
+    resp[3] = status;
+    memcpy(resp + 4, req + 2, 2);
+    return resp_len;
+}
+
+/* ------------------------------------------------------------------------- */
+// connections. one thread waits on all of them, the listener and the udp
+//   socket with lwip_select(). a connection's requests are answered as soon
+//   as each frame is whole, and everything answered in one round goes back
+//   in one send
+
+// a connection whose client isn't reading its responses stops being read
+#define kv_out_high (1 << 16)
+
+typedef struct {
+    int fd;
+    struct in_addr addr;
+    uint8_t in[2 + kv_frame_max];
+    size_t in_len;
+    uint8_t *out;
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+} kv_conn;
+
+// returns false if the client broke the protocol
+bool kv_conn_requests(key_value_t *kv, kv_conn *conn) {
+    // drop what has already gone out. a client that keeps sending while its
+    //   answers drain would otherwise grow the buffer without bound
+    if (conn->out_off) {
+        memmove(conn->out, conn->out + conn->out_off, conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+
+    size_t off = 0;
+    while (conn->in_len - off >= 2) {
+        size_t body_len = kv_get_u16(conn->in + off);
+        if (body_len < kv_header_len - 2 || body_len > kv_frame_max) {
+            return false;
+        }
+        if (conn->in_len - off < 2 + body_len) {
+            break;
+        }
+
+        if (conn->out_cap - conn->out_len < 2 + kv_frame_max) {
+            conn->out_cap = 2 * conn->out_cap + 2 + kv_frame_max;
+            conn->out = realloc(conn->out, conn->out_cap);
+        }
+        conn->out_len += kv_request(kv, conn->in + off + 2, body_len, false,
+                                    conn->out + conn->out_len, 2 + kv_frame_max);
+        off += 2 + body_len;
+    }
+
+    memmove(conn->in, conn->in + off, conn->in_len - off);
+    conn->in_len -= off;
+    return true;
+}
+
+// returns false if the connection has failed
+bool kv_conn_flush(kv_conn *conn) {
+    while (conn->out_off < conn->out_len) {
+        int sent = lwip_send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, LWIP_MSG_DONTWAIT);
+        if (sent < 0) {
+            // lwip is short of segments or pbufs for the moment on ENOMEM,
+            //   and says the socket is writable again once it has room
+            int err = lwip_socket_errno(conn->fd);
+            return err == EAGAIN || err == EWOULDBLOCK || err == ENOMEM;
+        }
+        conn->out_off += sent;
+    }
+    conn->out_off = conn->out_len = 0;
+    return true;
+}
+
+void kv_conn_close(kv_conn *conn) {
+    lwip_close(conn->fd);
+    free(conn->out);
+    free(conn);
+}
+
+void kv_datagrams(key_value_t *kv, int udp_socket) {
+    uint8_t req[2 + kv_frame_max];
+    uint8_t resp[kv_udp_max];
+
+    for (;;) {
+        struct lwip_sockaddr_in from;
+        lwip_socklen_t from_len = sizeof(from);
+        int recv_len = lwip_recvfrom(udp_socket, req, sizeof(req), LWIP_MSG_DONTWAIT,
+                                     (struct lwip_sockaddr*)&from, &from_len);
+        if (recv_len < 0) {
+            return;
+        }
+
+        // one whole frame, or it's ignored
+        if (recv_len < kv_header_len || kv_get_u16(req) != (size_t)recv_len - 2) {
+            continue;
+        }
+
+        size_t resp_len = kv_request(kv, req + 2, recv_len - 2, true, resp, sizeof(resp));
+        lwip_sendto(udp_socket, resp, resp_len, 0, (struct lwip_sockaddr*)&from, from_len);
+    }
+}
+
+void kv_serve(key_value_t *kv, int recv_socket, int udp_socket) {
+    size_t conns_cap = 8;
+    size_t num_conns = 0;
+    kv_conn **conns = calloc(conns_cap, sizeof(kv_conn*));
+
+    for (;;) {
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(recv_socket, &read_fds);
+        FD_SET(udp_socket, &read_fds);
+        int max_fd = (recv_socket > udp_socket) ? recv_socket : udp_socket;
+        for (size_t i = 0; i < num_conns; i++) {
+            kv_conn *conn = conns[i];
+            if (conn->out_len - conn->out_off < kv_out_high) {
+                FD_SET(conn->fd, &read_fds);
+            }
+            if (conn->out_off < conn->out_len) {
+                FD_SET(conn->fd, &write_fds);
+            }
+            if (conn->fd > max_fd) {
+                max_fd = conn->fd;
+            }
+        }
+
+        if (lwip_select(max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
+            printf("select failed\n");
+            continue;
+        }
+
+        for (size_t i = 0; i < num_conns; ) {
+            kv_conn *conn = conns[i];
+            bool alive = true;
+
+            if (FD_ISSET(conn->fd, &read_fds)) {
+                int recv_len = lwip_recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+                if (recv_len <= 0) {
+                    alive = false;
+                } else {
+                    conn->in_len += recv_len;
+                    if (!kv_conn_requests(kv, conn)) {
+                        printf("bad request from %s\n", inet_ntoa(conn->addr));
+                        alive = false;
+                    }
+                }
+            }
+
+            if (alive && conn->out_off < conn->out_len) {
+                alive = kv_conn_flush(conn);
+            }
+
+            if (!alive) {
+                kv_conn_close(conn);
+                conns[i] = conns[--num_conns];
+                continue;
+            }
+            i++;
+        }
+
+        if (FD_ISSET(udp_socket, &read_fds)) {
+            kv_datagrams(kv, udp_socket);
+        }
+
+        // everything this round added goes to the log in one go
+        key_value_flush(kv);
+
+        if (FD_ISSET(recv_socket, &read_fds)) {
+            struct lwip_sockaddr_in recv_from;
+            int conn_fd = recv_connection(recv_socket, &recv_from);
+            if (conn_fd < 0) {
+                continue;
+            }
+            if (conn_fd >= FD_SETSIZE) {
+                // select can't wait on it
+                printf("too many connections, dropping one\n");
+                lwip_close(conn_fd);
+                continue;
+            }
+
+            if (num_conns == conns_cap) {
+                conns_cap *= 2;
+                conns = realloc(conns, conns_cap * sizeof(kv_conn*));
+            }
+            kv_conn *conn = calloc(1, sizeof(kv_conn));
+            conn->fd = conn_fd;
+            conn->addr.s_addr = recv_from.sin_addr.s_addr;
+            conns[num_conns++] = conn;
+            printf("received connection from %s\n", inet_ntoa(conn->addr));
+        }
+    }
+
+    free(conns);
+}
+
 int main(int argc, char **argv) {
     PaError err = Pa_Initialize();
     if (err != paNoError) {
@@ -190,81 +794,24 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    key_value_t *kv = key_value_init();
-    kv_t temp_kv;
-    temp_kv.key = calloc(key_len, sizeof(uint8_t));
-    temp_kv.value = calloc(value_len, sizeof(uint8_t));
-
-    int recv_socket = open_recv(ipaddr_s);
-
-    size_t buf_len = 4096;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
-
-    struct sockaddr_in recv_from;
-    int conn_fd = recv_connection(recv_socket, &recv_from);
-    printf("received connection from %s\n", inet_ntoa(recv_from.sin_addr.s_addr));
-
-    for (;;) {
-        ssize_t recv_len = read(conn_fd, buf, buf_len);
-        if (recv_len) {
-            printf("received packet from %s: %.*s\n", inet_ntoa(recv_from.sin_addr.s_addr), (int)recv_len, buf);
-        } else {
-            close(conn_fd);
-            conn_fd = recv_connection(recv_socket, &recv_from);
-            printf("received connection from %s\n", inet_ntoa(recv_from.sin_addr.s_addr));
-            continue;
-        }
-
-        if (recv_len < 0) {
-            printf("read from connection failed\n");
-        }
-
-        if (memcmp(buf, recv_ping_str, strlen(recv_ping_str)) == 0) {
-            printf("sending response to %s\n", inet_ntoa(recv_from.sin_addr.s_addr));
-            memset(buf, 0, buf_len);
-            memcpy(buf, send_ping_str, strlen(send_ping_str));
-            write(conn_fd, buf, strlen(send_ping_str));
-        } else if (memcmp(buf, recv_add_str, strlen(recv_add_str)) == 0) {
-            ptrdiff_t key_offset = strlen(recv_add_str);
-            size_t remaining = recv_len - key_offset;
-            ptrdiff_t value_offset = 0;
-            for (size_t i = 0; i < (remaining - 1) && i < key_len; i++) {
-                if (buf[key_offset + i] == add_delim) {
-                    value_offset = key_offset + i + 1;
-                    break;
-                }
-            }
-
-            if (value_offset) {
-                memset(temp_kv.key, 0, key_len * sizeof(uint8_t));
-                memset(temp_kv.value, 0, value_len * sizeof(uint8_t));
-                memcpy(temp_kv.key, buf + key_offset, value_offset - key_offset - 1);
-                memcpy(temp_kv.value, buf + value_offset, recv_len - value_offset);
-                key_value_add(kv, &temp_kv);
-                key_value_print(kv);
-
-                memset(buf, 0, buf_len);
-                memcpy(buf, send_add_str, strlen(send_add_str));
-                write(conn_fd, buf, strlen(send_add_str));
-            }
-        } else if (memcmp(buf, recv_get_str, strlen(recv_get_str)) == 0) {
-            ptrdiff_t key_offset = strlen(recv_get_str);
-            memset(temp_kv.key, 0, key_len * sizeof(uint8_t));
-            memcpy(temp_kv.key, buf + key_offset, recv_len - key_offset);
-
-            const kv_t *found = key_value_find(kv, &temp_kv);
-            if (found) {
-                write(conn_fd, found->value, value_len);
-            } else {
-                write(conn_fd, get_notfound, strlen(get_notfound));
-            }
-        }
+    const char *log_path = (argc > 1) ? argv[1] : kv_log_path_default;
+    key_value_t *kv = key_value_init(log_path);
+    if (!kv) {
+        printf("couldn't open %s\n", log_path);
+        exit(1);
+    }
 
+    int recv_socket = open_recv(ipaddr_s, SOCK_STREAM);
+    int udp_socket = open_recv(ipaddr_s, SOCK_DGRAM);
+    if (recv_socket < 0 || udp_socket < 0) {
+        printf("couldn't open socket for listening\n");
+        exit(1);
     }
 
+    kv_serve(kv, recv_socket, udp_socket);
+
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
     key_value_destroy(kv);
-    free(buf);
     quiet_lwip_portaudio_destroy(interface);
 
     Pa_Terminate();
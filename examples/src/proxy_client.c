@@ -10,15 +10,19 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <errno.h>
+#include <stdbool.h>
 
 #include "quiet-lwip-portaudio.h"
 
 #include "quiet-lwip/lwip-socket.h"
 
-#include "relay.h"
+#include "quiet-lwip-relay.h"
+#include "quiet-lwip-mux.h"
 
 const int local_port = 2160;
 const int remote_port = 1080;
+const int tunnel_port = 1081;
 
 const uint8_t mac[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x07};
 const quiet_lwip_ipv4_addr ipaddr = (uint32_t)0xc0a80002;   // 192.168.0.2
@@ -28,14 +32,16 @@ const quiet_lwip_ipv4_addr gateway = (uint32_t)0xc0a80001;  // 192.168.0.1
 
 const uint8_t SOCKS_VERSION = 5;
 const uint8_t SOCKS_AUTH_NOAUTH = 0;
+const uint8_t SOCKS_AUTH_NONE_ACCEPTABLE = 0xff;
 const uint8_t SOCKS_CMD_CONNECT = 1;
 const uint8_t SOCKS_ADDR_IPV4 = 1;
 const uint8_t SOCKS_ADDR_DOMAINNAME = 3;
+const uint8_t SOCKS_ADDR_IPV6 = 4;
 
 const uint8_t SOCKS_CONN_SUCCEEDED = 0;
 const uint8_t SOCKS_CONN_FAILED = 1;
 
-int open_send(const char *addr) {
+int open_send(const char *addr, int port) {
     int socket_fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
 
     if (socket_fd < 0) {
@@ -46,11 +52,13 @@ int open_send(const char *addr) {
     struct lwip_sockaddr_in remote;
     remote.sin_family = AF_INET;
     remote.sin_addr.s_addr = inet_addr(addr);
-    remote.sin_port = htons(remote_port);
+    remote.sin_port = htons(port);
     int res = lwip_connect(socket_fd, (struct lwip_sockaddr*)&remote, sizeof(remote));
 
     if (res < 0) {
         printf("connect failed\n");
+        lwip_close(socket_fd);
+        return -1;
     }
 
     return socket_fd;
@@ -92,7 +100,350 @@ int recv_connection(int socket_fd, struct sockaddr_in *recv_from) {
     return accept(socket_fd, (struct sockaddr *)recv_from, &recv_from_len);
 }
 
+/* ------------------------------------------------------------------------- */
+// connections to the server opened ahead of time, so a new client doesn't
+//   wait on a tcp handshake over the link
+
+#define warm_conns (2)
+
+typedef struct {
+    pthread_mutex_t lock;
+    // wakes the refill thread
+    pthread_cond_t cond;
+    int fds[warm_conns];
+    size_t num_fds;
+    const char *server_addr;
+} warm_pool;
+
+warm_pool warm = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}, 0, NULL};
+
+void *warm_refill(void *arg) {
+    pthread_mutex_lock(&warm.lock);
+    for (;;) {
+        if (warm.num_fds == warm_conns) {
+            pthread_cond_wait(&warm.cond, &warm.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&warm.lock);
+
+        int remote_fd = open_send(warm.server_addr, remote_port);
+
+        pthread_mutex_lock(&warm.lock);
+        if (remote_fd < 0) {
+            // don't hammer a server that isn't there
+            pthread_mutex_unlock(&warm.lock);
+            sleep(1);
+            pthread_mutex_lock(&warm.lock);
+            continue;
+        }
+        warm.fds[warm.num_fds++] = remote_fd;
+    }
+    pthread_mutex_unlock(&warm.lock);
+    return NULL;
+}
+
+int warm_take() {
+    int remote_fd = -1;
+
+    pthread_mutex_lock(&warm.lock);
+    if (warm.num_fds) {
+        remote_fd = warm.fds[--warm.num_fds];
+        pthread_cond_signal(&warm.cond);
+    }
+    pthread_mutex_unlock(&warm.lock);
+
+    if (remote_fd < 0) {
+        remote_fd = open_send(warm.server_addr, remote_port);
+    }
+
+    return remote_fd;
+}
+
+/* ------------------------------------------------------------------------- */
+// the local side of the socks handshake. the method selection is answered
+//   here rather than by the server, so that the greeting, the request and
+//   anything the application sends after it cross the link together, and
+//   the connection is set up in one round trip
+
+// room for the longest greeting and request together, plus whatever data
+//   the application sends along with them
+#define socks_buf_len (1024)
+
+typedef struct {
+    int fd;
+    uint8_t buf[socks_buf_len];
+    size_t len;
+    size_t pos;
+} socks_conn;
+
+// make sure want unparsed bytes are in buf, reading only if they aren't
+int socks_fill(socks_conn *conn, size_t want) {
+    if (conn->pos + want > socks_buf_len) {
+        return -1;
+    }
+
+    while (conn->len - conn->pos < want) {
+        ssize_t nread = read(conn->fd, conn->buf + conn->len, socks_buf_len - conn->len);
+
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (nread <= 0) {
+            return -1;
+        }
+
+        conn->len += nread;
+    }
+
+    return 0;
+}
+
+int socks_greeting(socks_conn *conn) {
+    if (socks_fill(conn, 2) < 0) {
+        return -1;
+    }
+
+    if (conn->buf[conn->pos] != SOCKS_VERSION) {
+        return -1;
+    }
+
+    size_t nmethods = conn->buf[conn->pos + 1];
+
+    if (socks_fill(conn, 2 + nmethods) < 0) {
+        return -1;
+    }
+
+    const uint8_t *methods = conn->buf + conn->pos + 2;
+    conn->pos += 2 + nmethods;
+
+    for (size_t i = 0; i < nmethods; i++) {
+        if (methods[i] == SOCKS_AUTH_NOAUTH) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// skips over the request, which the server parses
+int socks_request(socks_conn *conn) {
+    if (socks_fill(conn, 4) < 0) {
+        return -1;
+    }
+
+    uint8_t addr_type = conn->buf[conn->pos + 3];
+    conn->pos += 4;
+
+    size_t addr_len;
+    if (addr_type == SOCKS_ADDR_IPV4) {
+        addr_len = 4;
+    } else if (addr_type == SOCKS_ADDR_DOMAINNAME) {
+        if (socks_fill(conn, 1) < 0) {
+            return -1;
+        }
+        addr_len = 1 + conn->buf[conn->pos];
+    } else if (addr_type == SOCKS_ADDR_IPV6) {
+        addr_len = 16;
+    } else {
+        return -1;
+    }
+
+    if (socks_fill(conn, addr_len + 2) < 0) {
+        return -1;
+    }
+
+    conn->pos += addr_len + 2;
+
+    return 0;
+}
+
+int lwip_read_all(int fd, uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t nread = lwip_read(fd, buf, len);
+
+        if (nread <= 0) {
+            return -1;
+        }
+
+        buf += nread;
+        len -= nread;
+    }
+
+    return 0;
+}
+
+// answers the greeting and skips over the request. points flight at what
+//   goes to the server in their place: a plain greeting, the request and
+//   whatever the application sent after it
+int socks_local(socks_conn *conn, uint8_t **flight, size_t *flight_len) {
+    uint8_t reply[2] = {SOCKS_VERSION, SOCKS_AUTH_NOAUTH};
+
+    if (socks_greeting(conn) < 0) {
+        reply[1] = SOCKS_AUTH_NONE_ACCEPTABLE;
+        write(conn->fd, reply, 2);
+        printf("socks auth failed\n");
+        return -1;
+    }
+
+    if (write(conn->fd, reply, 2) < 2) {
+        return -1;
+    }
+
+    size_t request_start = conn->pos;
+
+    if (socks_request(conn) < 0) {
+        printf("socks request failed\n");
+        return -1;
+    }
+
+    // the greeting took at least 3 bytes, so a plain one offering no
+    //   authentication fits in front of the request in its place
+    *flight = conn->buf + request_start - 3;
+    *flight_len = conn->len - (request_start - 3);
+    (*flight)[0] = SOCKS_VERSION;
+    (*flight)[1] = 1;
+    (*flight)[2] = SOCKS_AUTH_NOAUTH;
+
+    return 0;
+}
+
+// returns the server connection, ready to be spliced, or -1
+int socks_handshake(socks_conn *conn) {
+    uint8_t *flight;
+    size_t flight_len;
+
+    if (socks_local(conn, &flight, &flight_len) < 0) {
+        return -1;
+    }
+
+    // a warm connection may have gone stale, so one more try on a new one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int remote_fd = (attempt == 0) ? warm_take() : open_send(warm.server_addr, remote_port);
+
+        if (remote_fd < 0) {
+            continue;
+        }
+
+        // the server answers the greeting and the request together. its
+        //   method selection was already answered here, so it's dropped,
+        //   and the connect reply goes on to the application
+        uint8_t reply[2];
+        if (lwip_write(remote_fd, flight, flight_len) == (ssize_t)flight_len &&
+                lwip_read_all(remote_fd, reply, 2) == 0) {
+            if (reply[0] == SOCKS_VERSION && reply[1] == SOCKS_AUTH_NOAUTH) {
+                return remote_fd;
+            }
+            lwip_close(remote_fd);
+            return -1;
+        }
+
+        lwip_close(remote_fd);
+    }
+
+    printf("remote connect failed\n");
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+// with -m, every connection is a stream over one long-lived tunnel to the
+//   server, so a new one costs no tcp handshake over the link and small
+//   writes from different connections share segments. the flight goes out
+//   with the stream's open, and the server's connect reply comes back as
+//   the stream's first data
+
+bool use_tunnel = false;
+
+typedef struct {
+    pthread_mutex_t lock;
+    quiet_lwip_mux *mux;
+} tunnel_state;
+
+tunnel_state tunnel = {PTHREAD_MUTEX_INITIALIZER, NULL};
+
+// call with the tunnel's lock held. reopens the tunnel if it has closed
+quiet_lwip_mux *tunnel_get() {
+    if (tunnel.mux && quiet_lwip_mux_closed(tunnel.mux)) {
+        printf("tunnel closed\n");
+        quiet_lwip_mux_destroy(tunnel.mux);
+        tunnel.mux = NULL;
+    }
+
+    if (!tunnel.mux) {
+        int tunnel_fd = open_send(warm.server_addr, tunnel_port);
+        if (tunnel_fd >= 0) {
+            tunnel.mux = quiet_lwip_mux_create(tunnel_fd, true, NULL, NULL, NULL);
+        }
+    }
+
+    return tunnel.mux;
+}
+
+// hands conn's socket to the tunnel. returns -1 if it's still the caller's
+int tunnel_handshake(socks_conn *conn) {
+    uint8_t *flight;
+    size_t flight_len;
+
+    if (socks_local(conn, &flight, &flight_len) < 0) {
+        return -1;
+    }
+
+    // the tunnel may have closed since it was last used, so one more try on
+    //   a new one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        pthread_mutex_lock(&tunnel.lock);
+        quiet_lwip_mux *mux = tunnel_get();
+        int res = mux ? quiet_lwip_mux_open(mux, conn->fd, 0, flight, flight_len) : -1;
+        pthread_mutex_unlock(&tunnel.lock);
+
+        if (res == 0) {
+            return 0;
+        }
+    }
+
+    printf("tunnel open failed\n");
+    return -1;
+}
+
+void *socks_handshake_run(void *conn_v) {
+    socks_conn *conn = (socks_conn*)conn_v;
+
+    if (use_tunnel) {
+        if (tunnel_handshake(conn) < 0) {
+            close(conn->fd);
+        }
+        free(conn);
+        return NULL;
+    }
+
+    int remote_fd = socks_handshake(conn);
+
+    if (remote_fd < 0) {
+        close(conn->fd);
+    } else {
+        quiet_lwip_splice(conn->fd, remote_fd);
+    }
+
+    free(conn);
+    return NULL;
+}
+
 int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        if (opt == 'm') {
+            use_tunnel = true;
+        } else {
+            printf("usage: %s [-m] server_addr\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        printf("usage: %s [-m] server_addr\n", argv[0]);
+        return 1;
+    }
+
     signal(SIGPIPE, SIG_IGN);
     PaError err = Pa_Initialize();
     if (err != paNoError) {
@@ -131,38 +482,6 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    crossbar client_crossbar;
-    crossbar remote_crossbar;
-    crossbar_init(&client_crossbar);
-    crossbar_init(&remote_crossbar);
-
-    relay_t client_relay = {
-        .agent = agent_native,
-        .other_agent = agent_lwip,
-        .incoming = &client_crossbar,
-        .outgoing = &remote_crossbar,
-        .read = read,
-        .write = write,
-        .select = select,
-        .other_shutdown = lwip_shutdown,
-        .get_errno = native_errno,
-    };
-
-    relay_t remote_relay = {
-        .agent = agent_lwip,
-        .other_agent = agent_native,
-        .incoming = &remote_crossbar,
-        .outgoing = &client_crossbar,
-        .read = _lwip_read,
-        .write = _lwip_write,
-        .select = lwip_select,
-        .other_shutdown = shutdown,
-        .get_errno = lwip_errno,
-    };
-
-    start_relay_thread(&client_relay);
-    start_relay_thread(&remote_relay);
-
     int recv_socket = open_recv("127.0.0.1");
 
     if (recv_socket < 0) {
@@ -170,8 +489,16 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    size_t buf_len = 512;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
+    warm.server_addr = argv[optind];
+    if (use_tunnel) {
+        // up before the first application connects
+        pthread_mutex_lock(&tunnel.lock);
+        tunnel_get();
+        pthread_mutex_unlock(&tunnel.lock);
+    } else {
+        pthread_t refill;
+        pthread_create(&refill, NULL, warm_refill, NULL);
+    }
 
     for (;;) {
         struct sockaddr_in recv_from;
@@ -182,22 +509,18 @@ int main(int argc, char **argv) {
 
         printf("received connection from %s\n", inet_ntoa(recv_from.sin_addr));
 
-        int remote_fd = open_send(argv[1]);
-
-        if (remote_fd < 0) {
+        socks_conn *conn = calloc(1, sizeof(socks_conn));
+        conn->fd = conn_fd;
+        pthread_t handshake;
+        if (pthread_create(&handshake, NULL, socks_handshake_run, conn) != 0) {
             close(conn_fd);
-            printf("remote connect failed\n");
+            free(conn);
             continue;
         }
-
-        relay_conn *conn = relay_conn_create(conn_fd, remote_fd, 1 << 13);
-
-        crossbar_add_for_reading(&client_crossbar, conn);
-        crossbar_add_for_reading(&remote_crossbar, conn);
+        pthread_detach(handshake);
     }
 
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
-    free(buf);
     quiet_lwip_portaudio_destroy(interface);
 
     Pa_Terminate();
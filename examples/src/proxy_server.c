@@ -10,6 +10,7 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -17,9 +18,13 @@
 
 #include "quiet-lwip/lwip-socket.h"
 
-#include "relay.h"
+#include "quiet-lwip-relay.h"
+#include "quiet-lwip-mux.h"
 
 const int local_port = 1080;
+// proxy_client -m carries its connections as streams over one connection
+//   to this port
+const int tunnel_port = 1081;
 
 const uint8_t mac[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x07};
 const quiet_lwip_ipv4_addr ipaddr = (uint32_t)0xc0a80008;   // 192.168.0.8
@@ -36,27 +41,73 @@ const uint8_t SOCKS_ADDR_DOMAINNAME = 3;
 const uint8_t SOCKS_CONN_SUCCEEDED = 0;
 const uint8_t SOCKS_CONN_FAILED = 1;
 
-int socks_auth(int socket_fd, uint8_t *buf, size_t buf_len) {
-    ssize_t nread = lwip_read(socket_fd, buf, 2);
-
-    if (nread < 2) {
+const uint8_t SOCKS_AUTH_NONE_ACCEPTABLE = 0xff;
+
+// room for the longest greeting and request together, plus whatever data
+//   the client sends along with them
+#define socks_buf_len (1024)
+
+// a handshake in progress. each read takes whatever the client has sent so
+//   far, so a greeting and request that arrive in one flight are parsed
+//   from a single read, and bytes past the request are kept for the remote
+typedef struct {
+    int fd;
+    uint8_t buf[socks_buf_len];
+    size_t len;
+    size_t pos;
+} socks_conn;
+
+typedef struct {
+    // as the client named it, a domain name or a dotted quad
+    char host[256];
+    // network order
+    uint16_t port;
+} socks_dest;
+
+// make sure want unparsed bytes are in buf, reading only if they aren't
+int socks_fill(socks_conn *conn, size_t want) {
+    if (conn->pos + want > socks_buf_len) {
         return -1;
     }
 
-    if (buf[0] != SOCKS_VERSION) {
+    while (conn->len - conn->pos < want) {
+        // a handshake from a tunnel arrives whole, with nothing to read
+        if (conn->fd < 0) {
+            return -1;
+        }
+
+        ssize_t nread = lwip_read(conn->fd, conn->buf + conn->len, socks_buf_len - conn->len);
+
+        if (nread <= 0) {
+            return -1;
+        }
+
+        conn->len += nread;
+    }
+
+    return 0;
+}
+
+int socks_greeting(socks_conn *conn) {
+    if (socks_fill(conn, 2) < 0) {
         return -1;
     }
 
-    uint8_t nmethods = buf[1];
+    if (conn->buf[conn->pos] != SOCKS_VERSION) {
+        return -1;
+    }
 
-    nread = lwip_read(socket_fd, buf, nmethods);
+    size_t nmethods = conn->buf[conn->pos + 1];
 
-    if (nread < nmethods) {
+    if (socks_fill(conn, 2 + nmethods) < 0) {
         return -1;
     }
 
+    const uint8_t *methods = conn->buf + conn->pos + 2;
+    conn->pos += 2 + nmethods;
+
     for (size_t i = 0; i < nmethods; i++) {
-        if (buf[i] == SOCKS_AUTH_NOAUTH) {
+        if (methods[i] == SOCKS_AUTH_NOAUTH) {
             return 0;
         }
     }
@@ -64,78 +115,165 @@ int socks_auth(int socket_fd, uint8_t *buf, size_t buf_len) {
     return -1;
 }
 
-int socks_auth_reply(int socket_fd, uint8_t *buf, size_t buf_len) {
-    buf[0] = SOCKS_VERSION;
-    buf[1] = SOCKS_AUTH_NOAUTH;
-    ssize_t nwritten = lwip_write(socket_fd, buf, 2);
+int socks_request(socks_conn *conn, socks_dest *dest) {
+    if (socks_fill(conn, 4) < 0) {
+        return -1;
+    }
 
-    return (nwritten == 2) ? 0 : -1;
-}
+    const uint8_t *req = conn->buf + conn->pos;
 
-int socks_request_connect_ipv4(int socket_fd, uint8_t *buf, size_t buf_len) {
-    int remote_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (req[0] != SOCKS_VERSION) {
+        return -1;
+    }
 
-    if (remote_fd < 0) {
+    if (req[1] != SOCKS_CMD_CONNECT) {
         return -1;
     }
 
-    ssize_t nread = lwip_read(socket_fd, buf, 6);
+    // req[2] is a reserved byte
 
-    if (nread < 6) {
-        return -1;
+    uint8_t addr_type = req[3];
+    conn->pos += 4;
+
+    if (addr_type == SOCKS_ADDR_IPV4) {
+        if (socks_fill(conn, 6) < 0) {
+            return -1;
+        }
+
+        struct in_addr addr;
+        memcpy(&addr.s_addr, conn->buf + conn->pos, 4);
+        inet_ntop(AF_INET, &addr, dest->host, sizeof(dest->host));
+        memcpy(&dest->port, conn->buf + conn->pos + 4, 2);
+        conn->pos += 6;
+        return 0;
     }
 
-    uint32_t ipv4_addr = ((uint32_t*)buf)[0];
-    uint16_t port = ((uint16_t*)buf)[2];
+    if (addr_type == SOCKS_ADDR_DOMAINNAME) {
+        if (socks_fill(conn, 1) < 0) {
+            return -1;
+        }
 
-    struct sockaddr_in remote;
-    remote.sin_family = AF_INET;
-    remote.sin_addr.s_addr = ipv4_addr;
-    remote.sin_port = port;
+        size_t len = conn->buf[conn->pos];
 
-    printf("connecting to %s:%d\n", inet_ntoa(remote.sin_addr), ntohs(remote.sin_port));
+        if (socks_fill(conn, 1 + len + 2) < 0) {
+            return -1;
+        }
 
-    int res = connect(remote_fd, (struct sockaddr*)&remote, sizeof(remote));
+        memcpy(dest->host, conn->buf + conn->pos + 1, len);
+        dest->host[len] = 0;
+        memcpy(&dest->port, conn->buf + conn->pos + 1 + len, 2);
+        conn->pos += 1 + len + 2;
+        return 0;
+    }
 
-    if (res < 0) {
-        return -1;
+    return -1;
+}
+
+// writes the reply to a connect request into buf and returns its length.
+//   remote_fd < 0 means the connect failed
+size_t socks_request_reply(uint8_t *buf, int remote_fd) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t len = sizeof(addr);
+
+    if (remote_fd >= 0 &&
+            (getsockname(remote_fd, (struct sockaddr*)&addr, &len) < 0 || addr.sin_family != AF_INET)) {
+        // the reply only has room for an ipv4 address, so leave it blank
+        memset(&addr, 0, sizeof(addr));
     }
 
-    return remote_fd;
+    buf[0] = SOCKS_VERSION;
+    buf[1] = (remote_fd >= 0) ? SOCKS_CONN_SUCCEEDED : SOCKS_CONN_FAILED;
+    buf[2] = 0;
+    buf[3] = SOCKS_ADDR_IPV4;
+    memcpy(buf + 4, &addr.sin_addr.s_addr, 4);
+    memcpy(buf + 8, &addr.sin_port, 2);
+
+    return 10;
 }
 
-int socks_request_connect_domainname(int socket_fd, uint8_t *buf, size_t buf_len) {
-    ssize_t nread = lwip_read(socket_fd, buf, 1);
+int write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t nwritten = write(fd, buf, len);
 
-    if (nread < 1) {
-        return -1;
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        buf += nwritten;
+        len -= nwritten;
     }
 
-    uint8_t len = buf[0];
+    return 0;
+}
 
-    nread = lwip_read(socket_fd, buf, len + 2);
+/* ------------------------------------------------------------------------- */
+// warm upstream connections. a destination asked for recently keeps a few
+//   connections open ahead of time, so the next request for it is answered
+//   without waiting on a native connect. destinations nobody has asked for
+//   in a while are dropped along with their connections
+
+#define upstream_spares (2)
+const time_t upstream_idle_secs = 30;
+
+typedef struct upstream_dest upstream_dest;
+struct upstream_dest {
+    socks_dest dest;
+    // where the last connect went, so refills skip resolving
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int spares[upstream_spares];
+    size_t num_spares;
+    time_t last_used;
+    upstream_dest *next;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    // wakes the refill thread
+    pthread_cond_t cond;
+    upstream_dest *dests;
+} upstream_pool;
+
+upstream_pool upstreams = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL};
+
+// call with the pool's lock held
+upstream_dest *upstream_find(const socks_dest *dest) {
+    for (upstream_dest *d = upstreams.dests; d; d = d->next) {
+        if (d->dest.port == dest->port && strcmp(d->dest.host, dest->host) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+int upstream_connect(const struct sockaddr *addr, socklen_t addr_len) {
+    int remote_fd = socket(addr->sa_family, SOCK_STREAM, 0);
 
-    if (nread < len) {
+    if (remote_fd < 0) {
         return -1;
     }
 
-    char *domainname = calloc(len + 1, sizeof(char));
-    memcpy(domainname, buf, len);
+    if (connect(remote_fd, addr, addr_len) < 0) {
+        close(remote_fd);
+        return -1;
+    }
 
-    uint16_t *buf16 = (uint16_t*)(buf + len);
-    uint16_t remote_port = buf16[0];
-    char port_s[6];
-    memset(port_s, 0, 6);
-    snprintf(port_s, 5, "%d", ntohs(remote_port));
+    return remote_fd;
+}
 
-    printf("connecting to %s:%s\n", domainname, port_s);
+int upstream_resolve(const socks_dest *dest, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    char port_s[6];
+    snprintf(port_s, sizeof(port_s), "%d", ntohs(dest->port));
 
     struct addrinfo hints, *results;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
-    int res = getaddrinfo(domainname, port_s, &hints, &results);
-    free(domainname);
+    int res = getaddrinfo(dest->host, port_s, &hints, &results);
 
     if (res != 0) {
         printf("getaddrinfo failed: %s\n", gai_strerror(res));
@@ -143,105 +281,321 @@ int socks_request_connect_domainname(int socket_fd, uint8_t *buf, size_t buf_len
     }
 
     int remote_fd = -1;
-    for(struct addrinfo *i = results; i != NULL; i = i->ai_next) {
-        remote_fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
-        if (remote_fd < 0) {
-            continue;
+    for (struct addrinfo *i = results; i != NULL; i = i->ai_next) {
+        remote_fd = upstream_connect(i->ai_addr, i->ai_addrlen);
+
+        if (remote_fd >= 0) {
+            memcpy(addr, i->ai_addr, i->ai_addrlen);
+            *addr_len = i->ai_addrlen;
+            break;
         }
+    }
 
-        printf("connecting to %s:%d\n", inet_ntoa(((struct sockaddr_in*)(i->ai_addr))->sin_addr), ntohs(((struct sockaddr_in*)(i->ai_addr))->sin_port));
+    freeaddrinfo(results);
 
-        if (connect(remote_fd, i->ai_addr, i->ai_addrlen) == 0) {
-            break;
+    return remote_fd;
+}
+
+// a spare the remote has since closed reads as end of stream
+bool upstream_alive(int remote_fd) {
+    uint8_t b;
+    ssize_t res = recv(remote_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    return res > 0 || (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int upstream_take(const socks_dest *dest) {
+    int remote_fd = -1;
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+
+    pthread_mutex_lock(&upstreams.lock);
+    upstream_dest *d = upstream_find(dest);
+    if (d) {
+        d->last_used = time(NULL);
+        while (remote_fd < 0 && d->num_spares) {
+            int spare = d->spares[--d->num_spares];
+            if (upstream_alive(spare)) {
+                remote_fd = spare;
+            } else {
+                close(spare);
+            }
         }
+        addr = d->addr;
+        addr_len = d->addr_len;
+        // top it back up
+        pthread_cond_signal(&upstreams.cond);
+    }
+    pthread_mutex_unlock(&upstreams.lock);
 
-        close(remote_fd);
-        remote_fd = -1;
+    if (remote_fd >= 0) {
+        return remote_fd;
     }
 
-    freeaddrinfo(results);
+    if (addr_len) {
+        remote_fd = upstream_connect((struct sockaddr*)&addr, addr_len);
+    }
+
+    if (remote_fd < 0) {
+        remote_fd = upstream_resolve(dest, &addr, &addr_len);
+    }
+
+    if (remote_fd < 0) {
+        return -1;
+    }
+
+    // remember where it went. looked up again since the refill thread may
+    //   have dropped it meanwhile
+    pthread_mutex_lock(&upstreams.lock);
+    d = upstream_find(dest);
+    if (!d) {
+        d = calloc(1, sizeof(upstream_dest));
+        d->dest = *dest;
+        d->next = upstreams.dests;
+        upstreams.dests = d;
+    }
+    d->addr = addr;
+    d->addr_len = addr_len;
+    d->last_used = time(NULL);
+    pthread_cond_signal(&upstreams.cond);
+    pthread_mutex_unlock(&upstreams.lock);
 
     return remote_fd;
 }
 
-int socks_request(int socket_fd, uint8_t *buf, size_t buf_len) {
-    ssize_t nread = lwip_read(socket_fd, buf, 4);
+void *upstream_refill(void *arg) {
+    pthread_mutex_lock(&upstreams.lock);
+    for (;;) {
+        time_t now = time(NULL);
+        upstream_dest *need = NULL;
+
+        for (upstream_dest **link = &upstreams.dests; *link; ) {
+            upstream_dest *d = *link;
+            if (now - d->last_used > upstream_idle_secs) {
+                for (size_t i = 0; i < d->num_spares; i++) {
+                    close(d->spares[i]);
+                }
+                *link = d->next;
+                free(d);
+                continue;
+            }
+            if (!need && d->addr_len && d->num_spares < upstream_spares) {
+                need = d;
+            }
+            link = &d->next;
+        }
+
+        if (!need) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += upstream_idle_secs;
+            pthread_cond_timedwait(&upstreams.cond, &upstreams.lock, &deadline);
+            continue;
+        }
 
-    if (nread < 4) {
+        socks_dest dest = need->dest;
+        struct sockaddr_storage addr = need->addr;
+        socklen_t addr_len = need->addr_len;
+        pthread_mutex_unlock(&upstreams.lock);
+
+        int remote_fd = upstream_connect((struct sockaddr*)&addr, addr_len);
+
+        pthread_mutex_lock(&upstreams.lock);
+        upstream_dest *d = upstream_find(&dest);
+        if (remote_fd < 0) {
+            // stop trying until a request finds it again
+            if (d) {
+                d->addr_len = 0;
+            }
+            continue;
+        }
+        if (d && d->num_spares < upstream_spares) {
+            d->spares[d->num_spares++] = remote_fd;
+        } else {
+            close(remote_fd);
+        }
+    }
+    pthread_mutex_unlock(&upstreams.lock);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// parses the request and connects to the destination it names, then
+//   passes on everything the client sent past the request. the connect reply
+//   is appended to reply either way. returns the remote, or -1
+int socks_connect(socks_conn *conn, uint8_t *reply, size_t *reply_len) {
+    socks_dest dest;
+    if (socks_request(conn, &dest) < 0) {
+        *reply_len += socks_request_reply(reply + *reply_len, -1);
+        printf("socks request failed\n");
         return -1;
     }
 
-    if (buf[0] != SOCKS_VERSION) {
+    printf("connecting to %s:%d\n", dest.host, ntohs(dest.port));
+
+    int remote_fd = upstream_take(&dest);
+    *reply_len += socks_request_reply(reply + *reply_len, remote_fd);
+
+    if (remote_fd >= 0 && write_all(remote_fd, conn->buf + conn->pos, conn->len - conn->pos) < 0) {
+        close(remote_fd);
         return -1;
     }
 
-    if (buf[1] != SOCKS_CMD_CONNECT) {
+    return remote_fd;
+}
+
+// returns the connected remote, with everything the client sent past its
+//   request already passed on to it, or -1
+int socks_handshake(socks_conn *conn) {
+    // method selection reply, then connect reply
+    uint8_t reply[12];
+    size_t reply_len = 0;
+
+    if (socks_greeting(conn) < 0) {
+        reply[0] = SOCKS_VERSION;
+        reply[1] = SOCKS_AUTH_NONE_ACCEPTABLE;
+        lwip_write(conn->fd, reply, 2);
+        printf("socks auth failed\n");
         return -1;
     }
 
-    // buf[2] is a reserved byte
+    reply[reply_len++] = SOCKS_VERSION;
+    reply[reply_len++] = SOCKS_AUTH_NOAUTH;
 
-    if (buf[3] == SOCKS_ADDR_IPV4) {
-        return socks_request_connect_ipv4(socket_fd, buf, buf_len);
+    if (conn->pos == conn->len) {
+        // the client is waiting for this before it sends the request
+        if (lwip_write(conn->fd, reply, reply_len) < (ssize_t)reply_len) {
+            return -1;
+        }
+        reply_len = 0;
     }
+    // otherwise the request came in the same flight, and both are answered
+    //   at once
+
+    int remote_fd = socks_connect(conn, reply, &reply_len);
 
-    if (buf[3] == SOCKS_ADDR_DOMAINNAME) {
-        return socks_request_connect_domainname(socket_fd, buf, buf_len);
+    if (lwip_write(conn->fd, reply, reply_len) < (ssize_t)reply_len) {
+        printf("socks request reply failed\n");
+        if (remote_fd >= 0) {
+            close(remote_fd);
+        }
+        return -1;
     }
 
-    return -1;
+    return remote_fd;
 }
 
-int socks_request_reply(int client_fd, int remote_fd, uint8_t *buf, size_t buf_len) {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    int res = getsockname(remote_fd, (struct sockaddr*)&addr, &len);
+void *socks_handshake_run(void *conn_v) {
+    socks_conn *conn = (socks_conn*)conn_v;
+    int remote_fd = socks_handshake(conn);
 
-    if (res < 0) {
-        return -1;
+    if (remote_fd < 0) {
+        lwip_close(conn->fd);
+    } else {
+        quiet_lwip_splice(remote_fd, conn->fd);
     }
 
-    uint32_t *buf32 = (uint32_t*)buf;
-    uint16_t *buf16 = (uint16_t*)buf;
+    free(conn);
+    return NULL;
+}
 
-    buf[0] = SOCKS_VERSION;
-    buf[1] = SOCKS_CONN_SUCCEEDED;
-    buf[2] = 0;
-    buf[3] = SOCKS_ADDR_IPV4;
+/* ------------------------------------------------------------------------- */
+// tunnels. each stream a client opens carries one socks connection, and the
+//   stream's header is the client's whole first flight: greeting, request
+//   and any data after them. the client answers the method selection
+//   itself, so only the connect reply goes back
+
+typedef struct {
+    quiet_lwip_mux_stream *stream;
+    socks_conn conn;
+} tunnel_open;
+
+void *tunnel_handshake_run(void *open_v) {
+    tunnel_open *open = (tunnel_open*)open_v;
+    socks_conn *conn = &open->conn;
+    uint8_t reply[10];
+    size_t reply_len = 0;
+    int remote_fd = -1;
+
+    if (socks_greeting(conn) < 0) {
+        printf("socks auth failed\n");
+        reply_len = socks_request_reply(reply, -1);
+    } else {
+        remote_fd = socks_connect(conn, reply, &reply_len);
+    }
+
+    if (remote_fd < 0) {
+        quiet_lwip_mux_refuse(open->stream, reply, reply_len);
+    } else {
+        quiet_lwip_mux_accept(open->stream, remote_fd, 0, reply, reply_len);
+    }
 
-    buf32[1] = htonl(addr.sin_addr.s_addr);
-    buf16[4] = htons(addr.sin_port);
+    free(open);
+    return NULL;
+}
 
-    ssize_t nwritten = lwip_write(client_fd, buf, 10);
+// on the tunnel's thread, so the handshake goes elsewhere
+void tunnel_stream_open(quiet_lwip_mux_stream *stream, const uint8_t *hdr, size_t hdr_len, void *arg) {
+    uint8_t reply[10];
 
-    if (nwritten < 10) {
-        return -1;
+    if (hdr_len > socks_buf_len) {
+        quiet_lwip_mux_refuse(stream, reply, socks_request_reply(reply, -1));
+        return;
     }
 
-    return 0;
+    tunnel_open *open = calloc(1, sizeof(tunnel_open));
+    open->stream = stream;
+    open->conn.fd = -1;
+    memcpy(open->conn.buf, hdr, hdr_len);
+    open->conn.len = hdr_len;
+
+    pthread_t handshake;
+    if (pthread_create(&handshake, NULL, tunnel_handshake_run, open) != 0) {
+        quiet_lwip_mux_refuse(stream, reply, socks_request_reply(reply, -1));
+        free(open);
+        return;
+    }
+    pthread_detach(handshake);
 }
 
-int socks_request_reply_failed(int client_fd, uint8_t *buf, size_t buf_len) {
-    uint32_t *buf32 = (uint32_t*)buf;
-    uint16_t *buf16 = (uint16_t*)buf;
+void *tunnel_run(void *fd_v) {
+    int tunnel_fd = (int)(intptr_t)fd_v;
+    quiet_lwip_mux *mux = quiet_lwip_mux_create(tunnel_fd, false, NULL, tunnel_stream_open, NULL);
 
-    buf[0] = SOCKS_VERSION;
-    buf[1] = SOCKS_CONN_FAILED;
-    buf[2] = 0;
-    buf[3] = SOCKS_ADDR_IPV4;
-    buf32[1] = 0;
-    buf16[5] = 0;
+    quiet_lwip_mux_wait(mux);
 
-    ssize_t nwritten = lwip_write(client_fd, buf, 10);
+    quiet_lwip_mux_stats stats;
+    quiet_lwip_mux_get_stats(mux, &stats);
+    printf("tunnel closed after %llu streams\n", (unsigned long long)stats.opened);
+    quiet_lwip_mux_destroy(mux);
+    return NULL;
+}
 
-    if (nwritten < 10) {
-        return -1;
+void *tunnel_listen_run(void *listen_fd_v) {
+    int listen_fd = (int)(intptr_t)listen_fd_v;
+
+    for (;;) {
+        int tunnel_fd = lwip_accept(listen_fd, NULL, NULL);
+        if (tunnel_fd < 0) {
+            continue;
+        }
+
+        printf("received tunnel\n");
+
+        pthread_t tunnel;
+        if (pthread_create(&tunnel, NULL, tunnel_run, (void*)(intptr_t)tunnel_fd) != 0) {
+            lwip_close(tunnel_fd);
+            continue;
+        }
+        pthread_detach(tunnel);
     }
 
-    return 0;
+    return NULL;
 }
 
-int open_recv(const char *addr) {
+/* ------------------------------------------------------------------------- */
+
+int open_recv(const char *addr, int port) {
     int socket_fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
 
     if (socket_fd < 0) {
@@ -252,7 +606,7 @@ int open_recv(const char *addr) {
     struct lwip_sockaddr_in *local_addr = calloc(1, sizeof(struct lwip_sockaddr_in));
     local_addr->sin_family = AF_INET;
     local_addr->sin_addr.s_addr = inet_addr(addr);
-    local_addr->sin_port = htons(local_port);
+    local_addr->sin_port = htons(port);
 
     int res = lwip_bind(socket_fd, (struct lwip_sockaddr *)local_addr, sizeof(struct lwip_sockaddr_in));
     free(local_addr);
@@ -262,7 +616,9 @@ int open_recv(const char *addr) {
         return -1;
     }
 
-    res = lwip_listen(socket_fd, 1);
+    // the client keeps a few connections open ahead of time, so several
+    //   can arrive at once
+    res = lwip_listen(socket_fd, 8);
 
     if (res < 0) {
         printf("listen failed\n");
@@ -316,46 +672,18 @@ int main(int argc, char **argv) {
     quiet_lwip_portaudio_audio_threads *audio_threads =
         quiet_lwip_portaudio_start_audio_threads(interface);
 
-    crossbar client_crossbar;
-    crossbar remote_crossbar;
-    crossbar_init(&client_crossbar);
-    crossbar_init(&remote_crossbar);
-
-    relay_t client_relay = {
-        .agent = agent_lwip,
-        .other_agent = agent_native,
-        .incoming = &client_crossbar,
-        .outgoing = &remote_crossbar,
-        .read = _lwip_read,
-        .write = _lwip_write,
-        .select = lwip_select,
-        .other_shutdown = shutdown,
-        .get_errno = lwip_errno,
-    };
-
-    relay_t remote_relay = {
-        .agent = agent_native,
-        .other_agent = agent_lwip,
-        .incoming = &remote_crossbar,
-        .outgoing = &client_crossbar,
-        .read = read,
-        .write = write,
-        .select = select,
-        .other_shutdown = lwip_shutdown,
-        .get_errno = native_errno,
-    };
-
-    start_relay_thread(&client_relay);
-    start_relay_thread(&remote_relay);
-
-    int recv_socket = open_recv(ipaddr_s);
-    if (recv_socket < 0) {
+    int recv_socket = open_recv(ipaddr_s, local_port);
+    int tunnel_socket = open_recv(ipaddr_s, tunnel_port);
+    if (recv_socket < 0 || tunnel_socket < 0) {
         printf("couldn't open socket for listening\n");
         exit(1);
     }
 
-    size_t buf_len = 512;
-    uint8_t *buf = calloc(buf_len, sizeof(uint8_t));
+    pthread_t tunnels;
+    pthread_create(&tunnels, NULL, tunnel_listen_run, (void*)(intptr_t)tunnel_socket);
+
+    pthread_t refill;
+    pthread_create(&refill, NULL, upstream_refill, NULL);
 
     for (;;) {
         struct lwip_sockaddr_in recv_from;
@@ -369,47 +697,20 @@ int main(int argc, char **argv) {
 
         printf("received connection from %s\n", inet_ntoa(local_domain));
 
-        int res = socks_auth(conn_fd, buf, buf_len);
-
-        if (res < 0) {
-            printf("socks auth failed\n");
-            lwip_close(conn_fd);
-            continue;
-        }
-
-        res = socks_auth_reply(conn_fd, buf, buf_len);
-
-        if (res < 0) {
-            printf("socks auth reply failed\n");
-            lwip_close(conn_fd);
-            continue;
-        }
-
-        int remote_fd = socks_request(conn_fd, buf, buf_len);
-
-        if (remote_fd < 0) {
-            socks_request_reply_failed(conn_fd, buf, buf_len);
-            lwip_close(conn_fd);
-            printf("socks request failed\n");
-            continue;
-        }
-
-        res = socks_request_reply(conn_fd, remote_fd, buf, buf_len);
-
-        if (res < 0) {
-            printf("socks request reply failed\n");
+        // handshakes run side by side, so one waiting on the link or on a
+        //   slow remote doesn't hold up the rest
+        socks_conn *conn = calloc(1, sizeof(socks_conn));
+        conn->fd = conn_fd;
+        pthread_t handshake;
+        if (pthread_create(&handshake, NULL, socks_handshake_run, conn) != 0) {
             lwip_close(conn_fd);
+            free(conn);
             continue;
         }
-
-        relay_conn *conn = relay_conn_create(remote_fd, conn_fd, 1 << 13);
-
-        crossbar_add_for_reading(&client_crossbar, conn);
-        crossbar_add_for_reading(&remote_crossbar, conn);
+        pthread_detach(handshake);
     }
 
     quiet_lwip_portaudio_stop_audio_threads(audio_threads);
-    free(buf);
     quiet_lwip_portaudio_destroy(interface);
 
     Pa_Terminate();
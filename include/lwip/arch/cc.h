@@ -63,6 +63,7 @@ typedef uint16_t   u16_t;
 typedef int16_t    s16_t;
 typedef uint32_t   u32_t;
 typedef int32_t    s32_t;
+typedef uint64_t   u64_t;
 
 typedef uintptr_t  mem_ptr_t;
 
@@ -88,6 +89,9 @@ typedef uintptr_t  mem_ptr_t;
 #define PACK_STRUCT_BEGIN
 #define PACK_STRUCT_END
 
+/* Storage class for per-thread variables */
+#define LWIP_THREAD_LOCAL __thread
+
 /* prototypes for printf() and abort() */
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,6 +107,11 @@ typedef uintptr_t  mem_ptr_t;
 
 #define LWIP_RAND() ((u32_t)rand())
 
+/* Vectorized checksums, see chksum_arch.c */
+#include "arch/chksum.h"
+#define LWIP_CHKSUM lwip_arch_chksum
+#define LWIP_CHKSUM_COPY(dst, src, len) lwip_arch_chksum_copy(dst, src, len)
+
 struct sio_status_s;
 typedef struct sio_status_s sio_status_t;
 #define sio_fd_t sio_status_t*
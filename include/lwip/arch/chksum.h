@@ -0,0 +1,19 @@
+#ifndef LWIP_ARCH_CHKSUM_H
+#define LWIP_ARCH_CHKSUM_H
+
+/* Internet checksum kernels for LWIP_CHKSUM and LWIP_CHKSUM_COPY. The
+ * widest kernel the CPU supports (SSE2 or AVX2 on x86, NEON on ARM) is
+ * picked on first use. Both return the same non-inverted sum as
+ * lwip_standard_chksum() for data at any alignment. */
+u16_t lwip_arch_chksum(const void *dataptr, int len);
+u16_t lwip_arch_chksum_copy(void *dst, const void *src, u16_t len);
+
+/* Name of the kernel in use */
+const char *lwip_arch_chksum_kernel(void);
+/* Switch kernels by name ("scalar", "sse2", "avx2", "neon"), or back to the
+ * widest one with NULL. Returns 0 if the kernel isn't built in or the CPU
+ * can't run it. Meant for benchmarks: it is not synchronized with
+ * checksums in progress on other threads. */
+u8_t lwip_arch_chksum_select(const char *name);
+
+#endif /* LWIP_ARCH_CHKSUM_H */
@@ -44,8 +44,21 @@ typedef struct sys_sem * sys_sem_t;
 #define sys_sem_valid(sem) (((sem) != NULL) && (*(sem) != NULL))
 #define sys_sem_set_invalid(sem) do { if((sem) != NULL) { *(sem) = NULL; }}while(0)
 
-/* let sys.h use binary semaphores for mutexes */
-#define LWIP_COMPAT_MUTEX 1
+struct sys_mutex;
+typedef struct sys_mutex * sys_mutex_t;
+#define sys_mutex_valid(mutex) (((mutex) != NULL) && (*(mutex) != NULL))
+#define sys_mutex_set_invalid(mutex) do { if((mutex) != NULL) { *(mutex) = NULL; }}while(0)
+
+/* Counters every mutex keeps, e.g. to see how contended the core lock is */
+struct sys_mutex_stats {
+  uint64_t acquisitions;
+  /* acquisitions that found the mutex taken and had to wait for it */
+  uint64_t contended;
+  /* wall clock time spent waiting in those */
+  uint64_t wait_ns;
+};
+
+void sys_mutex_stats(sys_mutex_t *mutex, struct sys_mutex_stats *stats);
 
 struct sys_mbox;
 typedef struct sys_mbox *sys_mbox_t;
@@ -55,5 +68,22 @@ typedef struct sys_mbox *sys_mbox_t;
 struct sys_thread;
 typedef struct sys_thread * sys_thread_t;
 
+/* Have fn(arg) called when the calling thread exits, e.g. to hand back
+   memory a thread has been keeping to itself. Handlers run in the order
+   they were added. Returns ERR_MEM if the handler can't be recorded. */
+err_t sys_thread_atexit(void (*fn)(void *arg), void *arg);
+
+/* Switch sys_now(), sys_jiffies() and all timed waits from the wall clock to
+   a virtual clock that only moves through sys_clock_advance(). Lets
+   simulations run faster than real time without distorting lwip's timers. */
+void sys_clock_set_virtual(int enable);
+
+/* Let the stack settle, then move virtual time forward and wake any timed
+   waits that have expired. */
+void sys_clock_advance(uint64_t usec);
+
+/* Microseconds on whichever clock is in effect */
+uint64_t sys_clock_now_us(void);
+
 #endif /* LWIP_ARCH_SYS_ARCH_H */
 
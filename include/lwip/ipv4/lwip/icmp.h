@@ -101,6 +101,9 @@ PACK_STRUCT_END
 void icmp_input(struct pbuf *p, struct netif *inp);
 void icmp_dest_unreach(struct pbuf *p, enum icmp_dur_type t);
 void icmp_time_exceeded(struct pbuf *p, enum icmp_te_type t);
+#if IP_FORWARD
+void icmp_frag_needed(struct pbuf *p, u16_t mtu);
+#endif /* IP_FORWARD */
 
 #endif /* LWIP_ICMP */
 
@@ -0,0 +1,32 @@
+/**
+ * @file
+ * Path MTU cache (RFC 1191)
+ */
+
+#ifndef __LWIP_IP_PMTU_H__
+#define __LWIP_IP_PMTU_H__
+
+#include "lwip/opt.h"
+#include "lwip/netif.h"
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if IP_PMTU_DISCOVERY
+/** The path MTU timer interval in milliseconds. */
+#define IP_PMTU_TMR_INTERVAL 60000
+
+void ip_pmtu_tmr(void);
+u16_t ip_pmtu_get(ip_addr_t *dest, struct netif *netif);
+u16_t ip_pmtu_update(ip_addr_t *dest, u16_t mtu);
+#else /* IP_PMTU_DISCOVERY */
+#define ip_pmtu_get(dest, netif) ((netif)->mtu)
+#endif /* IP_PMTU_DISCOVERY */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LWIP_IP_PMTU_H__ */
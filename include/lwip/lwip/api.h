@@ -127,6 +127,13 @@ struct raw_pcb;
 struct netconn;
 struct api_msg_msg;
 
+/** One of several buffers written by netconn_write_vectors_partly().
+    Laid out like struct iovec so that sockets can pass those through. */
+struct netvector {
+  const void *ptr;
+  size_t len;
+};
+
 /** A callback prototype to inform about events for a netconn */
 typedef void (* netconn_callback)(struct netconn *, enum netconn_evt, u16_t len);
 
@@ -181,6 +188,10 @@ struct netconn {
   /** flags holding more netconn-internal state, see NETCONN_FLAG_* defines */
   u8_t flags;
 #if LWIP_TCP
+  /** TCP: the peer's FIN has been handed to the application. Receives then
+      return ERR_CLSD at once, while sends carry on (half close). Only
+      touched by the application thread. */
+  u8_t fin_received;
   /** TCP: when data passed to netconn_write doesn't fit into the send buffer,
       this temporarily stores how much is already sent. */
   size_t write_offset;
@@ -235,10 +246,19 @@ void    netconn_recved(struct netconn *conn, u32_t length);
 err_t   netconn_sendto(struct netconn *conn, struct netbuf *buf,
                        ip_addr_t *addr, u16_t port);
 err_t   netconn_send(struct netconn *conn, struct netbuf *buf);
+err_t   netconn_send_batch(struct netconn *conn, struct netbuf *bufs, u16_t count,
+                           u16_t *sent);
 err_t   netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
                              u8_t apiflags, size_t *bytes_written);
+err_t   netconn_write_vectors_partly(struct netconn *conn, const struct netvector *vectors,
+                                     u16_t vectorcnt, u8_t apiflags, size_t *bytes_written);
 #define netconn_write(conn, dataptr, size, apiflags) \
           netconn_write_partly(conn, dataptr, size, apiflags, NULL)
+#if LWIP_SUPPORT_CUSTOM_PBUF
+err_t   netconn_write_zc(struct netconn *conn, const void *dataptr, size_t size,
+                         u8_t apiflags, size_t *bytes_written,
+                         void (*done)(void *arg), void *arg);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
 err_t   netconn_close(struct netconn *conn);
 err_t   netconn_shutdown(struct netconn *conn, u8_t shut_rx, u8_t shut_tx);
 
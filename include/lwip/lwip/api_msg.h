@@ -84,14 +84,31 @@ struct api_msg_msg {
       u16_t *port;
       u8_t local;
     } ad;
+    /** used for do_send_batch */
+    struct {
+      struct netbuf *bufs;
+      u16_t count;
+      u16_t sent;
+    } bb;
     /** used for do_write */
     struct {
+      /** the buffer being written */
       const void *dataptr;
       size_t len;
+      /** buffers still to write after this one */
+      const struct netvector *vector;
+      u16_t vector_cnt;
+      /** bytes written from the buffers before this one */
+      size_t offset;
       u8_t apiflags;
 #if LWIP_SO_SNDTIMEO
       u32_t time_started;
 #endif /* LWIP_SO_SNDTIMEO */
+#if LWIP_PBUF_STAMP
+      u64_t stamp;
+#endif /* LWIP_PBUF_STAMP */
+      /** tracks the data when it is sent without copying, else NULL */
+      struct tcp_zc *zc;
     } w;
     /** used for do_recv */
     struct {
@@ -152,6 +169,7 @@ void do_connect         ( struct api_msg_msg *msg);
 void do_disconnect      ( struct api_msg_msg *msg);
 void do_listen          ( struct api_msg_msg *msg);
 void do_send            ( struct api_msg_msg *msg);
+void do_send_batch      ( struct api_msg_msg *msg);
 void do_recv            ( struct api_msg_msg *msg);
 void do_write           ( struct api_msg_msg *msg);
 void do_getaddr         ( struct api_msg_msg *msg);
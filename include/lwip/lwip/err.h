@@ -60,7 +60,8 @@ typedef s8_t err_t;
 #define ERR_USE        -8    /* Address in use.          */
 #define ERR_ISCONN     -9    /* Already connected.       */
 
-#define ERR_IS_FATAL(e) ((e) < ERR_ISCONN)
+/* a datagram too long for its path leaves the connection usable */
+#define ERR_IS_FATAL(e) (((e) < ERR_ISCONN) && ((e) != ERR_MSGSIZE))
 
 #define ERR_ABRT       -10   /* Connection aborted.      */
 #define ERR_RST        -11   /* Connection reset.        */
@@ -71,6 +72,8 @@ typedef s8_t err_t;
 
 #define ERR_IF         -15   /* Low-level netif error    */
 
+#define ERR_MSGSIZE    -16   /* Too long to send whole.  */
+
 
 #ifdef LWIP_DEBUG
 extern const char *lwip_strerr(err_t err);
@@ -66,16 +66,11 @@ typedef size_t mem_size_t;
 #endif
 #else /* MEM_LIBC_MALLOC */
 
-/* MEM_SIZE would have to be aligned, but using 64000 here instead of
- * 65535 leaves some room for alignment...
+/* the heap may be given any size at run time (see lwip/sizes.h), so
+ * offsets into it can't be assumed to fit 16 bits
  */
-#if MEM_SIZE > 64000L
 typedef u32_t mem_size_t;
 #define MEM_SIZE_F U32_F
-#else
-typedef u16_t mem_size_t;
-#define MEM_SIZE_F U16_F
-#endif /* MEM_SIZE > 64000 */
 
 #if MEM_USE_POOLS
 /** mem_init is not used when using pools instead of a heap */
@@ -87,6 +82,23 @@ typedef u16_t mem_size_t;
 /* lwIP alternative malloc */
 void  mem_init(void);
 void *mem_trim(void *mem, mem_size_t size);
+
+/** How the heap's memory is used at one moment. With the first-fit heap,
+ * size is the whole heap; with MEM_SLAB it is what has been taken from the
+ * C library so far. */
+struct mem_usage {
+  /** most the heap may take: lwip_sizes.mem_size */
+  mem_size_t limit;
+  /** memory the heap holds */
+  mem_size_t size;
+  /** part of size handed out to callers, with per-allocation overhead and
+   *  rounding */
+  mem_size_t reserved;
+  /** the largest request that would currently succeed */
+  mem_size_t largest_free;
+};
+
+void  mem_usage_get(struct mem_usage *usage);
 #endif /* MEM_USE_POOLS */
 void *mem_malloc(mem_size_t size);
 void *mem_calloc(mem_size_t count, mem_size_t size);
@@ -184,6 +184,11 @@ struct netif {
 #endif /* LWIP_NETIF_HOSTNAME */
   /** maximum transfer unit (in bytes) */
   u16_t mtu;
+#if LWIP_ARP
+  /** how the driver resolves addresses on this interface, for the
+      LWIP_HOOK_ETHARP_* hooks. NULL for plain ARP */
+  void *arp_policy;
+#endif /* LWIP_ARP */
   /** number of bytes used in hwaddr */
   u8_t hwaddr_len;
   /** link level hardware address of this interface */
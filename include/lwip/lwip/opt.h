@@ -180,6 +180,33 @@
 #define MEM_USE_POOLS_TRY_BIGGER_POOL   0
 #endif
 
+/**
+ * MEM_SLAB==1: Replace the first-fit heap behind mem_malloc() with a
+ * size-class slab allocator. Requests are rounded up to one of a fixed set
+ * of sizes and served from per-size free lists in pages taken from the C
+ * library; larger requests get pages of their own. The pages and large
+ * allocations together stay within lwip_sizes.mem_size. Allocation cost no
+ * longer depends on how fragmented the heap is, at the price of the
+ * rounding and of partly used pages. mem_trim() leaves allocations as
+ * they are.
+ */
+#ifndef MEM_SLAB
+#define MEM_SLAB                        0
+#endif
+
+/**
+ * MEM_SLAB_CACHE: with MEM_SLAB, the number of freed objects of each size
+ * that a thread keeps for itself (at most a page's worth), so that
+ * allocations and frees on the same thread mostly don't take the
+ * allocator's mutex. Objects move between the cache and the shared lists
+ * half a cache at a time. Caches are handed back when their thread exits
+ * and whenever the shared lists run dry (needs sys_thread_atexit() and
+ * LWIP_THREAD_LOCAL from the port). 0 disables the caches.
+ */
+#ifndef MEM_SLAB_CACHE
+#define MEM_SLAB_CACHE                  0
+#endif
+
 /**
  * MEMP_USE_CUSTOM_POOLS==1: whether to include a user file lwippools.h
  * that defines additional pools beyond the "standard" ones required
@@ -313,7 +340,7 @@
  * The formula expects settings to be either '0' or '1'.
  */
 #ifndef MEMP_NUM_SYS_TIMEOUT
-#define MEMP_NUM_SYS_TIMEOUT            (LWIP_TCP + IP_REASSEMBLY + LWIP_ARP + (2*LWIP_DHCP) + LWIP_AUTOIP + LWIP_IGMP + LWIP_DNS + PPP_SUPPORT)
+#define MEMP_NUM_SYS_TIMEOUT            (LWIP_TCP + IP_REASSEMBLY + LWIP_ARP + (2*LWIP_DHCP) + LWIP_AUTOIP + LWIP_IGMP + LWIP_DNS + PPP_SUPPORT + IP_PMTU_DISCOVERY)
 #endif
 
 /**
@@ -332,6 +359,44 @@
 #define MEMP_NUM_NETCONN                100
 #endif
 
+/**
+ * MEMP_GROW_CONNECTIONS==1: When the pools of netconns or of raw, UDP or
+ * TCP PCBs run out, take MEMP_GROW_CHUNK more elements from the C library
+ * heap rather than failing. The MEMP_NUM_* values for those pools are then
+ * only what is set aside up front, and the number of connections is bounded
+ * by memory. Grown elements stay in their pool once freed.
+ */
+#ifndef MEMP_GROW_CONNECTIONS
+#define MEMP_GROW_CONNECTIONS           1
+#endif
+
+/**
+ * MEMP_GROW_CHUNK: the number of elements a pool grows by at once.
+ */
+#ifndef MEMP_GROW_CHUNK
+#define MEMP_GROW_CHUNK                 16
+#endif
+
+/**
+ * MEMP_CACHE: the number of freed elements of each pool that a thread keeps
+ * for itself, so that a thread allocating and freeing pbufs, netbufs or
+ * segments mostly doesn't contend with the others for the pools. Elements
+ * move between a thread's cache and its pool half a cache at a time. A
+ * cache is handed back when its thread exits and when its pool runs dry.
+ * A pool's caches hold at most a quarter of the pool each and half of it
+ * between them, and a thread that finds room for fewer than 4 more
+ * elements uses the pool directly. Caches of fewer than 4 elements aren't
+ * worth their refills, so pools with fewer than 16 elements aren't cached.
+ * Elements in caches count as used in the pool's stats. Each element gets
+ * a header recording which thread's cache it went out through, so that
+ * frees from another thread can be counted. Needs sys_thread_atexit() and
+ * LWIP_THREAD_LOCAL from the port.
+ * 0 disables the caches.
+ */
+#ifndef MEMP_CACHE
+#define MEMP_CACHE                      0
+#endif
+
 /**
  * MEMP_NUM_TCPIP_MSG_API: the number of struct tcpip_msg, which are used
  * for callback/timeout API communication. 
@@ -427,12 +492,23 @@
 #endif
 
 /**
- * ARP_TABLE_SIZE: Number of active MAC-IP address pairs cached.
+ * ARP_TABLE_SIZE: Number of active MAC-IP address pairs cached. The table
+ * starts out with this many entries and grows by as many at a time, up to
+ * ARP_TABLE_MAX.
  */
 #ifndef ARP_TABLE_SIZE
 #define ARP_TABLE_SIZE                  10
 #endif
 
+/**
+ * ARP_TABLE_MAX: Most MAC-IP address pairs the ARP table grows to. Once it
+ * is full, the least recently used entries make way for new ones. The
+ * limit may be lowered at run time through lwip_sizes.arp_table_max.
+ */
+#ifndef ARP_TABLE_MAX
+#define ARP_TABLE_MAX                   ARP_TABLE_SIZE
+#endif
+
 /**
  * ARP_QUEUEING==1: Multiple outgoing packets are queued during hardware address
  * resolution. By default, only the most recent packet is queued per IP address.
@@ -444,6 +520,15 @@
 #define ARP_QUEUEING                    0
 #endif
 
+/**
+ * ARP_QUEUE_LEN: With ARP_QUEUEING, the most packets queued on one address
+ * while it is being resolved. The oldest is dropped to make room for a new
+ * one. May be changed at run time through lwip_sizes.arp_queue_len.
+ */
+#ifndef ARP_QUEUE_LEN
+#define ARP_QUEUE_LEN                   3
+#endif
+
 /**
  * ETHARP_TRUST_IP_MAC==1: Incoming IP packets cause the ARP table to be
  * updated with the source MAC and IP addresses supplied in the packet.
@@ -573,6 +658,38 @@
 #define IP_FRAG_MAX_MTU                 1500
 #endif
 
+/**
+ * IP_PMTU_DISCOVERY==1: Learn the path MTU to destinations from ICMP
+ * "fragmentation needed" messages (RFC 1191). TCP then sends its segments
+ * with DF set and sizes them to the path, and UDP sockets that ask not to
+ * fragment size their datagrams to it.
+ */
+#ifndef IP_PMTU_DISCOVERY
+#define IP_PMTU_DISCOVERY               0
+#endif
+
+/**
+ * IP_PMTU_TABLE_SIZE: Number of destinations whose path MTU is remembered.
+ */
+#ifndef IP_PMTU_TABLE_SIZE
+#define IP_PMTU_TABLE_SIZE              8
+#endif
+
+/**
+ * IP_PMTU_MAXAGE: Minutes a learned path MTU is kept before the path is
+ * tried at the interface's MTU again (RFC 1191 suggests 10).
+ */
+#ifndef IP_PMTU_MAXAGE
+#define IP_PMTU_MAXAGE                  10
+#endif
+
+/**
+ * IP_PMTU_MIN: Smallest path MTU believed, whatever a router reports.
+ */
+#ifndef IP_PMTU_MIN
+#define IP_PMTU_MIN                     68
+#endif
+
 /**
  * IP_DEFAULT_TTL: Default value for Time-To-Live used by transport layers.
  */
@@ -1065,7 +1182,7 @@
  * explicit window update
  */
 #ifndef TCP_WND_UPDATE_THRESHOLD
-#define TCP_WND_UPDATE_THRESHOLD   (TCP_WND / 4)
+#define TCP_WND_UPDATE_THRESHOLD   (lwip_sizes.tcp_wnd / 4)
 #endif
 
 /**
@@ -1498,6 +1615,37 @@
 #define SO_REUSE_RXTOALL                0
 #endif
 
+/**
+ * LWIP_SENDMMSG_BATCH: Number of datagrams lwip_sendmmsg() hands to the
+ * tcpip thread per message. Each one takes a struct netbuf on the stack of
+ * the calling thread.
+ */
+#ifndef LWIP_SENDMMSG_BATCH
+#define LWIP_SENDMMSG_BATCH             16
+#endif
+
+/**
+ * LWIP_SOCKET_MAX: Upper bound on the number of sockets open at once. The
+ * socket table grows in blocks as sockets are opened, so this only costs
+ * one pointer per block until it is used. Must be a multiple of 64 and at
+ * most 1 << 16.
+ */
+#ifndef LWIP_SOCKET_MAX
+#define LWIP_SOCKET_MAX                 65536
+#endif
+
+/**
+ * LWIP_SOCKET_GENERATION_BITS: Number of bits above the table index in each
+ * socket descriptor that hold the generation of its slot, so that a
+ * descriptor used after it was closed fails with EBADF instead of reaching
+ * whichever socket took the slot next. With 0, descriptors are dense small
+ * integers that fit in an fd_set; with more, they don't, and lwip_select()
+ * can't be used. At most 14.
+ */
+#ifndef LWIP_SOCKET_GENERATION_BITS
+#define LWIP_SOCKET_GENERATION_BITS     0
+#endif
+
 /*
    ----------------------------------------
    ---------- Statistics options ----------
@@ -1841,6 +1989,16 @@
 #define LWIP_CHECKSUM_ON_COPY           0
 #endif
 
+/**
+ * LWIP_PBUF_STAMP==1: give struct pbuf a stamp field holding the time, in
+ * microseconds, at which the packet passed its last traced stage. The core
+ * fills it from LWIP_STAMP_NOW() when data enters through the netconn API
+ * and reports each stage it passes to LWIP_HOOK_STAGE().
+ */
+#ifndef LWIP_PBUF_STAMP
+#define LWIP_PBUF_STAMP                 0
+#endif
+
 /*
    ---------------------------------------
    ---------- Hook options ---------------
@@ -1869,6 +2027,22 @@
  * that case, ip_route() continues as normal.
  */
 
+/**
+ * LWIP_STAMP_NOW():
+ * - only used with LWIP_PBUF_STAMP
+ * - called from netconn_write_partly() and netconn_send()
+ * Returns the current time in microseconds to stamp outgoing data with, or 0
+ * to leave it unstamped.
+ */
+
+/**
+ * LWIP_HOOK_STAGE(stage, pbuf):
+ * - only used with LWIP_PBUF_STAMP
+ * - stage: one of the PBUF_STAGE_* values in pbuf.h
+ * - pbuf: the packet, whose stamp field holds the time of its previous stage
+ *   or 0. The hook is expected to update the stamp.
+ */
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
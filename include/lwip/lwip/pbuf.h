@@ -75,6 +75,8 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates this packet must not be fragmented on its way (IP DF flag) */
+#define PBUF_FLAG_DF        0x40U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -107,8 +109,29 @@ struct pbuf {
    * the stack itself, or pbuf->next pointers from a chain.
    */
   u16_t ref;
+
+#if LWIP_PBUF_STAMP
+  /** time of the last traced stage, in microseconds, or 0 if untraced */
+  u64_t stamp;
+#endif /* LWIP_PBUF_STAMP */
 };
 
+#if LWIP_PBUF_STAMP
+/** stages reported to LWIP_HOOK_STAGE */
+/** a tcp segment or udp datagram is handed to ip */
+#define PBUF_STAGE_OUTPUT   0
+/** received data is handed to the application by the socket layer */
+#define PBUF_STAGE_READ     1
+
+#define PBUF_STAMP_SET(p, t) ((p)->stamp = (t))
+#define PBUF_STAMP_COPY(to, from) ((to)->stamp = (from)->stamp)
+#define PBUF_STAGE(stage, p) LWIP_HOOK_STAGE(stage, p)
+#else /* LWIP_PBUF_STAMP */
+#define PBUF_STAMP_SET(p, t)
+#define PBUF_STAMP_COPY(to, from)
+#define PBUF_STAGE(stage, p)
+#endif /* LWIP_PBUF_STAMP */
+
 #if LWIP_SUPPORT_CUSTOM_PBUF
 /** Prototype for a function to free a custom pbuf */
 typedef void (*pbuf_free_custom_fn)(struct pbuf *p);
@@ -164,6 +187,8 @@ struct pbuf *pbuf_coalesce(struct pbuf *p, pbuf_layer layer);
 #if LWIP_CHECKSUM_ON_COPY
 err_t pbuf_fill_chksum(struct pbuf *p, u16_t start_offset, const void *dataptr,
                        u16_t len, u16_t *chksum);
+err_t pbuf_take_chksum(struct pbuf *buf, const void *dataptr, u16_t len,
+                       u16_t *chksum);
 #endif /* LWIP_CHECKSUM_ON_COPY */
 
 u8_t pbuf_get_at(struct pbuf* p, u16_t offset);
@@ -0,0 +1,57 @@
+/**
+ * @file
+ * Sizes of the stack's memory and queues that a port can choose at run time
+ */
+
+#ifndef __LWIP_SIZES_H__
+#define __LWIP_SIZES_H__
+
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Sizes the stack is built with. lwip_sizes starts out with the values from
+ * opt.h/lwipopts.h and may be changed before lwip_init() (or tcpip_init())
+ * so that one build can serve very different memory budgets. The
+ * compile-time options remain the defaults and are what the sanity checks
+ * in init.c look at. */
+struct lwip_sizes {
+  /** MEM_SIZE: bytes in the heap */
+  mem_size_t mem_size;
+  /** MEMP_NUM_*, PBUF_POOL_SIZE: elements in each pool, indexed by memp_t.
+   *  Ignored with MEMP_SEPARATE_POOLS, whose pools are laid out at compile
+   *  time. */
+  u16_t memp_num[MEMP_MAX];
+  /** TCPIP_MBOX_SIZE */
+  int tcpip_mbox_size;
+  /** DEFAULT_RAW_RECVMBOX_SIZE, DEFAULT_UDP_RECVMBOX_SIZE,
+   *  DEFAULT_TCP_RECVMBOX_SIZE and DEFAULT_ACCEPTMBOX_SIZE */
+  int raw_recvmbox_size;
+  int udp_recvmbox_size;
+  int tcp_recvmbox_size;
+  int acceptmbox_size;
+  /** ARP_TABLE_MAX, which this may lower but not raise, and ARP_QUEUE_LEN */
+  u16_t arp_table_max;
+  u16_t arp_queue_len;
+  /** TCP_MSS, TCP_WND, TCP_SND_BUF and TCP_SND_QUEUELEN */
+  u16_t tcp_mss;
+  u16_t tcp_wnd;
+  u16_t tcp_snd_buf;
+  u16_t tcp_snd_queuelen;
+  /** TCP_SNDLOWAT and TCP_SNDQUEUELOWAT. lwip_init() lowers these if they
+   *  are no longer below tcp_snd_buf and tcp_snd_queuelen */
+  u16_t tcp_sndlowat;
+  u16_t tcp_sndqueuelowat;
+};
+
+extern struct lwip_sizes lwip_sizes;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LWIP_SIZES_H__ */
@@ -39,6 +39,7 @@
 #if LWIP_SOCKET /* don't build if not configured for use in lwipopts.h */
 
 #include <stddef.h> /* for size_t */
+#include <sys/uio.h> /* for struct iovec */
 
 #include "lwip/ip_addr.h"
 #include "lwip/inet.h"
@@ -68,6 +69,21 @@ struct sockaddr {
 typedef u32_t socklen_t;
 #endif
 
+struct msghdr {
+  void         *msg_name;
+  socklen_t     msg_namelen;
+  struct iovec *msg_iov;
+  int           msg_iovlen;
+  void         *msg_control;    /* Unimplemented: no ancillary data */
+  socklen_t     msg_controllen;
+  int           msg_flags;
+};
+
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int  msg_len;
+};
+
 /* Socket protocol types (TCP/UDP/RAW) */
 #define SOCK_STREAM     1
 #define SOCK_DGRAM      2
@@ -135,12 +151,25 @@ struct linger {
 #define MSG_DONTWAIT   0x08    /* Nonblocking i/o for this operation only */
 #define MSG_MORE       0x10    /* Sender will send more */
 
+/* Flags returned in msg_flags by recvmsg; kept apart from the flags above */
+#define MSG_TRUNC      0x20    /* The datagram was larger than the buffers supplied */
+
 
 /*
  * Options for level IPPROTO_IP
  */
 #define IP_TOS             1
 #define IP_TTL             2
+#if IP_PMTU_DISCOVERY
+#define IP_MTU_DISCOVER    10  /* int, one of the IP_PMTUDISC_ values */
+#define IP_MTU             14  /* int, path MTU of a connected socket (get only) */
+
+/*
+ * Values for IP_MTU_DISCOVER
+ */
+#define IP_PMTUDISC_DONT   0   /* let IP fragment datagrams too long for the path */
+#define IP_PMTUDISC_DO     2   /* fail them with EMSGSIZE instead */
+#endif /* IP_PMTU_DISCOVERY */
 
 #if LWIP_TCP
 /*
@@ -290,7 +319,8 @@ typedef struct ip_mreq {
 /* FD_SET used for lwip_select */
 #ifndef FD_SET
   #undef  FD_SETSIZE
-  /* Make FD_SETSIZE match NUM_SOCKETS in socket.c */
+  /* Only covers the sockets reserved up front: lwip_select() fails with
+     EINVAL for descriptors past them, once the socket table has grown */
   #define FD_SETSIZE    MEMP_NUM_NETCONN
   #define FD_SET(n, p)  ((p)->fd_bits[(n)/8] |=  (1 << ((n) & 7)))
   #define FD_CLR(n, p)  ((p)->fd_bits[(n)/8] &= ~(1 << ((n) & 7)))
@@ -337,11 +367,29 @@ int lwip_sendto(int s, const void *dataptr, size_t size, int flags,
     const struct sockaddr *to, socklen_t tolen);
 int lwip_socket(int domain, int type, int protocol);
 int lwip_write(int s, const void *dataptr, size_t size);
+int lwip_writev(int s, const struct iovec *iov, int iovcnt);
+int lwip_readv(int s, const struct iovec *iov, int iovcnt);
+int lwip_sendmsg(int s, const struct msghdr *msg, int flags);
+int lwip_recvmsg(int s, struct msghdr *msg, int flags);
+int lwip_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+int lwip_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
 int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
                 struct timeval *timeout);
 int lwip_ioctl(int s, long cmd, void *argp);
 int lwip_fcntl(int s, int cmd, int val);
 
+/** Received data lent to the application by lwip_recv_zc(). It stays valid
+ * until passed to lwip_recv_zc_release(). */
+struct lwip_zc_buf;
+int lwip_recv_zc(int s, struct lwip_zc_buf **zc, struct iovec *iov, int *iovcnt, int flags);
+void lwip_recv_zc_release(struct lwip_zc_buf *zc);
+/** Send without copying; 'done' is called once the stack no longer needs 'data'. */
+int lwip_send_zc(int s, const void *data, size_t size, int flags,
+                 void (*done)(void *arg), void *arg);
+/** Readiness notification without select, see sockets.c */
+int lwip_socket_set_event_callback(int s, void (*fn)(int s, void *arg), void *arg);
+int lwip_socket_errno(int s);
+
 #if LWIP_COMPAT_SOCKETS
 #define accept(a,b,c)         lwip_accept(a,b,c)
 #define bind(a,b,c)           lwip_bind(a,b,c)
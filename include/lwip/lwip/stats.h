@@ -68,6 +68,7 @@ struct stats_proto {
   STAT_COUNTER opterr;           /* Error in options. */
   STAT_COUNTER err;              /* Misc error. */
   STAT_COUNTER cachehit;
+  STAT_COUNTER rexmit;           /* Retransmissions (TCP only). */
 };
 
 struct stats_igmp {
@@ -98,6 +99,33 @@ struct stats_mem {
   STAT_COUNTER illegal;
 };
 
+/** Counters for the per-thread caches in front of a pool (MEMP_CACHE).
+ *  32 bits whatever LWIP_STATS_LARGE says, as the hits add up quickly. */
+struct stats_memp_cache {
+  /** allocations served from the calling thread's cache */
+  u32_t hits;
+  /** times a cache went to the pool for more */
+  u32_t refills;
+  /** times a cache handed elements back to the pool */
+  u32_t flushes;
+  /** elements freed by a different thread than the one they went out to */
+  u32_t xthread_frees;
+};
+
+/** Counters for the ARP table. 32 bits like the memp cache's, as hits are
+ *  counted for every packet sent. */
+struct stats_etharp_cache {
+  /** packets sent to an address the table already had */
+  u32_t hits;
+  /** packets sent to an address that had to be looked up or was pending */
+  u32_t misses;
+  /** entries dropped to make room for another address */
+  u32_t evictions;
+  /** entries in use, and entries the table has grown to */
+  u32_t used;
+  u32_t size;
+};
+
 struct stats_syselem {
   STAT_COUNTER used;
   STAT_COUNTER max;
@@ -116,6 +144,7 @@ struct stats_ {
 #endif
 #if ETHARP_STATS
   struct stats_proto etharp;
+  struct stats_etharp_cache etharp_cache;
 #endif
 #if IPFRAG_STATS
   struct stats_proto ip_frag;
@@ -140,6 +169,9 @@ struct stats_ {
 #endif
 #if MEMP_STATS
   struct stats_mem memp[MEMP_MAX];
+#if MEMP_CACHE
+  struct stats_memp_cache memp_cache[MEMP_MAX];
+#endif /* MEMP_CACHE */
 #endif
 #if SYS_STATS
   struct stats_sys sys;
@@ -214,9 +246,14 @@ void stats_init(void);
 
 #if ETHARP_STATS
 #define ETHARP_STATS_INC(x) STATS_INC(x)
-#define ETHARP_STATS_DISPLAY() stats_display_proto(&lwip_stats.etharp, "ETHARP")
+#define ETHARP_STATS_DEC(x) STATS_DEC(x)
+#define ETHARP_STATS_SET(x, y) lwip_stats.x = (y)
+#define ETHARP_STATS_DISPLAY() do { stats_display_proto(&lwip_stats.etharp, "ETHARP"); \
+                                     stats_display_etharp_cache(&lwip_stats.etharp_cache); } while(0)
 #else
 #define ETHARP_STATS_INC(x)
+#define ETHARP_STATS_DEC(x)
+#define ETHARP_STATS_SET(x, y)
 #define ETHARP_STATS_DISPLAY()
 #endif
 
@@ -273,6 +310,7 @@ void stats_init(void);
 void stats_display(void);
 void stats_display_proto(struct stats_proto *proto, const char *name);
 void stats_display_igmp(struct stats_igmp *igmp);
+void stats_display_etharp_cache(struct stats_etharp_cache *cache);
 void stats_display_mem(struct stats_mem *mem, const char *name);
 void stats_display_memp(struct stats_mem *mem, int index);
 void stats_display_sys(struct stats_sys *sys);
@@ -280,6 +318,7 @@ void stats_display_sys(struct stats_sys *sys);
 #define stats_display()
 #define stats_display_proto(proto, name)
 #define stats_display_igmp(igmp)
+#define stats_display_etharp_cache(cache)
 #define stats_display_mem(mem, name)
 #define stats_display_memp(mem, index)
 #define stats_display_sys(sys)
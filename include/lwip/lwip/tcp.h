@@ -358,6 +358,18 @@ err_t            tcp_shutdown(struct tcp_pcb *pcb, int shut_rx, int shut_tx);
 err_t            tcp_write   (struct tcp_pcb *pcb, const void *dataptr, u16_t len,
                               u8_t apiflags);
 
+/** Tracks caller-owned memory that tcp_write_zc() queued without copying */
+struct tcp_zc;
+/** Called once nothing refers to the memory of a zero-copy write any more */
+typedef void (*tcp_zc_done_fn)(void *arg);
+
+err_t            tcp_write_zc(struct tcp_pcb *pcb, const void *dataptr, u16_t len,
+                              u8_t apiflags, struct tcp_zc *zc);
+#if LWIP_SUPPORT_CUSTOM_PBUF
+struct tcp_zc *  tcp_zc_new  (tcp_zc_done_fn done, void *arg);
+void             tcp_zc_release(struct tcp_zc *zc);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
 void             tcp_setprio (struct tcp_pcb *pcb, u8_t prio);
 
 #define TCP_PRIO_MIN    1
@@ -67,6 +67,7 @@ PACK_STRUCT_END
 #define UDP_FLAGS_UDPLITE        0x02U
 #define UDP_FLAGS_CONNECTED      0x04U
 #define UDP_FLAGS_MULTICAST_LOOP 0x08U
+#define UDP_FLAGS_DONTFRAG       0x10U
 
 struct udp_pcb;
 
@@ -0,0 +1,54 @@
+#ifndef LWIP_LWIPOPTS_H
+#define LWIP_LWIPOPTS_H
+
+#include <stdint.h>
+
+/* stamp packets as they move through the stack so that quiet-lwip can
+   report where latency goes, see quiet_lwip_trace_enable() */
+#define LWIP_PBUF_STAMP 1
+
+struct pbuf;
+uint64_t quiet_lwip_trace_stamp_now(void);
+void quiet_lwip_trace_stage_hook(int stage, struct pbuf *p);
+
+#define LWIP_STAMP_NOW() quiet_lwip_trace_stamp_now()
+#define LWIP_HOOK_STAGE(stage, p) quiet_lwip_trace_stage_hook(stage, p)
+
+/* checksum data as it is copied in rather than in a second pass, see
+   LWIP_CHKSUM_COPY in arch/cc.h */
+#define LWIP_CHECKSUM_ON_COPY 1
+
+/* let the driver resolve hardware addresses without asking, learn them
+   from traffic and choose how long they are kept, see quiet-lwip-arp.h.
+   the snoop hook picks which interfaces trust IP frames' source addresses */
+struct netif;
+struct ip_addr;
+struct eth_addr;
+int quiet_lwip_arp_resolve_hook(struct netif *netif, const struct ip_addr *addr,
+                                struct eth_addr *ethaddr);
+int quiet_lwip_arp_snoop_hook(struct netif *netif);
+uint16_t quiet_lwip_arp_maxage_hook(struct netif *netif);
+
+#define LWIP_HOOK_ETHARP_RESOLVE(netif, addr, ethaddr) quiet_lwip_arp_resolve_hook(netif, addr, ethaddr)
+#define LWIP_HOOK_ETHARP_SNOOP(netif) quiet_lwip_arp_snoop_hook(netif)
+#define LWIP_HOOK_ETHARP_MAXAGE(netif) quiet_lwip_arp_maxage_hook(netif)
+#define ETHARP_TRUST_IP_MAC 1
+
+/* nodes that bridge many peers keep hundreds of addresses. the table starts
+   small and grows as it is used, see quiet_lwip_stack_config.arp_entries.
+   packets for an address still being asked for wait in a short queue
+   rather than only the last one being kept */
+#define ARP_TABLE_MAX 1024
+#define ARP_QUEUEING 1
+
+/* join multicast groups, so that discovery reaches only the nodes that
+   take part in it rather than every node on the channel */
+#define LWIP_IGMP 1
+
+/* a fragment lost on the modem loses the whole datagram. TCP sends
+   segments with DF set and shrinks them when a router reports a smaller
+   path, and UDP sockets can ask for EMSGSIZE instead of fragments, see
+   LWIP_IP_MTU_DISCOVER */
+#define IP_PMTU_DISCOVERY 1
+
+#endif /* LWIP_LWIPOPTS_H */
@@ -0,0 +1,45 @@
+#ifndef QUIET_LWIP_ARP_H
+#define QUIET_LWIP_ARP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// how an interface finds its peers' hardware addresses. plain ARP costs a
+//   frame each way over the link before the first packet to a new peer, and
+//   lwip forgets what it learned after 20 minutes and asks again. these
+//   settings let a link skip some or all of that
+typedef enum {
+    // ask with ARP
+    quiet_lwip_arp_dynamic = 0,
+    // every interface's hardware address is made from its IP address, as
+    //   02:51 followed by the address's four bytes, so any peer's is known
+    //   without asking. hardware_addr is ignored. peers on the link must
+    //   all use this mode to reach each other this way
+    quiet_lwip_arp_derived,
+} quiet_lwip_arp_mode;
+
+// a peer whose hardware address is known ahead of time
+typedef struct {
+    // network byte order, as with quiet_lwip_ipv4_addr
+    uint32_t ipv4_addr;
+    uint8_t hardware_addr[6];
+} quiet_lwip_arp_entry;
+
+typedef struct {
+    quiet_lwip_arp_mode mode;
+    // peers known up front. they are never asked for and never expire, in
+    //   either mode. the table is copied
+    const quiet_lwip_arp_entry *table;
+    size_t table_len;
+    // learn peers from every frame heard, IP or ARP, including the
+    //   gratuitous ARP each interface sends as it comes up, rather than only
+    //   from answers to our own requests
+    bool snoop;
+    // seconds a learned address is kept after it was last heard from. 0
+    //   keeps lwip's 20 minutes
+    unsigned int lifetime;
+} quiet_lwip_arp_config;
+
+// a lifetime for addresses that are never forgotten
+#define quiet_lwip_arp_forever ((unsigned int)-1)
+#endif
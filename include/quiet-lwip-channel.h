@@ -0,0 +1,73 @@
+#ifndef QUIET_LWIP_CHANNEL_H
+#define QUIET_LWIP_CHANNEL_H
+#include "quiet-lwip.h"
+
+// in-process stand-in for the audio medium. a channel connects any number of
+//   abstract interfaces: every step, each interface's transmission is mixed
+//   into what every *other* interface hears, after passing through the
+//   impairments below. this makes it possible to run the stack without a
+//   sound card and to reproduce a given channel exactly from its seed.
+typedef struct {
+    // samples moved per interface per step. 0 selects a default
+    size_t block_len;
+
+    // linear gain applied to every transmission
+    float gain;
+
+    // standard deviation of white gaussian noise added at each receiver
+    float noise_amplitude;
+
+    // single reflection, echo_gain relative to the direct path and arriving
+    //   echo_delay samples after it. echo_gain of 0 disables it
+    float echo_gain;
+    size_t echo_delay;
+
+    // propagation delay, in samples
+    size_t latency;
+
+    // how much faster receivers sample than transmitters, in parts per million
+    //   negative values make receivers slower. at most 100000 either way
+    double drift_ppm;
+
+    // probability in [0, 1] that a receiver loses a whole block to silence
+    double frame_loss;
+
+    // seed for noise and loss. the same seed and traffic give the same channel
+    uint32_t seed;
+
+    // when nonzero, the channel thread paces itself to this many samples per
+    //   second. when zero it runs as fast as the cpu allows
+    double sample_rate;
+
+    // when nonzero, the channel drives lwip's clock instead of the wall
+    //   clock: once the stack has settled after each step, time advances by
+    //   block_len / clock_rate seconds. combined with a sample_rate of 0 this
+    //   simulates the link faster than real time while timers, RTOs and
+    //   socket timeouts still see the link's true pace. only one channel per
+    //   process may drive the clock, and it stays virtual from then on
+    double clock_rate;
+} quiet_lwip_channel_config;
+
+struct quiet_lwip_channel;
+typedef struct quiet_lwip_channel quiet_lwip_channel;
+
+// NULL if conf is out of range
+quiet_lwip_channel *quiet_lwip_channel_create(const quiet_lwip_channel_config *conf);
+
+// interfaces must be attached before the channel starts stepping
+void quiet_lwip_channel_attach(quiet_lwip_channel *channel, quiet_lwip_interface *interface);
+
+// move one block of samples between all attached interfaces
+void quiet_lwip_channel_step(quiet_lwip_channel *channel);
+
+// total samples each transmitter has emitted into the channel
+uint64_t quiet_lwip_channel_elapsed(const quiet_lwip_channel *channel);
+
+// run quiet_lwip_channel_step() in a loop on a background thread
+void quiet_lwip_channel_start(quiet_lwip_channel *channel);
+
+void quiet_lwip_channel_stop(quiet_lwip_channel *channel);
+
+// does not destroy the attached interfaces
+void quiet_lwip_channel_destroy(quiet_lwip_channel *channel);
+#endif
@@ -0,0 +1,82 @@
+#ifndef QUIET_LWIP_MUX_H
+#define QUIET_LWIP_MUX_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// carries many streams over one connected lwip tcp socket, so a new stream
+//   costs no handshake over the link and small writes from many streams
+//   share segments. each stream joins a native socket on one end to a native
+//   socket on the other. streams are opened by either side, and the opener
+//   can pass a header that arrives with the open, ahead of any data.
+//
+// each stream has its own window: a side only sends what the other has
+//   room to buffer for it, so a slow reader holds up its own stream and no
+//   other. when the tunnel has room, higher priority streams (lower numbers)
+//   are served first and streams of equal priority take turns
+typedef struct {
+    // bytes each stream may have in flight toward us. 0 selects a default
+    size_t window;
+} quiet_lwip_mux_config;
+
+typedef struct {
+    // streams open right now, including those waiting to be accepted
+    size_t open;
+    // streams ever opened, by either side
+    uint64_t opened;
+    // stream payload carried each way
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    // frames sent, and lwip sends they were batched into
+    uint64_t frames_sent;
+    uint64_t sends;
+} quiet_lwip_mux_stats;
+
+struct quiet_lwip_mux;
+typedef struct quiet_lwip_mux quiet_lwip_mux;
+
+struct quiet_lwip_mux_stream;
+typedef struct quiet_lwip_mux_stream quiet_lwip_mux_stream;
+
+// called on the mux's thread for each stream the peer opens, with the
+//   header the peer gave. it must return quickly and hand the stream to
+//   quiet_lwip_mux_accept() or quiet_lwip_mux_refuse() later, from any
+//   thread. data the peer sends meanwhile is held for the stream
+typedef void (*quiet_lwip_mux_open_fn)(quiet_lwip_mux_stream *stream,
+                                       const uint8_t *hdr, size_t hdr_len, void *arg);
+
+// takes over lwip_fd, which must be a connected tcp socket, and closes it
+//   when the mux is destroyed. the side that connected passes initiator, so
+//   the two sides number their streams apart. on_open may be NULL if the
+//   peer isn't expected to open streams, in which case they are refused
+quiet_lwip_mux *quiet_lwip_mux_create(int lwip_fd, bool initiator, const quiet_lwip_mux_config *conf,
+                                      quiet_lwip_mux_open_fn on_open, void *on_open_arg);
+
+// open a stream carrying native_fd, a connected stream socket that the mux
+//   takes over and closes when the stream ends. hdr, at most 1024 bytes, is
+//   sent along with the open. returns 0, or -1 if the tunnel has closed or
+//   hdr is too long, in which case native_fd is left to the caller
+int quiet_lwip_mux_open(quiet_lwip_mux *mux, int native_fd, uint8_t priority,
+                        const void *hdr, size_t hdr_len);
+
+// join a stream from quiet_lwip_mux_open_fn to native_fd, which the mux
+//   takes over. reply goes to the peer ahead of anything read from native_fd
+void quiet_lwip_mux_accept(quiet_lwip_mux_stream *stream, int native_fd, uint8_t priority,
+                           const void *reply, size_t reply_len);
+
+// turn down a stream from quiet_lwip_mux_open_fn. reply, if any, reaches
+//   the peer before the stream is closed
+void quiet_lwip_mux_refuse(quiet_lwip_mux_stream *stream, const void *reply, size_t reply_len);
+
+// blocks until the tunnel closes, from either end or on an error
+void quiet_lwip_mux_wait(quiet_lwip_mux *mux);
+
+bool quiet_lwip_mux_closed(quiet_lwip_mux *mux);
+
+void quiet_lwip_mux_get_stats(quiet_lwip_mux *mux, quiet_lwip_mux_stats *stats);
+
+// closes the tunnel and every stream still open. streams still waiting
+//   for quiet_lwip_mux_accept() or quiet_lwip_mux_refuse() stay valid until
+//   they get it
+void quiet_lwip_mux_destroy(quiet_lwip_mux *mux);
+#endif
@@ -2,6 +2,8 @@
 
 #include <quiet.h>
 
+#include "quiet-lwip-arp.h"
+
 typedef struct {
     const quiet_encoder_options *encoder_opt;
     const quiet_decoder_options *decoder_opt;
@@ -15,6 +17,9 @@ typedef struct {
     size_t encoder_sample_size;
     size_t decoder_sample_size;
     uint8_t hardware_addr[6];
+    // how peers' hardware addresses are found, see quiet-lwip-arp.h. all
+    //   zero is plain ARP
+    quiet_lwip_arp_config arp;
 } quiet_lwip_portaudio_driver_config;
 
 typedef uint32_t quiet_lwip_ipv4_addr;
@@ -0,0 +1,55 @@
+#ifndef QUIET_LWIP_RELAY_H
+#define QUIET_LWIP_RELAY_H
+#include <stddef.h>
+#include <stdint.h>
+
+// moves data both ways between pairs of connected sockets, one native and
+//   one lwip, until both directions have been closed. each relay thread
+//   owns a share of the connections and waits on their native sockets with
+//   poll() and on their lwip sockets through lwip's event callbacks, so a
+//   connection is only looked at when one of its sockets has something to
+//   say. neither direction copies: native data is read into memory lwip
+//   sends from by reference, and lwip's receive buffers are written to the
+//   native socket as they are. a side that can't keep up holds back
+//   reading from the other, and an end of stream in one direction is passed
+//   on as a half close while the other direction keeps flowing
+typedef struct {
+    // threads sharing the connections. 0 selects 1
+    size_t num_threads;
+
+    // size of the chunks native data is read into. lwip sends straight out
+    //   of them and they are freed as it acks the data, so a connection
+    //   holds at most its lwip send buffer plus one chunk, and an idle one
+    //   holds none. 0 selects a default
+    size_t buf_len;
+} quiet_lwip_relay_config;
+
+typedef struct {
+    // connections being relayed right now
+    size_t open;
+    // connections ever handed to the relay
+    uint64_t opened;
+    uint64_t bytes_to_lwip;
+    uint64_t bytes_to_native;
+} quiet_lwip_relay_stats;
+
+struct quiet_lwip_relay;
+typedef struct quiet_lwip_relay quiet_lwip_relay;
+
+quiet_lwip_relay *quiet_lwip_relay_create(const quiet_lwip_relay_config *conf);
+
+// relay between native_fd and lwip_fd, both connected stream sockets. the
+//   relay makes them nonblocking and closes them once both directions are
+//   done or either side fails. returns 0, or -1 if the relay is shutting down
+int quiet_lwip_relay_add(quiet_lwip_relay *relay, int native_fd, int lwip_fd);
+
+void quiet_lwip_relay_get_stats(quiet_lwip_relay *relay, quiet_lwip_relay_stats *stats);
+
+// stops the relay threads and closes every connection still open
+void quiet_lwip_relay_destroy(quiet_lwip_relay *relay);
+
+// forward between native_fd and lwip_fd in both directions until both are
+//   closed, as quiet_lwip_relay_add() does, on a relay with the default
+//   config that is started on first use and shared by the whole process
+int quiet_lwip_splice(int native_fd, int lwip_fd);
+#endif
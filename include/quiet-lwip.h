@@ -1,5 +1,41 @@
+#ifndef QUIET_LWIP_H
+#define QUIET_LWIP_H
 #include <quiet.h>
 
+#include "quiet-lwip-arp.h"
+
+// sizes of lwip's memory and queues, shared by every interface. any field
+//   left 0 keeps the default lwip was built with (see lwip/opt.h)
+typedef struct {
+    // bytes in lwip's heap, which holds outgoing TCP segments among others
+    size_t heap_size;
+    // pbufs that received frames are read into
+    size_t pbuf_pool_size;
+    // connections set aside up front. lwip adds more as they run out, so
+    //   these only trade startup memory against allocations later
+    size_t tcp_pcbs;
+    size_t tcp_listen_pcbs;
+    size_t udp_pcbs;
+    size_t netconns;
+    // TCP segments queued for sending across all connections
+    size_t tcp_segs;
+    // messages waiting for lwip's thread, received packets waiting for
+    //   each socket, and connections waiting to be accepted
+    size_t tcpip_mbox_size;
+    size_t recv_mbox_size;
+    size_t accept_mbox_size;
+    // defaults for new TCP connections
+    size_t tcp_mss;
+    size_t tcp_wnd;
+    size_t tcp_snd_buf;
+    // peers whose hardware addresses are remembered. the table grows to
+    //   this as it fills, then forgets the least recently used. at most
+    //   1024
+    size_t arp_entries;
+    // packets held for each peer while its address is being asked for
+    size_t arp_queue_len;
+} quiet_lwip_stack_config;
+
 typedef struct {
     const quiet_encoder_options *encoder_opt;
     const quiet_decoder_options *decoder_opt;
@@ -7,6 +43,21 @@ typedef struct {
     unsigned int encoder_rate;
     unsigned int decoder_rate;
     uint8_t hardware_addr[6];
+    // capacity of the sample rings used by the span API below, in samples
+    // the tx ring bounds how far ahead of playback the encoder may run
+    // 0 selects a default
+    size_t tx_ring_len;
+    size_t rx_ring_len;
+    // received frames the interface can have in lwip at once in buffers
+    //   sized to the profile's frame length. beyond that, frames are copied
+    //   into lwip's general pbuf pool. 0 selects a default
+    size_t rx_pool_len;
+    // how peers' hardware addresses are found, see quiet-lwip-arp.h. all
+    //   zero is plain ARP
+    quiet_lwip_arp_config arp;
+    // lwip is set up by the first quiet_lwip_create(), which sizes it from
+    //   this. NULL, and this field in later calls, are ignored
+    const quiet_lwip_stack_config *stack;
 } quiet_lwip_driver_config;
 
 typedef uint32_t quiet_lwip_ipv4_addr;
@@ -18,9 +69,104 @@ ssize_t quiet_lwip_get_next_audio_packet(quiet_lwip_interface *interface, quiet_
 
 void quiet_lwip_recv_audio_packet(quiet_lwip_interface *interface, quiet_sample_t *buf, size_t samplebuf_len);
 
+// span API: instead of copying through caller buffers, these hand out
+//   contiguous regions of the interface's own sample rings. a span is
+//   valid until its matching commit. spans may be shorter than the space
+//   actually available when the ring wraps, so callers should loop until
+//   they have moved as many samples as they need.
+// use either the span API or the packet API above on an interface, not both.
+
+// samples ready for playback. the encoder writes straight into the ring,
+//   padding with silence when it has no frame to send, so the returned span
+//   is only empty when the ring is full of samples already handed out
+quiet_sample_t *quiet_lwip_acquire_tx_span(quiet_lwip_interface *interface, size_t *span_len);
+
+// release samples from the front of the last tx span after playing them
+void quiet_lwip_commit_tx_span(quiet_lwip_interface *interface, size_t samples_played);
+
+// free space for captured samples
+quiet_sample_t *quiet_lwip_acquire_rx_span(quiet_lwip_interface *interface, size_t *span_len);
+
+// hand captured samples written to the front of the last rx span to the
+//   decoder. any frames they complete are passed up to lwip before this returns
+void quiet_lwip_commit_rx_span(quiet_lwip_interface *interface, size_t samples_captured);
+
+// returns NULL if conf->stack asks for sizes lwip can't work with
 quiet_lwip_interface *quiet_lwip_create(quiet_lwip_driver_config *conf,
                                         quiet_lwip_ipv4_addr local_address,
                                         quiet_lwip_ipv4_addr netmask,
                                         quiet_lwip_ipv4_addr gateway);
 
 void quiet_lwip_destroy(quiet_lwip_interface *interface);
+
+// microseconds on lwip's clock. this is the monotonic wall clock unless a
+//   channel drives a virtual clock (see quiet-lwip-channel.h)
+uint64_t quiet_lwip_now_us();
+
+// when built with QUIET_LWIP_CORE_LOCKING, application threads run their
+//   socket calls themselves while holding lwip's core lock, rather than
+//   handing each one to lwip's thread and waiting for it
+typedef struct {
+    uint64_t acquisitions;
+    // acquisitions that found the lock taken and had to wait
+    uint64_t contended;
+    uint64_t wait_ns;
+} quiet_lwip_lock_stats;
+
+// counters since startup for the core lock. returns false, with stats
+//   zeroed, if the library was built without core locking
+bool quiet_lwip_core_lock_stats(quiet_lwip_lock_stats *stats);
+
+// per-stage latency tracing
+// stages a frame passes through on its way from one application to another.
+//   the first six are stamped on the sending interface, the rest on the
+//   receiving one. emitted and decoded samples are timed by their position in
+//   the audio stream relative to the call that carried them, not by when the
+//   call happened, so the stages around the modem are sample-accurate
+typedef enum {
+    // lwip_write()/lwip_send() accepts the data
+    quiet_lwip_stage_socket_send,
+    // tcp segment, or udp datagram, handed to ip
+    quiet_lwip_stage_tcp_output,
+    // frame handed to the interface
+    quiet_lwip_stage_linkoutput,
+    // frame queued for the encoder
+    quiet_lwip_stage_encoder_queue,
+    quiet_lwip_stage_first_sample_emitted,
+    quiet_lwip_stage_last_sample_emitted,
+    // decoder locks on to a frame
+    quiet_lwip_stage_first_sample_decoded,
+    quiet_lwip_stage_last_sample_decoded,
+    // decoded frame handed to lwip
+    quiet_lwip_stage_recv_pbuf,
+    // lwip_read()/lwip_recv() picks up the data
+    quiet_lwip_stage_socket_read,
+    quiet_lwip_num_stages,
+} quiet_lwip_stage;
+
+#define QUIET_LWIP_HISTOGRAM_BUCKETS 32
+
+// time frames took to reach a stage from the stage before it. the first
+//   stage of each direction has nothing before it, so its histogram stays empty
+typedef struct {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    // bucket 0 counts latencies under 1us, bucket i those in [2^(i-1), 2^i)us
+    uint64_t buckets[QUIET_LWIP_HISTOGRAM_BUCKETS];
+} quiet_lwip_latency_histogram;
+
+// turn tracing on or off for the whole process. interfaces decide whether
+//   to trace when they are created, so enable it before quiet_lwip_create()
+// while tracing, an interface hands frames to its encoder one at a time so
+//   that it can find where each begins and ends in the sample stream
+void quiet_lwip_trace_enable(bool enable);
+
+void quiet_lwip_trace_reset();
+
+// copy out one histogram per stage, indexed by quiet_lwip_stage.
+//   hists must have room for quiet_lwip_num_stages entries
+void quiet_lwip_trace_histograms(quiet_lwip_latency_histogram *hists);
+
+const char *quiet_lwip_stage_name(quiet_lwip_stage stage);
+#endif
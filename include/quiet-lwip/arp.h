@@ -0,0 +1,27 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "quiet-lwip-arp.h"
+
+#include "lwip/netif.h"
+#include "netif/etharp.h"
+
+// an interface's quiet_lwip_arp_config, kept in netif->arp_policy where
+//   etharp's hooks (see lwipopts.h) find it. it is only read once the
+//   interface is up, so it needs no lock
+typedef struct {
+    quiet_lwip_arp_mode mode;
+    quiet_lwip_arp_entry *table;
+    size_t table_len;
+    bool snoop;
+    // lifetime in etharp timer ticks, 0 if entries never expire
+    uint16_t maxage;
+} arp_policy;
+
+arp_policy *arp_policy_create(const quiet_lwip_arp_config *conf);
+
+void arp_policy_destroy(arp_policy *policy);
+
+// the hardware address quiet_lwip_arp_derived gives to addr
+void arp_derive_hwaddr(uint32_t addr, uint8_t *hwaddr);
@@ -1,12 +1,54 @@
+#include <pthread.h>
+
 #include "quiet-lwip.h"
 
 #include "quiet-lwip/util.h"
+#include "quiet-lwip/arp.h"
+#include "quiet-lwip/ring.h"
+#include "quiet-lwip/rx_pool.h"
+#include "quiet-lwip/trace.h"
+
+// a frame waiting for, or passing through, the encoder while tracing
+typedef struct {
+    uint8_t *frame;
+    size_t len;
+    // time of the last stage this frame passed
+    uint64_t stamp;
+    // positions of its first and last samples in the interface's tx stream
+    uint64_t first_sample;
+    uint64_t last_sample;
+    bool first_sample_released;
+} traced_frame;
 
 typedef struct {
     quiet_encoder *encoder;
     quiet_decoder *decoder;
+    // longest frame the encoder sends, ethernet header included
+    size_t frame_len;
     uint8_t *send_temp;
     size_t send_temp_len;
     uint8_t *recv_temp;
     size_t recv_temp_len;
+    // received frames are decoded straight into these
+    rx_pool *rx_pool;
+    sample_ring *tx_ring;
+    sample_ring *rx_ring;
+    unsigned int encoder_rate;
+    unsigned int decoder_rate;
+    // tracing state, only used when trace is set
+    // tx_frames is a ring indexed by three running counts. frames before
+    //   tx_frames_encoding have been fully emitted, and those from
+    //   tx_frames_released on still have samples the caller hasn't taken
+    bool trace;
+    pthread_mutex_t tx_frames_lock;
+    traced_frame *tx_frames;
+    size_t tx_frames_len;
+    size_t tx_frames_released;
+    size_t tx_frames_encoding;
+    size_t tx_frames_queued;
+    bool tx_encoder_busy;
+    uint64_t tx_samples_emitted;
+    uint64_t tx_samples_released;
+    // capture time of the first sample of the frame being decoded, or 0
+    uint64_t rx_frame_start;
 } eth_driver;
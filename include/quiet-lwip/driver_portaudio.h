@@ -4,6 +4,7 @@
 #include "quiet-lwip-portaudio.h"
 
 #include "quiet-lwip/util.h"
+#include "quiet-lwip/arp.h"
 
 typedef struct {
     quiet_portaudio_encoder *encoder;
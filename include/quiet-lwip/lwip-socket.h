@@ -2,6 +2,8 @@
 #define QUIET_LWIP_SOCKET_H
 #include <stdint.h>
 #include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/uio.h>
 
 struct lwip_in_addr {
     uint32_t s_addr;
@@ -23,6 +25,52 @@ struct lwip_sockaddr {
 
 typedef uint32_t lwip_socklen_t;
 
+struct lwip_msghdr {
+    void *msg_name;
+    lwip_socklen_t msg_namelen;
+    struct iovec *msg_iov;
+    int msg_iovlen;
+    void *msg_control;
+    lwip_socklen_t msg_controllen;
+    int msg_flags;
+};
+
+struct lwip_mmsghdr {
+    struct lwip_msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+// set in msg_flags when a datagram didn't fit the buffers given to lwip_recvmsg()
+#define LWIP_MSG_TRUNC 0x20
+
+// lwip's option numbers differ from the host's, so callers of
+//   lwip_getsockopt() and lwip_setsockopt() use these
+#define LWIP_SOL_SOCKET 0xfff
+#define LWIP_SO_ERROR 0x1007
+#define LWIP_SO_TYPE 0x1008
+#define LWIP_IPPROTO_TCP 6
+#define LWIP_TCP_NODELAY 0x01
+#define LWIP_IPPROTO_IP 0
+#define LWIP_IP_ADD_MEMBERSHIP 3
+#define LWIP_IP_DROP_MEMBERSHIP 4
+#define LWIP_IP_MULTICAST_TTL 5
+#define LWIP_IP_MULTICAST_IF 6
+#define LWIP_IP_MULTICAST_LOOP 7
+#define LWIP_IP_MTU_DISCOVER 10
+#define LWIP_IP_MTU 14
+
+// values for LWIP_IP_MTU_DISCOVER on UDP sockets. with LWIP_IP_PMTUDISC_DO,
+//   sending a datagram longer than the path MTU fails with EMSGSIZE rather
+//   than splitting it into fragments
+#define LWIP_IP_PMTUDISC_DONT 0
+#define LWIP_IP_PMTUDISC_DO 2
+
+// option value for LWIP_IP_ADD_MEMBERSHIP and LWIP_IP_DROP_MEMBERSHIP
+struct lwip_ip_mreq {
+    struct lwip_in_addr imr_multiaddr;
+    struct lwip_in_addr imr_interface;
+};
+
 int lwip_accept(int s, struct lwip_sockaddr *addr, lwip_socklen_t *addrlen);
 int lwip_bind(int s, const struct lwip_sockaddr *name, lwip_socklen_t namelen);
 int lwip_shutdown(int s, int how);
@@ -46,4 +94,45 @@ int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptse
                 struct timeval *timeout);
 int lwip_ioctl(int s, long cmd, void *argp);
 int lwip_fcntl(int s, int cmd, int val);
+
+// vectored and batched i/o: each call is a single trip to the network thread.
+//   the mmsg variants return the number of messages handled. lwip_recvmmsg()
+//   only waits for the first message and takes whatever else is queued
+int lwip_writev(int s, const struct iovec *iov, int iovcnt);
+int lwip_readv(int s, const struct iovec *iov, int iovcnt);
+int lwip_sendmsg(int s, const struct lwip_msghdr *msg, int flags);
+int lwip_recvmsg(int s, struct lwip_msghdr *msg, int flags);
+int lwip_sendmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen, int flags);
+int lwip_recvmmsg(int s, struct lwip_mmsghdr *msgvec, unsigned int vlen, int flags);
+
+// zero-copy receive: fills iov with up to *iovcnt regions of lwip's own
+//   receive buffers and returns their total length. the regions stay valid
+//   until zc is released. for tcp, data that doesn't fit in iov is left for
+//   the next receive. for udp it is discarded, as with lwip_recv()
+struct lwip_zc_buf;
+int lwip_recv_zc(int s, struct lwip_zc_buf **zc, struct iovec *iov, int *iovcnt, int flags);
+void lwip_recv_zc_release(struct lwip_zc_buf *zc);
+
+// zero-copy send: as lwip_send(), but data is referenced rather than copied
+//   and must not be modified until done(arg) is called. done is called
+//   exactly once, also when the send fails, and may be called from the
+//   network thread, so it must not block or call back into lwip
+int lwip_send_zc(int s, const void *data, size_t size, int flags,
+                 void (*done)(void *arg), void *arg);
+
+// readiness notification: fn(s, arg) is called whenever s receives data,
+//   gains room to send or sees an error, so one thread can watch lwip
+//   sockets alongside native ones. it runs on lwip's thread or whichever
+//   thread caused the event, with lwip's socket table locked, so it must be
+//   brief and must not call into lwip. NULL removes it, after which the old
+//   callback is guaranteed not to be running
+int lwip_socket_set_event_callback(int s, void (*fn)(int s, void *arg), void *arg);
+
+// lwip doesn't set errno. this is the error left by the last call on s, 0
+//   if it succeeded
+int lwip_socket_errno(int s);
+
+// lwip's flag values differ from the host's
+#define LWIP_O_NONBLOCK 1
+#define LWIP_MSG_DONTWAIT 0x08
 #endif
@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include <quiet.h>
+
+// single producer, single consumer ring of audio samples
+// indices count total samples produced/consumed and are wrapped on access,
+// so the ring never has to waste a slot to tell full from empty
+typedef struct {
+    quiet_sample_t *samples;
+    size_t len;
+    _Atomic size_t read_index;
+    _Atomic size_t write_index;
+} sample_ring;
+
+sample_ring *sample_ring_create(size_t len);
+
+void sample_ring_destroy(sample_ring *ring);
+
+size_t sample_ring_readable(sample_ring *ring);
+
+size_t sample_ring_writable(sample_ring *ring);
+
+// contiguous run of samples ready to be consumed, may be shorter than
+// sample_ring_readable() when the readable region wraps
+quiet_sample_t *sample_ring_read_span(sample_ring *ring, size_t *span_len);
+
+void sample_ring_read_commit(sample_ring *ring, size_t len);
+
+// contiguous run of free slots, may be shorter than sample_ring_writable()
+quiet_sample_t *sample_ring_write_span(sample_ring *ring, size_t *span_len);
+
+void sample_ring_write_commit(sample_ring *ring, size_t len);
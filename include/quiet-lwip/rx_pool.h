@@ -0,0 +1,42 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lwip/pbuf.h"
+
+// fixed set of pbufs, each big enough for one whole received frame, so a
+//   frame always arrives in a single contiguous pbuf whatever the link's
+//   frame length is next to lwip's PBUF_POOL_BUFSIZE. buffers are taken on
+//   the thread feeding the decoder and come back through pbuf_free(), from
+//   whichever thread lwip or the application frees them on
+typedef struct rx_buf rx_buf;
+
+typedef struct {
+    pthread_mutex_t lock;
+    rx_buf *free;
+    // buffers handed out and not yet back
+    size_t out;
+    bool destroyed;
+    size_t frame_len;
+    uint8_t *memory;
+} rx_pool;
+
+rx_pool *rx_pool_create(size_t frame_len, size_t count);
+
+// the memory is released once the last buffer still held by lwip comes back
+void rx_pool_destroy(rx_pool *pool);
+
+// NULL if every buffer is out
+rx_buf *rx_pool_take(rx_pool *pool);
+
+// for a buffer that was taken but never turned into a pbuf
+void rx_pool_give_back(rx_buf *buf);
+
+// where the frame goes, room for frame_len bytes. the buffer keeps
+//   ETH_PAD_SIZE bytes in front of it
+uint8_t *rx_buf_frame(rx_buf *buf);
+
+// a pbuf over the first len bytes of the frame, plus the pad, ready for
+//   netif->input. freeing it returns the buffer to its pool
+struct pbuf *rx_buf_pbuf(rx_buf *buf, size_t len);
@@ -0,0 +1,16 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "quiet-lwip.h"
+
+#include "lwip/pbuf.h"
+
+bool trace_enabled();
+
+// microseconds on lwip's clock while tracing, 0 otherwise
+uint64_t trace_now();
+
+// a frame reached stage at time now. if *stamp holds the time of its
+//   previous stage, the difference is added to the stage's histogram.
+//   *stamp then moves to now
+void trace_stage(quiet_lwip_stage stage, uint64_t *stamp, uint64_t now);
@@ -1,6 +1,7 @@
 #include "lwip/def.h"
 #include "lwip/netif.h"
 #include "lwip/pbuf.h"
+#include "lwip/sizes.h"
 #include "lwip/stats.h"
 #include "netif/etharp.h"
 #include "lwip/tcpip.h"
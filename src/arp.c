@@ -0,0 +1,81 @@
+#include "quiet-lwip/arp.h"
+
+#include <string.h>
+
+// locally administered, unicast
+static const uint8_t derived_prefix[] = {0x02, 0x51};
+
+// lwip's own lifetime, in ticks of ARP_TMR_INTERVAL
+static const uint16_t default_maxage = 240;
+
+arp_policy *arp_policy_create(const quiet_lwip_arp_config *conf) {
+    arp_policy *policy = calloc(1, sizeof(arp_policy));
+    policy->mode = conf->mode;
+    policy->snoop = conf->snoop;
+
+    if (conf->table_len) {
+        policy->table = malloc(conf->table_len * sizeof(quiet_lwip_arp_entry));
+        memcpy(policy->table, conf->table, conf->table_len * sizeof(quiet_lwip_arp_entry));
+        policy->table_len = conf->table_len;
+    }
+
+    const unsigned int tick_s = ARP_TMR_INTERVAL / 1000;
+    if (conf->lifetime == 0) {
+        policy->maxage = default_maxage;
+    } else if (conf->lifetime == quiet_lwip_arp_forever ||
+               conf->lifetime / tick_s >= UINT16_MAX) {
+        policy->maxage = 0;
+    } else {
+        policy->maxage = (conf->lifetime + tick_s - 1) / tick_s;
+    }
+
+    return policy;
+}
+
+void arp_policy_destroy(arp_policy *policy) {
+    if (!policy) {
+        return;
+    }
+    free(policy->table);
+    free(policy);
+}
+
+void arp_derive_hwaddr(uint32_t addr, uint8_t *hwaddr) {
+    memcpy(hwaddr, derived_prefix, sizeof(derived_prefix));
+    memcpy(hwaddr + sizeof(derived_prefix), &addr, sizeof(addr));
+}
+
+/* ------------------------------------------------------------------------- */
+// etharp -> quiet: LWIP_HOOK_ETHARP_*(). these run on lwip's thread
+
+int quiet_lwip_arp_resolve_hook(struct netif *netif, const struct ip_addr *addr,
+                                struct eth_addr *ethaddr) {
+    const arp_policy *policy = netif->arp_policy;
+    if (!policy) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < policy->table_len; i++) {
+        if (policy->table[i].ipv4_addr == addr->addr) {
+            memcpy(ethaddr->addr, policy->table[i].hardware_addr, ETHARP_HWADDR_LEN);
+            return 1;
+        }
+    }
+
+    if (policy->mode == quiet_lwip_arp_derived) {
+        arp_derive_hwaddr(addr->addr, ethaddr->addr);
+        return 1;
+    }
+
+    return 0;
+}
+
+int quiet_lwip_arp_snoop_hook(struct netif *netif) {
+    const arp_policy *policy = netif->arp_policy;
+    return policy && policy->snoop;
+}
+
+uint16_t quiet_lwip_arp_maxage_hook(struct netif *netif) {
+    const arp_policy *policy = netif->arp_policy;
+    return policy ? policy->maxage : default_maxage;
+}
@@ -0,0 +1,286 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "quiet-lwip-channel.h"
+
+#include "lwip/sys.h"
+
+typedef struct {
+    quiet_lwip_interface *interface;
+    // this interface's past transmissions, indexed by sample time mod history_len
+    quiet_sample_t *history;
+    // mixed signal at this receiver not yet resampled to its clock
+    quiet_sample_t *heard;
+    size_t heard_len;
+    double heard_pos;
+    // one block as sampled by this receiver
+    quiet_sample_t *resampled;
+} channel_port;
+
+struct quiet_lwip_channel {
+    quiet_lwip_channel_config conf;
+    channel_port *ports;
+    size_t num_ports;
+    size_t history_len;
+    uint64_t elapsed;
+    // how far this channel has moved lwip's clock, when it drives it
+    uint64_t clock_advanced_us;
+    uint64_t rng_state;
+    quiet_sample_t *mix;
+    pthread_t thread;
+    _Atomic bool shutdown;
+    bool running;
+};
+
+static const size_t default_block_len = 1 << 8;
+
+// a receiver this far off is not hearing the same modem any more. it also
+//   keeps a resampled block within the twice-the-block buffers below
+static const double max_drift_ppm = 1e5;
+
+// xorshift64*, so that runs do not depend on the libc rand() in use
+static uint64_t channel_rand(quiet_lwip_channel *c) {
+    c->rng_state ^= c->rng_state >> 12;
+    c->rng_state ^= c->rng_state << 25;
+    c->rng_state ^= c->rng_state >> 27;
+    return c->rng_state * 2685821657736338717ULL;
+}
+
+// uniform in (0, 1]
+static double channel_uniform(quiet_lwip_channel *c) {
+    return ((channel_rand(c) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double channel_gaussian(quiet_lwip_channel *c) {
+    // box-muller, discarding the second deviate to keep the stream simple
+    double u1 = channel_uniform(c);
+    double u2 = channel_uniform(c);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+quiet_lwip_channel *quiet_lwip_channel_create(const quiet_lwip_channel_config *conf) {
+    // written so that NaN fails too
+    if (!(fabs(conf->drift_ppm) <= max_drift_ppm)) {
+        return NULL;
+    }
+
+    quiet_lwip_channel *c = calloc(1, sizeof(quiet_lwip_channel));
+    c->conf = *conf;
+    if (!c->conf.block_len) {
+        c->conf.block_len = default_block_len;
+    }
+    if (c->conf.gain == 0) {
+        c->conf.gain = 1;
+    }
+
+    // the history must reach back past the latest echo while the current
+    //   block is written, and keeping it a multiple of the block length means
+    //   each transmitted block lands contiguously
+    size_t block_len = c->conf.block_len;
+    size_t reach = c->conf.latency + c->conf.echo_delay + block_len;
+    c->history_len = ((reach + block_len - 1) / block_len) * block_len;
+
+    c->mix = calloc(block_len, sizeof(quiet_sample_t));
+
+    // xorshift must not start from 0
+    c->rng_state = ((uint64_t)c->conf.seed << 32) ^ 0x9e3779b97f4a7c15ULL;
+
+    if (c->conf.clock_rate > 0) {
+        sys_clock_set_virtual(1);
+    }
+
+    atomic_init(&c->shutdown, false);
+    return c;
+}
+
+void quiet_lwip_channel_attach(quiet_lwip_channel *c, quiet_lwip_interface *interface) {
+    c->ports = realloc(c->ports, (c->num_ports + 1) * sizeof(channel_port));
+    channel_port *port = c->ports + c->num_ports;
+    c->num_ports++;
+
+    size_t block_len = c->conf.block_len;
+    port->interface = interface;
+    port->history = calloc(c->history_len, sizeof(quiet_sample_t));
+    // drift is at most max_drift_ppm, so twice the block is plenty
+    port->heard = calloc(2 * block_len + 2, sizeof(quiet_sample_t));
+    port->heard_len = 0;
+    port->heard_pos = 0;
+    port->resampled = calloc(2 * block_len + 2, sizeof(quiet_sample_t));
+}
+
+static quiet_sample_t channel_tap(const quiet_lwip_channel *c, const channel_port *port, int64_t t) {
+    if (t < 0) {
+        return 0;
+    }
+    return port->history[t % c->history_len];
+}
+
+// mix what every port but `receiver` sent into c->mix, then impair it
+static void channel_mix(quiet_lwip_channel *c, size_t receiver) {
+    size_t block_len = c->conf.block_len;
+    int64_t now = (int64_t)c->elapsed;
+    int64_t direct = (int64_t)c->conf.latency;
+    int64_t echo = direct + (int64_t)c->conf.echo_delay;
+
+    memset(c->mix, 0, block_len * sizeof(quiet_sample_t));
+
+    bool lost = (c->conf.frame_loss > 0) && (channel_uniform(c) <= c->conf.frame_loss);
+
+    if (!lost) {
+        for (size_t i = 0; i < c->num_ports; i++) {
+            if (i == receiver) {
+                continue;
+            }
+            const channel_port *sender = c->ports + i;
+            for (size_t k = 0; k < block_len; k++) {
+                int64_t t = now + (int64_t)k;
+                quiet_sample_t s = channel_tap(c, sender, t - direct);
+                if (c->conf.echo_gain != 0) {
+                    s += c->conf.echo_gain * channel_tap(c, sender, t - echo);
+                }
+                c->mix[k] += c->conf.gain * s;
+            }
+        }
+    }
+
+    if (c->conf.noise_amplitude != 0) {
+        for (size_t k = 0; k < block_len; k++) {
+            c->mix[k] += c->conf.noise_amplitude * channel_gaussian(c);
+        }
+    }
+}
+
+// resample the mixed block to the receiver's clock, linear interpolation is
+//   plenty for offsets of a few hundred ppm
+static size_t channel_resample(quiet_lwip_channel *c, channel_port *port) {
+    size_t block_len = c->conf.block_len;
+    memcpy(port->heard + port->heard_len, c->mix, block_len * sizeof(quiet_sample_t));
+    port->heard_len += block_len;
+
+    double step = 1.0 / (1.0 + c->conf.drift_ppm * 1e-6);
+    size_t n = 0;
+    while (port->heard_pos + 1 < port->heard_len) {
+        size_t i = (size_t)port->heard_pos;
+        double frac = port->heard_pos - i;
+        port->resampled[n++] = (1 - frac) * port->heard[i] + frac * port->heard[i + 1];
+        port->heard_pos += step;
+    }
+
+    size_t consumed = (size_t)port->heard_pos;
+    if (consumed > port->heard_len) {
+        consumed = port->heard_len;
+    }
+    memmove(port->heard, port->heard + consumed, (port->heard_len - consumed) * sizeof(quiet_sample_t));
+    port->heard_len -= consumed;
+    port->heard_pos -= consumed;
+
+    return n;
+}
+
+void quiet_lwip_channel_step(quiet_lwip_channel *c) {
+    size_t block_len = c->conf.block_len;
+    size_t offset = c->elapsed % c->history_len;
+
+    // everyone transmits before anyone listens so a block sent now can be
+    //   heard now when latency is 0
+    for (size_t i = 0; i < c->num_ports; i++) {
+        channel_port *port = c->ports + i;
+        quiet_sample_t *block = port->history + offset;
+        ssize_t written = quiet_lwip_get_next_audio_packet(port->interface, block, block_len);
+        if (written < 0) {
+            written = 0;
+        }
+        if ((size_t)written < block_len) {
+            memset(block + written, 0, (block_len - written) * sizeof(quiet_sample_t));
+        }
+    }
+
+    if (c->conf.clock_rate > 0) {
+        // derive from the sample count rather than adding a rounded step
+        //   each time so that the clock doesn't drift from the audio.
+        //   this happens between sending and hearing the block so that
+        //   receivers get it once it has been fully played, as they would
+        //   from a sound card
+        uint64_t target_us = (uint64_t)((c->elapsed + block_len) * 1e6 / c->conf.clock_rate);
+        sys_clock_advance(target_us - c->clock_advanced_us);
+        c->clock_advanced_us = target_us;
+    }
+
+    for (size_t i = 0; i < c->num_ports; i++) {
+        channel_port *port = c->ports + i;
+        channel_mix(c, i);
+        if (c->conf.drift_ppm == 0) {
+            quiet_lwip_recv_audio_packet(port->interface, c->mix, block_len);
+        } else {
+            size_t n = channel_resample(c, port);
+            quiet_lwip_recv_audio_packet(port->interface, port->resampled, n);
+        }
+    }
+
+    c->elapsed += block_len;
+}
+
+uint64_t quiet_lwip_channel_elapsed(const quiet_lwip_channel *c) {
+    return c->elapsed;
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns) {
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000L;
+    ts->tv_nsec = ns % 1000000000L;
+}
+
+static void *channel_loop(void *c_v) {
+    quiet_lwip_channel *c = (quiet_lwip_channel*)c_v;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t start_elapsed = c->elapsed;
+
+    while (!atomic_load(&c->shutdown)) {
+        quiet_lwip_channel_step(c);
+        if (c->conf.sample_rate > 0) {
+            // pace against the start time rather than per step so that
+            //   oversleeping doesn't accumulate
+            struct timespec deadline = start;
+            double seconds = (c->elapsed - start_elapsed) / c->conf.sample_rate;
+            timespec_add_ns(&deadline, (uint64_t)(seconds * 1e9));
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        }
+    }
+    return NULL;
+}
+
+void quiet_lwip_channel_start(quiet_lwip_channel *c) {
+    if (c->running) {
+        return;
+    }
+    atomic_store(&c->shutdown, false);
+    pthread_create(&c->thread, NULL, channel_loop, c);
+    c->running = true;
+}
+
+void quiet_lwip_channel_stop(quiet_lwip_channel *c) {
+    if (!c->running) {
+        return;
+    }
+    atomic_store(&c->shutdown, true);
+    pthread_join(c->thread, NULL);
+    c->running = false;
+}
+
+void quiet_lwip_channel_destroy(quiet_lwip_channel *c) {
+    quiet_lwip_channel_stop(c);
+    for (size_t i = 0; i < c->num_ports; i++) {
+        free(c->ports[i].history);
+        free(c->ports[i].heard);
+        free(c->ports[i].resampled);
+    }
+    free(c->ports);
+    free(c->mix);
+    free(c);
+}
@@ -1,9 +1,51 @@
 #include "quiet-lwip/driver.h"
 
+// capture or playback time of a sample offset samples after one at base_us
+static uint64_t sample_time(uint64_t base_us, double offset, unsigned int rate) {
+    if (!base_us) {
+        return 0;
+    }
+    double t = base_us + offset * 1e6 / rate;
+    return (t > 1) ? (uint64_t)t : 1;
+}
+
+// lwip -> quiet: hold a tx frame until the encoder is idle
+static err_t quiet_lwip_queue_traced_frame(struct netif *netif, struct pbuf *p) {
+    eth_driver *driver = (eth_driver*)netif->state;
+
+    uint64_t stamp = p->stamp;
+    trace_stage(quiet_lwip_stage_linkoutput, &stamp, trace_now());
+    // tcp keeps this pbuf for retransmission, and a retransmitted segment
+    //   should not be timed from when the application first wrote it
+    p->stamp = 0;
+
+    pthread_mutex_lock(&driver->tx_frames_lock);
+    if (driver->tx_frames_queued - driver->tx_frames_released == driver->tx_frames_len) {
+        pthread_mutex_unlock(&driver->tx_frames_lock);
+        LINK_STATS_INC(link.drop);
+        return ERR_MEM;
+    }
+    traced_frame *f = driver->tx_frames + (driver->tx_frames_queued % driver->tx_frames_len);
+    f->len = pbuf2buf(f->frame, p);
+    f->stamp = stamp;
+    f->first_sample_released = false;
+    trace_stage(quiet_lwip_stage_encoder_queue, &f->stamp, trace_now());
+    driver->tx_frames_queued++;
+    pthread_mutex_unlock(&driver->tx_frames_lock);
+
+    LINK_STATS_INC(link.xmit);
+
+    return ERR_OK;
+}
+
 // lwip -> quiet: convert tx data frame to audio samples
 static err_t quiet_lwip_encode_frame(struct netif *netif, struct pbuf *p) {
     eth_driver *driver = (eth_driver*)netif->state;
 
+    if (driver->trace) {
+        return quiet_lwip_queue_traced_frame(netif, p);
+    }
+
     size_t len = pbuf2buf(driver->send_temp, p);
 
     quiet_encoder_send(driver->encoder, driver->send_temp, len);
@@ -18,22 +60,137 @@ static err_t quiet_lwip_encode_frame(struct netif *netif, struct pbuf *p) {
     return ERR_OK;
 }
 
+// quiet -> hw: fill buf from the encoder, passing it held frames one at a
+//   time. the encoder only comes up short when it runs out of frame, which
+//   shows exactly where each frame ends in the sample stream
+static void quiet_lwip_emit_traced(struct netif *netif, quiet_sample_t *buf, size_t samplebuf_len) {
+    eth_driver *driver = (eth_driver*)netif->state;
+
+    pthread_mutex_lock(&driver->tx_frames_lock);
+    size_t filled = 0;
+    while (filled < samplebuf_len) {
+        traced_frame *f = driver->tx_frames + (driver->tx_frames_encoding % driver->tx_frames_len);
+        if (!driver->tx_encoder_busy) {
+            if (driver->tx_frames_encoding == driver->tx_frames_queued) {
+                break;
+            }
+            quiet_encoder_send(driver->encoder, f->frame, f->len);
+            f->first_sample = driver->tx_samples_emitted + filled;
+            driver->tx_encoder_busy = true;
+        }
+        ssize_t written = quiet_encoder_emit(driver->encoder, buf + filled, samplebuf_len - filled);
+        if (written > 0) {
+            filled += written;
+        }
+        if (filled < samplebuf_len) {
+            f->last_sample = driver->tx_samples_emitted + filled - 1;
+            driver->tx_frames_encoding++;
+            driver->tx_encoder_busy = false;
+        }
+    }
+    memset(buf + filled, 0, (samplebuf_len - filled) * sizeof(quiet_sample_t));
+    driver->tx_samples_emitted += samplebuf_len;
+    pthread_mutex_unlock(&driver->tx_frames_lock);
+}
+
+// quiet -> hw: the caller took the next samples_len samples of the tx
+//   stream for playback starting at now. stamp the frames that begin or end
+//   among them
+static void quiet_lwip_release_traced(struct netif *netif, size_t samples_len, uint64_t now) {
+    eth_driver *driver = (eth_driver*)netif->state;
+
+    pthread_mutex_lock(&driver->tx_frames_lock);
+    uint64_t start = driver->tx_samples_released;
+    uint64_t end = start + samples_len;
+    for (size_t i = driver->tx_frames_released; i < driver->tx_frames_encoding ||
+            (i == driver->tx_frames_encoding && driver->tx_encoder_busy); i++) {
+        traced_frame *f = driver->tx_frames + (i % driver->tx_frames_len);
+        if (!f->first_sample_released) {
+            if (f->first_sample >= end) {
+                break;
+            }
+            trace_stage(quiet_lwip_stage_first_sample_emitted, &f->stamp,
+                        sample_time(now, f->first_sample - start, driver->encoder_rate));
+            f->first_sample_released = true;
+        }
+        if (i == driver->tx_frames_encoding || f->last_sample >= end) {
+            break;
+        }
+        trace_stage(quiet_lwip_stage_last_sample_emitted, &f->stamp,
+                    sample_time(now, f->last_sample - start, driver->encoder_rate));
+        driver->tx_frames_released++;
+    }
+    driver->tx_samples_released = end;
+    pthread_mutex_unlock(&driver->tx_frames_lock);
+}
+
 // quiet -> hw: call user code to send audio samples to hw
 ssize_t quiet_lwip_get_next_audio_packet(struct netif *netif, quiet_sample_t *buf, size_t samplebuf_len) {
     eth_driver *driver = (eth_driver*)netif->state;
+    if (driver->trace) {
+        quiet_lwip_emit_traced(netif, buf, samplebuf_len);
+        quiet_lwip_release_traced(netif, samplebuf_len, trace_now());
+        return samplebuf_len;
+    }
     return quiet_encoder_emit(driver->encoder, buf, samplebuf_len);
 }
 
+// quiet -> hw: top up the tx ring from the encoder and lend the caller
+//   the oldest run of samples
+quiet_sample_t *quiet_lwip_acquire_tx_span(struct netif *netif, size_t *span_len) {
+    eth_driver *driver = (eth_driver*)netif->state;
+    sample_ring *ring = driver->tx_ring;
+
+    // the free region can wrap, so this takes at most two passes
+    for (;;) {
+        size_t free_len;
+        quiet_sample_t *free_span = sample_ring_write_span(ring, &free_len);
+        if (!free_len) {
+            break;
+        }
+        // emit zero-fills whatever it doesn't have frame samples for, so the
+        //   whole span is valid audio either way
+        if (driver->trace) {
+            quiet_lwip_emit_traced(netif, free_span, free_len);
+        } else {
+            quiet_encoder_emit(driver->encoder, free_span, free_len);
+        }
+        sample_ring_write_commit(ring, free_len);
+    }
+
+    return sample_ring_read_span(ring, span_len);
+}
+
+void quiet_lwip_commit_tx_span(struct netif *netif, size_t samples_played) {
+    eth_driver *driver = (eth_driver*)netif->state;
+    if (driver->trace) {
+        quiet_lwip_release_traced(netif, samples_played, trace_now());
+    }
+    sample_ring_read_commit(driver->tx_ring, samples_played);
+}
+
 // quiet -> lwip: pull one received frame out of quiet's receive buffer
 static struct pbuf *quiet_lwip_fetch_single_frame(struct netif *netif) {
     eth_driver *driver = (eth_driver*)netif->state;
-    ssize_t len = quiet_decoder_recv(driver->decoder, driver->recv_temp, driver->recv_temp_len);
-    // XXX negative len (quiet errors)
-    if (!len) {
-        // all done
-        return NULL;
+    struct pbuf *p;
+    rx_buf *buf = rx_pool_take(driver->rx_pool);
+    if (buf) {
+        ssize_t len = quiet_decoder_recv(driver->decoder, rx_buf_frame(buf), driver->frame_len);
+        // XXX negative len (quiet errors)
+        if (len <= 0) {
+            // all done
+            rx_pool_give_back(buf);
+            return NULL;
+        }
+        p = rx_buf_pbuf(buf, len);
+    } else {
+        // lwip is still holding every frame-sized buffer
+        ssize_t len = quiet_decoder_recv(driver->decoder, driver->recv_temp, driver->recv_temp_len);
+        if (len <= 0) {
+            return NULL;
+        }
+        p = buf2pbuf(driver->recv_temp, len);
     }
-    struct pbuf *p = buf2pbuf(driver->recv_temp, len);
     if (!p) {
         LINK_STATS_INC(link.memerr);
         LINK_STATS_INC(link.drop);
@@ -61,13 +218,99 @@ static void quiet_lwip_process_audio(struct netif *netif) {
     }
 }
 
+static const size_t trace_decode_chunk = 1 << 6;
+
+// hw -> quiet: decode samples, the first of which was captured at start_us.
+//   the decoder is fed a few samples at a time so that frames can be stamped
+//   with when their samples were captured to within a chunk
+static void quiet_lwip_decode_traced(struct netif *netif, const quiet_sample_t *buf, size_t samplebuf_len, uint64_t start_us) {
+    eth_driver *driver = (eth_driver*)netif->state;
+
+    for (size_t offset = 0; offset < samplebuf_len; offset += trace_decode_chunk) {
+        size_t chunk_len = samplebuf_len - offset;
+        if (chunk_len > trace_decode_chunk) {
+            chunk_len = trace_decode_chunk;
+        }
+        quiet_decoder_consume(driver->decoder, buf + offset, chunk_len);
+        uint64_t chunk_start = sample_time(start_us, offset, driver->decoder_rate);
+        uint64_t chunk_last = sample_time(start_us, offset + chunk_len - 1, driver->decoder_rate);
+
+        while (true) {
+            struct pbuf *p = quiet_lwip_fetch_single_frame(netif);
+            if (!p) {
+                break;
+            }
+            uint64_t stamp = 0;
+            trace_stage(quiet_lwip_stage_first_sample_decoded, &stamp,
+                        driver->rx_frame_start ? driver->rx_frame_start : chunk_start);
+            trace_stage(quiet_lwip_stage_last_sample_decoded, &stamp, chunk_last);
+            p->stamp = stamp;
+            driver->rx_frame_start = 0;
+            recv_pbuf(netif, p);
+        }
+
+        if (!quiet_decoder_frame_in_progress(driver->decoder)) {
+            driver->rx_frame_start = 0;
+        } else if (!driver->rx_frame_start) {
+            driver->rx_frame_start = chunk_start;
+        }
+    }
+}
+
+// capture time of the first of samplebuf_len samples that ended just now
+static uint64_t capture_start(eth_driver *driver, size_t samplebuf_len) {
+    uint64_t now = trace_now();
+    return now ? sample_time(now, -(double)samplebuf_len, driver->decoder_rate) : 0;
+}
+
 // hw -> quiet: receive audio samples from user/hw and decode to frame
 void quiet_lwip_recv_audio_packet(struct netif *netif, quiet_sample_t *buf, size_t samplebuf_len) {
     eth_driver *driver = (eth_driver*)netif->state;
+    if (driver->trace) {
+        quiet_lwip_decode_traced(netif, buf, samplebuf_len, capture_start(driver, samplebuf_len));
+        return;
+    }
     quiet_decoder_consume(driver->decoder, buf, samplebuf_len);
     quiet_lwip_process_audio(netif);
 }
 
+// hw -> quiet: lend the caller free space in the rx ring
+quiet_sample_t *quiet_lwip_acquire_rx_span(struct netif *netif, size_t *span_len) {
+    eth_driver *driver = (eth_driver*)netif->state;
+    return sample_ring_write_span(driver->rx_ring, span_len);
+}
+
+// hw -> quiet: decode samples the caller captured into the rx ring
+void quiet_lwip_commit_rx_span(struct netif *netif, size_t samples_captured) {
+    eth_driver *driver = (eth_driver*)netif->state;
+    sample_ring *ring = driver->rx_ring;
+    sample_ring_write_commit(ring, samples_captured);
+
+    uint64_t start_us = 0;
+    if (driver->trace) {
+        start_us = capture_start(driver, sample_ring_readable(ring));
+    }
+
+    // the decoder reads straight out of the ring
+    for (size_t decoded = 0; ; ) {
+        size_t span_len;
+        quiet_sample_t *span = sample_ring_read_span(ring, &span_len);
+        if (!span_len) {
+            break;
+        }
+        if (driver->trace) {
+            quiet_lwip_decode_traced(netif, span, span_len,
+                                     sample_time(start_us, decoded, driver->decoder_rate));
+        } else {
+            quiet_decoder_consume(driver->decoder, span, span_len);
+        }
+        sample_ring_read_commit(ring, span_len);
+        decoded += span_len;
+    }
+    if (!driver->trace) {
+        quiet_lwip_process_audio(netif);
+    }
+}
 
 // TODO add capability for quiet to calculate its bps
 // based on frame length, number of samples in frame, sample rate?
@@ -75,6 +318,12 @@ unsigned int calculate_bps(const quiet_encoder *e) {
     return 4000;
 }
 
+static const size_t default_ring_len = 1 << 12;
+
+static const size_t default_rx_pool_len = 32;
+
+static const size_t trace_tx_frames_len = 1 << 6;
+
 static err_t quiet_lwip_init(struct netif *netif) {
     quiet_lwip_driver_config *conf = (quiet_lwip_driver_config*)netif->state;
 
@@ -85,6 +334,8 @@ static err_t quiet_lwip_init(struct netif *netif) {
     eth_driver *driver = calloc(1, sizeof(eth_driver));
     driver->encoder = e;
     driver->decoder = d;
+    driver->encoder_rate = conf->encoder_rate;
+    driver->decoder_rate = conf->decoder_rate;
 
     netif->state = driver;
 
@@ -100,18 +351,108 @@ static err_t quiet_lwip_init(struct netif *netif) {
     netif->hwaddr_len = ETHARP_HWADDR_LEN;
 
     memcpy(netif->hwaddr, conf->hardware_addr, 6);
+    netif->arp_policy = arp_policy_create(&conf->arp);
+    if (conf->arp.mode == quiet_lwip_arp_derived) {
+        arp_derive_hwaddr(netif->ip_addr.addr, netif->hwaddr);
+    }
 
-    netif->mtu = quiet_encoder_get_frame_len(e);
-    driver->send_temp_len = netif->mtu + ETH_PAD_SIZE;
+    // a whole ethernet frame has to fit in one modem frame, so IP gets
+    //   what's left after the ethernet header. tcp sizes its segments and
+    //   udp its unfragmented datagrams from this
+    driver->frame_len = quiet_encoder_get_frame_len(e);
+    netif->mtu = driver->frame_len - PBUF_LINK_HLEN;
+    driver->send_temp_len = driver->frame_len + ETH_PAD_SIZE;
     driver->send_temp = malloc(driver->send_temp_len * sizeof(uint8_t));
-    driver->recv_temp_len = netif->mtu + ETH_PAD_SIZE;
+    driver->recv_temp_len = driver->frame_len + ETH_PAD_SIZE;
     driver->recv_temp = malloc(driver->recv_temp_len * sizeof(uint8_t));
+    driver->rx_pool = rx_pool_create(driver->frame_len, conf->rx_pool_len ? conf->rx_pool_len : default_rx_pool_len);
+
+    driver->tx_ring = sample_ring_create(conf->tx_ring_len ? conf->tx_ring_len : default_ring_len);
+    driver->rx_ring = sample_ring_create(conf->rx_ring_len ? conf->rx_ring_len : default_ring_len);
+
+    driver->trace = trace_enabled();
+    if (driver->trace) {
+        pthread_mutex_init(&driver->tx_frames_lock, NULL);
+        driver->tx_frames_len = trace_tx_frames_len;
+        driver->tx_frames = calloc(driver->tx_frames_len, sizeof(traced_frame));
+        for (size_t i = 0; i < driver->tx_frames_len; i++) {
+            driver->tx_frames[i].frame = malloc(driver->send_temp_len * sizeof(uint8_t));
+        }
+    }
 
-    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_IGMP;
 
     return ERR_OK;
 }
 
+static void set_size(u16_t *dest, size_t size) {
+    if (size) {
+        *dest = (u16_t)size;
+    }
+}
+
+// fill lwip_sizes from conf before lwip is set up. returns false if the
+//   sizes don't fit lwip's fields or don't hang together
+static bool quiet_lwip_set_sizes(const quiet_lwip_stack_config *conf) {
+    const size_t u16_max = 0xffff;
+    if (conf->pbuf_pool_size > u16_max || conf->tcp_pcbs > u16_max ||
+        conf->tcp_listen_pcbs > u16_max || conf->udp_pcbs > u16_max ||
+        conf->netconns > u16_max || conf->tcp_segs > u16_max ||
+        conf->tcp_mss > u16_max || conf->tcp_wnd > u16_max ||
+        conf->tcp_snd_buf > u16_max || conf->heap_size > UINT32_MAX ||
+        conf->tcpip_mbox_size > INT_MAX || conf->recv_mbox_size > INT_MAX ||
+        conf->accept_mbox_size > INT_MAX || conf->arp_entries > ARP_TABLE_MAX ||
+        conf->arp_queue_len > u16_max) {
+        return false;
+    }
+
+    struct lwip_sizes sizes = lwip_sizes;
+    if (conf->heap_size) {
+        sizes.mem_size = (mem_size_t)conf->heap_size;
+    }
+    set_size(&sizes.memp_num[MEMP_PBUF_POOL], conf->pbuf_pool_size);
+    set_size(&sizes.memp_num[MEMP_TCP_PCB], conf->tcp_pcbs);
+    set_size(&sizes.memp_num[MEMP_TCP_PCB_LISTEN], conf->tcp_listen_pcbs);
+    set_size(&sizes.memp_num[MEMP_UDP_PCB], conf->udp_pcbs);
+    set_size(&sizes.memp_num[MEMP_NETCONN], conf->netconns);
+    set_size(&sizes.memp_num[MEMP_TCP_SEG], conf->tcp_segs);
+    if (conf->tcpip_mbox_size) {
+        sizes.tcpip_mbox_size = (int)conf->tcpip_mbox_size;
+    }
+    if (conf->recv_mbox_size) {
+        sizes.raw_recvmbox_size = (int)conf->recv_mbox_size;
+        sizes.udp_recvmbox_size = (int)conf->recv_mbox_size;
+        sizes.tcp_recvmbox_size = (int)conf->recv_mbox_size;
+    }
+    if (conf->accept_mbox_size) {
+        sizes.acceptmbox_size = (int)conf->accept_mbox_size;
+    }
+    set_size(&sizes.arp_table_max, conf->arp_entries);
+    set_size(&sizes.arp_queue_len, conf->arp_queue_len);
+
+    set_size(&sizes.tcp_mss, conf->tcp_mss);
+    set_size(&sizes.tcp_wnd, conf->tcp_wnd);
+    set_size(&sizes.tcp_snd_buf, conf->tcp_snd_buf);
+    if (conf->tcp_mss || conf->tcp_snd_buf) {
+        // same as lwip's default: enough segments for 4 buffers of full ones
+        size_t queuelen = (4 * sizes.tcp_snd_buf + sizes.tcp_mss - 1) / sizes.tcp_mss;
+        if (queuelen > u16_max) {
+            return false;
+        }
+        sizes.tcp_snd_queuelen = (u16_t)queuelen;
+        if (!conf->tcp_segs && sizes.memp_num[MEMP_TCP_SEG] < queuelen) {
+            sizes.memp_num[MEMP_TCP_SEG] = (u16_t)queuelen;
+        }
+    }
+    if (!sizes.tcp_mss || sizes.tcp_wnd < sizes.tcp_mss ||
+        sizes.tcp_snd_buf < 2 * sizes.tcp_mss ||
+        sizes.memp_num[MEMP_TCP_SEG] < sizes.tcp_snd_queuelen) {
+        return false;
+    }
+    lwip_sizes = sizes;
+    return true;
+}
+
 quiet_lwip_interface *quiet_lwip_create(quiet_lwip_driver_config *conf,
                                         quiet_lwip_ipv4_addr local_address,
                                         quiet_lwip_ipv4_addr netmask,
@@ -119,6 +460,9 @@ quiet_lwip_interface *quiet_lwip_create(quiet_lwip_driver_config *conf,
     static bool has_lwip_init = false;
 
     if (!has_lwip_init) {
+        if (conf->stack && !quiet_lwip_set_sizes(conf->stack)) {
+            return NULL;
+        }
         tcpip_init(NULL, NULL);
         has_lwip_init = true;
     }
@@ -135,8 +479,48 @@ quiet_lwip_interface *quiet_lwip_create(quiet_lwip_driver_config *conf,
     return interface;
 }
 
+static void eth_driver_destroy(eth_driver *driver) {
+    quiet_encoder_destroy(driver->encoder);
+    quiet_decoder_destroy(driver->decoder);
+    free(driver->send_temp);
+    free(driver->recv_temp);
+    rx_pool_destroy(driver->rx_pool);
+    sample_ring_destroy(driver->tx_ring);
+    sample_ring_destroy(driver->rx_ring);
+    if (driver->trace) {
+        for (size_t i = 0; i < driver->tx_frames_len; i++) {
+            free(driver->tx_frames[i].frame);
+        }
+        free(driver->tx_frames);
+        pthread_mutex_destroy(&driver->tx_frames_lock);
+    }
+    free(driver);
+}
+
 void quiet_lwip_destroy(quiet_lwip_interface *interface) {
     netif_set_down(interface);
     netif_remove(interface);
+    eth_driver_destroy((eth_driver*)interface->state);
+    arp_policy_destroy(interface->arp_policy);
     free(interface);
 }
+
+uint64_t quiet_lwip_now_us() {
+    return sys_clock_now_us();
+}
+
+bool quiet_lwip_core_lock_stats(quiet_lwip_lock_stats *stats) {
+    memset(stats, 0, sizeof(quiet_lwip_lock_stats));
+#if LWIP_TCPIP_CORE_LOCKING
+    if (sys_mutex_valid(&lock_tcpip_core)) {
+        struct sys_mutex_stats mutex_stats;
+        sys_mutex_stats(&lock_tcpip_core, &mutex_stats);
+        stats->acquisitions = mutex_stats.acquisitions;
+        stats->contended = mutex_stats.contended;
+        stats->wait_ns = mutex_stats.wait_ns;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
@@ -156,6 +156,10 @@ static err_t quiet_lwip_portaudio_init(struct netif *netif) {
     netif->hwaddr_len = ETHARP_HWADDR_LEN;
 
     memcpy(netif->hwaddr, conf->hardware_addr, 6);
+    netif->arp_policy = arp_policy_create(&conf->arp);
+    if (conf->arp.mode == quiet_lwip_arp_derived) {
+        arp_derive_hwaddr(netif->ip_addr.addr, netif->hwaddr);
+    }
 
     size_t frame_len = quiet_portaudio_encoder_get_frame_len(e);
 
@@ -165,7 +169,7 @@ static err_t quiet_lwip_portaudio_init(struct netif *netif) {
     driver->recv_temp_len = frame_len + ETH_PAD_SIZE;
     driver->recv_temp = malloc(driver->recv_temp_len * sizeof(uint8_t));
 
-    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_IGMP;
 
     return ERR_OK;
 }
@@ -196,6 +200,7 @@ quiet_lwip_portaudio_interface *quiet_lwip_portaudio_create(quiet_lwip_portaudio
 void quiet_lwip_portaudio_destroy(quiet_lwip_portaudio_interface *interface) {
     netif_set_down(interface);
     netif_remove(interface);
+    arp_policy_destroy(interface->arp_policy);
     free(interface);
 }
 
@@ -361,6 +361,12 @@ netconn_recv_data(struct netconn *conn, void **new_buf)
        before the fatal error occurred - is that a problem? */
     return err;
   }
+#if LWIP_TCP
+  if (conn->fin_received) {
+    /* nothing more will come, and waiting on recvmbox would be forever */
+    return ERR_CLSD;
+  }
+#endif /* LWIP_TCP */
 
 #if LWIP_SO_RCVTIMEO
   if (sys_arch_mbox_fetch(&conn->recvmbox, &buf, conn->recv_timeout) == SYS_ARCH_TIMEOUT) {
@@ -394,8 +400,9 @@ netconn_recv_data(struct netconn *conn, void **new_buf)
     /* If we are closed, we indicate that we no longer wish to use the socket */
     if (buf == NULL) {
       API_EVENT(conn, NETCONN_EVT_RCVMINUS, 0);
-      /* Avoid to lose any previous error code */
-      NETCONN_SET_SAFE_ERR(conn, ERR_CLSD);
+      /* Only the receive side is closed: a sticky ERR_CLSD in last_err
+         would fail the sends of a half-closed connection too */
+      conn->fin_received = 1;
       return ERR_CLSD;
     }
     len = ((struct pbuf *)buf)->tot_len;
@@ -572,6 +579,7 @@ netconn_send(struct netconn *conn, struct netbuf *buf)
   LWIP_ERROR("netconn_send: invalid conn",  (conn != NULL), return ERR_ARG;);
 
   LWIP_DEBUGF(API_LIB_DEBUG, ("netconn_send: sending %"U16_F" bytes\n", buf->p->tot_len));
+  PBUF_STAMP_SET(buf->p, LWIP_STAMP_NOW());
   msg.function = do_send;
   msg.msg.conn = conn;
   msg.msg.msg.b = buf;
@@ -582,31 +590,35 @@ netconn_send(struct netconn *conn, struct netbuf *buf)
 }
 
 /**
- * Send data over a TCP netconn.
+ * Common part of the netconn_write variants.
  *
- * @param conn the TCP netconn over which to send data
- * @param dataptr pointer to the application buffer that contains the data to send
- * @param size size of the application data to send
- * @param apiflags combination of following flags :
- * - NETCONN_COPY: data will be copied into memory belonging to the stack
- * - NETCONN_MORE: for TCP connection, PSH flag will be set on last segment sent
- * - NETCONN_DONTBLOCK: only write the data if all dat can be written at once
- * @param bytes_written pointer to a location that receives the number of written bytes
- * @return ERR_OK if data was sent, any other err_t on error
+ * @param zc tracker for data sent without copying, or NULL
  */
-err_t
-netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
-                     u8_t apiflags, size_t *bytes_written)
+static err_t
+netconn_write_internal(struct netconn *conn, const struct netvector *vectors,
+                       u16_t vectorcnt, u8_t apiflags, size_t *bytes_written,
+                       struct tcp_zc *zc)
 {
   struct api_msg msg;
   err_t err;
   u8_t dontblock;
+  size_t size;
+  u16_t i;
 
   LWIP_ERROR("netconn_write: invalid conn",  (conn != NULL), return ERR_ARG;);
   LWIP_ERROR("netconn_write: invalid conn->type",  (conn->type == NETCONN_TCP), return ERR_VAL;);
+  size = 0;
+  for (i = 0; i < vectorcnt; i++) {
+    size += vectors[i].len;
+  }
   if (size == 0) {
     return ERR_OK;
   }
+  /* do_write starts with a non-empty buffer */
+  while (vectors->len == 0) {
+    vectors++;
+    vectorcnt--;
+  }
   dontblock = netconn_is_nonblocking(conn) || (apiflags & NETCONN_DONTBLOCK);
   if (dontblock && !bytes_written) {
     /* This implies netconn_write() cannot be used for non-blocking send, since
@@ -617,9 +629,13 @@ netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
   /* non-blocking write sends as much  */
   msg.function = do_write;
   msg.msg.conn = conn;
-  msg.msg.msg.w.dataptr = dataptr;
+  msg.msg.msg.w.dataptr = vectors->ptr;
+  msg.msg.msg.w.len = vectors->len;
+  msg.msg.msg.w.vector = vectors + 1;
+  msg.msg.msg.w.vector_cnt = vectorcnt - 1;
+  msg.msg.msg.w.offset = 0;
   msg.msg.msg.w.apiflags = apiflags;
-  msg.msg.msg.w.len = size;
+  msg.msg.msg.w.zc = zc;
 #if LWIP_SO_SNDTIMEO
   if (conn->send_timeout != 0) {
     /* get the time we started, which is later compared to
@@ -629,6 +645,9 @@ netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
     msg.msg.msg.w.time_started = 0;
   }
 #endif /* LWIP_SO_SNDTIMEO */
+#if LWIP_PBUF_STAMP
+  msg.msg.msg.w.stamp = LWIP_STAMP_NOW();
+#endif /* LWIP_PBUF_STAMP */
 
   /* For locking the core: this _can_ be delayed on low memory/low send buffer,
      but if it is, this is done inside api_msg.c:do_write(), so we can use the
@@ -652,6 +671,125 @@ netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
   return err;
 }
 
+/**
+ * Send several netbufs over a UDP or RAW netconn with a single call into the
+ * tcpip thread. Sending stops at the first netbuf that fails.
+ *
+ * @param conn the UDP or RAW netconn over which to send data
+ * @param bufs the netbufs to send, each with its own destination
+ * @param count number of entries in bufs
+ * @param sent receives the number of netbufs sent
+ * @return ERR_OK if all were sent, else the error of the one that failed
+ */
+err_t
+netconn_send_batch(struct netconn *conn, struct netbuf *bufs, u16_t count, u16_t *sent)
+{
+  struct api_msg msg;
+  err_t err;
+  u16_t i;
+
+  LWIP_ERROR("netconn_send_batch: invalid conn",  (conn != NULL), return ERR_ARG;);
+
+  LWIP_DEBUGF(API_LIB_DEBUG, ("netconn_send_batch: sending %"U16_F" netbufs\n", count));
+  for (i = 0; i < count; i++) {
+    PBUF_STAMP_SET(bufs[i].p, LWIP_STAMP_NOW());
+  }
+  msg.function = do_send_batch;
+  msg.msg.conn = conn;
+  msg.msg.msg.bb.bufs = bufs;
+  msg.msg.msg.bb.count = count;
+  err = TCPIP_APIMSG(&msg);
+  *sent = msg.msg.msg.bb.sent;
+
+  NETCONN_SET_SAFE_ERR(conn, err);
+  return err;
+}
+
+/**
+ * Send data over a TCP netconn.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param dataptr pointer to the application buffer that contains the data to send
+ * @param size size of the application data to send
+ * @param apiflags combination of following flags :
+ * - NETCONN_COPY: data will be copied into memory belonging to the stack
+ * - NETCONN_MORE: for TCP connection, PSH flag will be set on last segment sent
+ * - NETCONN_DONTBLOCK: only write the data if all dat can be written at once
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
+                     u8_t apiflags, size_t *bytes_written)
+{
+  struct netvector vector;
+
+  vector.ptr = dataptr;
+  vector.len = size;
+  return netconn_write_internal(conn, &vector, 1, apiflags, bytes_written, NULL);
+}
+
+/**
+ * Send the contents of several buffers over a TCP netconn, as if they were
+ * concatenated, with a single call into the tcpip thread.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param vectors the buffers to send
+ * @param vectorcnt number of entries in vectors
+ * @param apiflags as for netconn_write_partly()
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_vectors_partly(struct netconn *conn, const struct netvector *vectors,
+                             u16_t vectorcnt, u8_t apiflags, size_t *bytes_written)
+{
+  return netconn_write_internal(conn, vectors, vectorcnt, apiflags, bytes_written, NULL);
+}
+
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/**
+ * Send caller-owned data over a TCP netconn without copying it. The data
+ * must stay untouched until 'done' is called, which happens once every
+ * segment referring to it has been ACKed and freed, or dropped when the
+ * connection went away. 'done' is called exactly once, even on error, and
+ * may run on the tcpip thread, so it must not block or call back into the
+ * netconn or socket API.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param dataptr pointer to the application buffer that contains the data to send
+ * @param size size of the application data to send
+ * @param apiflags as for netconn_write_partly(), except that NETCONN_COPY is ignored
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @param done completion callback
+ * @param arg passed to done
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_zc(struct netconn *conn, const void *dataptr, size_t size,
+                 u8_t apiflags, size_t *bytes_written,
+                 void (*done)(void *arg), void *arg)
+{
+  struct netvector vector;
+  struct tcp_zc *zc;
+  err_t err;
+
+  zc = tcp_zc_new(done, arg);
+  if (zc == NULL) {
+    done(arg);
+    return ERR_MEM;
+  }
+  vector.ptr = dataptr;
+  vector.len = size;
+  err = netconn_write_internal(conn, &vector, 1, apiflags & ~NETCONN_COPY,
+                               bytes_written, zc);
+  /* the segments queued hold their own references from here on */
+  tcp_zc_release(zc);
+  return err;
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
+
 /**
  * Close ot shutdown a TCP netconn (doesn't delete it).
  *
@@ -45,9 +45,11 @@
 #include "lwip/ip.h"
 #include "lwip/udp.h"
 #include "lwip/tcp.h"
+#include "lwip/tcp_impl.h"
 #include "lwip/raw.h"
 
 #include "lwip/memp.h"
+#include "lwip/sizes.h"
 #include "lwip/tcpip.h"
 #include "lwip/igmp.h"
 #include "lwip/dns.h"
@@ -292,8 +294,8 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
   if (conn->flags & NETCONN_FLAG_CHECK_WRITESPACE) {
     /* If the queued byte- or pbuf-count drops below the configured low-water limit,
        let select mark this pcb as writable again. */
-    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > TCP_SNDLOWAT) &&
-      (tcp_sndqueuelen(conn->pcb.tcp) < TCP_SNDQUEUELOWAT)) {
+    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > lwip_sizes.tcp_sndlowat) &&
+      (tcp_sndqueuelen(conn->pcb.tcp) < lwip_sizes.tcp_sndqueuelowat)) {
       conn->flags &= ~NETCONN_FLAG_CHECK_WRITESPACE;
       API_EVENT(conn, NETCONN_EVT_SENDPLUS, 0);
     }
@@ -326,8 +328,8 @@ sent_tcp(void *arg, struct tcp_pcb *pcb, u16_t len)
   if (conn) {
     /* If the queued byte- or pbuf-count drops below the configured low-water limit,
        let select mark this pcb as writable again. */
-    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > TCP_SNDLOWAT) &&
-      (tcp_sndqueuelen(conn->pcb.tcp) < TCP_SNDQUEUELOWAT)) {
+    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > lwip_sizes.tcp_sndlowat) &&
+      (tcp_sndqueuelen(conn->pcb.tcp) < lwip_sizes.tcp_sndqueuelowat)) {
       conn->flags &= ~NETCONN_FLAG_CHECK_WRITESPACE;
       API_EVENT(conn, NETCONN_EVT_SENDPLUS, len);
     }
@@ -583,31 +585,26 @@ netconn_alloc(enum netconn_type t, netconn_callback callback)
   conn->type = t;
   conn->pcb.tcp = NULL;
 
-#if (DEFAULT_RAW_RECVMBOX_SIZE == DEFAULT_UDP_RECVMBOX_SIZE) && \
-    (DEFAULT_RAW_RECVMBOX_SIZE == DEFAULT_TCP_RECVMBOX_SIZE)
-  size = DEFAULT_RAW_RECVMBOX_SIZE;
-#else
   switch(NETCONNTYPE_GROUP(t)) {
 #if LWIP_RAW
   case NETCONN_RAW:
-    size = DEFAULT_RAW_RECVMBOX_SIZE;
+    size = lwip_sizes.raw_recvmbox_size;
     break;
 #endif /* LWIP_RAW */
 #if LWIP_UDP
   case NETCONN_UDP:
-    size = DEFAULT_UDP_RECVMBOX_SIZE;
+    size = lwip_sizes.udp_recvmbox_size;
     break;
 #endif /* LWIP_UDP */
 #if LWIP_TCP
   case NETCONN_TCP:
-    size = DEFAULT_TCP_RECVMBOX_SIZE;
+    size = lwip_sizes.tcp_recvmbox_size;
     break;
 #endif /* LWIP_TCP */
   default:
     LWIP_ASSERT("netconn_alloc: undefined netconn_type", 0);
     goto free_and_return;
   }
-#endif
 
   if (sys_sem_new(&conn->op_completed, 0) != ERR_OK) {
     goto free_and_return;
@@ -641,6 +638,9 @@ netconn_alloc(enum netconn_type t, netconn_callback callback)
   conn->recv_avail   = 0;
 #endif /* LWIP_SO_RCVBUF */
   conn->flags = 0;
+#if LWIP_TCP
+  conn->fin_received = 0;
+#endif /* LWIP_TCP */
   return conn;
 free_and_return:
   memp_free(MEMP_NETCONN, conn);
@@ -1087,7 +1087,7 @@ do_listen(struct api_msg_msg *msg)
             }
             msg->err = ERR_OK;
             if (!sys_mbox_valid(&msg->conn->acceptmbox)) {
-              msg->err = sys_mbox_new(&msg->conn->acceptmbox, DEFAULT_ACCEPTMBOX_SIZE);
+              msg->err = sys_mbox_new(&msg->conn->acceptmbox, lwip_sizes.acceptmbox_size);
             }
             if (msg->err == ERR_OK) {
               msg->conn->state = NETCONN_LISTEN;
@@ -1110,6 +1110,56 @@ do_listen(struct api_msg_msg *msg)
 }
 #endif /* LWIP_TCP */
 
+/**
+ * Send one netbuf on the RAW or UDP pcb of a netconn
+ *
+ * @param conn the netconn to send on
+ * @param buf the data and, unless it is IP_ADDR_ANY, the destination
+ * @return the error returned by raw_send[to]() or udp_send[to]()
+ */
+static err_t
+do_send_netbuf(struct netconn *conn, struct netbuf *buf)
+{
+  err_t err = ERR_CONN;
+
+  if (conn->pcb.tcp != NULL) {
+    switch (NETCONNTYPE_GROUP(conn->type)) {
+#if LWIP_RAW
+    case NETCONN_RAW:
+      if (ip_addr_isany(&buf->addr)) {
+        err = raw_send(conn->pcb.raw, buf->p);
+      } else {
+        err = raw_sendto(conn->pcb.raw, buf->p, &buf->addr);
+      }
+      break;
+#endif
+#if LWIP_UDP
+    case NETCONN_UDP:
+#if LWIP_CHECKSUM_ON_COPY
+      if (ip_addr_isany(&buf->addr)) {
+        err = udp_send_chksum(conn->pcb.udp, buf->p,
+          buf->flags & NETBUF_FLAG_CHKSUM, buf->toport_chksum);
+      } else {
+        err = udp_sendto_chksum(conn->pcb.udp, buf->p,
+          &buf->addr, buf->port,
+          buf->flags & NETBUF_FLAG_CHKSUM, buf->toport_chksum);
+      }
+#else /* LWIP_CHECKSUM_ON_COPY */
+      if (ip_addr_isany(&buf->addr)) {
+        err = udp_send(conn->pcb.udp, buf->p);
+      } else {
+        err = udp_sendto(conn->pcb.udp, buf->p, &buf->addr, buf->port);
+      }
+#endif /* LWIP_CHECKSUM_ON_COPY */
+      break;
+#endif /* LWIP_UDP */
+    default:
+      break;
+    }
+  }
+  return err;
+}
+
 /**
  * Send some data on a RAW or UDP pcb contained in a netconn
  * Called from netconn_send
@@ -1122,40 +1172,30 @@ do_send(struct api_msg_msg *msg)
   if (ERR_IS_FATAL(msg->conn->last_err)) {
     msg->err = msg->conn->last_err;
   } else {
-    msg->err = ERR_CONN;
-    if (msg->conn->pcb.tcp != NULL) {
-      switch (NETCONNTYPE_GROUP(msg->conn->type)) {
-#if LWIP_RAW
-      case NETCONN_RAW:
-        if (ip_addr_isany(&msg->msg.b->addr)) {
-          msg->err = raw_send(msg->conn->pcb.raw, msg->msg.b->p);
-        } else {
-          msg->err = raw_sendto(msg->conn->pcb.raw, msg->msg.b->p, &msg->msg.b->addr);
-        }
-        break;
-#endif
-#if LWIP_UDP
-      case NETCONN_UDP:
-#if LWIP_CHECKSUM_ON_COPY
-        if (ip_addr_isany(&msg->msg.b->addr)) {
-          msg->err = udp_send_chksum(msg->conn->pcb.udp, msg->msg.b->p,
-            msg->msg.b->flags & NETBUF_FLAG_CHKSUM, msg->msg.b->toport_chksum);
-        } else {
-          msg->err = udp_sendto_chksum(msg->conn->pcb.udp, msg->msg.b->p,
-            &msg->msg.b->addr, msg->msg.b->port,
-            msg->msg.b->flags & NETBUF_FLAG_CHKSUM, msg->msg.b->toport_chksum);
-        }
-#else /* LWIP_CHECKSUM_ON_COPY */
-        if (ip_addr_isany(&msg->msg.b->addr)) {
-          msg->err = udp_send(msg->conn->pcb.udp, msg->msg.b->p);
-        } else {
-          msg->err = udp_sendto(msg->conn->pcb.udp, msg->msg.b->p, &msg->msg.b->addr, msg->msg.b->port);
-        }
-#endif /* LWIP_CHECKSUM_ON_COPY */
-        break;
-#endif /* LWIP_UDP */
-      default:
-        break;
+    msg->err = do_send_netbuf(msg->conn, msg->msg.b);
+  }
+  TCPIP_APIMSG_ACK(msg);
+}
+
+/**
+ * Send several netbufs on a RAW or UDP pcb contained in a netconn,
+ * stopping at the first one that fails.
+ * Called from netconn_send_batch
+ *
+ * @param msg the api_msg_msg pointing to the connection
+ */
+void
+do_send_batch(struct api_msg_msg *msg)
+{
+  msg->msg.bb.sent = 0;
+  if (ERR_IS_FATAL(msg->conn->last_err)) {
+    msg->err = msg->conn->last_err;
+  } else {
+    msg->err = ERR_OK;
+    while ((msg->msg.bb.sent < msg->msg.bb.count) && (msg->err == ERR_OK)) {
+      msg->err = do_send_netbuf(msg->conn, &msg->msg.bb.bufs[msg->msg.bb.sent]);
+      if (msg->err == ERR_OK) {
+        msg->msg.bb.sent++;
       }
     }
   }
@@ -1193,6 +1233,57 @@ do_recv(struct api_msg_msg *msg)
   TCPIP_APIMSG_ACK(msg);
 }
 
+#if LWIP_PBUF_STAMP
+/**
+ * Stamp the segments that tcp_write() queued after 'tail' with the time the
+ * application handed over the data.
+ *
+ * @param pcb the pcb that was written to
+ * @param tail the last unsent segment before the write, or NULL
+ * @param stamp time of the write
+ */
+static void
+stamp_new_segments(struct tcp_pcb *pcb, struct tcp_seg *tail, u64_t stamp)
+{
+  struct tcp_seg *seg = (tail != NULL) ? tail->next : pcb->unsent;
+  for (; seg != NULL; seg = seg->next) {
+    PBUF_STAMP_SET(seg->p, stamp);
+  }
+}
+
+static struct tcp_seg *
+last_unsent_segment(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg = pcb->unsent;
+  while ((seg != NULL) && (seg->next != NULL)) {
+    seg = seg->next;
+  }
+  return seg;
+}
+#endif /* LWIP_PBUF_STAMP */
+
+/**
+ * Make the next non-empty buffer of a vectored write the current one, or
+ * leave an empty one if there are none left.
+ *
+ * @param conn netconn (that is currently in state NETCONN_WRITE) to advance
+ */
+static void
+do_nextvector(struct netconn *conn)
+{
+  struct api_msg_msg *msg = conn->current_msg;
+
+  msg->msg.w.offset += msg->msg.w.len;
+  msg->msg.w.len = 0;
+  conn->write_offset = 0;
+  while ((msg->msg.w.len == 0) && (msg->msg.w.vector_cnt > 0)) {
+    msg->msg.w.dataptr = msg->msg.w.vector->ptr;
+    msg->msg.w.len = msg->msg.w.vector->len;
+    msg->msg.w.vector++;
+    msg->msg.w.vector_cnt--;
+  }
+}
+
 /**
  * See if more data needs to be written from a previous call to netconn_write.
  * Called initially from do_write. If the first call can't send all data
@@ -1215,6 +1306,9 @@ do_writemore(struct netconn *conn)
   u8_t dontblock = netconn_is_nonblocking(conn) ||
        (conn->current_msg->msg.w.apiflags & NETCONN_DONTBLOCK);
   u8_t apiflags = conn->current_msg->msg.w.apiflags;
+#if LWIP_PBUF_STAMP
+  struct tcp_seg *tail;
+#endif /* LWIP_PBUF_STAMP */
 
   LWIP_ASSERT("conn != NULL", conn != NULL);
   LWIP_ASSERT("conn->state == NETCONN_WRITE", (conn->state == NETCONN_WRITE));
@@ -1227,18 +1321,23 @@ do_writemore(struct netconn *conn)
   if ((conn->send_timeout != 0) &&
       ((s32_t)(sys_now() - conn->current_msg->msg.w.time_started) >= conn->send_timeout)) {
     write_finished = 1;
-    if (conn->write_offset == 0) {
+    if ((conn->write_offset == 0) && (conn->current_msg->msg.w.offset == 0)) {
       /* nothing has been written */
       err = ERR_WOULDBLOCK;
       conn->current_msg->msg.w.len = 0;
     } else {
       /* partial write */
       err = ERR_OK;
-      conn->current_msg->msg.w.len = conn->write_offset;
+      conn->current_msg->msg.w.len = conn->current_msg->msg.w.offset + conn->write_offset;
     }
   } else
 #endif /* LWIP_SO_SNDTIMEO */
   {
+next_vector:
+    if (conn->current_msg->msg.w.vector_cnt > 0) {
+      /* only push the last buffer */
+      apiflags |= TCP_WRITE_FLAG_MORE;
+    }
     dataptr = (u8_t*)conn->current_msg->msg.w.dataptr + conn->write_offset;
     diff = conn->current_msg->msg.w.len - conn->write_offset;
     if (diff > 0xffffUL) { /* max_u16_t */
@@ -1267,17 +1366,27 @@ do_writemore(struct netconn *conn)
       }
     }
     LWIP_ASSERT("do_writemore: invalid length!", ((conn->write_offset + len) <= conn->current_msg->msg.w.len));
-    err = tcp_write(conn->pcb.tcp, dataptr, len, apiflags);
+#if LWIP_PBUF_STAMP
+    /* only writes being traced carry a stamp, don't walk the queue for others */
+    tail = (conn->current_msg->msg.w.stamp != 0) ? last_unsent_segment(conn->pcb.tcp) : NULL;
+#endif /* LWIP_PBUF_STAMP */
+    err = tcp_write_zc(conn->pcb.tcp, dataptr, len, apiflags, conn->current_msg->msg.w.zc);
+#if LWIP_PBUF_STAMP
+    if ((err == ERR_OK) && (conn->current_msg->msg.w.stamp != 0)) {
+      stamp_new_segments(conn->pcb.tcp, tail, conn->current_msg->msg.w.stamp);
+    }
+#endif /* LWIP_PBUF_STAMP */
     /* if OK or memory error, check available space */
     if ((err == ERR_OK) || (err == ERR_MEM)) {
 err_mem:
-      if (dontblock && (len < conn->current_msg->msg.w.len)) {
-        /* non-blocking write did not write everything: mark the pcb non-writable
-           and let poll_tcp check writable space to mark the pcb writable again */
+      if (dontblock && ((err != ERR_OK) || (len < conn->current_msg->msg.w.len))) {
+        /* non-blocking write did not write everything (or tcp_write ran out of
+           memory): mark the pcb non-writable and let poll_tcp check writable
+           space to mark the pcb writable again */
         API_EVENT(conn, NETCONN_EVT_SENDMINUS, len);
         conn->flags |= NETCONN_FLAG_CHECK_WRITESPACE;
-      } else if ((tcp_sndbuf(conn->pcb.tcp) <= TCP_SNDLOWAT) ||
-                 (tcp_sndqueuelen(conn->pcb.tcp) >= TCP_SNDQUEUELOWAT)) {
+      } else if ((tcp_sndbuf(conn->pcb.tcp) <= lwip_sizes.tcp_sndlowat) ||
+                 (tcp_sndqueuelen(conn->pcb.tcp) >= lwip_sizes.tcp_sndqueuelowat)) {
         /* The queued byte- or pbuf-count exceeds the configured low-water limit,
            let select mark this pcb as non-writable. */
         API_EVENT(conn, NETCONN_EVT_SENDMINUS, len);
@@ -1286,9 +1395,21 @@ err_mem:
 
     if (err == ERR_OK) {
       conn->write_offset += len;
+      if ((conn->write_offset == conn->current_msg->msg.w.len) &&
+          (conn->current_msg->msg.w.vector_cnt > 0)) {
+        /* this buffer is done, go on with the next one while there's room */
+        do_nextvector(conn);
+        if ((conn->current_msg->msg.w.len > 0) && (tcp_sndbuf(conn->pcb.tcp) > 0)) {
+          apiflags = conn->current_msg->msg.w.apiflags;
+          goto next_vector;
+        }
+#if LWIP_TCPIP_CORE_LOCKING
+        conn->flags |= NETCONN_FLAG_WRITE_DELAYED;
+#endif
+      }
       if ((conn->write_offset == conn->current_msg->msg.w.len) || dontblock) {
         /* return sent length */
-        conn->current_msg->msg.w.len = conn->write_offset;
+        conn->current_msg->msg.w.len = conn->current_msg->msg.w.offset + conn->write_offset;
         /* everything was written */
         write_finished = 1;
         conn->write_offset = 0;
@@ -1309,7 +1430,16 @@ err_mem:
       /* On errors != ERR_MEM, we don't try writing any more but return
          the error to the application thread. */
       write_finished = 1;
-      conn->current_msg->msg.w.len = 0;
+      if ((conn->write_offset == 0) && (conn->current_msg->msg.w.offset == 0)) {
+        /* nothing has been written */
+        conn->current_msg->msg.w.len = 0;
+      } else {
+        /* partial write: earlier buffers are already queued, so report them
+           rather than have the caller send them again */
+        err = ERR_OK;
+        conn->current_msg->msg.w.len = conn->current_msg->msg.w.offset + conn->write_offset;
+      }
+      conn->write_offset = 0;
     }
   }
   if (write_finished) {
@@ -57,6 +57,7 @@ static const char *err_strerr[] = {
            "Not connected.",         /* ERR_CONN       -13 */
            "Illegal argument.",      /* ERR_ARG        -14 */
            "Low-level netif error.", /* ERR_IF         -15 */
+           "Too long to send whole.",/* ERR_MSGSIZE    -16 */
 };
 
 /**
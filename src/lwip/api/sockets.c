@@ -52,13 +52,33 @@
 #include "lwip/udp.h"
 #include "lwip/tcpip.h"
 #include "lwip/pbuf.h"
+#include "lwip/ip_pmtu.h"
 #if LWIP_CHECKSUM_ON_COPY
 #include "lwip/inet_chksum.h"
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 
-#define NUM_SOCKETS MEMP_NUM_NETCONN
+/** Sockets are allocated in blocks of this many. A block is never moved or
+ * freed, so a struct lwip_sock stays where it is while the table grows */
+#define SOCKET_BLOCK_SIZE 64
+#define SOCKET_BLOCKS (LWIP_SOCKET_MAX / SOCKET_BLOCK_SIZE)
+
+/** A socket descriptor holds the socket's index in the table in its low
+ * bits and the generation of that slot above them */
+#define SOCKET_INDEX_BITS 16
+#define SOCKET_INDEX_MASK ((1 << SOCKET_INDEX_BITS) - 1)
+#define SOCKET_GENERATION_MASK ((1 << LWIP_SOCKET_GENERATION_BITS) - 1)
+#define SOCKET_FD(index, generation) \
+  ((int)(((generation) & SOCKET_GENERATION_MASK) << SOCKET_INDEX_BITS) | (index))
+
+#if (LWIP_SOCKET_MAX % SOCKET_BLOCK_SIZE) || (LWIP_SOCKET_MAX > (1 << SOCKET_INDEX_BITS))
+#error "LWIP_SOCKET_MAX must be a multiple of 64 and at most 1 << 16"
+#endif
+#if LWIP_SOCKET_GENERATION_BITS > 14
+#error "LWIP_SOCKET_GENERATION_BITS must be at most 14"
+#endif
 
 /** Contains all internal pointers and states used for a socket */
 struct lwip_sock {
@@ -80,6 +100,13 @@ struct lwip_sock {
   int err;
   /** counter of how many threads are waiting for this socket using select */
   int select_waiting;
+  /** called by event_callback(), see lwip_socket_set_event_callback() */
+  void (*event_fn)(int s, void *arg);
+  void *event_arg;
+  /** bumped each time the slot is freed, to tell its descriptors apart */
+  u16_t generation;
+  /** index of the next slot on the free list, -1 at its end */
+  int next_free;
 };
 
 /** Description for a task waiting in select */
@@ -122,8 +149,13 @@ struct lwip_setgetsockopt_data {
   err_t err;
 };
 
-/** The global array of available sockets */
-static struct lwip_sock sockets[NUM_SOCKETS];
+/** The global table of sockets, grown a block at a time */
+static struct lwip_sock *socket_blocks[SOCKET_BLOCKS];
+static int num_socket_blocks;
+/** Free slots, oldest first, so that a closed slot is reused as late as
+ * possible. Protected by SYS_ARCH_PROTECT */
+static int free_sockets_head = -1;
+static int free_sockets_tail = -1;
 /** The global list of tasks waiting for select */
 static struct lwip_select_cb *select_cb_list;
 /** This counter is increased from lwip_select when the list is chagned
@@ -149,6 +181,7 @@ static const int err_to_errno_table[] = {
   ENOTCONN,      /* ERR_CONN       -13     Not connected.           */
   EIO,           /* ERR_ARG        -14     Illegal argument.        */
   -1,            /* ERR_IF         -15     Low-level netif error    */
+  EMSGSIZE,      /* ERR_MSGSIZE    -16     Too long to send whole.  */
 };
 
 #define ERR_TO_ERRNO_TABLE_SIZE \
@@ -186,49 +219,100 @@ lwip_socket_init(void)
 }
 
 /**
- * Map a externally used socket index to the internal socket representation.
+ * Find the slot for a table index.
+ *
+ * @param index index into the socket table
+ * @return the slot or NULL if its block hasn't been allocated
+ */
+static struct lwip_sock *
+socket_slot(int index)
+{
+  struct lwip_sock *block;
+
+  if ((index < 0) || (index >= LWIP_SOCKET_MAX)) {
+    return NULL;
+  }
+  block = socket_blocks[index / SOCKET_BLOCK_SIZE];
+  if (block == NULL) {
+    return NULL;
+  }
+  return &block[index % SOCKET_BLOCK_SIZE];
+}
+
+/**
+ * Same as get_socket but doesn't set errno
  *
  * @param s externally used socket index
  * @return struct lwip_sock for the socket or NULL if not found
  */
 static struct lwip_sock *
-get_socket(int s)
+tryget_socket(int s)
 {
   struct lwip_sock *sock;
 
-  if ((s < 0) || (s >= NUM_SOCKETS)) {
-    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): invalid\n", s));
-    set_errno(EBADF);
+  if (s < 0) {
     return NULL;
   }
-
-  sock = &sockets[s];
-
-  if (!sock->conn) {
-    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): not active\n", s));
-    set_errno(EBADF);
+  sock = socket_slot(s & SOCKET_INDEX_MASK);
+  if ((sock == NULL) || !sock->conn) {
+    return NULL;
+  }
+  /* the slot has been closed and reused since s was handed out */
+  if (SOCKET_FD(s & SOCKET_INDEX_MASK, sock->generation) != s) {
     return NULL;
   }
-
   return sock;
 }
 
 /**
- * Same as get_socket but doesn't set errno
+ * Map a externally used socket index to the internal socket representation.
  *
  * @param s externally used socket index
  * @return struct lwip_sock for the socket or NULL if not found
  */
 static struct lwip_sock *
-tryget_socket(int s)
+get_socket(int s)
 {
-  if ((s < 0) || (s >= NUM_SOCKETS)) {
+  struct lwip_sock *sock;
+
+  sock = tryget_socket(s);
+  if (!sock) {
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): invalid or not active\n", s));
+    set_errno(EBADF);
     return NULL;
   }
-  if (!sockets[s].conn) {
-    return NULL;
+
+  return sock;
+}
+
+/**
+ * Add a block of free slots to the socket table.
+ * Must be called with the table protected.
+ *
+ * @return 0 if the table is full or out of memory
+ */
+static int
+grow_sockets(void)
+{
+  struct lwip_sock *block;
+  int first, i;
+
+  if (num_socket_blocks == SOCKET_BLOCKS) {
+    return 0;
+  }
+  block = (struct lwip_sock *)calloc(SOCKET_BLOCK_SIZE, sizeof(struct lwip_sock));
+  if (block == NULL) {
+    return 0;
+  }
+  first = num_socket_blocks * SOCKET_BLOCK_SIZE;
+  for (i = 0; i < SOCKET_BLOCK_SIZE; i++) {
+    block[i].next_free = (i + 1 < SOCKET_BLOCK_SIZE) ? first + i + 1 : -1;
   }
-  return &sockets[s];
+  socket_blocks[num_socket_blocks++] = block;
+  /* the table only grows when there are no free slots */
+  free_sockets_head = first;
+  free_sockets_tail = first + SOCKET_BLOCK_SIZE - 1;
+  return 1;
 }
 
 /**
@@ -243,41 +327,48 @@ static int
 alloc_socket(struct netconn *newconn, int accepted)
 {
   int i;
+  struct lwip_sock *sock;
   SYS_ARCH_DECL_PROTECT(lev);
 
-  /* allocate a new socket identifier */
-  for (i = 0; i < NUM_SOCKETS; ++i) {
-    /* Protect socket array */
-    SYS_ARCH_PROTECT(lev);
-    if (!sockets[i].conn) {
-      sockets[i].conn       = newconn;
-      /* The socket is not yet known to anyone, so no need to protect
-         after having marked it as used. */
-      SYS_ARCH_UNPROTECT(lev);
-      sockets[i].lastdata   = NULL;
-      sockets[i].lastoffset = 0;
-      sockets[i].rcvevent   = 0;
-      /* TCP sendbuf is empty, but the socket is not yet writable until connected
-       * (unless it has been created by accept()). */
-      sockets[i].sendevent  = (newconn->type == NETCONN_TCP ? (accepted != 0) : 1);
-      sockets[i].errevent   = 0;
-      sockets[i].err        = 0;
-      sockets[i].select_waiting = 0;
-      return i;
-    }
+  /* Protect socket table */
+  SYS_ARCH_PROTECT(lev);
+  if ((free_sockets_head < 0) && !grow_sockets()) {
     SYS_ARCH_UNPROTECT(lev);
+    return -1;
   }
-  return -1;
+  i = free_sockets_head;
+  sock = socket_slot(i);
+  free_sockets_head = sock->next_free;
+  if (free_sockets_head < 0) {
+    free_sockets_tail = -1;
+  }
+  sock->conn       = newconn;
+  /* The socket is not yet known to anyone, so no need to protect
+     after having marked it as used. */
+  SYS_ARCH_UNPROTECT(lev);
+  sock->lastdata   = NULL;
+  sock->lastoffset = 0;
+  sock->rcvevent   = 0;
+  /* TCP sendbuf is empty, but the socket is not yet writable until connected
+   * (unless it has been created by accept()). */
+  sock->sendevent  = (newconn->type == NETCONN_TCP ? (accepted != 0) : 1);
+  sock->errevent   = 0;
+  sock->err        = 0;
+  sock->select_waiting = 0;
+  sock->event_fn   = NULL;
+  sock->event_arg  = NULL;
+  return SOCKET_FD(i, sock->generation);
 }
 
 /** Free a socket. The socket's netconn must have been
  * delete before!
  *
  * @param sock the socket to free
+ * @param s the descriptor of sock
  * @param is_tcp != 0 for TCP sockets, used to free lastdata
  */
 static void
-free_socket(struct lwip_sock *sock, int is_tcp)
+free_socket(struct lwip_sock *sock, int s, int is_tcp)
 {
   void *lastdata;
   SYS_ARCH_DECL_PROTECT(lev);
@@ -287,9 +378,20 @@ free_socket(struct lwip_sock *sock, int is_tcp)
   sock->lastoffset = 0;
   sock->err        = 0;
 
-  /* Protect socket array */
+  /* Protect socket table */
   SYS_ARCH_PROTECT(lev);
   sock->conn       = NULL;
+  sock->event_fn   = NULL;
+  sock->event_arg  = NULL;
+  sock->generation++;
+  /* back of the free list */
+  sock->next_free  = -1;
+  if (free_sockets_tail >= 0) {
+    socket_slot(free_sockets_tail)->next_free = s & SOCKET_INDEX_MASK;
+  } else {
+    free_sockets_head = s & SOCKET_INDEX_MASK;
+  }
+  free_sockets_tail = s & SOCKET_INDEX_MASK;
   SYS_ARCH_UNPROTECT(lev);
   /* don't use 'sock' after this line, as another task might have allocated it */
 
@@ -379,9 +481,9 @@ lwip_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     sock_set_errno(sock, ENFILE);
     return -1;
   }
-  LWIP_ASSERT("invalid socket index", (newsock >= 0) && (newsock < NUM_SOCKETS));
   LWIP_ASSERT("newconn->callback == event_callback", newconn->callback == event_callback);
-  nsock = &sockets[newsock];
+  nsock = tryget_socket(newsock);
+  LWIP_ASSERT("invalid socket index", nsock != NULL);
 
   /* See event_callback: If data comes in right away after an accept, even
    * though the server task might not have created a new socket yet.
@@ -462,7 +564,7 @@ lwip_close(int s)
 
   netconn_delete(sock->conn);
 
-  free_socket(sock, is_tcp);
+  free_socket(sock, s, is_tcp);
   set_errno(0);
   return 0;
 }
@@ -553,6 +655,53 @@ lwip_listen(int s, int backlog)
   return 0;
 }
 
+/**
+ * Get the data left over from the last receive on a socket or, if there is
+ * none, the next buffer from its connection.
+ *
+ * @param sock the socket to receive from
+ * @param flags MSG_DONTWAIT is honoured
+ * @param buf receives a struct pbuf for TCP or a struct netbuf otherwise. It
+ *            is also kept in sock->lastdata.
+ * @return ERR_OK, ERR_WOULDBLOCK or the connection's error
+ */
+static err_t
+lwip_recv_buf(struct lwip_sock *sock, int flags, void **buf)
+{
+  err_t err;
+
+  /* Check if there is data left from the last recv operation. */
+  if (sock->lastdata) {
+    *buf = sock->lastdata;
+    return ERR_OK;
+  }
+
+  /* If this is non-blocking call, then check first */
+  if (((flags & MSG_DONTWAIT) || netconn_is_nonblocking(sock->conn)) &&
+      (sock->rcvevent <= 0)) {
+    return ERR_WOULDBLOCK;
+  }
+
+  /* No data was left from the previous operation, so we try to get
+     some from the network. */
+  if (netconn_type(sock->conn) == NETCONN_TCP) {
+    err = netconn_recv_tcp_pbuf(sock->conn, (struct pbuf **)buf);
+  } else {
+    err = netconn_recv(sock->conn, (struct netbuf **)buf);
+  }
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recv_buf: netconn_recv err=%d, netbuf=%p\n",
+    err, *buf));
+  if (err != ERR_OK) {
+    return err;
+  }
+
+  LWIP_ASSERT("buf != NULL", *buf != NULL);
+  sock->lastdata = *buf;
+  PBUF_STAGE(PBUF_STAGE_READ, (netconn_type(sock->conn) == NETCONN_TCP) ?
+    (struct pbuf *)*buf : ((struct netbuf *)*buf)->p);
+  return ERR_OK;
+}
+
 int
 lwip_recvfrom(int s, void *mem, size_t len, int flags,
         struct sockaddr *from, socklen_t *fromlen)
@@ -575,55 +724,24 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
 
   do {
     LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom: top while sock->lastdata=%p\n", sock->lastdata));
-    /* Check if there is data left from the last recv operation. */
-    if (sock->lastdata) {
-      buf = sock->lastdata;
-    } else {
-      /* If this is non-blocking call, then check first */
-      if (((flags & MSG_DONTWAIT) || netconn_is_nonblocking(sock->conn)) && 
-          (sock->rcvevent <= 0)) {
-        if (off > 0) {
-          /* update receive window */
-          netconn_recved(sock->conn, (u32_t)off);
-          /* already received data, return that */
-          sock_set_errno(sock, 0);
-          return off;
-        }
-        LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d): returning EWOULDBLOCK\n", s));
-        sock_set_errno(sock, EWOULDBLOCK);
-        return -1;
+    err = lwip_recv_buf(sock, flags, &buf);
+    if (err != ERR_OK) {
+      if (off > 0) {
+        /* update receive window */
+        netconn_recved(sock->conn, (u32_t)off);
+        /* already received data, return that */
+        sock_set_errno(sock, 0);
+        return off;
       }
-
-      /* No data was left from the previous operation, so we try to get
-         some from the network. */
-      if (netconn_type(sock->conn) == NETCONN_TCP) {
-        err = netconn_recv_tcp_pbuf(sock->conn, (struct pbuf **)&buf);
+      /* We should really do some error checking here. */
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d): buf == NULL, error is \"%s\"!\n",
+        s, lwip_strerr(err)));
+      sock_set_errno(sock, err_to_errno(err));
+      if (err == ERR_CLSD) {
+        return 0;
       } else {
-        err = netconn_recv(sock->conn, (struct netbuf **)&buf);
-      }
-      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom: netconn_recv err=%d, netbuf=%p\n",
-        err, buf));
-
-      if (err != ERR_OK) {
-        if (off > 0) {
-          /* update receive window */
-          netconn_recved(sock->conn, (u32_t)off);
-          /* already received data, return that */
-          sock_set_errno(sock, 0);
-          return off;
-        }
-        /* We should really do some error checking here. */
-        LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d): buf == NULL, error is \"%s\"!\n",
-          s, lwip_strerr(err)));
-        sock_set_errno(sock, err_to_errno(err));
-        if (err == ERR_CLSD) {
-          return 0;
-        } else {
-          return -1;
-        }
+        return -1;
       }
-      LWIP_ASSERT("buf != NULL", buf != NULL);
-      sock->lastdata = buf;
     }
 
     if (netconn_type(sock->conn) == NETCONN_TCP) {
@@ -738,6 +856,110 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
   return off;
 }
 
+/**
+ * Receive without copying: describe the received data in place with iovecs
+ * into lwIP's own buffers. The caller holds a reference to those buffers
+ * until it calls lwip_recv_zc_release(). As with lwip_recv(), a TCP receive
+ * opens the window by the amount returned straight away.
+ *
+ * @param s the socket to receive from
+ * @param zc receives the handle to release, left untouched if nothing is returned
+ * @param iov array to fill
+ * @param iovcnt capacity of iov on input, entries filled on output. TCP data
+ *        that doesn't fit is left for the next receive, while the rest of a
+ *        datagram is discarded.
+ * @param flags MSG_DONTWAIT and MSG_PEEK are honoured
+ * @return number of bytes described by iov, 0 at end of stream or -1 on error
+ */
+int
+lwip_recv_zc(int s, struct lwip_zc_buf **zc, struct iovec *iov, int *iovcnt, int flags)
+{
+  struct lwip_sock *sock;
+  void             *buf = NULL;
+  struct pbuf      *p, *q;
+  u16_t            offset;
+  int              n = 0;
+  int              len = 0;
+  err_t            err;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recv_zc(%d, 0x%x)\n", s, flags));
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+  if ((zc == NULL) || (iov == NULL) || (iovcnt == NULL) || (*iovcnt <= 0)) {
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+  }
+
+  err = lwip_recv_buf(sock, flags, &buf);
+  if (err != ERR_OK) {
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recv_zc(%d): error is \"%s\"!\n",
+      s, lwip_strerr(err)));
+    sock_set_errno(sock, err_to_errno(err));
+    return (err == ERR_CLSD) ? 0 : -1;
+  }
+
+  if (netconn_type(sock->conn) == NETCONN_TCP) {
+    p = (struct pbuf *)buf;
+  } else {
+    p = ((struct netbuf *)buf)->p;
+  }
+
+  /* skip what earlier receives have already taken */
+  offset = sock->lastoffset;
+  for (q = p; (q != NULL) && (offset >= q->len); q = q->next) {
+    offset -= q->len;
+  }
+  for (; (q != NULL) && (n < *iovcnt); q = q->next) {
+    if (q->len > offset) {
+      iov[n].iov_base = (u8_t *)q->payload + offset;
+      iov[n].iov_len = q->len - offset;
+      len += q->len - offset;
+      n++;
+    }
+    offset = 0;
+  }
+
+  /* the handle keeps the chain alive after the socket lets go of it */
+  pbuf_ref(p);
+  *zc = (struct lwip_zc_buf *)p;
+  *iovcnt = n;
+
+  if ((flags & MSG_PEEK) == 0) {
+    if ((netconn_type(sock->conn) == NETCONN_TCP) &&
+        (sock->lastoffset + len < p->tot_len)) {
+      sock->lastoffset += (u16_t)len;
+    } else {
+      sock->lastdata = NULL;
+      sock->lastoffset = 0;
+      if (netconn_type(sock->conn) == NETCONN_TCP) {
+        pbuf_free(p);
+      } else {
+        netbuf_delete((struct netbuf *)buf);
+      }
+    }
+    if ((netconn_type(sock->conn) == NETCONN_TCP) && (len > 0)) {
+      /* update receive window */
+      netconn_recved(sock->conn, (u32_t)len);
+    }
+  }
+
+  sock_set_errno(sock, 0);
+  return len;
+}
+
+/**
+ * Give back buffers lent out by lwip_recv_zc().
+ */
+void
+lwip_recv_zc_release(struct lwip_zc_buf *zc)
+{
+  if (zc != NULL) {
+    pbuf_free((struct pbuf *)zc);
+  }
+}
+
 int
 lwip_read(int s, void *mem, size_t len)
 {
@@ -786,6 +1008,52 @@ lwip_send(int s, const void *data, size_t size, int flags)
   return (err == ERR_OK ? (int)written : -1);
 }
 
+/**
+ * Send data without copying it into the stack. 'data' must stay untouched
+ * until 'done' has been called, which for TCP happens once all of it has
+ * been ACKed (or the connection went away). 'done' is called exactly once,
+ * also on error, and may be called from the tcpip thread.
+ *
+ * @return number of bytes queued or -1 on error
+ */
+int
+lwip_send_zc(int s, const void *data, size_t size, int flags,
+             void (*done)(void *arg), void *arg)
+{
+  struct lwip_sock *sock;
+  err_t err;
+  u8_t write_flags;
+  size_t written;
+  int ret;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_zc(%d, data=%p, size=%"SZT_F", flags=0x%x)\n",
+                              s, data, size, flags));
+
+  sock = get_socket(s);
+  if (!sock) {
+    done(arg);
+    return -1;
+  }
+
+  if (sock->conn->type != NETCONN_TCP) {
+    /* datagrams are sent by reference and have left the stack (or been
+       copied into the ARP queue) by the time lwip_sendto() returns */
+    ret = lwip_send(s, data, size, flags);
+    done(arg);
+    return ret;
+  }
+
+  write_flags =
+    ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
+    ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
+  written = 0;
+  err = netconn_write_zc(sock->conn, data, size, write_flags, &written, done, arg);
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_zc(%d) err=%d written=%"SZT_F"\n", s, err, written));
+  sock_set_errno(sock, err_to_errno(err));
+  return (err == ERR_OK ? (int)written : -1);
+}
+
 int
 lwip_sendto(int s, const void *data, size_t size, int flags,
        const struct sockaddr *to, socklen_t tolen)
@@ -795,9 +1063,7 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
   u16_t short_size;
   const struct sockaddr_in *to_in;
   u16_t remote_port;
-#if !LWIP_TCPIP_CORE_LOCKING
   struct netbuf buf;
-#endif
 
   sock = get_socket(s);
   if (!sock) {
@@ -823,75 +1089,6 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
              sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
   to_in = (const struct sockaddr_in *)(void*)to;
 
-#if LWIP_TCPIP_CORE_LOCKING
-  /* Should only be consider like a sample or a simple way to experiment this option (no check of "to" field...) */
-  {
-    struct pbuf* p;
-    ip_addr_t *remote_addr;
-
-#if LWIP_NETIF_TX_SINGLE_PBUF
-    p = pbuf_alloc(PBUF_TRANSPORT, short_size, PBUF_RAM);
-    if (p != NULL) {
-#if LWIP_CHECKSUM_ON_COPY
-      u16_t chksum = 0;
-      if (sock->conn->type != NETCONN_RAW) {
-        chksum = LWIP_CHKSUM_COPY(p->payload, data, short_size);
-      } else
-#endif /* LWIP_CHECKSUM_ON_COPY */
-      MEMCPY(p->payload, data, size);
-#else /* LWIP_NETIF_TX_SINGLE_PBUF */
-    p = pbuf_alloc(PBUF_TRANSPORT, short_size, PBUF_REF);
-    if (p != NULL) {
-      p->payload = (void*)data;
-#endif /* LWIP_NETIF_TX_SINGLE_PBUF */
-
-      if (to_in != NULL) {
-        inet_addr_to_ipaddr_p(remote_addr, &to_in->sin_addr);
-        remote_port = ntohs(to_in->sin_port);
-      } else {
-        remote_addr = &sock->conn->pcb.ip->remote_ip;
-#if LWIP_UDP
-        if (NETCONNTYPE_GROUP(sock->conn->type) == NETCONN_UDP) {
-          remote_port = sock->conn->pcb.udp->remote_port;
-        } else
-#endif /* LWIP_UDP */
-        {
-          remote_port = 0;
-        }
-      }
-
-      LOCK_TCPIP_CORE();
-      if (netconn_type(sock->conn) == NETCONN_RAW) {
-#if LWIP_RAW
-        err = sock->conn->last_err = raw_sendto(sock->conn->pcb.raw, p, remote_addr);
-#else /* LWIP_RAW */
-        err = ERR_ARG;
-#endif /* LWIP_RAW */
-      }
-#if LWIP_UDP && LWIP_RAW
-      else
-#endif /* LWIP_UDP && LWIP_RAW */
-      {
-#if LWIP_UDP
-#if LWIP_CHECKSUM_ON_COPY && LWIP_NETIF_TX_SINGLE_PBUF
-        err = sock->conn->last_err = udp_sendto_chksum(sock->conn->pcb.udp, p,
-          remote_addr, remote_port, 1, chksum);
-#else /* LWIP_CHECKSUM_ON_COPY && LWIP_NETIF_TX_SINGLE_PBUF */
-        err = sock->conn->last_err = udp_sendto(sock->conn->pcb.udp, p,
-          remote_addr, remote_port);
-#endif /* LWIP_CHECKSUM_ON_COPY && LWIP_NETIF_TX_SINGLE_PBUF */
-#else /* LWIP_UDP */
-        err = ERR_ARG;
-#endif /* LWIP_UDP */
-      }
-      UNLOCK_TCPIP_CORE();
-      
-      pbuf_free(p);
-    } else {
-      err = ERR_MEM;
-    }
-  }
-#else /* LWIP_TCPIP_CORE_LOCKING */
   /* initialize a buffer */
   buf.p = buf.ptr = NULL;
 #if LWIP_CHECKSUM_ON_COPY
@@ -920,9 +1117,9 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
   } else {
 #if LWIP_CHECKSUM_ON_COPY
     if (sock->conn->type != NETCONN_RAW) {
-      u16_t chksum = LWIP_CHKSUM_COPY(buf.p->payload, data, short_size);
+      u16_t chksum;
+      err = pbuf_take_chksum(buf.p, data, short_size, &chksum);
       netbuf_set_chksum(&buf, chksum);
-      err = ERR_OK;
     } else
 #endif /* LWIP_CHECKSUM_ON_COPY */
     {
@@ -930,6 +1127,8 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
     }
   }
 #else /* LWIP_NETIF_TX_SINGLE_PBUF */
+  /* The data is sent by reference and checksummed where it lies, so there
+     is no copy here for the checksum to ride along with. */
   err = netbuf_ref(&buf, data, short_size);
 #endif /* LWIP_NETIF_TX_SINGLE_PBUF */
   if (err == ERR_OK) {
@@ -939,7 +1138,6 @@ lwip_sendto(int s, const void *data, size_t size, int flags,
 
   /* deallocated the buffer */
   netbuf_free(&buf);
-#endif /* LWIP_TCPIP_CORE_LOCKING */
   sock_set_errno(sock, err_to_errno(err));
   return (err == ERR_OK ? short_size : -1);
 }
@@ -1006,6 +1204,422 @@ lwip_write(int s, const void *data, size_t size)
   return lwip_send(s, data, size, 0);
 }
 
+/**
+ * Fill in the address of the peer of a TCP socket or the sender of a
+ * datagram, truncated to *namelen.
+ *
+ * @param sock the socket received from
+ * @param buf the netbuf received on a UDP or RAW socket
+ * @param name receives a struct sockaddr_in
+ * @param namelen size of name on input, bytes written on output
+ */
+static void
+lwip_fill_sockaddr(struct lwip_sock *sock, void *buf, void *name, socklen_t *namelen)
+{
+  struct sockaddr_in sin;
+  ip_addr_t fromaddr;
+  ip_addr_t *addr;
+  u16_t port;
+
+  if (netconn_type(sock->conn) == NETCONN_TCP) {
+    addr = &fromaddr;
+    netconn_getaddr(sock->conn, addr, &port, 0);
+  } else {
+    addr = netbuf_fromaddr((struct netbuf *)buf);
+    port = netbuf_fromport((struct netbuf *)buf);
+  }
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_len = sizeof(sin);
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  inet_addr_from_ipaddr(&sin.sin_addr, addr);
+
+  if (*namelen > sizeof(sin)) {
+    *namelen = sizeof(sin);
+  }
+  MEMCPY(name, &sin, *namelen);
+}
+
+/**
+ * Receive into the buffers of a msghdr. For TCP this keeps filling them
+ * while data is queued, for UDP and RAW it takes one datagram and sets
+ * MSG_TRUNC in msg_flags if it didn't fit.
+ */
+static int
+lwip_recvmsg_internal(struct lwip_sock *sock, struct msghdr *msg, int flags)
+{
+  void        *buf = NULL;
+  struct pbuf *p;
+  u16_t       buflen, copylen, copied;
+  size_t      room, iov_off = 0;
+  int         iov = 0;
+  int         off = 0;
+  u8_t        done = 0;
+  u8_t        is_tcp = (netconn_type(sock->conn) == NETCONN_TCP);
+  err_t       err;
+
+  msg->msg_flags = 0;
+  msg->msg_controllen = 0;
+
+  do {
+    err = lwip_recv_buf(sock, flags, &buf);
+    if (err != ERR_OK) {
+      if (off > 0) {
+        /* already received data, return that */
+        break;
+      }
+      sock_set_errno(sock, err_to_errno(err));
+      return (err == ERR_CLSD) ? 0 : -1;
+    }
+
+    p = is_tcp ? (struct pbuf *)buf : ((struct netbuf *)buf)->p;
+    buflen = p->tot_len - sock->lastoffset;
+
+    /* scatter over whatever is left of the buffers */
+    copied = 0;
+    while ((copied < buflen) && (iov < msg->msg_iovlen)) {
+      room = msg->msg_iov[iov].iov_len - iov_off;
+      copylen = (room < (size_t)(buflen - copied)) ? (u16_t)room : (u16_t)(buflen - copied);
+      pbuf_copy_partial(p, (u8_t*)msg->msg_iov[iov].iov_base + iov_off, copylen,
+                        sock->lastoffset + copied);
+      copied += copylen;
+      iov_off += copylen;
+      if (iov_off == msg->msg_iov[iov].iov_len) {
+        iov++;
+        iov_off = 0;
+      }
+    }
+    off += copied;
+
+    if (is_tcp) {
+      if ((iov == msg->msg_iovlen) ||
+          (p->flags & PBUF_FLAG_PUSH) ||
+          (sock->rcvevent <= 0) ||
+          ((flags & MSG_PEEK) != 0)) {
+        done = 1;
+      }
+    } else {
+      done = 1;
+      if (copied < buflen) {
+        msg->msg_flags |= MSG_TRUNC;
+      }
+    }
+
+    if (done && (msg->msg_name != NULL)) {
+      lwip_fill_sockaddr(sock, buf, msg->msg_name, &msg->msg_namelen);
+    }
+
+    if ((flags & MSG_PEEK) == 0) {
+      if (is_tcp && (buflen - copied > 0)) {
+        sock->lastdata = buf;
+        sock->lastoffset += copied;
+      } else {
+        sock->lastdata = NULL;
+        sock->lastoffset = 0;
+        if (is_tcp) {
+          pbuf_free((struct pbuf *)buf);
+        } else {
+          netbuf_delete((struct netbuf *)buf);
+        }
+      }
+    }
+  } while (!done);
+
+  if ((off > 0) && ((flags & MSG_PEEK) == 0)) {
+    /* update receive window */
+    netconn_recved(sock->conn, (u32_t)off);
+  }
+  sock_set_errno(sock, 0);
+  return off;
+}
+
+int
+lwip_recvmsg(int s, struct msghdr *msg, int flags)
+{
+  struct lwip_sock *sock;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvmsg(%d, %p, 0x%x)\n", s, (void *)msg, flags));
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+  LWIP_ERROR("lwip_recvmsg: invalid msghdr", (msg != NULL) && (msg->msg_iovlen >= 0),
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  return lwip_recvmsg_internal(sock, msg, flags);
+}
+
+int
+lwip_readv(int s, const struct iovec *iov, int iovcnt)
+{
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  return lwip_recvmsg(s, &msg, 0);
+}
+
+/**
+ * Receive up to vlen messages. Only the first one is waited for (as allowed
+ * by flags), the rest are taken only if they are queued already. On a TCP
+ * socket each message holds what one lwip_recvmsg() would return.
+ *
+ * @return number of messages received, with msg_len set for each, or -1 if
+ *         not even the first could be
+ */
+int
+lwip_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+  struct lwip_sock *sock;
+  unsigned int i;
+  int ret;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvmmsg(%d, %p, %u, 0x%x)\n", s, (void *)msgvec, vlen, flags));
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  for (i = 0; i < vlen; i++) {
+    ret = lwip_recvmsg_internal(sock, &msgvec[i].msg_hdr, flags);
+    if (ret < 0) {
+      if (i == 0) {
+        return -1;
+      }
+      sock_set_errno(sock, 0);
+      break;
+    }
+    if ((ret == 0) && (netconn_type(sock->conn) == NETCONN_TCP)) {
+      /* end of stream (or no room) ends the batch */
+      break;
+    }
+    msgvec[i].msg_len = (unsigned int)ret;
+    flags |= MSG_DONTWAIT;
+  }
+  return (int)i;
+}
+
+/**
+ * Point a netbuf at the buffers and destination of a message to send on a
+ * UDP or RAW socket. The data is referenced, not copied, unless
+ * LWIP_NETIF_TX_SINGLE_PBUF asks for it in one piece. The caller must
+ * netbuf_free() it, also on error.
+ */
+static err_t
+lwip_msg_to_netbuf(struct lwip_sock *sock, const struct msghdr *msg, struct netbuf *buf)
+{
+  const struct sockaddr_in *to_in;
+  size_t size = 0;
+  int i;
+#if LWIP_NETIF_TX_SINGLE_PBUF
+  u16_t off = 0;
+#else /* LWIP_NETIF_TX_SINGLE_PBUF */
+  struct pbuf *p;
+  err_t err;
+#endif /* LWIP_NETIF_TX_SINGLE_PBUF */
+
+  LWIP_UNUSED_ARG(sock);
+
+  buf->p = buf->ptr = NULL;
+#if LWIP_CHECKSUM_ON_COPY
+  buf->flags = 0;
+#endif /* LWIP_CHECKSUM_ON_COPY */
+
+  if ((msg->msg_iovlen < 0) ||
+      ((msg->msg_name != NULL) &&
+       ((msg->msg_namelen != sizeof(struct sockaddr_in)) ||
+        (((const struct sockaddr *)msg->msg_name)->sa_family != AF_INET) ||
+        ((((mem_ptr_t)msg->msg_name) % 4) != 0)))) {
+    return ERR_ARG;
+  }
+  for (i = 0; i < msg->msg_iovlen; i++) {
+    size += msg->msg_iov[i].iov_len;
+  }
+  if (size > 0xffff) {
+    return ERR_VAL;
+  }
+
+  to_in = (const struct sockaddr_in *)msg->msg_name;
+  if (to_in != NULL) {
+    inet_addr_to_ipaddr(&buf->addr, &to_in->sin_addr);
+    netbuf_fromport(buf) = ntohs(to_in->sin_port);
+  } else {
+    ip_addr_set_any(&buf->addr);
+    netbuf_fromport(buf) = 0;
+  }
+
+#if LWIP_NETIF_TX_SINGLE_PBUF
+  if (netbuf_alloc(buf, (u16_t)size) == NULL) {
+    return ERR_MEM;
+  }
+  for (i = 0; i < msg->msg_iovlen; i++) {
+    MEMCPY((u8_t*)buf->p->payload + off, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+    off += (u16_t)msg->msg_iov[i].iov_len;
+  }
+#else /* LWIP_NETIF_TX_SINGLE_PBUF */
+  for (i = 0; i < msg->msg_iovlen; i++) {
+    if (msg->msg_iov[i].iov_len == 0) {
+      continue;
+    }
+    if (buf->p == NULL) {
+      err = netbuf_ref(buf, msg->msg_iov[i].iov_base, (u16_t)msg->msg_iov[i].iov_len);
+      if (err != ERR_OK) {
+        return err;
+      }
+    } else {
+      p = pbuf_alloc(PBUF_RAW, (u16_t)msg->msg_iov[i].iov_len, PBUF_REF);
+      if (p == NULL) {
+        return ERR_MEM;
+      }
+      p->payload = msg->msg_iov[i].iov_base;
+      pbuf_cat(buf->p, p);
+    }
+  }
+  if (buf->p == NULL) {
+    /* an empty datagram */
+    return netbuf_ref(buf, NULL, 0);
+  }
+#endif /* LWIP_NETIF_TX_SINGLE_PBUF */
+  return ERR_OK;
+}
+
+int
+lwip_sendmsg(int s, const struct msghdr *msg, int flags)
+{
+  struct lwip_sock *sock;
+  struct netbuf buf;
+  err_t err;
+  u8_t write_flags;
+  size_t written;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_sendmsg(%d, %p, 0x%x)\n", s, (const void *)msg, flags));
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+  LWIP_ERROR("lwip_sendmsg: invalid msghdr", (msg != NULL) &&
+             (msg->msg_iovlen >= 0) && (msg->msg_iovlen <= 0xffff),
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  if (sock->conn->type == NETCONN_TCP) {
+#if LWIP_TCP
+    write_flags = NETCONN_COPY |
+      ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
+      ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
+    written = 0;
+    /* struct netvector is laid out like struct iovec */
+    err = netconn_write_vectors_partly(sock->conn, (const struct netvector *)msg->msg_iov,
+                                       (u16_t)msg->msg_iovlen, write_flags, &written);
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_sendmsg(%d) err=%d written=%"SZT_F"\n", s, err, written));
+    sock_set_errno(sock, err_to_errno(err));
+    return (err == ERR_OK ? (int)written : -1);
+#else /* LWIP_TCP */
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+#endif /* LWIP_TCP */
+  }
+
+  LWIP_UNUSED_ARG(write_flags);
+  err = lwip_msg_to_netbuf(sock, msg, &buf);
+  if (err == ERR_OK) {
+    written = buf.p->tot_len;
+    err = netconn_send(sock->conn, &buf);
+  }
+  netbuf_free(&buf);
+  sock_set_errno(sock, err_to_errno(err));
+  return (err == ERR_OK ? (int)written : -1);
+}
+
+int
+lwip_writev(int s, const struct iovec *iov, int iovcnt)
+{
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  return lwip_sendmsg(s, &msg, 0);
+}
+
+/**
+ * Send up to vlen messages. Datagrams are handed to the tcpip thread
+ * LWIP_SENDMMSG_BATCH at a time; on TCP each message is one lwip_sendmsg().
+ *
+ * @return number of messages sent, with msg_len set for each, or -1 if not
+ *         even the first could be
+ */
+int
+lwip_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+  struct lwip_sock *sock;
+  struct netbuf bufs[LWIP_SENDMMSG_BATCH];
+  u16_t lens[LWIP_SENDMMSG_BATCH];
+  unsigned int i = 0;
+  u16_t n, sent, j;
+  err_t err = ERR_OK, send_err;
+  int ret;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_sendmmsg(%d, %p, %u, 0x%x)\n", s, (void *)msgvec, vlen, flags));
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  if (sock->conn->type == NETCONN_TCP) {
+    for (i = 0; i < vlen; i++) {
+      ret = lwip_sendmsg(s, &msgvec[i].msg_hdr, flags);
+      if (ret < 0) {
+        if (i == 0) {
+          return -1;
+        }
+        break;
+      }
+      msgvec[i].msg_len = (unsigned int)ret;
+    }
+    sock_set_errno(sock, 0);
+    return (int)i;
+  }
+
+  while ((i < vlen) && (err == ERR_OK)) {
+    for (n = 0; (n < LWIP_SENDMMSG_BATCH) && (i + n < vlen); n++) {
+      err = lwip_msg_to_netbuf(sock, &msgvec[i + n].msg_hdr, &bufs[n]);
+      if (err != ERR_OK) {
+        netbuf_free(&bufs[n]);
+        break;
+      }
+      lens[n] = bufs[n].p->tot_len;
+    }
+    if ((err == ERR_MEM) && (n > 0)) {
+      /* out of pbufs: send what we have, which frees them, and go on */
+      err = ERR_OK;
+    }
+    sent = 0;
+    if (n > 0) {
+      send_err = netconn_send_batch(sock->conn, bufs, n, &sent);
+      if (send_err != ERR_OK) {
+        err = send_err;
+      }
+    }
+    for (j = 0; j < n; j++) {
+      if (j < sent) {
+        msgvec[i + j].msg_len = lens[j];
+      }
+      netbuf_free(&bufs[j]);
+    }
+    i += sent;
+  }
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_sendmmsg(%d) err=%d sent=%u\n", s, err, i));
+  if ((i == 0) && (err != ERR_OK)) {
+    sock_set_errno(sock, err_to_errno(err));
+    return -1;
+  }
+  sock_set_errno(sock, 0);
+  return (int)i;
+}
+
 /**
  * Go through the readset and writeset lists and see which socket of the sockets
  * set in the sets has events. On return, readset, writeset and exceptset have
@@ -1102,6 +1716,12 @@ lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
                   timeout ? (s32_t)timeout->tv_sec : (s32_t)-1,
                   timeout ? (s32_t)timeout->tv_usec : (s32_t)-1));
 
+  if ((maxfdp1 < 0) || (maxfdp1 > FD_SETSIZE)) {
+    /* the sets have no bits for these descriptors */
+    set_errno(EINVAL);
+    return -1;
+  }
+
   /* Go through each socket in each list to count number of sockets which
      currently match */
   nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
@@ -1306,6 +1926,15 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
       break;
   }
 
+  /* only news the callback can act on: the MINUS events come from the
+     socket's own user running out of data or room, and passing those on
+     would have it wake itself up forever */
+  if (sock->event_fn != NULL && evt != NETCONN_EVT_RCVMINUS && evt != NETCONN_EVT_SENDMINUS) {
+    /* still protected, so that the callback is done with its argument by
+       the time lwip_socket_set_event_callback() replaces it */
+    sock->event_fn(s, sock->event_arg);
+  }
+
   if (sock->select_waiting == 0) {
     /* noone is waiting for this socket, no need to check select_cb_list */
     SYS_ARCH_UNPROTECT(lev);
@@ -1359,6 +1988,54 @@ again:
   SYS_ARCH_UNPROTECT(lev);
 }
 
+/**
+ * Have fn(s, arg) called whenever the socket receives data, gains room to
+ * send or sees an error, as an alternative to waiting in select. fn runs on
+ * whichever thread caused the event, often tcpip_thread, with the socket
+ * table locked: it must be brief and must not call into lwIP. Passing NULL
+ * removes the callback, and once this returns the old one is not running.
+ *
+ * @param s the socket to watch
+ * @param fn the callback, or NULL
+ * @param arg passed to fn
+ * @return 0 on success, -1 if s is not a socket
+ */
+int
+lwip_socket_set_event_callback(int s, void (*fn)(int s, void *arg), void *arg)
+{
+  struct lwip_sock *sock;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+  SYS_ARCH_PROTECT(lev);
+  sock->event_fn = fn;
+  sock->event_arg = arg;
+  SYS_ARCH_UNPROTECT(lev);
+  return 0;
+}
+
+/**
+ * The error left by the last call on a socket, since this port does not set
+ * errno. Unlike SO_ERROR it neither waits for tcpip_thread nor clears it.
+ *
+ * @param s the socket
+ * @return an errno value, 0 if the last call succeeded, EBADF if s is not a
+ *         socket
+ */
+int
+lwip_socket_errno(int s)
+{
+  struct lwip_sock *sock = tryget_socket(s);
+
+  if (!sock) {
+    return EBADF;
+  }
+  return sock->err;
+}
+
 /**
  * Unimplemented: Close one end of a full-duplex connection.
  * Currently, the full connection is closed.
@@ -1537,6 +2214,25 @@ lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
         err = EINVAL;
       }
       break;
+#if IP_PMTU_DISCOVERY
+    case IP_MTU_DISCOVER:
+      if (*optlen < sizeof(int)) {
+        err = EINVAL;
+      }
+      if (NETCONNTYPE_GROUP(sock->conn->type) != NETCONN_UDP) {
+        err = EAFNOSUPPORT;
+      }
+      break;
+    case IP_MTU:
+      if (*optlen < sizeof(int)) {
+        err = EINVAL;
+      }
+      if ((NETCONNTYPE_GROUP(sock->conn->type) != NETCONN_UDP) &&
+          (NETCONNTYPE_GROUP(sock->conn->type) != NETCONN_TCP)) {
+        err = EAFNOSUPPORT;
+      }
+      break;
+#endif /* IP_PMTU_DISCOVERY */
 #if LWIP_IGMP
     case IP_MULTICAST_TTL:
       if (*optlen < sizeof(u8_t)) {
@@ -1642,7 +2338,14 @@ lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
   data.optval = optval;
   data.optlen = optlen;
   data.err = err;
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  lwip_getsockopt_internal(&data);
+  UNLOCK_TCPIP_CORE();
+#else /* LWIP_TCPIP_CORE_LOCKING */
   tcpip_callback(lwip_getsockopt_internal, &data);
+#endif /* LWIP_TCPIP_CORE_LOCKING */
+  /* the call signals op_completed when it is done */
   sys_arch_sem_wait(&sock->conn->op_completed, 0);
   /* maybe lwip_getsockopt_internal has changed err */
   err = data.err;
@@ -1767,6 +2470,40 @@ lwip_getsockopt_internal(void *arg)
       LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_getsockopt(%d, IPPROTO_IP, IP_TOS) = %d\n",
                   s, *(int *)optval));
       break;
+#if IP_PMTU_DISCOVERY
+    case IP_MTU_DISCOVER:
+      if ((udp_flags(sock->conn->pcb.udp) & UDP_FLAGS_DONTFRAG) != 0) {
+        *(int*)optval = IP_PMTUDISC_DO;
+      } else {
+        *(int*)optval = IP_PMTUDISC_DONT;
+      }
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_getsockopt(%d, IPPROTO_IP, IP_MTU_DISCOVER) = %d\n",
+                  s, *(int *)optval));
+      break;
+    case IP_MTU:
+      {
+        struct netif *netif = NULL;
+        /* only a socket with a peer has a path */
+        if (NETCONNTYPE_GROUP(sock->conn->type) == NETCONN_UDP) {
+          if ((udp_flags(sock->conn->pcb.udp) & UDP_FLAGS_CONNECTED) != 0) {
+            netif = ip_route(&sock->conn->pcb.ip->remote_ip);
+          }
+        }
+#if LWIP_TCP
+        else if (sock->conn->pcb.tcp->state >= ESTABLISHED) {
+          netif = ip_route(&sock->conn->pcb.ip->remote_ip);
+        }
+#endif /* LWIP_TCP */
+        if (netif == NULL) {
+          data->err = ENOTCONN;
+          break;
+        }
+        *(int*)optval = ip_pmtu_get(&sock->conn->pcb.ip->remote_ip, netif);
+        LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_getsockopt(%d, IPPROTO_IP, IP_MTU) = %d\n",
+                    s, *(int *)optval));
+      }
+      break;
+#endif /* IP_PMTU_DISCOVERY */
 #if LWIP_IGMP
     case IP_MULTICAST_TTL:
       *(u8_t*)optval = sock->conn->pcb.ip->ttl;
@@ -1940,6 +2677,18 @@ lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t opt
         err = EINVAL;
       }
       break;
+#if IP_PMTU_DISCOVERY
+    case IP_MTU_DISCOVER:
+      if (optlen < sizeof(int)) {
+        err = EINVAL;
+      } else if ((*(int*)optval != IP_PMTUDISC_DONT) && (*(int*)optval != IP_PMTUDISC_DO)) {
+        err = EINVAL;
+      }
+      if (NETCONNTYPE_GROUP(sock->conn->type) != NETCONN_UDP) {
+        err = EAFNOSUPPORT;
+      }
+      break;
+#endif /* IP_PMTU_DISCOVERY */
 #if LWIP_IGMP
     case IP_MULTICAST_TTL:
       if (optlen < sizeof(u8_t)) {
@@ -2059,7 +2808,14 @@ lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t opt
   data.optval = (void*)optval;
   data.optlen = &optlen;
   data.err = err;
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  lwip_setsockopt_internal(&data);
+  UNLOCK_TCPIP_CORE();
+#else /* LWIP_TCPIP_CORE_LOCKING */
   tcpip_callback(lwip_setsockopt_internal, &data);
+#endif /* LWIP_TCPIP_CORE_LOCKING */
+  /* the call signals op_completed when it is done */
   sys_arch_sem_wait(&sock->conn->op_completed, 0);
   /* maybe lwip_setsockopt_internal has changed err */
   err = data.err;
@@ -2158,6 +2914,17 @@ lwip_setsockopt_internal(void *arg)
       LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_setsockopt(%d, IPPROTO_IP, IP_TOS, ..)-> %d\n",
                   s, sock->conn->pcb.ip->tos));
       break;
+#if IP_PMTU_DISCOVERY
+    case IP_MTU_DISCOVER:
+      if (*(int*)optval == IP_PMTUDISC_DO) {
+        udp_setflags(sock->conn->pcb.udp, udp_flags(sock->conn->pcb.udp) | UDP_FLAGS_DONTFRAG);
+      } else {
+        udp_setflags(sock->conn->pcb.udp, udp_flags(sock->conn->pcb.udp) & ~UDP_FLAGS_DONTFRAG);
+      }
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_setsockopt(%d, IPPROTO_IP, IP_MTU_DISCOVER, ..) -> %d\n",
+                  s, *(int*)optval));
+      break;
+#endif /* IP_PMTU_DISCOVERY */
 #if LWIP_IGMP
     case IP_MULTICAST_TTL:
       sock->conn->pcb.udp->ttl = (u8_t)(*(u8_t*)optval);
@@ -43,6 +43,7 @@
 #include "lwip/sys.h"
 #include "lwip/memp.h"
 #include "lwip/mem.h"
+#include "lwip/sizes.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcpip.h"
 #include "lwip/init.h"
@@ -458,7 +459,7 @@ tcpip_init(tcpip_init_done_fn initfunc, void *arg)
 
   tcpip_init_done = initfunc;
   tcpip_init_done_arg = arg;
-  if(sys_mbox_new(&mbox, TCPIP_MBOX_SIZE) != ERR_OK) {
+  if(sys_mbox_new(&mbox, lwip_sizes.tcpip_mbox_size) != ERR_OK) {
     LWIP_ASSERT("failed to create tcpip_thread mbox", 0);
   }
 #if LWIP_TCPIP_CORE_LOCKING
@@ -0,0 +1,367 @@
+/*
+ * Internet checksum kernels for the unix port, used as LWIP_CHKSUM and
+ * LWIP_CHKSUM_COPY (see arch/cc.h).
+ *
+ * The sum is endian-neutral (RFC 1071): adding up the data as native 16-bit
+ * words and folding gives the checksum in network order once it is stored
+ * back natively. Any wider word folds to the same sum, so the kernels add
+ * 16-bit words into 32-bit vector lanes, fold the lanes into a 64-bit
+ * accumulator every so often, and leave the last few bytes to the scalar
+ * tail. Loads are unaligned throughout, so the alignment of the data only
+ * affects speed.
+ */
+#include "lwip/opt.h"
+#include "lwip/def.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHKSUM_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define CHKSUM_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Vector iterations between folds of the lanes. Each iteration adds two
+ * words to every lane of two accumulators, which are then added together,
+ * so this keeps the 32-bit lanes well clear of overflow. */
+#define CHKSUM_ROUNDS 8192
+
+struct chksum_kernel {
+  const char *name;
+  u16_t (*chksum)(const void *dataptr, int len);
+  u16_t (*copy)(void *dst, const void *src, u16_t len);
+  int (*usable)(void);
+};
+
+static u16_t
+chksum_fold(u64_t acc)
+{
+  while ((acc >> 16) != 0) {
+    acc = (acc >> 16) + (acc & 0xffff);
+  }
+  return (u16_t)acc;
+}
+
+/** Adds up whatever the wide loops leave over, the last byte as the first
+ * half of a word, like lwip_standard_chksum() */
+static u64_t
+chksum_tail(const u8_t *src, size_t len, u64_t acc)
+{
+  u16_t word;
+
+  while (len >= 2) {
+    memcpy(&word, src, 2);
+    acc += word;
+    src += 2;
+    len -= 2;
+  }
+  if (len != 0) {
+    word = 0;
+    ((u8_t *)&word)[0] = *src;
+    acc += word;
+  }
+  return acc;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* scalar: 32-bit words into a 64-bit accumulator */
+
+static u16_t
+chksum_scalar_run(u8_t *dst, const u8_t *src, size_t len)
+{
+  u64_t acc = 0;
+  u32_t a, b;
+
+  while (len >= 8) {
+    memcpy(&a, src, 4);
+    memcpy(&b, src + 4, 4);
+    if (dst != NULL) {
+      memcpy(dst, src, 8);
+      dst += 8;
+    }
+    acc += a;
+    acc += b;
+    src += 8;
+    len -= 8;
+  }
+  if (dst != NULL) {
+    memcpy(dst, src, len);
+  }
+  return chksum_fold(chksum_tail(src, len, acc));
+}
+
+static u16_t
+chksum_scalar(const void *dataptr, int len)
+{
+  return chksum_scalar_run(NULL, (const u8_t *)dataptr, (size_t)len);
+}
+
+static u16_t
+chksum_copy_scalar(void *dst, const void *src, u16_t len)
+{
+  return chksum_scalar_run((u8_t *)dst, (const u8_t *)src, len);
+}
+
+static int
+chksum_scalar_usable(void)
+{
+  return 1;
+}
+
+#if CHKSUM_X86
+/*-----------------------------------------------------------------------------------*/
+/* SSE2: 32 bytes per iteration */
+
+__attribute__((target("sse2"), always_inline)) static inline u16_t
+chksum_sse2_run(u8_t *dst, const u8_t *src, size_t len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  u32_t lanes[4];
+  u64_t acc = 0;
+
+  while (len >= 32) {
+    size_t rounds = LWIP_MIN(len / 32, CHKSUM_ROUNDS);
+    __m128i s0 = zero;
+    __m128i s1 = zero;
+    len -= rounds * 32;
+    while (rounds-- != 0) {
+      __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+      __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+      if (dst != NULL) {
+        _mm_storeu_si128((__m128i *)dst, v0);
+        _mm_storeu_si128((__m128i *)(dst + 16), v1);
+        dst += 32;
+      }
+      s0 = _mm_add_epi32(s0, _mm_add_epi32(_mm_unpacklo_epi16(v0, zero), _mm_unpackhi_epi16(v0, zero)));
+      s1 = _mm_add_epi32(s1, _mm_add_epi32(_mm_unpacklo_epi16(v1, zero), _mm_unpackhi_epi16(v1, zero)));
+      src += 32;
+    }
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(s0, s1));
+    acc += (u64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  if (dst != NULL) {
+    memcpy(dst, src, len);
+  }
+  return chksum_fold(chksum_tail(src, len, acc));
+}
+
+__attribute__((target("sse2"))) static u16_t
+chksum_sse2(const void *dataptr, int len)
+{
+  return chksum_sse2_run(NULL, (const u8_t *)dataptr, (size_t)len);
+}
+
+__attribute__((target("sse2"))) static u16_t
+chksum_copy_sse2(void *dst, const void *src, u16_t len)
+{
+  return chksum_sse2_run((u8_t *)dst, (const u8_t *)src, len);
+}
+
+static int
+chksum_sse2_usable(void)
+{
+  return __builtin_cpu_supports("sse2");
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* AVX2: 64 bytes per iteration */
+
+__attribute__((target("avx2"), always_inline)) static inline u16_t
+chksum_avx2_run(u8_t *dst, const u8_t *src, size_t len)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  u32_t lanes[8];
+  u64_t acc = 0;
+  int i;
+
+  while (len >= 64) {
+    size_t rounds = LWIP_MIN(len / 64, CHKSUM_ROUNDS);
+    __m256i s0 = zero;
+    __m256i s1 = zero;
+    len -= rounds * 64;
+    while (rounds-- != 0) {
+      __m256i v0 = _mm256_loadu_si256((const __m256i *)src);
+      __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+      if (dst != NULL) {
+        _mm256_storeu_si256((__m256i *)dst, v0);
+        _mm256_storeu_si256((__m256i *)(dst + 32), v1);
+        dst += 64;
+      }
+      /* the unpacks work within 128-bit halves, which doesn't matter to a sum */
+      s0 = _mm256_add_epi32(s0, _mm256_add_epi32(_mm256_unpacklo_epi16(v0, zero), _mm256_unpackhi_epi16(v0, zero)));
+      s1 = _mm256_add_epi32(s1, _mm256_add_epi32(_mm256_unpacklo_epi16(v1, zero), _mm256_unpackhi_epi16(v1, zero)));
+      src += 64;
+    }
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi32(s0, s1));
+    for (i = 0; i < 8; i++) {
+      acc += lanes[i];
+    }
+  }
+  if (dst != NULL) {
+    memcpy(dst, src, len);
+  }
+  return chksum_fold(chksum_tail(src, len, acc));
+}
+
+__attribute__((target("avx2"))) static u16_t
+chksum_avx2(const void *dataptr, int len)
+{
+  return chksum_avx2_run(NULL, (const u8_t *)dataptr, (size_t)len);
+}
+
+__attribute__((target("avx2"))) static u16_t
+chksum_copy_avx2(void *dst, const void *src, u16_t len)
+{
+  return chksum_avx2_run((u8_t *)dst, (const u8_t *)src, len);
+}
+
+static int
+chksum_avx2_usable(void)
+{
+  return __builtin_cpu_supports("avx2");
+}
+#endif /* CHKSUM_X86 */
+
+#if CHKSUM_NEON
+/*-----------------------------------------------------------------------------------*/
+/* NEON: 32 bytes per iteration, pairwise adds straight into 32-bit lanes */
+
+static inline u16_t
+chksum_neon_run(u8_t *dst, const u8_t *src, size_t len)
+{
+  u64_t acc = 0;
+
+  while (len >= 32) {
+    size_t rounds = LWIP_MIN(len / 32, CHKSUM_ROUNDS);
+    uint32x4_t s0 = vdupq_n_u32(0);
+    uint32x4_t s1 = vdupq_n_u32(0);
+    len -= rounds * 32;
+    while (rounds-- != 0) {
+      uint8x16_t v0 = vld1q_u8(src);
+      uint8x16_t v1 = vld1q_u8(src + 16);
+      if (dst != NULL) {
+        vst1q_u8(dst, v0);
+        vst1q_u8(dst + 16, v1);
+        dst += 32;
+      }
+      s0 = vpadalq_u16(s0, vreinterpretq_u16_u8(v0));
+      s1 = vpadalq_u16(s1, vreinterpretq_u16_u8(v1));
+      src += 32;
+    }
+    acc += vaddlvq_u32(s0) + vaddlvq_u32(s1);
+  }
+  if (dst != NULL) {
+    memcpy(dst, src, len);
+  }
+  return chksum_fold(chksum_tail(src, len, acc));
+}
+
+static u16_t
+chksum_neon(const void *dataptr, int len)
+{
+  return chksum_neon_run(NULL, (const u8_t *)dataptr, (size_t)len);
+}
+
+static u16_t
+chksum_copy_neon(void *dst, const void *src, u16_t len)
+{
+  return chksum_neon_run((u8_t *)dst, (const u8_t *)src, len);
+}
+
+static int
+chksum_neon_usable(void)
+{
+  /* always there on aarch64 */
+  return 1;
+}
+#endif /* CHKSUM_NEON */
+
+/*-----------------------------------------------------------------------------------*/
+
+/* narrowest to widest */
+static const struct chksum_kernel chksum_kernels[] = {
+  {"scalar", chksum_scalar, chksum_copy_scalar, chksum_scalar_usable},
+#if CHKSUM_X86
+  {"sse2", chksum_sse2, chksum_copy_sse2, chksum_sse2_usable},
+  {"avx2", chksum_avx2, chksum_copy_avx2, chksum_avx2_usable},
+#endif /* CHKSUM_X86 */
+#if CHKSUM_NEON
+  {"neon", chksum_neon, chksum_copy_neon, chksum_neon_usable},
+#endif /* CHKSUM_NEON */
+};
+
+#define CHKSUM_NUM_KERNELS (sizeof(chksum_kernels) / sizeof(chksum_kernels[0]))
+
+/* NULL until the first checksum. Picking is idempotent, so threads racing
+ * to do it agree on the result */
+static const struct chksum_kernel *_Atomic chksum_active;
+
+static const struct chksum_kernel *
+chksum_widest(void)
+{
+  size_t i;
+
+  for (i = CHKSUM_NUM_KERNELS; i-- > 1; ) {
+    if (chksum_kernels[i].usable()) {
+      return &chksum_kernels[i];
+    }
+  }
+  return &chksum_kernels[0];
+}
+
+static const struct chksum_kernel *
+chksum_kernel_get(void)
+{
+  const struct chksum_kernel *kernel = atomic_load_explicit(&chksum_active, memory_order_relaxed);
+
+  if (kernel == NULL) {
+    kernel = chksum_widest();
+    atomic_store_explicit(&chksum_active, kernel, memory_order_relaxed);
+  }
+  return kernel;
+}
+
+u16_t
+lwip_arch_chksum(const void *dataptr, int len)
+{
+  if (len <= 0) {
+    return 0;
+  }
+  return chksum_kernel_get()->chksum(dataptr, len);
+}
+
+u16_t
+lwip_arch_chksum_copy(void *dst, const void *src, u16_t len)
+{
+  return chksum_kernel_get()->copy(dst, src, len);
+}
+
+const char *
+lwip_arch_chksum_kernel(void)
+{
+  return chksum_kernel_get()->name;
+}
+
+u8_t
+lwip_arch_chksum_select(const char *name)
+{
+  size_t i;
+
+  if (name == NULL) {
+    atomic_store_explicit(&chksum_active, chksum_widest(), memory_order_relaxed);
+    return 1;
+  }
+  for (i = 0; i < CHKSUM_NUM_KERNELS; i++) {
+    if (strcmp(chksum_kernels[i].name, name) == 0) {
+      if (!chksum_kernels[i].usable()) {
+        return 0;
+      }
+      atomic_store_explicit(&chksum_active, &chksum_kernels[i], memory_order_relaxed);
+      return 1;
+    }
+  }
+  return 0;
+}
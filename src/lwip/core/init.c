@@ -43,6 +43,7 @@
 #include "lwip/sys.h"
 #include "lwip/mem.h"
 #include "lwip/memp.h"
+#include "lwip/sizes.h"
 #include "lwip/pbuf.h"
 #include "lwip/netif.h"
 #include "lwip/sockets.h"
@@ -85,6 +86,9 @@
 #if (!LWIP_UDP && LWIP_DNS)
   #error "If you want to use DNS, you have to define LWIP_UDP=1 in your lwipopts.h"
 #endif
+#if (MEMP_CACHE && MEMP_OVERFLOW_CHECK)
+  #error "MEMP_CACHE skips the pool checks MEMP_OVERFLOW_CHECK makes, turn one of them off in your lwipopts.h"
+#endif
 #if !MEMP_MEM_MALLOC /* MEMP_NUM_* checks are disabled when not using the pool allocator */
 #if (LWIP_ARP && ARP_QUEUEING && (MEMP_NUM_ARP_QUEUE<=0))
   #error "If you want to use ARP Queueing, you have to define MEMP_NUM_ARP_QUEUE>=1 in your lwipopts.h"
@@ -282,12 +286,48 @@
 #endif /* LWIP_TCP */
 #endif /* !LWIP_DISABLE_TCP_SANITY_CHECKS */
 
+struct lwip_sizes lwip_sizes = {
+  MEM_SIZE,
+  {
+#define LWIP_MEMPOOL(name,num,size,desc)  (num),
+#include "lwip/memp_std.h"
+  },
+  TCPIP_MBOX_SIZE,
+  DEFAULT_RAW_RECVMBOX_SIZE,
+  DEFAULT_UDP_RECVMBOX_SIZE,
+  DEFAULT_TCP_RECVMBOX_SIZE,
+  DEFAULT_ACCEPTMBOX_SIZE,
+  ARP_TABLE_MAX,
+  ARP_QUEUE_LEN,
+#if LWIP_TCP
+  TCP_MSS,
+  TCP_WND,
+  TCP_SND_BUF,
+  TCP_SND_QUEUELEN,
+  TCP_SNDLOWAT,
+  TCP_SNDQUEUELOWAT,
+#endif /* LWIP_TCP */
+};
+
 /**
  * Perform Sanity check of user-configurable values, and initialize all modules.
  */
 void
 lwip_init(void)
 {
+#if LWIP_TCP
+  /* sizes changed at run time bypass the checks above, so at least keep
+     the low-water marks below what they mark */
+  LWIP_ASSERT("tcp_wnd >= tcp_mss", lwip_sizes.tcp_wnd >= lwip_sizes.tcp_mss);
+  LWIP_ASSERT("tcp_snd_queuelen >= 2", lwip_sizes.tcp_snd_queuelen >= 2);
+  if (lwip_sizes.tcp_sndlowat >= lwip_sizes.tcp_snd_buf) {
+    lwip_sizes.tcp_sndlowat = lwip_sizes.tcp_snd_buf / 2;
+  }
+  if (lwip_sizes.tcp_sndqueuelowat >= lwip_sizes.tcp_snd_queuelen) {
+    lwip_sizes.tcp_sndqueuelowat = lwip_sizes.tcp_snd_queuelen / 2;
+  }
+#endif /* LWIP_TCP */
+
   /* Modules initialization */
   stats_init();
 #if !NO_SYS
@@ -37,7 +37,8 @@
  */
 
 /* Some ICMP messages should be passed to the transport protocols. This
-   is not implemented. */
+   is only implemented for "fragmentation needed", which feeds path MTU
+   discovery. */
 
 #include "lwip/opt.h"
 
@@ -49,6 +50,8 @@
 #include "lwip/def.h"
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
+#include "lwip/ip_pmtu.h"
+#include "lwip/tcp_impl.h"
 
 #include <string.h>
 
@@ -62,7 +65,10 @@
 /* The amount of data from the original packet to return in a dest-unreachable */
 #define ICMP_DEST_UNREACH_DATASIZE 8
 
-static void icmp_send_response(struct pbuf *p, u8_t type, u8_t code);
+static void icmp_send_response(struct pbuf *p, u8_t type, u8_t code, u16_t nexthop_mtu);
+#if IP_PMTU_DISCOVERY
+static void icmp_frag_needed_input(struct pbuf *p);
+#endif /* IP_PMTU_DISCOVERY */
 
 /**
  * Processes ICMP input packets, called from ip_input().
@@ -104,6 +110,13 @@ icmp_input(struct pbuf *p, struct netif *inp)
     /* This is OK, echo reply might have been parsed by a raw PCB
        (as obviously, an echo request has been sent, too). */
     break; 
+#if IP_PMTU_DISCOVERY
+  case ICMP_DUR:
+    if (*(((u8_t *)p->payload)+1) == ICMP_DUR_FRAG) {
+      icmp_frag_needed_input(p);
+    }
+    break;
+#endif /* IP_PMTU_DISCOVERY */
   case ICMP_ECHO:
 #if !LWIP_MULTICAST_PING || !LWIP_BROADCAST_PING
     {
@@ -260,8 +273,24 @@ memerr:
 void
 icmp_dest_unreach(struct pbuf *p, enum icmp_dur_type t)
 {
-  icmp_send_response(p, ICMP_DUR, t);
+  icmp_send_response(p, ICMP_DUR, t, 0);
+}
+
+#if IP_FORWARD
+/**
+ * Send an icmp 'fragmentation needed' packet, called from ip_forward() if
+ * a packet with DF set is too large for the next hop.
+ *
+ * @param p the input packet that could not be forwarded,
+ *          p->payload pointing to the IP header
+ * @param mtu the MTU of the next hop (RFC 1191)
+ */
+void
+icmp_frag_needed(struct pbuf *p, u16_t mtu)
+{
+  icmp_send_response(p, ICMP_DUR, ICMP_DUR_FRAG, mtu);
 }
+#endif /* IP_FORWARD */
 
 #if IP_FORWARD || IP_REASSEMBLY
 /**
@@ -274,7 +303,7 @@ icmp_dest_unreach(struct pbuf *p, enum icmp_dur_type t)
 void
 icmp_time_exceeded(struct pbuf *p, enum icmp_te_type t)
 {
-  icmp_send_response(p, ICMP_TE, t);
+  icmp_send_response(p, ICMP_TE, t, 0);
 }
 
 #endif /* IP_FORWARD || IP_REASSEMBLY */
@@ -286,9 +315,10 @@ icmp_time_exceeded(struct pbuf *p, enum icmp_te_type t)
  *          p->payload pointing to the IP header
  * @param type Type of the ICMP header
  * @param code Code of the ICMP header
+ * @param nexthop_mtu MTU of the next hop for 'fragmentation needed', else 0
  */
 static void
-icmp_send_response(struct pbuf *p, u8_t type, u8_t code)
+icmp_send_response(struct pbuf *p, u8_t type, u8_t code, u16_t nexthop_mtu)
 {
   struct pbuf *q;
   struct ip_hdr *iphdr;
@@ -317,7 +347,7 @@ icmp_send_response(struct pbuf *p, u8_t type, u8_t code)
   icmphdr->type = type;
   icmphdr->code = code;
   icmphdr->id = 0;
-  icmphdr->seqno = 0;
+  icmphdr->seqno = htons(nexthop_mtu);
 
   /* copy fields from original packet */
   SMEMCPY((u8_t *)q->payload + sizeof(struct icmp_echo_hdr), (u8_t *)p->payload,
@@ -336,4 +366,73 @@ icmp_send_response(struct pbuf *p, u8_t type, u8_t code)
   pbuf_free(q);
 }
 
+#if IP_PMTU_DISCOVERY
+/** Path MTUs to try when a router does not say which it needs (RFC 1191) */
+static const u16_t icmp_mtu_plateaus[] = {
+  32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, IP_PMTU_MIN
+};
+
+/**
+ * Lower the path MTU to the destination of a datagram that a router could
+ * not pass without fragmenting it, and let TCP resize what it sends there.
+ *
+ * @param p the ICMP message, p->payload pointing to the ICMP header
+ */
+static void
+icmp_frag_needed_input(struct pbuf *p)
+{
+  struct icmp_echo_hdr *icmphdr;
+  struct ip_hdr *iphdr;
+  struct netif *netif;
+  ip_addr_t src, dest;
+  u16_t mtu, len;
+  u8_t i;
+
+  /* the ICMP header is followed by the header of the dropped datagram */
+  if (p->len < sizeof(struct icmp_echo_hdr) + IP_HLEN) {
+    LWIP_DEBUGF(ICMP_DEBUG, ("icmp_input: short 'fragmentation needed' received\n"));
+    ICMP_STATS_INC(icmp.lenerr);
+    return;
+  }
+  icmphdr = (struct icmp_echo_hdr *)p->payload;
+  iphdr = (struct ip_hdr *)((u8_t *)p->payload + sizeof(struct icmp_echo_hdr));
+  ip_addr_copy(src, iphdr->src);
+  ip_addr_copy(dest, iphdr->dest);
+
+  /* only believe it about datagrams we sent */
+  for (netif = netif_list; netif != NULL; netif = netif->next) {
+    if (ip_addr_cmp(&src, &netif->ip_addr)) {
+      break;
+    }
+  }
+  if (netif == NULL) {
+    ICMP_STATS_INC(icmp.drop);
+    return;
+  }
+
+  len = ntohs(IPH_LEN(iphdr));
+  mtu = ntohs(icmphdr->seqno);
+  if (mtu == 0) {
+    /* the router predates RFC 1191: guess the next plateau down */
+    mtu = IP_PMTU_MIN;
+    for (i = 0; i < sizeof(icmp_mtu_plateaus) / sizeof(icmp_mtu_plateaus[0]); i++) {
+      if (icmp_mtu_plateaus[i] < len) {
+        mtu = icmp_mtu_plateaus[i];
+        break;
+      }
+    }
+  }
+  if (mtu >= len) {
+    /* the datagram would have fit */
+    ICMP_STATS_INC(icmp.drop);
+    return;
+  }
+
+  mtu = ip_pmtu_update(&dest, mtu);
+#if LWIP_TCP
+  tcp_pmtu_update(&dest, mtu);
+#endif /* LWIP_TCP */
+}
+#endif /* IP_PMTU_DISCOVERY */
+
 #endif /* LWIP_ICMP */
@@ -161,6 +161,33 @@ ip_route(ip_addr_t *dest)
   return netif_default;
 }
 
+/**
+ * Like ip_route(), but a packet from an address owned by one of our netifs
+ * leaves through that netif whenever it can reach dest directly. This
+ * matters when several netifs share one subnet (e.g. interfaces attached to
+ * the same simulated medium), where the destination alone is ambiguous.
+ *
+ * @param dest the destination IP address for which to find the route
+ * @param src the source IP address the packet will carry (may be ANY)
+ * @return the netif on which to send to reach dest
+ */
+struct netif *
+ip_route_src(ip_addr_t *dest, ip_addr_t *src)
+{
+  struct netif *netif;
+
+  if ((src != NULL) && !ip_addr_isany(src)) {
+    for (netif = netif_list; netif != NULL; netif = netif->next) {
+      if (netif_is_up(netif) && ip_addr_cmp(src, &(netif->ip_addr)) &&
+          (ip_addr_netcmp(dest, &(netif->ip_addr), &(netif->netmask)) ||
+           ip_addr_isbroadcast(dest, netif))) {
+        return netif;
+      }
+    }
+  }
+  return ip_route(dest);
+}
+
 #if IP_FORWARD
 /**
  * Determine whether an IP address is in a reserved set of addresses
@@ -282,8 +309,9 @@ ip_forward(struct pbuf *p, struct ip_hdr *iphdr, struct netif *inp)
       /* @todo: send ICMP Destination Unreacheable code 13 "Communication administratively prohibited"? */
 #endif /* IP_FRAG */
     } else {
-      /* send ICMP Destination Unreacheable code 4: "Fragmentation Needed and DF Set" */
-      icmp_dest_unreach(p, ICMP_DUR_FRAG);
+      /* send ICMP Destination Unreacheable code 4: "Fragmentation Needed and DF Set",
+         with the MTU of the next hop for the sender's path MTU discovery */
+      icmp_frag_needed(p, netif->mtu);
     }
     return;
   }
@@ -743,9 +771,14 @@ err_t ip_output_if_opt(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
 #if CHECKSUM_GEN_IP_INLINE
     chk_sum += iphdr->_len;
 #endif /* CHECKSUM_GEN_IP_INLINE */
-    IPH_OFFSET_SET(iphdr, 0);
+    if ((p->flags & PBUF_FLAG_DF) != 0) {
+      IPH_OFFSET_SET(iphdr, PP_HTONS(IP_DF));
+    } else {
+      IPH_OFFSET_SET(iphdr, 0);
+    }
     IPH_ID_SET(iphdr, htons(ip_id));
 #if CHECKSUM_GEN_IP_INLINE
+    chk_sum += iphdr->_offset;
     chk_sum += iphdr->_id;
 #endif /* CHECKSUM_GEN_IP_INLINE */
     ++ip_id;
@@ -794,12 +827,19 @@ err_t ip_output_if_opt(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
   }
 #endif /* LWIP_IGMP */
 #endif /* ENABLE_LOOPBACK */
-#if IP_FRAG
   /* don't fragment if interface has mtu set to 0 [loopif] */
   if (netif->mtu && (p->tot_len > netif->mtu)) {
+    if ((IPH_OFFSET(iphdr) & PP_HTONS(IP_DF)) != 0) {
+      /* the sender wants this to arrive whole or not at all */
+      LWIP_DEBUGF(IP_DEBUG, ("ip_output_if: %"U16_F" bytes with DF set exceed the MTU\n", p->tot_len));
+      IP_STATS_INC(ip.drop);
+      snmp_inc_ipoutdiscards();
+      return ERR_MSGSIZE;
+    }
+#if IP_FRAG
     return ip_frag(p, netif, dest);
-  }
 #endif /* IP_FRAG */
+  }
 
   LWIP_DEBUGF(IP_DEBUG, ("netif->output()"));
   return netif->output(netif, p, dest);
@@ -807,7 +847,9 @@ err_t ip_output_if_opt(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
 
 /**
  * Simple interface to ip_output_if. It finds the outgoing network
- * interface and calls upon ip_output_if to do the actual work.
+ * interface with ip_route_src(), so that a packet from one of our netifs'
+ * addresses leaves through that netif, and calls upon ip_output_if to do
+ * the actual work.
  *
  * @param p the packet to send (p->payload points to the data, e.g. next
             protocol header; if dest == IP_HDRINCL, p already includes an IP
@@ -832,7 +874,7 @@ ip_output(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
      gets altered as the packet is passed down the stack */
   LWIP_ASSERT("p->ref == 1", p->ref == 1);
 
-  if ((netif = ip_route(dest)) == NULL) {
+  if ((netif = ip_route_src(dest, src)) == NULL) {
     LWIP_DEBUGF(IP_DEBUG, ("ip_output: No route to %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
       ip4_addr1_16(dest), ip4_addr2_16(dest), ip4_addr3_16(dest), ip4_addr4_16(dest)));
     IP_STATS_INC(ip.rterr);
@@ -872,7 +914,7 @@ ip_output_hinted(struct pbuf *p, ip_addr_t *src, ip_addr_t *dest,
      gets altered as the packet is passed down the stack */
   LWIP_ASSERT("p->ref == 1", p->ref == 1);
 
-  if ((netif = ip_route(dest)) == NULL) {
+  if ((netif = ip_route_src(dest, src)) == NULL) {
     LWIP_DEBUGF(IP_DEBUG, ("ip_output: No route to %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
       ip4_addr1_16(dest), ip4_addr2_16(dest), ip4_addr3_16(dest), ip4_addr4_16(dest)));
     IP_STATS_INC(ip.rterr);
@@ -0,0 +1,114 @@
+/**
+ * @file
+ * Path MTU cache (RFC 1191)
+ *
+ * Remembers, for the destinations a router has told us about with an ICMP
+ * "fragmentation needed" message, the largest datagram that reaches them
+ * whole. TCP sizes its segments and don't-fragment UDP sockets size their
+ * datagrams from this rather than from the outgoing interface alone, so
+ * large datagrams are avoided instead of being fragmented on the way: on a
+ * lossy link a single lost fragment costs the whole datagram.
+ *
+ * Entries are forgotten after IP_PMTU_MAXAGE minutes, which lets a path
+ * that has grown again be used in full.
+ */
+
+#include "lwip/opt.h"
+
+#if IP_PMTU_DISCOVERY /* don't build if not configured for use in lwipopts.h */
+
+#include "lwip/ip_pmtu.h"
+#include "lwip/def.h"
+
+struct ip_pmtu_entry {
+  ip_addr_t dest;
+  /** 0 if the entry is unused */
+  u16_t mtu;
+  /** minutes since the entry was last lowered */
+  u8_t age;
+};
+
+static struct ip_pmtu_entry ip_pmtu_table[IP_PMTU_TABLE_SIZE];
+
+/**
+ * Ages the entries, forgetting those older than IP_PMTU_MAXAGE.
+ * Should be called every IP_PMTU_TMR_INTERVAL milliseconds (1 minute).
+ */
+void
+ip_pmtu_tmr(void)
+{
+  u8_t i;
+
+  for (i = 0; i < IP_PMTU_TABLE_SIZE; i++) {
+    if ((ip_pmtu_table[i].mtu != 0) && (++ip_pmtu_table[i].age >= IP_PMTU_MAXAGE)) {
+      LWIP_DEBUGF(IP_DEBUG, ("ip_pmtu_tmr: forgetting %"U16_F" for %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
+        ip_pmtu_table[i].mtu, ip4_addr1_16(&ip_pmtu_table[i].dest), ip4_addr2_16(&ip_pmtu_table[i].dest),
+        ip4_addr3_16(&ip_pmtu_table[i].dest), ip4_addr4_16(&ip_pmtu_table[i].dest)));
+      ip_pmtu_table[i].mtu = 0;
+    }
+  }
+}
+
+/**
+ * The largest datagram that reaches dest whole when sent on netif.
+ *
+ * @param dest the destination address
+ * @param netif the interface datagrams to dest leave by
+ * @return the path MTU, or 0 if netif has no MTU [loopif]
+ */
+u16_t
+ip_pmtu_get(ip_addr_t *dest, struct netif *netif)
+{
+  u8_t i;
+
+  if (netif->mtu == 0) {
+    return 0;
+  }
+  for (i = 0; i < IP_PMTU_TABLE_SIZE; i++) {
+    if ((ip_pmtu_table[i].mtu != 0) && ip_addr_cmp(&ip_pmtu_table[i].dest, dest)) {
+      return LWIP_MIN(ip_pmtu_table[i].mtu, netif->mtu);
+    }
+  }
+  return netif->mtu;
+}
+
+/**
+ * Lowers the path MTU to dest. An entry is only ever lowered, and a new one
+ * replaces the oldest if the table is full.
+ *
+ * @param dest the destination address
+ * @param mtu the largest datagram a router on the way passes whole
+ * @return the path MTU to dest from now on
+ */
+u16_t
+ip_pmtu_update(ip_addr_t *dest, u16_t mtu)
+{
+  u8_t i, slot = 0;
+
+  if (mtu < IP_PMTU_MIN) {
+    /* RFC 1191: never go below the smallest MTU every host must accept */
+    mtu = IP_PMTU_MIN;
+  }
+  for (i = 0; i < IP_PMTU_TABLE_SIZE; i++) {
+    if ((ip_pmtu_table[i].mtu != 0) && ip_addr_cmp(&ip_pmtu_table[i].dest, dest)) {
+      if (mtu < ip_pmtu_table[i].mtu) {
+        ip_pmtu_table[i].mtu = mtu;
+        ip_pmtu_table[i].age = 0;
+      }
+      return ip_pmtu_table[i].mtu;
+    }
+    /* remember an unused entry, or else the oldest */
+    if ((ip_pmtu_table[slot].mtu != 0) &&
+        ((ip_pmtu_table[i].mtu == 0) || (ip_pmtu_table[i].age > ip_pmtu_table[slot].age))) {
+      slot = i;
+    }
+  }
+  LWIP_DEBUGF(IP_DEBUG, ("ip_pmtu_update: %"U16_F" for %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
+    mtu, ip4_addr1_16(dest), ip4_addr2_16(dest), ip4_addr3_16(dest), ip4_addr4_16(dest)));
+  ip_addr_copy(ip_pmtu_table[slot].dest, *dest);
+  ip_pmtu_table[slot].mtu = mtu;
+  ip_pmtu_table[slot].age = 0;
+  return mtu;
+}
+
+#endif /* IP_PMTU_DISCOVERY */
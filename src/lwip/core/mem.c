@@ -62,7 +62,9 @@
 #include "lwip/sys.h"
 #include "lwip/stats.h"
 #include "lwip/err.h"
+#include "lwip/sizes.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #if MEM_USE_POOLS
@@ -145,8 +147,9 @@ mem_free(void *rmem)
   memp_free(hmem->poolnr, hmem);
 }
 
-#else /* MEM_USE_POOLS */
+#elif !MEM_SLAB /* MEM_USE_POOLS */
 /* lwIP replacement for your libc malloc() */
+/* (the MEM_SLAB replacement is in mem_slab.c) */
 
 /**
  * The heap is made up as a list of structs of this type.
@@ -171,16 +174,20 @@ struct mem {
 /* some alignment macros: we define them here for better source code layout */
 #define MIN_SIZE_ALIGNED     LWIP_MEM_ALIGN_SIZE(MIN_SIZE)
 #define SIZEOF_STRUCT_MEM    LWIP_MEM_ALIGN_SIZE(sizeof(struct mem))
-#define MEM_SIZE_ALIGNED     LWIP_MEM_ALIGN_SIZE(MEM_SIZE)
+/** the size of the heap, from lwip_sizes.mem_size when it is set up */
+static mem_size_t mem_size_aligned;
+#define MEM_SIZE_ALIGNED     mem_size_aligned
 
 /** If you want to relocate the heap to external memory, simply define
  * LWIP_RAM_HEAP_POINTER as a void-pointer to that location.
  * If so, make sure the memory at that location is big enough (see below on
- * how that space is calculated). */
+ * how that space is calculated), and note that the heap then keeps MEM_SIZE
+ * rather than lwip_sizes.mem_size. */
 #ifndef LWIP_RAM_HEAP_POINTER
-/** the heap. we need one struct mem at the end and some room for alignment */
-u8_t ram_heap[MEM_SIZE_ALIGNED + (2*SIZEOF_STRUCT_MEM) + MEM_ALIGNMENT];
+/** the heap, allocated by mem_init() */
+static u8_t *ram_heap;
 #define LWIP_RAM_HEAP_POINTER ram_heap
+#define LWIP_RAM_HEAP_RUNTIME 1
 #endif /* LWIP_RAM_HEAP_POINTER */
 
 /** pointer to the heap (ram_heap): for alignment, ram is now a pointer instead of an array */
@@ -278,6 +285,15 @@ mem_init(void)
   LWIP_ASSERT("Sanity check alignment",
     (SIZEOF_STRUCT_MEM & (MEM_ALIGNMENT-1)) == 0);
 
+#ifdef LWIP_RAM_HEAP_RUNTIME
+  mem_size_aligned = LWIP_MEM_ALIGN_SIZE(lwip_sizes.mem_size);
+  /* we need one struct mem at the end and some room for alignment */
+  ram_heap = (u8_t *)malloc(MEM_SIZE_ALIGNED + (2*SIZEOF_STRUCT_MEM) + MEM_ALIGNMENT);
+  LWIP_ASSERT("failed to allocate the heap", ram_heap != NULL);
+#else /* LWIP_RAM_HEAP_RUNTIME */
+  mem_size_aligned = LWIP_MEM_ALIGN_SIZE(MEM_SIZE);
+#endif /* LWIP_RAM_HEAP_RUNTIME */
+
   /* align the heap */
   ram = (u8_t *)LWIP_MEM_ALIGN(LWIP_RAM_HEAP_POINTER);
   /* initialize the start of the heap */
@@ -632,6 +648,36 @@ mem_malloc_adjust_lfree:
   return NULL;
 }
 
+/**
+ * Report how much of the heap is in use and how fragmented the rest is
+ *
+ * @param usage filled in with a snapshot of the heap
+ */
+void
+mem_usage_get(struct mem_usage *usage)
+{
+  struct mem *mem;
+  mem_size_t size, free_total = 0, largest = 0;
+
+  sys_mutex_lock(&mem_mutex);
+  for (mem = (struct mem *)(void *)ram; mem != ram_end;
+       mem = (struct mem *)(void *)&ram[mem->next]) {
+    if (!mem->used) {
+      size = mem->next - (mem_size_t)((u8_t *)mem - ram) - SIZEOF_STRUCT_MEM;
+      free_total += size;
+      if (size > largest) {
+        largest = size;
+      }
+    }
+  }
+  sys_mutex_unlock(&mem_mutex);
+
+  usage->limit = MEM_SIZE_ALIGNED;
+  usage->size = MEM_SIZE_ALIGNED;
+  usage->reserved = MEM_SIZE_ALIGNED - free_total;
+  usage->largest_free = largest;
+}
+
 #endif /* MEM_USE_POOLS */
 /**
  * Contiguously allocates enough space for count objects that are size bytes
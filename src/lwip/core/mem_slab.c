@@ -0,0 +1,559 @@
+/**
+ * @file
+ * Size-class slab allocator behind mem_malloc() (MEM_SLAB)
+ *
+ * Requests are rounded up to one of slab_sizes[] and served from free lists
+ * threaded through pages of SLAB_PAGE_SIZE bytes. A page only ever holds
+ * objects of one size and starts with a struct slab_page, so the page of an
+ * object is found by masking its address. Requests too large to share a
+ * page get a run of pages of their own with the same header.
+ */
+
+#include "lwip/opt.h"
+
+#if !MEM_LIBC_MALLOC && !MEM_USE_POOLS && MEM_SLAB
+
+#include "lwip/def.h"
+#include "lwip/mem.h"
+#include "lwip/sizes.h"
+#include "lwip/sys.h"
+#include "lwip/stats.h"
+
+#include <string.h>
+
+/** pages are this big and aligned to their size */
+#define SLAB_PAGE_SIZE       4096
+#define SLAB_PAGE_OF(mem)    ((struct slab_page *)((mem_ptr_t)(mem) & ~(mem_ptr_t)(SLAB_PAGE_SIZE - 1)))
+/** empty pages kept for reuse by any size before going back to the C library */
+#define SLAB_SPARE_PAGES     4
+
+/** the sizes requests are rounded up to, all multiples of SLAB_GRANULE */
+static const u16_t slab_sizes[] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536
+};
+#define SLAB_NUM_CLASSES     (sizeof(slab_sizes) / sizeof(slab_sizes[0]))
+#define SLAB_MAX_SIZE        1536
+#define SLAB_GRANULE         16
+/** class_idx of the pages of a large allocation */
+#define SLAB_LARGE           0xff
+
+struct slab_page {
+  /** neighbours in the list of pages with free objects, or of spare pages */
+  struct slab_page *next;
+  struct slab_page *prev;
+  /** free objects in this page, linked through their first word */
+  void *free;
+  /** objects handed out from this page */
+  u16_t used;
+  /** index into slab_classes, or SLAB_LARGE */
+  u8_t class_idx;
+  /** bytes in the pages of a large allocation */
+  mem_size_t large_size;
+};
+
+/** objects start this far into their page, aligned like the sizes */
+#define SLAB_HDR_SIZE        ((sizeof(struct slab_page) + SLAB_GRANULE - 1) & ~(SLAB_GRANULE - 1))
+
+struct slab_class {
+  /** pages of this size with at least one free object */
+  struct slab_page *partial;
+  /** objects that fit in a page */
+  u16_t per_page;
+#if MEM_SLAB_CACHE
+  /** objects of this size a thread keeps: no more than a page's worth, so
+   *  that caches can't hold on to more than a few pages each */
+  u16_t cache_max;
+#endif /* MEM_SLAB_CACHE */
+};
+
+static struct slab_class slab_classes[SLAB_NUM_CLASSES];
+/** class of a request, indexed by its size in granules (rounded up) */
+static u8_t slab_class_of[SLAB_MAX_SIZE / SLAB_GRANULE + 1];
+static struct slab_page *spare_pages;
+static u16_t num_spare_pages;
+/** bytes taken from the C library: pages and large allocations */
+static mem_size_t slab_held;
+/** bytes handed out: objects (including those in thread caches) and large
+ *  allocations */
+static mem_size_t slab_reserved;
+
+/** concurrent access protection */
+static sys_mutex_t mem_mutex;
+
+#if MEM_SLAB_CACHE
+/** Freed objects a thread keeps for itself, per size */
+struct slab_cache {
+  /** 0: not set up yet, 1: in use, 2: not in use (no exit handler, or the
+   *  thread is exiting) */
+  u8_t state;
+  /** the last slab_reclaim this cache answered */
+  u32_t reclaim;
+  u16_t count[SLAB_NUM_CLASSES];
+  void *objs[SLAB_NUM_CLASSES][MEM_SLAB_CACHE];
+};
+
+static LWIP_THREAD_LOCAL struct slab_cache slab_cache;
+
+/** Bumped when the shared lists run dry, asking every thread to give its
+ *  cache back the next time it allocates or frees. Read without the mutex,
+ *  like mem.c's mem_free_count. */
+static volatile u32_t slab_reclaim;
+#endif /* MEM_SLAB_CACHE */
+
+static void
+slab_list_push(struct slab_page **list, struct slab_page *page)
+{
+  page->prev = NULL;
+  page->next = *list;
+  if (*list != NULL) {
+    (*list)->prev = page;
+  }
+  *list = page;
+}
+
+static void
+slab_list_remove(struct slab_page **list, struct slab_page *page)
+{
+  if (page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    *list = page->next;
+  }
+  if (page->next != NULL) {
+    page->next->prev = page->prev;
+  }
+}
+
+/**
+ * Make room for bytes more from the C library within lwip_sizes.mem_size,
+ * giving up spare pages if that helps, and then the empty pages that
+ * slab_free_locked() keeps for each size.
+ *
+ * @return 1 if the bytes fit
+ */
+static int
+slab_reserve_held(mem_size_t bytes)
+{
+  struct slab_page *page, *next;
+  u8_t c;
+
+  while ((slab_held + bytes > lwip_sizes.mem_size) && (spare_pages != NULL)) {
+    page = spare_pages;
+    slab_list_remove(&spare_pages, page);
+    num_spare_pages--;
+    slab_held -= SLAB_PAGE_SIZE;
+    free(page);
+  }
+  for (c = 0; (c < SLAB_NUM_CLASSES) && (slab_held + bytes > lwip_sizes.mem_size); c++) {
+    for (page = slab_classes[c].partial; page != NULL; page = next) {
+      next = page->next;
+      if (page->used == 0) {
+        slab_list_remove(&slab_classes[c].partial, page);
+        slab_held -= SLAB_PAGE_SIZE;
+        free(page);
+        if (slab_held + bytes <= lwip_sizes.mem_size) {
+          break;
+        }
+      }
+    }
+  }
+  return slab_held + bytes <= lwip_sizes.mem_size;
+}
+
+/** Get a page for class c and thread its objects onto its free list */
+static struct slab_page *
+slab_page_new(u8_t c)
+{
+  struct slab_page *page;
+  u8_t *obj;
+  u16_t i, size = slab_sizes[c];
+
+  if (spare_pages != NULL) {
+    page = spare_pages;
+    slab_list_remove(&spare_pages, page);
+    num_spare_pages--;
+  } else {
+    if (!slab_reserve_held(SLAB_PAGE_SIZE)) {
+      return NULL;
+    }
+    page = (struct slab_page *)aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+    if (page == NULL) {
+      return NULL;
+    }
+    slab_held += SLAB_PAGE_SIZE;
+  }
+
+  page->class_idx = c;
+  page->used = 0;
+  page->large_size = 0;
+  obj = (u8_t *)page + SLAB_HDR_SIZE;
+  page->free = obj;
+  for (i = 1; i < slab_classes[c].per_page; i++, obj += size) {
+    *(void **)obj = obj + size;
+  }
+  *(void **)obj = NULL;
+  return page;
+}
+
+/** Keep an empty page for reuse or give it back to the C library */
+static void
+slab_page_release(struct slab_page *page)
+{
+  if (num_spare_pages < SLAB_SPARE_PAGES) {
+    slab_list_push(&spare_pages, page);
+    num_spare_pages++;
+  } else {
+    slab_held -= SLAB_PAGE_SIZE;
+    free(page);
+  }
+}
+
+/** Take an object of class c from the shared lists; mem_mutex is held */
+static void *
+slab_alloc_locked(u8_t c)
+{
+  struct slab_class *cls = &slab_classes[c];
+  struct slab_page *page = cls->partial;
+  void *mem;
+
+  if (page == NULL) {
+    page = slab_page_new(c);
+    if (page == NULL) {
+      return NULL;
+    }
+    slab_list_push(&cls->partial, page);
+  }
+  mem = page->free;
+  page->free = *(void **)mem;
+  page->used++;
+  if (page->free == NULL) {
+    slab_list_remove(&cls->partial, page);
+  }
+  slab_reserved += slab_sizes[c];
+  MEM_STATS_INC_USED(used, slab_sizes[c]);
+  return mem;
+}
+
+/** Put an object back on the shared lists; mem_mutex is held */
+static void
+slab_free_locked(void *mem)
+{
+  struct slab_page *page = SLAB_PAGE_OF(mem);
+  struct slab_class *cls = &slab_classes[page->class_idx];
+
+  LWIP_ASSERT("mem_free: object from a large allocation", page->class_idx != SLAB_LARGE);
+  LWIP_ASSERT("mem_free: page has nothing handed out", page->used > 0);
+
+  if (page->free == NULL) {
+    slab_list_push(&cls->partial, page);
+  }
+  *(void **)mem = page->free;
+  page->free = mem;
+  page->used--;
+  slab_reserved -= slab_sizes[page->class_idx];
+  MEM_STATS_DEC_USED(used, slab_sizes[page->class_idx]);
+
+  /* keep the last page of a size so that one object going back and forth
+     doesn't take a page in and out each time */
+  if ((page->used == 0) && ((cls->partial != page) || (page->next != NULL))) {
+    slab_list_remove(&cls->partial, page);
+    slab_page_release(page);
+  }
+}
+
+static void *
+slab_alloc_large(mem_size_t size)
+{
+  struct slab_page *page = NULL;
+  mem_size_t bytes;
+
+  if (size > lwip_sizes.mem_size) {
+    /* also keeps the rounding below from overflowing */
+    MEM_STATS_INC(err);
+    return NULL;
+  }
+  bytes = (SLAB_HDR_SIZE + size + SLAB_PAGE_SIZE - 1) & ~(mem_size_t)(SLAB_PAGE_SIZE - 1);
+
+  sys_mutex_lock(&mem_mutex);
+  if (slab_reserve_held(bytes)) {
+    page = (struct slab_page *)aligned_alloc(SLAB_PAGE_SIZE, bytes);
+  }
+  if (page == NULL) {
+    LWIP_DEBUGF(MEM_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mem_malloc: could not allocate %"MEM_SIZE_F" bytes\n", size));
+    MEM_STATS_INC(err);
+#if MEM_SLAB_CACHE
+    slab_reclaim++;
+#endif /* MEM_SLAB_CACHE */
+    sys_mutex_unlock(&mem_mutex);
+    return NULL;
+  }
+  slab_held += bytes;
+  slab_reserved += bytes;
+  MEM_STATS_INC_USED(used, bytes);
+  sys_mutex_unlock(&mem_mutex);
+
+  page->class_idx = SLAB_LARGE;
+  page->used = 1;
+  page->large_size = bytes;
+  return (u8_t *)page + SLAB_HDR_SIZE;
+}
+
+static void
+slab_free_large(struct slab_page *page)
+{
+  sys_mutex_lock(&mem_mutex);
+  slab_held -= page->large_size;
+  slab_reserved -= page->large_size;
+  MEM_STATS_DEC_USED(used, page->large_size);
+  sys_mutex_unlock(&mem_mutex);
+  free(page);
+}
+
+#if MEM_SLAB_CACHE
+/** Hand everything in the calling thread's cache back to the shared lists;
+ *  mem_mutex is held */
+static void
+slab_cache_flush_locked(void)
+{
+  u8_t c;
+
+  for (c = 0; c < SLAB_NUM_CLASSES; c++) {
+    while (slab_cache.count[c] > 0) {
+      slab_free_locked(slab_cache.objs[c][--slab_cache.count[c]]);
+    }
+  }
+  slab_cache.reclaim = slab_reclaim;
+}
+
+/** Give the cache back and stop caching; run when the thread exits */
+static void
+slab_cache_exit(void *arg)
+{
+  LWIP_UNUSED_ARG(arg);
+  slab_cache.state = 2;
+  sys_mutex_lock(&mem_mutex);
+  slab_cache_flush_locked();
+  sys_mutex_unlock(&mem_mutex);
+}
+
+/** @return 1 if the calling thread can use its cache */
+static int
+slab_cache_usable(void)
+{
+  if (slab_cache.state == 0) {
+    slab_cache.reclaim = slab_reclaim;
+    slab_cache.state = (sys_thread_atexit(slab_cache_exit, NULL) == ERR_OK) ? 1 : 2;
+  }
+  if ((slab_cache.state == 1) && (slab_cache.reclaim != slab_reclaim)) {
+    sys_mutex_lock(&mem_mutex);
+    slab_cache_flush_locked();
+    sys_mutex_unlock(&mem_mutex);
+  }
+  return slab_cache.state == 1;
+}
+
+/** Take half a cache's worth of class c from the shared lists, giving
+ *  back the rest of the cache first if they have run dry */
+static void
+slab_cache_refill(u8_t c)
+{
+  u16_t batch = (slab_classes[c].cache_max + 1) / 2;
+  void *mem;
+
+  sys_mutex_lock(&mem_mutex);
+  while (slab_cache.count[c] < batch) {
+    mem = slab_alloc_locked(c);
+    if (mem == NULL) {
+      break;
+    }
+    slab_cache.objs[c][slab_cache.count[c]++] = mem;
+  }
+  if (slab_cache.count[c] == 0) {
+    slab_reclaim++;
+    slab_cache_flush_locked();
+    mem = slab_alloc_locked(c);
+    if (mem != NULL) {
+      slab_cache.objs[c][slab_cache.count[c]++] = mem;
+    } else {
+      MEM_STATS_INC(err);
+    }
+  }
+  sys_mutex_unlock(&mem_mutex);
+}
+#endif /* MEM_SLAB_CACHE */
+
+/**
+ * Set up the size classes
+ */
+void
+mem_init(void)
+{
+  u8_t c = 0;
+  u16_t i;
+
+  LWIP_ASSERT("Sanity check page header", SLAB_HDR_SIZE + 2 * SLAB_MAX_SIZE <= SLAB_PAGE_SIZE);
+
+  for (i = 0; i < SLAB_NUM_CLASSES; i++) {
+    slab_classes[i].partial = NULL;
+    slab_classes[i].per_page = (u16_t)((SLAB_PAGE_SIZE - SLAB_HDR_SIZE) / slab_sizes[i]);
+#if MEM_SLAB_CACHE
+    slab_classes[i].cache_max = LWIP_MIN(MEM_SLAB_CACHE, slab_classes[i].per_page);
+#endif /* MEM_SLAB_CACHE */
+  }
+  for (i = 0; i < sizeof(slab_class_of); i++) {
+    while (slab_sizes[c] < i * SLAB_GRANULE) {
+      c++;
+    }
+    slab_class_of[i] = c;
+  }
+  spare_pages = NULL;
+  num_spare_pages = 0;
+  slab_held = 0;
+  slab_reserved = 0;
+
+  MEM_STATS_AVAIL(avail, lwip_sizes.mem_size);
+
+  if(sys_mutex_new(&mem_mutex) != ERR_OK) {
+    LWIP_ASSERT("failed to create mem_mutex", 0);
+  }
+}
+
+/**
+ * Allocate a block of memory with a minimum of 'size' bytes.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ * @return pointer to allocated memory or NULL if no free memory was found.
+ */
+void *
+mem_malloc(mem_size_t size)
+{
+  void *mem;
+  u8_t c;
+
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > SLAB_MAX_SIZE) {
+    return slab_alloc_large(size);
+  }
+  c = slab_class_of[(size + SLAB_GRANULE - 1) / SLAB_GRANULE];
+
+#if MEM_SLAB_CACHE
+  if (slab_cache_usable()) {
+    if (slab_cache.count[c] == 0) {
+      slab_cache_refill(c);
+      if (slab_cache.count[c] == 0) {
+        return NULL;
+      }
+    }
+    return slab_cache.objs[c][--slab_cache.count[c]];
+  }
+#endif /* MEM_SLAB_CACHE */
+
+  sys_mutex_lock(&mem_mutex);
+  mem = slab_alloc_locked(c);
+  if (mem == NULL) {
+    LWIP_DEBUGF(MEM_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mem_malloc: could not allocate %"MEM_SIZE_F" bytes\n", size));
+    MEM_STATS_INC(err);
+#if MEM_SLAB_CACHE
+    slab_reclaim++;
+#endif /* MEM_SLAB_CACHE */
+  }
+  sys_mutex_unlock(&mem_mutex);
+  return mem;
+}
+
+/**
+ * Put memory from mem_malloc() back
+ *
+ * @param rmem as returned by mem_malloc()
+ */
+void
+mem_free(void *rmem)
+{
+  struct slab_page *page;
+
+  if (rmem == NULL) {
+    LWIP_DEBUGF(MEM_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_LEVEL_SERIOUS, ("mem_free(p == NULL) was called.\n"));
+    return;
+  }
+  page = SLAB_PAGE_OF(rmem);
+  if (page->class_idx == SLAB_LARGE) {
+    LWIP_ASSERT("mem_free: not the start of a large allocation",
+      (u8_t *)rmem == (u8_t *)page + SLAB_HDR_SIZE);
+    slab_free_large(page);
+    return;
+  }
+
+#if MEM_SLAB_CACHE
+  if (slab_cache_usable()) {
+    u8_t c = page->class_idx;
+    u16_t cache_max = slab_classes[c].cache_max;
+    if (slab_cache.count[c] == cache_max) {
+      /* make room by handing half the cache back */
+      sys_mutex_lock(&mem_mutex);
+      while (slab_cache.count[c] > cache_max / 2) {
+        slab_free_locked(slab_cache.objs[c][--slab_cache.count[c]]);
+      }
+      sys_mutex_unlock(&mem_mutex);
+    }
+    slab_cache.objs[c][slab_cache.count[c]++] = rmem;
+    return;
+  }
+#endif /* MEM_SLAB_CACHE */
+
+  sys_mutex_lock(&mem_mutex);
+  slab_free_locked(rmem);
+  sys_mutex_unlock(&mem_mutex);
+}
+
+/**
+ * Objects can't shrink in place, so this leaves them as they are.
+ *
+ * @param rmem as returned by mem_malloc()
+ * @param newsize the size the caller still needs
+ * @return rmem
+ */
+void *
+mem_trim(void *rmem, mem_size_t newsize)
+{
+  LWIP_UNUSED_ARG(newsize);
+  return rmem;
+}
+
+/**
+ * Report how much memory the allocator holds and how much of it is handed
+ * out. Objects in thread caches count as handed out.
+ *
+ * @param usage filled in with a snapshot of the allocator
+ */
+void
+mem_usage_get(struct mem_usage *usage)
+{
+  mem_size_t room, largest = 0;
+  s16_t c;
+
+  sys_mutex_lock(&mem_mutex);
+  /* spare pages would be given up for a large allocation */
+  room = lwip_sizes.mem_size - slab_held + num_spare_pages * SLAB_PAGE_SIZE;
+  if (room >= SLAB_PAGE_SIZE) {
+    largest = (room & ~(mem_size_t)(SLAB_PAGE_SIZE - 1)) - SLAB_HDR_SIZE;
+  }
+  if (largest < SLAB_MAX_SIZE) {
+    for (c = SLAB_NUM_CLASSES - 1; c >= 0; c--) {
+      if (slab_classes[c].partial != NULL) {
+        if (slab_sizes[c] > largest) {
+          largest = slab_sizes[c];
+        }
+        break;
+      }
+    }
+  }
+  usage->limit = lwip_sizes.mem_size;
+  usage->size = slab_held;
+  usage->reserved = slab_reserved;
+  usage->largest_free = largest;
+  sys_mutex_unlock(&mem_mutex);
+}
+
+#endif /* !MEM_LIBC_MALLOC && !MEM_USE_POOLS && MEM_SLAB */
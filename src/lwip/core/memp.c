@@ -41,6 +41,7 @@
 #include "lwip/opt.h"
 
 #include "lwip/memp.h"
+#include "lwip/sizes.h"
 #include "lwip/pbuf.h"
 #include "lwip/udp.h"
 #include "lwip/raw.h"
@@ -59,6 +60,7 @@
 #include "lwip/dns.h"
 #include "netif/ppp_oe.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #if !MEMP_MEM_MALLOC /* don't build if not configured for use in lwipopts.h */
@@ -69,6 +71,10 @@ struct memp {
   const char *file;
   int line;
 #endif /* MEMP_OVERFLOW_CHECK */
+#if MEMP_CACHE
+  /** the cache of the thread the element went out to, NULL if none */
+  struct memp_cache *owner;
+#endif /* MEMP_CACHE */
 };
 
 #if MEMP_OVERFLOW_CHECK
@@ -103,11 +109,18 @@ struct memp {
 
 #else /* MEMP_OVERFLOW_CHECK */
 
+#if MEMP_CACHE
+/* No sanity checks, but the struct memp stays in front of each element to
+ * say which thread's cache it went out through.
+ */
+#define MEMP_SIZE           LWIP_MEM_ALIGN_SIZE(sizeof(struct memp))
+#else /* MEMP_CACHE */
 /* No sanity checks
  * We don't need to preserve the struct memp while not allocated, so we
  * can save a little space and set MEMP_SIZE to 0.
  */
 #define MEMP_SIZE           0
+#endif /* MEMP_CACHE */
 #define MEMP_ALIGN_SIZE(x) (LWIP_MEM_ALIGN_SIZE(x))
 
 #endif /* MEMP_OVERFLOW_CHECK */
@@ -116,6 +129,44 @@ struct memp {
  *  Elements form a linked list. */
 static struct memp *memp_tab[MEMP_MAX];
 
+#if MEMP_CACHE
+/** Freed elements a thread keeps for itself, per pool */
+struct memp_cache {
+  /** 0: not set up yet, 1: in use, 2: not in use (no exit handler, or the
+   *  thread is exiting) */
+  u8_t state;
+  /** how many elements of each pool this cache may hold, taken from
+   *  memp_cache_left[] the first time the thread uses the pool; 0 if not
+   *  taken yet or there was too little left */
+  u16_t max[MEMP_MAX];
+  u16_t count[MEMP_MAX];
+  /** the last memp_reclaim[] this cache answered, per pool */
+  u32_t reclaim[MEMP_MAX];
+  struct memp *elems[MEMP_MAX][MEMP_CACHE];
+#if MEMP_STATS
+  /** counted here without protection and added to lwip_stats the next
+   *  time the pools are protected anyway */
+  u32_t hits[MEMP_MAX];
+  u32_t xthread_frees[MEMP_MAX];
+#endif /* MEMP_STATS */
+};
+
+static LWIP_THREAD_LOCAL struct memp_cache memp_cache;
+
+/** How many elements of each pool a cache holds at most, set by memp_init() */
+static u16_t memp_cache_max[MEMP_MAX];
+
+/** How many more elements of each pool the caches may hold between them.
+ *  Bounding the sum keeps half of each pool out of the caches, so that
+ *  threads that stop using a pool can't strand all of it */
+static u16_t memp_cache_left[MEMP_MAX];
+
+/** Bumped when a pool runs dry, asking every thread to give back what it
+ *  holds of that pool the next time it allocates or frees from it. Read
+ *  without protection, like mem.c's mem_free_count. */
+static volatile u32_t memp_reclaim[MEMP_MAX];
+#endif /* MEMP_CACHE */
+
 #else /* MEMP_MEM_MALLOC */
 
 #define MEMP_ALIGN_SIZE(x) (LWIP_MEM_ALIGN_SIZE(x))
@@ -133,11 +184,17 @@ const u16_t memp_sizes[MEMP_MAX] = {
 
 #if !MEMP_MEM_MALLOC /* don't build if not configured for use in lwipopts.h */
 
-/** This array holds the number of elements in each pool. */
+#if MEMP_SEPARATE_POOLS
+/** This array holds the number of elements in each pool. Separate pools are
+ *  laid out at compile time, so they keep the sizes from opt.h */
 static const u16_t memp_num[MEMP_MAX] = {
 #define LWIP_MEMPOOL(name,num,size,desc)  (num),
 #include "lwip/memp_std.h"
 };
+#else /* MEMP_SEPARATE_POOLS */
+/** The number of elements in each pool, which may be set at run time */
+#define memp_num lwip_sizes.memp_num
+#endif /* MEMP_SEPARATE_POOLS */
 
 /** This array holds a textual description of each pool. */
 #ifdef LWIP_DEBUG
@@ -166,11 +223,9 @@ static u8_t *const memp_bases[] = {
 
 #else /* MEMP_SEPARATE_POOLS */
 
-/** This is the actual memory used by the pools (all pools in one big block). */
-static u8_t memp_memory[MEM_ALIGNMENT - 1 
-#define LWIP_MEMPOOL(name,num,size,desc) + ( (num) * (MEMP_SIZE + MEMP_ALIGN_SIZE(size) ) )
-#include "lwip/memp_std.h"
-];
+/** This is the actual memory used by the pools (all pools in one big block),
+ *  allocated by memp_init() once the number of elements in each is known. */
+static u8_t *memp_memory;
 
 #endif /* MEMP_SEPARATE_POOLS */
 
@@ -345,9 +400,26 @@ memp_init(void)
     MEMP_STATS_AVAIL(max, i, 0);
     MEMP_STATS_AVAIL(err, i, 0);
     MEMP_STATS_AVAIL(avail, i, memp_num[i]);
+#if MEMP_CACHE
+    /* smaller caches would move elements one at a time, costing more in
+       refills and flushes than they save */
+    memp_cache_max[i] = LWIP_MIN(MEMP_CACHE, memp_num[i] / 4);
+    if (memp_cache_max[i] < 4) {
+      memp_cache_max[i] = 0;
+    }
+    memp_cache_left[i] = memp_num[i] / 2;
+#endif /* MEMP_CACHE */
   }
 
 #if !MEMP_SEPARATE_POOLS
+  {
+    size_t memory_size = MEM_ALIGNMENT - 1;
+    for (i = 0; i < MEMP_MAX; ++i) {
+      memory_size += memp_num[i] * (MEMP_SIZE + MEMP_ALIGN_SIZE(memp_sizes[i]));
+    }
+    memp_memory = (u8_t *)malloc(memory_size);
+    LWIP_ASSERT("failed to allocate the pools", memp_memory != NULL);
+  }
   memp = (struct memp *)LWIP_MEM_ALIGN(memp_memory);
 #endif /* !MEMP_SEPARATE_POOLS */
   /* for every pool: */
@@ -374,6 +446,232 @@ memp_init(void)
 #endif /* MEMP_OVERFLOW_CHECK */
 }
 
+#if MEMP_GROW_CONNECTIONS
+/**
+ * Check whether a pool may take more memory from the heap when it is empty.
+ * These are the pools a connection holds on to for its whole life.
+ */
+static int
+memp_can_grow(memp_t type)
+{
+  switch (type) {
+#if LWIP_RAW
+  case MEMP_RAW_PCB:
+#endif /* LWIP_RAW */
+#if LWIP_UDP
+  case MEMP_UDP_PCB:
+#endif /* LWIP_UDP */
+#if LWIP_TCP
+  case MEMP_TCP_PCB:
+  case MEMP_TCP_PCB_LISTEN:
+#endif /* LWIP_TCP */
+#if LWIP_NETCONN
+  case MEMP_NETCONN:
+#endif /* LWIP_NETCONN */
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Add MEMP_GROW_CHUNK elements from the heap to an empty pool.
+ * Must be called with the pools protected.
+ *
+ * @param type the pool to grow
+ */
+static void
+memp_grow(memp_t type)
+{
+  struct memp *memp;
+  u8_t *chunk;
+  u16_t j;
+  size_t element_size = MEMP_SIZE + memp_sizes[type]
+#if MEMP_OVERFLOW_CHECK
+    + MEMP_SANITY_REGION_AFTER_ALIGNED
+#endif
+    ;
+
+  /* never freed: grown elements go back on the pool's list like the rest */
+  chunk = (u8_t *)malloc(MEM_ALIGNMENT - 1 + MEMP_GROW_CHUNK * element_size);
+  if (chunk == NULL) {
+    return;
+  }
+  memp = (struct memp *)LWIP_MEM_ALIGN(chunk);
+  for (j = 0; j < MEMP_GROW_CHUNK; ++j) {
+#if MEMP_OVERFLOW_CHECK
+#if MEMP_SANITY_REGION_BEFORE_ALIGNED > 0
+    memset((u8_t*)memp + MEMP_SIZE - MEMP_SANITY_REGION_BEFORE_ALIGNED, 0xcd, MEMP_SANITY_REGION_BEFORE_ALIGNED);
+#endif
+#if MEMP_SANITY_REGION_AFTER_ALIGNED > 0
+    memset((u8_t*)memp + MEMP_SIZE + memp_sizes[type], 0xcd, MEMP_SANITY_REGION_AFTER_ALIGNED);
+#endif
+#endif /* MEMP_OVERFLOW_CHECK */
+    memp->next = memp_tab[type];
+    memp_tab[type] = memp;
+    memp = (struct memp *)(void *)((u8_t *)memp + element_size);
+  }
+#if MEMP_STATS
+  lwip_stats.memp[type].avail += MEMP_GROW_CHUNK;
+#endif /* MEMP_STATS */
+}
+#endif /* MEMP_GROW_CONNECTIONS */
+
+#if MEMP_CACHE
+/**
+ * Add the calling thread's cache counters to lwip_stats.
+ * Must be called with the pools protected.
+ */
+static void
+memp_cache_stats(memp_t type)
+{
+#if MEMP_STATS
+  lwip_stats.memp_cache[type].hits += memp_cache.hits[type];
+  lwip_stats.memp_cache[type].xthread_frees += memp_cache.xthread_frees[type];
+  memp_cache.hits[type] = 0;
+  memp_cache.xthread_frees[type] = 0;
+#else /* MEMP_STATS */
+  LWIP_UNUSED_ARG(type);
+#endif /* MEMP_STATS */
+}
+
+/**
+ * Hand elements of one pool back from the calling thread's cache until
+ * it holds no more than keep.
+ * Must be called with the pools protected.
+ */
+static void
+memp_cache_flush(memp_t type, u16_t keep)
+{
+  struct memp *memp;
+
+#if MEMP_STATS
+  if (memp_cache.count[type] > keep) {
+    lwip_stats.memp_cache[type].flushes++;
+  }
+#endif /* MEMP_STATS */
+  while (memp_cache.count[type] > keep) {
+    memp = memp_cache.elems[type][--memp_cache.count[type]];
+    memp->next = memp_tab[type];
+    memp_tab[type] = memp;
+    MEMP_STATS_DEC(used, type);
+  }
+  memp_cache_stats(type);
+}
+
+/**
+ * Give the whole cache back and stop caching; run when the thread exits.
+ */
+static void
+memp_cache_exit(void *arg)
+{
+  u16_t i;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  LWIP_UNUSED_ARG(arg);
+  memp_cache.state = 2;
+  SYS_ARCH_PROTECT(old_level);
+  for (i = 0; i < MEMP_MAX; ++i) {
+    memp_cache_flush((memp_t)i, 0);
+    memp_cache_left[i] += memp_cache.max[i];
+    memp_cache.max[i] = 0;
+  }
+  SYS_ARCH_UNPROTECT(old_level);
+}
+
+/**
+ * Check whether the calling thread can go through its cache for a pool,
+ * first giving the pool back its elements if it has run dry since.
+ *
+ * @return 1 if the cache can be used
+ */
+static int
+memp_cache_usable(memp_t type)
+{
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  if (memp_cache_max[type] == 0) {
+    return 0;
+  }
+  if (memp_cache.state == 0) {
+    u16_t i;
+    for (i = 0; i < MEMP_MAX; ++i) {
+      memp_cache.reclaim[i] = memp_reclaim[i];
+    }
+    memp_cache.state = (sys_thread_atexit(memp_cache_exit, NULL) == ERR_OK) ? 1 : 2;
+  }
+  if (memp_cache.state != 1) {
+    return 0;
+  }
+  if (memp_cache.max[type] == 0) {
+    /* memp_cache_left[] is only looked at here without protection, to
+       spare threads that didn't get a cache the lock on every call */
+    if (memp_cache_left[type] < 4) {
+      return 0;
+    }
+    SYS_ARCH_PROTECT(old_level);
+    if (memp_cache_left[type] >= 4) {
+      memp_cache.max[type] = LWIP_MIN(memp_cache_max[type], memp_cache_left[type]);
+      memp_cache_left[type] -= memp_cache.max[type];
+    }
+    SYS_ARCH_UNPROTECT(old_level);
+    if (memp_cache.max[type] == 0) {
+      return 0;
+    }
+  }
+  if (memp_cache.reclaim[type] != memp_reclaim[type]) {
+    SYS_ARCH_PROTECT(old_level);
+    memp_cache_flush(type, 0);
+    memp_cache.reclaim[type] = memp_reclaim[type];
+    SYS_ARCH_UNPROTECT(old_level);
+  }
+  return 1;
+}
+
+/**
+ * Take half a cache's worth of elements from a pool into the calling
+ * thread's cache, growing the pool if it may. If the pool is empty, the
+ * other threads are asked to give back what they hold.
+ */
+static void
+memp_cache_refill(memp_t type)
+{
+  struct memp *memp;
+  u16_t batch = (memp_cache.max[type] + 1) / 2;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  SYS_ARCH_PROTECT(old_level);
+  while (memp_cache.count[type] < batch) {
+    memp = memp_tab[type];
+#if MEMP_GROW_CONNECTIONS
+    if ((memp == NULL) && memp_can_grow(type)) {
+      memp_grow(type);
+      memp = memp_tab[type];
+    }
+#endif /* MEMP_GROW_CONNECTIONS */
+    if (memp == NULL) {
+      break;
+    }
+    memp_tab[type] = memp->next;
+    memp->owner = &memp_cache;
+    memp_cache.elems[type][memp_cache.count[type]++] = memp;
+    MEMP_STATS_INC_USED(used, type);
+  }
+  if (memp_cache.count[type] > 0) {
+#if MEMP_STATS
+    lwip_stats.memp_cache[type].refills++;
+#endif /* MEMP_STATS */
+  } else {
+    LWIP_DEBUGF(MEMP_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("memp_malloc: out of memory in pool %s\n", memp_desc[type]));
+    MEMP_STATS_INC(err, type);
+    memp_reclaim[type]++;
+    memp_cache.reclaim[type] = memp_reclaim[type];
+  }
+  memp_cache_stats(type);
+  SYS_ARCH_UNPROTECT(old_level);
+}
+#endif /* MEMP_CACHE */
+
 /**
  * Get an element from a specific pool.
  *
@@ -397,12 +695,35 @@ memp_malloc_fn(memp_t type, const char* file, const int line)
  
   LWIP_ERROR("memp_malloc: type < MEMP_MAX", (type < MEMP_MAX), return NULL;);
 
+#if MEMP_CACHE
+  if (memp_cache_usable(type)) {
+    if (memp_cache.count[type] == 0) {
+      memp_cache_refill(type);
+      if (memp_cache.count[type] == 0) {
+        return NULL;
+      }
+    } else {
+#if MEMP_STATS
+      memp_cache.hits[type]++;
+#endif /* MEMP_STATS */
+    }
+    memp = memp_cache.elems[type][--memp_cache.count[type]];
+    return (u8_t*)memp + MEMP_SIZE;
+  }
+#endif /* MEMP_CACHE */
+
   SYS_ARCH_PROTECT(old_level);
 #if MEMP_OVERFLOW_CHECK >= 2
   memp_overflow_check_all();
 #endif /* MEMP_OVERFLOW_CHECK >= 2 */
 
   memp = memp_tab[type];
+#if MEMP_GROW_CONNECTIONS
+  if ((memp == NULL) && memp_can_grow(type)) {
+    memp_grow(type);
+    memp = memp_tab[type];
+  }
+#endif /* MEMP_GROW_CONNECTIONS */
   
   if (memp != NULL) {
     memp_tab[type] = memp->next;
@@ -411,6 +732,9 @@ memp_malloc_fn(memp_t type, const char* file, const int line)
     memp->file = file;
     memp->line = line;
 #endif /* MEMP_OVERFLOW_CHECK */
+#if MEMP_CACHE
+    memp->owner = NULL;
+#endif /* MEMP_CACHE */
     MEMP_STATS_INC_USED(used, type);
     LWIP_ASSERT("memp_malloc: memp properly aligned",
                 ((mem_ptr_t)memp % MEM_ALIGNMENT) == 0);
@@ -445,6 +769,25 @@ memp_free(memp_t type, void *mem)
 
   memp = (struct memp *)(void *)((u8_t*)mem - MEMP_SIZE);
 
+#if MEMP_CACHE
+  if (memp_cache_usable(type)) {
+#if MEMP_STATS
+    if (memp->owner != &memp_cache) {
+      memp_cache.xthread_frees[type]++;
+    }
+#endif /* MEMP_STATS */
+    if (memp_cache.count[type] == memp_cache.max[type]) {
+      /* make room by handing half the cache back */
+      SYS_ARCH_PROTECT(old_level);
+      memp_cache_flush(type, memp_cache.max[type] / 2);
+      SYS_ARCH_UNPROTECT(old_level);
+    }
+    memp->owner = &memp_cache;
+    memp_cache.elems[type][memp_cache.count[type]++] = memp;
+    return;
+  }
+#endif /* MEMP_CACHE */
+
   SYS_ARCH_PROTECT(old_level);
 #if MEMP_OVERFLOW_CHECK
 #if MEMP_OVERFLOW_CHECK >= 2
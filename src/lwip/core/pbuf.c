@@ -294,6 +294,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
                   ((u8_t*)p->payload + p->len <=
                    (u8_t*)p + SIZEOF_STRUCT_PBUF + PBUF_POOL_BUFSIZE_ALIGNED));
       q->ref = 1;
+      PBUF_STAMP_SET(q, 0);
       /* calculate remaining length to be allocated */
       rem_len -= q->len;
       /* remember this pbuf for linkage in next iteration */
@@ -344,6 +345,7 @@ pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
   p->ref = 1;
   /* set flags */
   p->flags = 0;
+  PBUF_STAMP_SET(p, 0);
   LWIP_DEBUGF(PBUF_DEBUG | LWIP_DBG_TRACE, ("pbuf_alloc(length=%"U16_F") == %p\n", length, (void *)p));
   return p;
 }
@@ -407,6 +409,7 @@ pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type, struct pbuf_cust
   p->pbuf.len = p->pbuf.tot_len = length;
   p->pbuf.type = type;
   p->pbuf.ref = 1;
+  PBUF_STAMP_SET(&p->pbuf, 0);
   return &p->pbuf;
 }
 #endif /* LWIP_SUPPORT_CUSTOM_PBUF */
@@ -1064,6 +1067,58 @@ pbuf_fill_chksum(struct pbuf *p, u16_t start_offset, const void *dataptr,
   *chksum = FOLD_U32T(acc);
   return ERR_OK;
 }
+
+/**
+ * Same as pbuf_take, but also returns the checksum of the copied data as
+ * LWIP_CHKSUM_COPY would for a single buffer, so the data is only read once.
+ *
+ * @param buf pbuf to fill with data
+ * @param dataptr application supplied data buffer
+ * @param len length of the application supplied data buffer
+ * @param chksum where to store the (non-inverted) checksum of the data
+ *
+ * @return ERR_OK if successful, ERR_ARG if an argument is NULL or the pbuf
+ *         is not big enough
+ */
+err_t
+pbuf_take_chksum(struct pbuf *buf, const void *dataptr, u16_t len, u16_t *chksum)
+{
+  struct pbuf *p;
+  u16_t buf_copy_len;
+  u16_t total_copy_len = len;
+  u16_t copied_total = 0;
+  u16_t copy_chksum;
+  u32_t acc = 0;
+
+  LWIP_ERROR("pbuf_take_chksum: invalid buf", (buf != NULL), return ERR_ARG;);
+  LWIP_ERROR("pbuf_take_chksum: invalid dataptr", (dataptr != NULL), return ERR_ARG;);
+  LWIP_ERROR("pbuf_take_chksum: invalid chksum", (chksum != NULL), return ERR_ARG;);
+
+  if ((buf == NULL) || (dataptr == NULL) || (chksum == NULL) || (buf->tot_len < len)) {
+    return ERR_ARG;
+  }
+
+  for(p = buf; total_copy_len != 0; p = p->next) {
+    LWIP_ASSERT("pbuf_take_chksum: invalid pbuf", p != NULL);
+    buf_copy_len = total_copy_len;
+    if (buf_copy_len > p->len) {
+      /* this pbuf cannot hold all remaining data */
+      buf_copy_len = p->len;
+    }
+    copy_chksum = LWIP_CHKSUM_COPY(p->payload, &((const char*)dataptr)[copied_total], buf_copy_len);
+    /* a part starting at an odd offset has its bytes the other way round */
+    if ((copied_total & 1) != 0) {
+      copy_chksum = SWAP_BYTES_IN_WORD(copy_chksum);
+    }
+    acc += copy_chksum;
+    total_copy_len -= buf_copy_len;
+    copied_total += buf_copy_len;
+  }
+  LWIP_ASSERT("did not copy all data", total_copy_len == 0 && copied_total == len);
+  acc = FOLD_U32T(acc);
+  *chksum = (u16_t)FOLD_U32T(acc);
+  return ERR_OK;
+}
 #endif /* LWIP_CHECKSUM_ON_COPY */
 
  /** Get one byte from the specified position in a pbuf
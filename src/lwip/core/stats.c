@@ -83,7 +83,8 @@ stats_display_proto(struct stats_proto *proto, const char *name)
   LWIP_PLATFORM_DIAG(("proterr: %"STAT_COUNTER_F"\n\t", proto->proterr)); 
   LWIP_PLATFORM_DIAG(("opterr: %"STAT_COUNTER_F"\n\t", proto->opterr)); 
   LWIP_PLATFORM_DIAG(("err: %"STAT_COUNTER_F"\n\t", proto->err)); 
-  LWIP_PLATFORM_DIAG(("cachehit: %"STAT_COUNTER_F"\n", proto->cachehit)); 
+  LWIP_PLATFORM_DIAG(("cachehit: %"STAT_COUNTER_F"\n\t", proto->cachehit)); 
+  LWIP_PLATFORM_DIAG(("rexmit: %"STAT_COUNTER_F"\n", proto->rexmit)); 
 }
 
 #if IGMP_STATS
@@ -108,6 +109,18 @@ stats_display_igmp(struct stats_igmp *igmp)
 }
 #endif /* IGMP_STATS */
 
+#if ETHARP_STATS
+void
+stats_display_etharp_cache(struct stats_etharp_cache *cache)
+{
+  LWIP_PLATFORM_DIAG(("\tcache.hits: %"U32_F"\n\t", cache->hits));
+  LWIP_PLATFORM_DIAG(("cache.misses: %"U32_F"\n\t", cache->misses));
+  LWIP_PLATFORM_DIAG(("cache.evictions: %"U32_F"\n\t", cache->evictions));
+  LWIP_PLATFORM_DIAG(("cache.used: %"U32_F"\n\t", cache->used));
+  LWIP_PLATFORM_DIAG(("cache.size: %"U32_F"\n", cache->size));
+}
+#endif /* ETHARP_STATS */
+
 #if MEM_STATS || MEMP_STATS
 void
 stats_display_mem(struct stats_mem *mem, const char *name)
@@ -129,6 +142,12 @@ stats_display_memp(struct stats_mem *mem, int index)
   };
   if(index < MEMP_MAX) {
     stats_display_mem(mem, memp_names[index]);
+#if MEMP_CACHE
+    LWIP_PLATFORM_DIAG(("\tcache.hits: %"U32_F"\n\t", lwip_stats.memp_cache[index].hits));
+    LWIP_PLATFORM_DIAG(("cache.refills: %"U32_F"\n\t", lwip_stats.memp_cache[index].refills));
+    LWIP_PLATFORM_DIAG(("cache.flushes: %"U32_F"\n\t", lwip_stats.memp_cache[index].flushes));
+    LWIP_PLATFORM_DIAG(("cache.xthread_frees: %"U32_F"\n", lwip_stats.memp_cache[index].xthread_frees));
+#endif /* MEMP_CACHE */
   }
 }
 #endif /* MEMP_STATS */
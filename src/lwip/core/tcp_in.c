@@ -368,7 +368,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
           } else {
             /* correct rcv_wnd as the application won't call tcp_recved()
                for the FIN's seqno */
-            if (pcb->rcv_wnd != TCP_WND) {
+            if (pcb->rcv_wnd != lwip_sizes.tcp_wnd) {
               pcb->rcv_wnd++;
             }
             TCP_EVENT_CLOSED(pcb, err);
@@ -1575,7 +1575,7 @@ tcp_parseopt(struct tcp_pcb *pcb)
         /* An MSS option with the right option length. */
         mss = (opts[c + 2] << 8) | opts[c + 3];
         /* Limit the mss to the configured TCP_MSS and prevent division by zero */
-        pcb->mss = ((mss > TCP_MSS) || (mss == 0)) ? TCP_MSS : mss;
+        pcb->mss = ((mss > lwip_sizes.tcp_mss) || (mss == 0)) ? lwip_sizes.tcp_mss : mss;
         /* Advance to next option */
         c += 0x04;
         break;
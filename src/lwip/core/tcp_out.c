@@ -51,9 +51,7 @@
 #include "lwip/inet_chksum.h"
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
-#if LWIP_TCP_TIMESTAMPS
 #include "lwip/sys.h"
-#endif
 
 #include <string.h>
 
@@ -80,6 +78,113 @@
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
 
+#if LWIP_SUPPORT_CUSTOM_PBUF
+struct tcp_zc {
+  /** pbufs referring to the memory, plus one held by the writer */
+  u32_t refs;
+  tcp_zc_done_fn done;
+  void *arg;
+};
+
+/** A pbuf referring to part of a zero-copy write */
+struct tcp_zc_pbuf {
+  struct pbuf_custom pc;
+  struct tcp_zc *zc;
+};
+
+/**
+ * Start tracking a zero-copy write. The caller holds the first reference
+ * and drops it with tcp_zc_release() once it has finished queueing data.
+ *
+ * @param done called when the last reference is dropped
+ * @param arg passed to done
+ * @return the tracker, or NULL if out of memory
+ */
+struct tcp_zc *
+tcp_zc_new(tcp_zc_done_fn done, void *arg)
+{
+  struct tcp_zc *zc = (struct tcp_zc *)mem_malloc(sizeof(struct tcp_zc));
+  if (zc != NULL) {
+    zc->refs = 1;
+    zc->done = done;
+    zc->arg = arg;
+  }
+  return zc;
+}
+
+/**
+ * Drop a reference to a zero-copy write, completing it if it was the last.
+ * This may be called from the tcpip thread or the application's.
+ */
+void
+tcp_zc_release(struct tcp_zc *zc)
+{
+  u32_t refs;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  SYS_ARCH_PROTECT(old_level);
+  refs = --zc->refs;
+  SYS_ARCH_UNPROTECT(old_level);
+
+  if (refs == 0) {
+    if (zc->done != NULL) {
+      zc->done(zc->arg);
+    }
+    mem_free(zc);
+  }
+}
+
+static void
+tcp_zc_pbuf_free(struct pbuf *p)
+{
+  struct tcp_zc_pbuf *zp = (struct tcp_zc_pbuf *)p;
+  struct tcp_zc *zc = zp->zc;
+  mem_free(zp);
+  tcp_zc_release(zc);
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
+/**
+ * Allocate a pbuf that refers to len bytes at data rather than copying them.
+ *
+ * @param zc if not NULL, the pbuf holds a reference to this zero-copy write
+ *           until it is freed
+ */
+static struct pbuf *
+tcp_pbuf_ref(pbuf_layer layer, const void *data, u16_t len, struct tcp_zc *zc)
+{
+  struct pbuf *p;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  if (zc != NULL) {
+    SYS_ARCH_DECL_PROTECT(old_level);
+    struct tcp_zc_pbuf *zp = (struct tcp_zc_pbuf *)mem_malloc(sizeof(struct tcp_zc_pbuf));
+    if (zp == NULL) {
+      return NULL;
+    }
+    zp->pc.custom_free_function = tcp_zc_pbuf_free;
+    zp->zc = zc;
+    /* the data never gets a header prepended, so PBUF_RAW fits any layer */
+    p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &zp->pc, (void *)data, len);
+    if (p == NULL) {
+      mem_free(zp);
+      return NULL;
+    }
+    SYS_ARCH_PROTECT(old_level);
+    zc->refs++;
+    SYS_ARCH_UNPROTECT(old_level);
+    return p;
+  }
+#else /* LWIP_SUPPORT_CUSTOM_PBUF */
+  LWIP_ASSERT("zero-copy writes need LWIP_SUPPORT_CUSTOM_PBUF", zc == NULL);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+  p = pbuf_alloc(layer, len, PBUF_ROM);
+  if (p != NULL) {
+    /* reference the non-volatile payload data */
+    p->payload = (void *)data;
+  }
+  return p;
+}
+
 /** Allocate a pbuf and create a tcphdr at p->payload, used for output
  * functions other than the default tcp_output -> tcp_output_segment
  * (e.g. tcp_send_empty_ack, etc.)
@@ -317,9 +422,9 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
   /* If total number of pbufs on the unsent/unacked queues exceeds the
    * configured maximum, return an error */
   /* check for configured max queuelen and possible overflow */
-  if ((pcb->snd_queuelen >= TCP_SND_QUEUELEN) || (pcb->snd_queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
+  if ((pcb->snd_queuelen >= lwip_sizes.tcp_snd_queuelen) || (pcb->snd_queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too long queue %"U16_F" (max %"U16_F")\n",
-      pcb->snd_queuelen, TCP_SND_QUEUELEN));
+      pcb->snd_queuelen, lwip_sizes.tcp_snd_queuelen));
     TCP_STATS_INC(tcp.memerr);
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
@@ -352,6 +457,21 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
  */
 err_t
 tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
+{
+  return tcp_write_zc(pcb, arg, len, apiflags, NULL);
+}
+
+/**
+ * Like tcp_write(), but when data isn't copied, every pbuf referring to it
+ * holds a reference to zc. Once the data has been ACKed and its segments
+ * freed, the last reference goes and zc's completion runs, after which the
+ * caller may reuse the memory.
+ *
+ * @param zc tracker from tcp_zc_new(), or NULL to behave like tcp_write()
+ */
+err_t
+tcp_write_zc(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags,
+             struct tcp_zc *zc)
 {
   struct pbuf *concat_p = NULL;
   struct tcp_seg *last_unsent = NULL, *seg = NULL, *prev_seg = NULL, *queue = NULL;
@@ -488,7 +608,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #endif /* TCP_CHECKSUM_ON_COPY */
       } else {
         /* Data is not copied */
-        if ((concat_p = pbuf_alloc(PBUF_RAW, seglen, PBUF_ROM)) == NULL) {
+        if ((concat_p = tcp_pbuf_ref(PBUF_RAW, (u8_t*)arg + pos, seglen, zc)) == NULL) {
           LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2,
                       ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
           goto memerr;
@@ -499,8 +619,6 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
           &concat_chksum, &concat_chksum_swapped);
         concat_chksummed += seglen;
 #endif /* TCP_CHECKSUM_ON_COPY */
-        /* reference the non-volatile payload data */
-        concat_p->payload = (u8_t*)arg + pos;
       }
 
       pos += seglen;
@@ -549,7 +667,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #if TCP_OVERSIZE
       LWIP_ASSERT("oversize == 0", oversize == 0);
 #endif /* TCP_OVERSIZE */
-      if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+      if ((p2 = tcp_pbuf_ref(PBUF_TRANSPORT, (u8_t*)arg + pos, seglen, zc)) == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
         goto memerr;
       }
@@ -557,8 +675,6 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
       /* calculate the checksum of nocopy-data */
       chksum = ~inet_chksum((u8_t*)arg + pos, seglen);
 #endif /* TCP_CHECKSUM_ON_COPY */
-      /* reference the non-volatile payload data */
-      p2->payload = (u8_t*)arg + pos;
 
       /* Second, allocate a pbuf for the headers. */
       if ((p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM)) == NULL) {
@@ -577,8 +693,8 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
     /* Now that there are more segments queued, we check again if the
      * length of the queue exceeds the configured maximum or
      * overflows. */
-    if ((queuelen > TCP_SND_QUEUELEN) || (queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
-      LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_write: queue too long %"U16_F" (%"U16_F")\n", queuelen, TCP_SND_QUEUELEN));
+    if ((queuelen > lwip_sizes.tcp_snd_queuelen) || (queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
+      LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_write: queue too long %"U16_F" (%"U16_F")\n", queuelen, lwip_sizes.tcp_snd_queuelen));
       pbuf_free(p);
       goto memerr;
     }
@@ -732,9 +848,9 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
               (flags & (TCP_SYN | TCP_FIN)) != 0);
 
   /* check for configured max queuelen and possible overflow */
-  if ((pcb->snd_queuelen >= TCP_SND_QUEUELEN) || (pcb->snd_queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
+  if ((pcb->snd_queuelen >= lwip_sizes.tcp_snd_queuelen) || (pcb->snd_queuelen > TCP_SNDQUEUELEN_OVERFLOW)) {
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_enqueue_flags: too long queue %"U16_F" (max %"U16_F")\n",
-                                       pcb->snd_queuelen, TCP_SND_QUEUELEN));
+                                       pcb->snd_queuelen, lwip_sizes.tcp_snd_queuelen));
     TCP_STATS_INC(tcp.memerr);
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
@@ -1070,9 +1186,9 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   if (seg->flags & TF_SEG_OPTS_MSS) {
     u16_t mss;
 #if TCP_CALCULATE_EFF_SEND_MSS
-    mss = tcp_eff_send_mss(TCP_MSS, &pcb->remote_ip);
+    mss = tcp_eff_send_mss(lwip_sizes.tcp_mss, &pcb->remote_ip);
 #else /* TCP_CALCULATE_EFF_SEND_MSS */
-    mss = TCP_MSS;
+    mss = lwip_sizes.tcp_mss;
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
     *opts = TCP_BUILD_MSS_OPTION(mss);
     opts += 1;
@@ -1093,9 +1209,9 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   }
 
   /* If we don't have a local IP address, we get one by
-     calling ip_route(). */
+     calling ip_route_src(). */
   if (ip_addr_isany(&(pcb->local_ip))) {
-    netif = ip_route(&(pcb->remote_ip));
+    netif = ip_route_src(&(pcb->remote_ip), &(pcb->local_ip));
     if (netif == NULL) {
       return;
     }
@@ -1160,7 +1276,16 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
          IP_PROTO_TCP, seg->p->tot_len);
 #endif /* TCP_CHECKSUM_ON_COPY */
 #endif /* CHECKSUM_GEN_TCP */
+#if IP_PMTU_DISCOVERY
+  /* segments cut before the path MTU last dropped are let through fragmented */
+  if (seg->len <= pcb->mss) {
+    seg->p->flags |= PBUF_FLAG_DF;
+  } else {
+    seg->p->flags &= ~PBUF_FLAG_DF;
+  }
+#endif /* IP_PMTU_DISCOVERY */
   TCP_STATS_INC(tcp.xmit);
+  PBUF_STAGE(PBUF_STAGE_OUTPUT, seg->p);
 
 #if LWIP_NETIF_HWADDRHINT
   ip_output_hinted(seg->p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
@@ -1212,7 +1337,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN/4, TCP_RST | TCP_ACK);
-  tcphdr->wnd = PP_HTONS(TCP_WND);
+  tcphdr->wnd = htons(lwip_sizes.tcp_wnd);
   tcphdr->chksum = 0;
   tcphdr->urgp = 0;
 
@@ -1256,6 +1381,7 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
 
   /* increment number of retransmissions */
   ++pcb->nrtx;
+  TCP_STATS_INC(tcp.rexmit);
 
   /* Don't take any RTT measurements after retransmitting. */
   pcb->rttest = 0;
@@ -1301,6 +1427,7 @@ tcp_rexmit(struct tcp_pcb *pcb)
 #endif /* TCP_OVERSIZE */
 
   ++pcb->nrtx;
+  TCP_STATS_INC(tcp.rexmit);
 
   /* Don't take any rtt measurements after retransmitting. */
   pcb->rttest = 0;
@@ -51,6 +51,7 @@
 #include "lwip/tcpip.h"
 
 #include "lwip/ip_frag.h"
+#include "lwip/ip_pmtu.h"
 #include "netif/etharp.h"
 #include "lwip/dhcp.h"
 #include "lwip/autoip.h"
@@ -125,6 +126,22 @@ ip_reass_timer(void *arg)
 }
 #endif /* IP_REASSEMBLY */
 
+#if IP_PMTU_DISCOVERY
+/**
+ * Timer callback function that calls ip_pmtu_tmr() and reschedules itself.
+ *
+ * @param arg unused argument
+ */
+static void
+ip_pmtu_timer(void *arg)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_DEBUGF(TIMERS_DEBUG, ("tcpip: ip_pmtu_tmr()\n"));
+  ip_pmtu_tmr();
+  sys_timeout(IP_PMTU_TMR_INTERVAL, ip_pmtu_timer, NULL);
+}
+#endif /* IP_PMTU_DISCOVERY */
+
 #if LWIP_ARP
 /**
  * Timer callback function that calls etharp_tmr() and reschedules itself.
@@ -225,6 +242,9 @@ void sys_timeouts_init(void)
 #if IP_REASSEMBLY
   sys_timeout(IP_TMR_INTERVAL, ip_reass_timer, NULL);
 #endif /* IP_REASSEMBLY */
+#if IP_PMTU_DISCOVERY
+  sys_timeout(IP_PMTU_TMR_INTERVAL, ip_pmtu_timer, NULL);
+#endif /* IP_PMTU_DISCOVERY */
 #if LWIP_ARP
   sys_timeout(ARP_TMR_INTERVAL, arp_timer, NULL);
 #endif /* LWIP_ARP */
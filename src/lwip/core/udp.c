@@ -57,6 +57,7 @@
 #include "lwip/ip_addr.h"
 #include "lwip/netif.h"
 #include "lwip/icmp.h"
+#include "lwip/ip_pmtu.h"
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
 #include "arch/perf.h"
@@ -507,9 +508,15 @@ udp_sendto_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
 
   /* find the outgoing network interface for this packet */
 #if LWIP_IGMP
-  netif = ip_route((ip_addr_ismulticast(dst_ip))?(&(pcb->multicast_ip)):(dst_ip));
+  /* multicast_ip names the interface by its own address, so it is also
+     the source that picks that interface over a peer on the same network */
+  if (ip_addr_ismulticast(dst_ip) && !ip_addr_isany(&pcb->multicast_ip)) {
+    netif = ip_route_src(&(pcb->multicast_ip), &(pcb->multicast_ip));
+  } else {
+    netif = ip_route_src(dst_ip, &(pcb->local_ip));
+  }
 #else
-  netif = ip_route(dst_ip);
+  netif = ip_route_src(dst_ip, &(pcb->local_ip));
 #endif /* LWIP_IGMP */
 
   /* no outgoing network interface could be found? */
@@ -584,6 +591,17 @@ udp_sendto_if_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
     }
   }
 
+  /* a datagram that may not be fragmented must fit the path as it is */
+  if (pcb->flags & UDP_FLAGS_DONTFRAG) {
+    u16_t mtu = ip_pmtu_get(dst_ip, netif);
+    if ((mtu != 0) && ((u32_t)p->tot_len + UDP_HLEN + IP_HLEN > mtu)) {
+      LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE,
+        ("udp_send: datagram of length %"U16_F" exceeds path MTU %"U16_F"\n", p->tot_len, mtu));
+      UDP_STATS_INC(udp.drop);
+      return ERR_MSGSIZE;
+    }
+  }
+
   /* not enough space to add an UDP header to first pbuf in given p chain? */
   if (pbuf_header(p, UDP_HLEN)) {
     /* allocate header in a separate new pbuf */
@@ -597,6 +615,7 @@ udp_sendto_if_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
       /* chain header q in front of given pbuf p (only if p contains data) */
       pbuf_chain(q, p);
     }
+    PBUF_STAMP_COPY(q, p);
     /* first pbuf q points to header pbuf */
     LWIP_DEBUGF(UDP_DEBUG,
                 ("udp_send: added header pbuf %p before given pbuf %p\n", (void *)q, (void *)p));
@@ -609,6 +628,7 @@ udp_sendto_if_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
   LWIP_ASSERT("check that first pbuf can hold struct udp_hdr",
               (q->len >= sizeof(struct udp_hdr)));
   /* q now represents the packet to be sent */
+  PBUF_STAGE(PBUF_STAGE_OUTPUT, q);
   udphdr = (struct udp_hdr *)q->payload;
   udphdr->src = htons(pcb->local_port);
   udphdr->dest = htons(dst_port);
@@ -622,6 +642,9 @@ udp_sendto_if_chksum(struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *dst_ip,
   }
 #endif /* LWIP_IGMP */
 
+  if (pcb->flags & UDP_FLAGS_DONTFRAG) {
+    q->flags |= PBUF_FLAG_DF;
+  }
 
   /* PCB local address is IP_ANY_ADDR? */
   if (ip_addr_isany(&pcb->local_ip)) {
@@ -54,12 +54,14 @@
 #include "lwip/snmp.h"
 #include "lwip/dhcp.h"
 #include "lwip/autoip.h"
+#include "lwip/sizes.h"
 #include "netif/etharp.h"
 
 #if PPPOE_SUPPORT
 #include "netif/ppp_oe.h"
 #endif /* PPPOE_SUPPORT */
 
+#include <stdlib.h>
 #include <string.h>
 
 const struct eth_addr ethbroadcast = {{0xff,0xff,0xff,0xff,0xff,0xff}};
@@ -79,7 +81,23 @@ const struct eth_addr ethzero = {{0,0,0,0,0,0}};
 #define ARP_MAXAGE              240
 /** Re-request a used ARP entry 1 minute before it would expire to prevent
  *  breaking a steadily used connection because the ARP entry timed out. */
-#define ARP_AGE_REREQUEST_USED  (ARP_MAXAGE - 12)
+#define ARP_AGE_REREQUEST_MARGIN 12
+
+/** the driver may choose the lifetime of the entries on each interface,
+ *  0 for entries that never expire */
+#ifdef LWIP_HOOK_ETHARP_MAXAGE
+#define ETHARP_MAXAGE(netif)    LWIP_HOOK_ETHARP_MAXAGE(netif)
+#else /* LWIP_HOOK_ETHARP_MAXAGE */
+#define ETHARP_MAXAGE(netif)    ARP_MAXAGE
+#endif /* LWIP_HOOK_ETHARP_MAXAGE */
+
+/** the driver may learn addresses from any frame an interface hears,
+ *  rather than only refresh those it already has */
+#ifdef LWIP_HOOK_ETHARP_SNOOP
+#define ETHARP_SNOOP(netif)     LWIP_HOOK_ETHARP_SNOOP(netif)
+#else /* LWIP_HOOK_ETHARP_SNOOP */
+#define ETHARP_SNOOP(netif)     0
+#endif /* LWIP_HOOK_ETHARP_SNOOP */
 
 /** the time an ARP entry stays pending after first request,
  *  for ARP_TMR_INTERVAL = 5000, this is
@@ -106,6 +124,8 @@ struct etharp_entry {
 #if ARP_QUEUEING
   /** Pointer to queue of pending outgoing packets on this ARP entry. */
   struct etharp_q_entry *q;
+  /** Number of packets on q */
+  u16_t qlen;
 #else /* ARP_QUEUEING */
   /** Pointer to a single pending outgoing packet on this ARP entry. */
   struct pbuf *q;
@@ -114,13 +134,37 @@ struct etharp_entry {
   struct netif *netif;
   struct eth_addr ethaddr;
   u8_t state;
-  u8_t ctime;
+  u16_t ctime;
+  /** Next entry in the same hash bucket, or on the free list */
+  s16_t next;
+  /** Neighbours on the LRU list, most recently used first */
+  s16_t lru_prev;
+  s16_t lru_next;
 };
 
-static struct etharp_entry arp_table[ARP_TABLE_SIZE];
+/** The table grows a block of ARP_TABLE_SIZE entries at a time, so that
+ *  entries never move and the pointers etharp_find_addr() hands out stay
+ *  good. Entries are found through a hash of their IP address. */
+#define ARP_TABLE_BLOCKS ((ARP_TABLE_MAX + ARP_TABLE_SIZE - 1) / ARP_TABLE_SIZE)
+
+static struct etharp_entry *arp_blocks[ARP_TABLE_BLOCKS];
+static u16_t arp_num_blocks;
+/** Number of entries in all blocks */
+static u16_t arp_table_size;
+
+#define arp_table(i) (arp_blocks[(i) / ARP_TABLE_SIZE][(i) % ARP_TABLE_SIZE])
+
+/** Heads of the hash chains, a power of two of them, at least one per entry */
+static s16_t *arp_buckets;
+static u16_t arp_bucket_mask;
+/** Empty entries, linked through next */
+static s16_t arp_free = -1;
+/** Entries in use, most recently used first */
+static s16_t arp_lru_head = -1;
+static s16_t arp_lru_tail = -1;
 
 #if !LWIP_NETIF_HWADDRHINT
-static u8_t etharp_cached_entry;
+static s16_t etharp_cached_entry = -1;
 #endif /* !LWIP_NETIF_HWADDRHINT */
 
 /** Try hard to create a new entry - we want the IP address to appear in
@@ -132,16 +176,20 @@ static u8_t etharp_cached_entry;
 #endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
 
 #if LWIP_NETIF_HWADDRHINT
+/* the per-pcb hints are a u8_t, entries past those are found by hash */
 #define ETHARP_SET_HINT(netif, hint)  if (((netif) != NULL) && ((netif)->addr_hint != NULL))  \
-                                      *((netif)->addr_hint) = (hint);
+                                      *((netif)->addr_hint) = ((hint) < 0xff) ? (u8_t)(hint) : 0xff;
 #else /* LWIP_NETIF_HWADDRHINT */
 #define ETHARP_SET_HINT(netif, hint)  (etharp_cached_entry = (hint))
 #endif /* LWIP_NETIF_HWADDRHINT */
 
 
 /* Some checks, instead of etharp_init(): */
-#if (LWIP_ARP && (ARP_TABLE_SIZE > 0x7f))
-  #error "ARP_TABLE_SIZE must fit in an s8_t, you have to reduce it in your lwipopts.h"
+#if (LWIP_ARP && (ARP_TABLE_BLOCKS * ARP_TABLE_SIZE > 0x7fff))
+  #error "ARP_TABLE_MAX must fit in an s16_t, you have to reduce it in your lwipopts.h"
+#endif
+#if (LWIP_ARP && (ARP_TABLE_MAX < ARP_TABLE_SIZE))
+  #error "ARP_TABLE_MAX must be at least ARP_TABLE_SIZE, you have to raise it in your lwipopts.h"
 #endif
 
 
@@ -172,27 +220,171 @@ free_etharp_q(struct etharp_q_entry *q)
 
 #endif /* ARP_QUEUEING */
 
+/** Hash bucket of an IP address */
+static u16_t
+etharp_hash(ip_addr_t *ipaddr)
+{
+  u32_t h = ip4_addr_get_u32(ipaddr) * 0x9e3779b1UL;
+  return (u16_t)((h ^ (h >> 16)) & arp_bucket_mask);
+}
+
+/** Put an entry in use at the head of its hash chain and the LRU list */
+static void
+etharp_link_entry(s16_t i)
+{
+  u16_t bucket = etharp_hash(&arp_table(i).ipaddr);
+  arp_table(i).next = arp_buckets[bucket];
+  arp_buckets[bucket] = i;
+
+  arp_table(i).lru_prev = -1;
+  arp_table(i).lru_next = arp_lru_head;
+  if (arp_lru_head >= 0) {
+    arp_table(arp_lru_head).lru_prev = i;
+  } else {
+    arp_lru_tail = i;
+  }
+  arp_lru_head = i;
+}
+
+/** Take an entry off its hash chain and the LRU list */
+static void
+etharp_unlink_entry(s16_t i)
+{
+  s16_t *link = &arp_buckets[etharp_hash(&arp_table(i).ipaddr)];
+  while (*link != i) {
+    LWIP_ASSERT("entry is on its hash chain", *link >= 0);
+    link = &arp_table(*link).next;
+  }
+  *link = arp_table(i).next;
+
+  if (arp_table(i).lru_prev >= 0) {
+    arp_table(arp_table(i).lru_prev).lru_next = arp_table(i).lru_next;
+  } else {
+    arp_lru_head = arp_table(i).lru_next;
+  }
+  if (arp_table(i).lru_next >= 0) {
+    arp_table(arp_table(i).lru_next).lru_prev = arp_table(i).lru_prev;
+  } else {
+    arp_lru_tail = arp_table(i).lru_prev;
+  }
+}
+
+/** Move an entry to the front of the LRU list */
+static void
+etharp_touch_entry(s16_t i)
+{
+  if (arp_lru_head == i) {
+    return;
+  }
+  /* it is not the head, so it has a predecessor */
+  arp_table(arp_table(i).lru_prev).lru_next = arp_table(i).lru_next;
+  if (arp_table(i).lru_next >= 0) {
+    arp_table(arp_table(i).lru_next).lru_prev = arp_table(i).lru_prev;
+  } else {
+    arp_lru_tail = arp_table(i).lru_prev;
+  }
+  arp_table(i).lru_prev = -1;
+  arp_table(i).lru_next = arp_lru_head;
+  arp_table(arp_lru_head).lru_prev = i;
+  arp_lru_head = i;
+}
+
+/** Index of the entry in use for ipaddr, or -1 */
+static s16_t
+etharp_lookup(ip_addr_t *ipaddr)
+{
+  s16_t i;
+  if (arp_buckets == NULL) {
+    return -1;
+  }
+  for (i = arp_buckets[etharp_hash(ipaddr)]; i >= 0; i = arp_table(i).next) {
+    if (ip_addr_cmp(ipaddr, &arp_table(i).ipaddr)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Add a block of empty entries to the table, and rehash the entries in use
+ * into as many buckets as there are now entries.
+ *
+ * @return 0 if the table is at its limit or out of memory
+ */
+static int
+etharp_grow_table(void)
+{
+  struct etharp_entry *block;
+  s16_t *buckets;
+  u16_t num_buckets = 1;
+  u16_t first;
+  s16_t i;
+
+  if ((arp_num_blocks == ARP_TABLE_BLOCKS) ||
+      ((arp_num_blocks > 0) && (arp_table_size >= lwip_sizes.arp_table_max))) {
+    return 0;
+  }
+  while (num_buckets < arp_table_size + ARP_TABLE_SIZE) {
+    num_buckets <<= 1;
+  }
+  block = (struct etharp_entry *)calloc(ARP_TABLE_SIZE, sizeof(struct etharp_entry));
+  buckets = (s16_t *)malloc(num_buckets * sizeof(s16_t));
+  if ((block == NULL) || (buckets == NULL)) {
+    free(block);
+    free(buckets);
+    return 0;
+  }
+  first = arp_table_size;
+  arp_blocks[arp_num_blocks++] = block;
+  arp_table_size += ARP_TABLE_SIZE;
+  for (i = ARP_TABLE_SIZE - 1; i >= 0; i--) {
+    block[i].next = arp_free;
+    arp_free = (s16_t)(first + i);
+  }
+
+  /* rehash, keeping the LRU list as it is */
+  free(arp_buckets);
+  arp_buckets = buckets;
+  arp_bucket_mask = num_buckets - 1;
+  memset(arp_buckets, 0xff, num_buckets * sizeof(s16_t));
+  for (i = arp_lru_tail; i >= 0; i = arp_table(i).lru_prev) {
+    u16_t bucket = etharp_hash(&arp_table(i).ipaddr);
+    arp_table(i).next = arp_buckets[bucket];
+    arp_buckets[bucket] = i;
+  }
+  ETHARP_STATS_SET(etharp_cache.size, arp_table_size);
+  LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_grow_table: %"U16_F" entries\n", arp_table_size));
+  return 1;
+}
+
 /** Clean up ARP table entries */
 static void
-etharp_free_entry(int i)
+etharp_free_entry(s16_t i)
 {
   /* remove from SNMP ARP index tree */
-  snmp_delete_arpidx_tree(arp_table[i].netif, &arp_table[i].ipaddr);
+  snmp_delete_arpidx_tree(arp_table(i).netif, &arp_table(i).ipaddr);
   /* and empty packet queue */
-  if (arp_table[i].q != NULL) {
+  if (arp_table(i).q != NULL) {
     /* remove all queued packets */
-    LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_free_entry: freeing entry %"U16_F", packet queue %p.\n", (u16_t)i, (void *)(arp_table[i].q)));
-    free_etharp_q(arp_table[i].q);
-    arp_table[i].q = NULL;
+    LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_free_entry: freeing entry %"U16_F", packet queue %p.\n", (u16_t)i, (void *)(arp_table(i).q)));
+    free_etharp_q(arp_table(i).q);
+    arp_table(i).q = NULL;
+#if ARP_QUEUEING
+    arp_table(i).qlen = 0;
+#endif /* ARP_QUEUEING */
   }
+  etharp_unlink_entry(i);
   /* recycle entry for re-use */
-  arp_table[i].state = ETHARP_STATE_EMPTY;
+  arp_table(i).state = ETHARP_STATE_EMPTY;
+  arp_table(i).next = arp_free;
+  arp_free = i;
+  ETHARP_STATS_DEC(etharp_cache.used);
 #ifdef LWIP_DEBUG
   /* for debugging, clean out the complete entry */
-  arp_table[i].ctime = 0;
-  arp_table[i].netif = NULL;
-  ip_addr_set_zero(&arp_table[i].ipaddr);
-  arp_table[i].ethaddr = ethzero;
+  arp_table(i).ctime = 0;
+  arp_table(i).netif = NULL;
+  ip_addr_set_zero(&arp_table(i).ipaddr);
+  arp_table(i).ethaddr = ethzero;
 #endif /* LWIP_DEBUG */
 }
 
@@ -205,35 +397,39 @@ etharp_free_entry(int i)
 void
 etharp_tmr(void)
 {
-  u8_t i;
+  s16_t i;
 
   LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_timer\n"));
   /* remove expired entries from the ARP table */
-  for (i = 0; i < ARP_TABLE_SIZE; ++i) {
-    u8_t state = arp_table[i].state;
+  for (i = 0; i < arp_table_size; ++i) {
+    u8_t state = arp_table(i).state;
     if (state != ETHARP_STATE_EMPTY
 #if ETHARP_SUPPORT_STATIC_ENTRIES
       && (state != ETHARP_STATE_STATIC)
 #endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
       ) {
-      arp_table[i].ctime++;
-      if ((arp_table[i].ctime >= ARP_MAXAGE) ||
-          ((arp_table[i].state == ETHARP_STATE_PENDING)  &&
-           (arp_table[i].ctime >= ARP_MAXPENDING))) {
+      u16_t maxage = (state >= ETHARP_STATE_STABLE) ? ETHARP_MAXAGE(arp_table(i).netif) : 0;
+      /* stable entries that never expire don't age */
+      if ((state == ETHARP_STATE_PENDING) || (maxage != 0)) {
+        arp_table(i).ctime++;
+      }
+      if (((maxage != 0) && (arp_table(i).ctime >= maxage)) ||
+          ((arp_table(i).state == ETHARP_STATE_PENDING)  &&
+           (arp_table(i).ctime >= ARP_MAXPENDING))) {
         /* pending or stable entry has become old! */
         LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_timer: expired %s entry %"U16_F".\n",
-             arp_table[i].state >= ETHARP_STATE_STABLE ? "stable" : "pending", (u16_t)i));
+             arp_table(i).state >= ETHARP_STATE_STABLE ? "stable" : "pending", (u16_t)i));
         /* clean up entries that have just been expired */
         etharp_free_entry(i);
       }
-      else if (arp_table[i].state == ETHARP_STATE_STABLE_REREQUESTING) {
+      else if (arp_table(i).state == ETHARP_STATE_STABLE_REREQUESTING) {
         /* Reset state to stable, so that the next transmitted packet will
            re-send an ARP request. */
-        arp_table[i].state = ETHARP_STATE_STABLE;
+        arp_table(i).state = ETHARP_STATE_STABLE;
       }
 #if ARP_QUEUEING
       /* still pending entry? (not expired) */
-      if (arp_table[i].state == ETHARP_STATE_PENDING) {
+      if (arp_table(i).state == ETHARP_STATE_PENDING) {
         /* resend an ARP query here? */
       }
 #endif /* ARP_QUEUEING */
@@ -241,164 +437,122 @@ etharp_tmr(void)
   }
 }
 
+/**
+ * Choose the entry in use that is least missed if it is recycled,
+ * searching from the least recently used:
+ * 1) a stable entry
+ * 2) a pending entry without queued packets
+ * 3) a pending entry with queued packets
+ *
+ * @return The ARP entry index, or -1 if there is none (all are static).
+ */
+static s16_t
+etharp_find_victim(void)
+{
+  s16_t old_pending = -1, old_queue = -1;
+  s16_t i;
+
+  for (i = arp_lru_tail; i >= 0; i = arp_table(i).lru_prev) {
+    u8_t state = arp_table(i).state;
+    if (state == ETHARP_STATE_PENDING) {
+      if (arp_table(i).q != NULL) {
+        if (old_queue < 0) {
+          old_queue = i;
+        }
+      } else if (old_pending < 0) {
+        old_pending = i;
+      }
+    } else
+#if ETHARP_SUPPORT_STATIC_ENTRIES
+    /* static entries never expire, so they are not recycled either */
+    if (state < ETHARP_STATE_STATIC)
+#endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
+    {
+      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_victim: selecting least recently used stable entry %"U16_F"\n", (u16_t)i));
+      /* no queued packets should exist on stable entries */
+      LWIP_ASSERT("arp_table(i).q == NULL", arp_table(i).q == NULL);
+      return i;
+    }
+  }
+  if (old_pending >= 0) {
+    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_victim: selecting least recently used pending entry %"U16_F" (without queue)\n", (u16_t)old_pending));
+    return old_pending;
+  }
+  if (old_queue >= 0) {
+    /* queued packets are freed in etharp_free_entry */
+    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_victim: selecting least recently used pending entry %"U16_F", freeing packet queue %p\n", (u16_t)old_queue, (void *)(arp_table(old_queue).q)));
+  }
+  return old_queue;
+}
+
 /**
  * Search the ARP table for a matching or new entry.
  * 
- * If an IP address is given, return a pending or stable ARP entry that matches
- * the address. If no match is found, create a new entry with this address set,
- * but in state ETHARP_EMPTY. The caller must check and possibly change the
- * state of the returned entry.
+ * Return a pending or stable ARP entry that matches the address. If no
+ * match is found, create a new entry with this address set, in state
+ * ETHARP_STATE_PENDING. The caller must check and possibly change the state
+ * of the returned entry.
  * 
- * If ipaddr is NULL, return a initialized new entry in state ETHARP_EMPTY.
- * 
- * In all cases, attempt to create new entries from an empty entry. If no
- * empty entries are available and ETHARP_FLAG_TRY_HARD flag is set, recycle
- * old entries. Heuristic choose the least important entry for recycling.
+ * New entries are taken from empty ones, and the table grows when it has
+ * none left, up to lwip_sizes.arp_table_max. Past that and only if the
+ * ETHARP_FLAG_TRY_HARD flag is set, the least recently used entry is
+ * recycled, by the preference of etharp_find_victim().
  *
  * @param ipaddr IP address to find in ARP cache, or to add if not found.
  * @param flags @see definition of ETHARP_FLAG_*
- * @param netif netif related to this address (used for NETIF_HWADDRHINT)
  *  
  * @return The ARP entry index that matched or is created, ERR_MEM if no
  * entry is found or could be recycled.
  */
-static s8_t
+static s16_t
 etharp_find_entry(ip_addr_t *ipaddr, u8_t flags)
 {
-  s8_t old_pending = ARP_TABLE_SIZE, old_stable = ARP_TABLE_SIZE;
-  s8_t empty = ARP_TABLE_SIZE;
-  u8_t i = 0, age_pending = 0, age_stable = 0;
-  /* oldest entry with packets on queue */
-  s8_t old_queue = ARP_TABLE_SIZE;
-  /* its age */
-  u8_t age_queue = 0;
-
-  /**
-   * a) do a search through the cache, remember candidates
-   * b) select candidate entry
-   * c) create new entry
-   */
-
-  /* a) in a single search sweep, do all of this
-   * 1) remember the first empty entry (if any)
-   * 2) remember the oldest stable entry (if any)
-   * 3) remember the oldest pending entry without queued packets (if any)
-   * 4) remember the oldest pending entry with queued packets (if any)
-   * 5) search for a matching IP entry, either pending or stable
-   *    until 5 matches, or all entries are searched for.
-   */
-
-  for (i = 0; i < ARP_TABLE_SIZE; ++i) {
-    u8_t state = arp_table[i].state;
-    /* no empty entry found yet and now we do find one? */
-    if ((empty == ARP_TABLE_SIZE) && (state == ETHARP_STATE_EMPTY)) {
-      LWIP_DEBUGF(ETHARP_DEBUG, ("etharp_find_entry: found empty entry %"U16_F"\n", (u16_t)i));
-      /* remember first empty entry */
-      empty = i;
-    } else if (state != ETHARP_STATE_EMPTY) {
-      LWIP_ASSERT("state == ETHARP_STATE_PENDING || state >= ETHARP_STATE_STABLE",
-        state == ETHARP_STATE_PENDING || state >= ETHARP_STATE_STABLE);
-      /* if given, does IP address match IP address in ARP entry? */
-      if (ipaddr && ip_addr_cmp(ipaddr, &arp_table[i].ipaddr)) {
-        LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: found matching entry %"U16_F"\n", (u16_t)i));
-        /* found exact IP address match, simply bail out */
-        return i;
-      }
-      /* pending entry? */
-      if (state == ETHARP_STATE_PENDING) {
-        /* pending with queued packets? */
-        if (arp_table[i].q != NULL) {
-          if (arp_table[i].ctime >= age_queue) {
-            old_queue = i;
-            age_queue = arp_table[i].ctime;
-          }
-        } else
-        /* pending without queued packets? */
-        {
-          if (arp_table[i].ctime >= age_pending) {
-            old_pending = i;
-            age_pending = arp_table[i].ctime;
-          }
-        }
-      /* stable entry? */
-      } else if (state >= ETHARP_STATE_STABLE) {
-#if ETHARP_SUPPORT_STATIC_ENTRIES
-        /* don't record old_stable for static entries since they never expire */
-        if (state < ETHARP_STATE_STATIC)
-#endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
-        {
-          /* remember entry with oldest stable entry in oldest, its age in maxtime */
-          if (arp_table[i].ctime >= age_stable) {
-            old_stable = i;
-            age_stable = arp_table[i].ctime;
-          }
-        }
-      }
-    }
+  s16_t i;
+
+  LWIP_ASSERT("ipaddr != NULL", ipaddr != NULL);
+
+  i = etharp_lookup(ipaddr);
+  if (i >= 0) {
+    LWIP_ASSERT("state == ETHARP_STATE_PENDING || state >= ETHARP_STATE_STABLE",
+      arp_table(i).state == ETHARP_STATE_PENDING || arp_table(i).state >= ETHARP_STATE_STABLE);
+    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: found matching entry %"U16_F"\n", (u16_t)i));
+    /* found exact IP address match, simply bail out */
+    return i;
   }
   /* { we have no match } => try to create a new entry */
-   
+
   /* don't create new entry, only search? */
-  if (((flags & ETHARP_FLAG_FIND_ONLY) != 0) ||
-      /* or no empty entry found and not allowed to recycle? */
-      ((empty == ARP_TABLE_SIZE) && ((flags & ETHARP_FLAG_TRY_HARD) == 0))) {
-    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: no empty entry found and not allowed to recycle\n"));
-    return (s8_t)ERR_MEM;
+  if ((flags & ETHARP_FLAG_FIND_ONLY) != 0) {
+    return (s16_t)ERR_MEM;
   }
-  
-  /* b) choose the least destructive entry to recycle:
-   * 1) empty entry
-   * 2) oldest stable entry
-   * 3) oldest pending entry without queued packets
-   * 4) oldest pending entry with queued packets
-   * 
-   * { ETHARP_FLAG_TRY_HARD is set at this point }
-   */ 
-
-  /* 1) empty entry available? */
-  if (empty < ARP_TABLE_SIZE) {
-    i = empty;
-    LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: selecting empty entry %"U16_F"\n", (u16_t)i));
-  } else {
-    /* 2) found recyclable stable entry? */
-    if (old_stable < ARP_TABLE_SIZE) {
-      /* recycle oldest stable*/
-      i = old_stable;
-      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: selecting oldest stable entry %"U16_F"\n", (u16_t)i));
-      /* no queued packets should exist on stable entries */
-      LWIP_ASSERT("arp_table[i].q == NULL", arp_table[i].q == NULL);
-    /* 3) found recyclable pending entry without queued packets? */
-    } else if (old_pending < ARP_TABLE_SIZE) {
-      /* recycle oldest pending */
-      i = old_pending;
-      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: selecting oldest pending entry %"U16_F" (without queue)\n", (u16_t)i));
-    /* 4) found recyclable pending entry with queued packets? */
-    } else if (old_queue < ARP_TABLE_SIZE) {
-      /* recycle oldest pending (queued packets are free in etharp_free_entry) */
-      i = old_queue;
-      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: selecting oldest pending entry %"U16_F", freeing packet queue %p\n", (u16_t)i, (void *)(arp_table[i].q)));
-      /* no empty or recyclable entries found */
-    } else {
+
+  if ((arp_free < 0) && !etharp_grow_table()) {
+    /* no empty entry left and not allowed to recycle? */
+    if ((flags & ETHARP_FLAG_TRY_HARD) == 0) {
+      LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: no empty entry found and not allowed to recycle\n"));
+      return (s16_t)ERR_MEM;
+    }
+    i = etharp_find_victim();
+    if (i < 0) {
       LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_find_entry: no empty or recyclable entries found\n"));
-      return (s8_t)ERR_MEM;
+      return (s16_t)ERR_MEM;
     }
-
-    /* { empty or recyclable entry found } */
-    LWIP_ASSERT("i < ARP_TABLE_SIZE", i < ARP_TABLE_SIZE);
     etharp_free_entry(i);
+    ETHARP_STATS_INC(etharp_cache.evictions);
   }
 
-  LWIP_ASSERT("i < ARP_TABLE_SIZE", i < ARP_TABLE_SIZE);
-  LWIP_ASSERT("arp_table[i].state == ETHARP_STATE_EMPTY",
-    arp_table[i].state == ETHARP_STATE_EMPTY);
-
-  /* IP address given? */
-  if (ipaddr != NULL) {
-    /* set IP address */
-    ip_addr_copy(arp_table[i].ipaddr, *ipaddr);
-  }
-  arp_table[i].ctime = 0;
-  return (err_t)i;
+  /* take the first empty entry */
+  i = arp_free;
+  LWIP_ASSERT("arp_table(i).state == ETHARP_STATE_EMPTY",
+    arp_table(i).state == ETHARP_STATE_EMPTY);
+  arp_free = arp_table(i).next;
+
+  ip_addr_copy(arp_table(i).ipaddr, *ipaddr);
+  arp_table(i).state = ETHARP_STATE_PENDING;
+  arp_table(i).ctime = 0;
+  etharp_link_entry(i);
+  ETHARP_STATS_INC(etharp_cache.used);
+  return i;
 }
 
 /**
@@ -447,7 +601,7 @@ etharp_send_ip(struct netif *netif, struct pbuf *p, struct eth_addr *src, struct
 static err_t
 etharp_update_arp_entry(struct netif *netif, ip_addr_t *ipaddr, struct eth_addr *ethaddr, u8_t flags)
 {
-  s8_t i;
+  s16_t i;
   LWIP_ASSERT("netif->hwaddr_len == ETHARP_HWADDR_LEN", netif->hwaddr_len == ETHARP_HWADDR_LEN);
   LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_update_arp_entry: %"U16_F".%"U16_F".%"U16_F".%"U16_F" - %02"X16_F":%02"X16_F":%02"X16_F":%02"X16_F":%02"X16_F":%02"X16_F"\n",
     ip4_addr1_16(ipaddr), ip4_addr2_16(ipaddr), ip4_addr3_16(ipaddr), ip4_addr4_16(ipaddr),
@@ -470,40 +624,42 @@ etharp_update_arp_entry(struct netif *netif, ip_addr_t *ipaddr, struct eth_addr
 #if ETHARP_SUPPORT_STATIC_ENTRIES
   if (flags & ETHARP_FLAG_STATIC_ENTRY) {
     /* record static type */
-    arp_table[i].state = ETHARP_STATE_STATIC;
+    arp_table(i).state = ETHARP_STATE_STATIC;
   } else
 #endif /* ETHARP_SUPPORT_STATIC_ENTRIES */
   {
     /* mark it stable */
-    arp_table[i].state = ETHARP_STATE_STABLE;
+    arp_table(i).state = ETHARP_STATE_STABLE;
   }
 
   /* record network interface */
-  arp_table[i].netif = netif;
+  arp_table(i).netif = netif;
   /* insert in SNMP ARP index tree */
-  snmp_insert_arpidx_tree(netif, &arp_table[i].ipaddr);
+  snmp_insert_arpidx_tree(netif, &arp_table(i).ipaddr);
 
   LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_update_arp_entry: updating stable entry %"S16_F"\n", (s16_t)i));
   /* update address */
-  ETHADDR32_COPY(&arp_table[i].ethaddr, ethaddr);
+  ETHADDR32_COPY(&arp_table(i).ethaddr, ethaddr);
   /* reset time stamp */
-  arp_table[i].ctime = 0;
+  arp_table(i).ctime = 0;
+  etharp_touch_entry(i);
   /* this is where we will send out queued packets! */
 #if ARP_QUEUEING
-  while (arp_table[i].q != NULL) {
+  while (arp_table(i).q != NULL) {
     struct pbuf *p;
     /* remember remainder of queue */
-    struct etharp_q_entry *q = arp_table[i].q;
+    struct etharp_q_entry *q = arp_table(i).q;
     /* pop first item off the queue */
-    arp_table[i].q = q->next;
+    arp_table(i).q = q->next;
+    arp_table(i).qlen--;
     /* get the packet pointer */
     p = q->p;
     /* now queue entry can be freed */
     memp_free(MEMP_ARP_QUEUE, q);
 #else /* ARP_QUEUEING */
-  if (arp_table[i].q != NULL) {
-    struct pbuf *p = arp_table[i].q;
-    arp_table[i].q = NULL;
+  if (arp_table(i).q != NULL) {
+    struct pbuf *p = arp_table(i).q;
+    arp_table(i).q = NULL;
 #endif /* ARP_QUEUEING */
     /* send the queued IP packet */
     etharp_send_ip(netif, p, (struct eth_addr*)(netif->hwaddr), ethaddr);
@@ -550,7 +706,7 @@ etharp_add_static_entry(ip_addr_t *ipaddr, struct eth_addr *ethaddr)
 err_t
 etharp_remove_static_entry(ip_addr_t *ipaddr)
 {
-  s8_t i;
+  s16_t i;
   LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_remove_static_entry: %"U16_F".%"U16_F".%"U16_F".%"U16_F"\n",
     ip4_addr1_16(ipaddr), ip4_addr2_16(ipaddr), ip4_addr3_16(ipaddr), ip4_addr4_16(ipaddr)));
 
@@ -561,7 +717,7 @@ etharp_remove_static_entry(ip_addr_t *ipaddr)
     return (err_t)i;
   }
 
-  if (arp_table[i].state != ETHARP_STATE_STATIC) {
+  if (arp_table(i).state != ETHARP_STATE_STATIC) {
     /* entry wasn't a static entry, cannot remove it */
     return ERR_ARG;
   }
@@ -578,11 +734,11 @@ etharp_remove_static_entry(ip_addr_t *ipaddr)
  */
 void etharp_cleanup_netif(struct netif *netif)
 {
-  u8_t i;
+  s16_t i;
 
-  for (i = 0; i < ARP_TABLE_SIZE; ++i) {
-    u8_t state = arp_table[i].state;
-    if ((state != ETHARP_STATE_EMPTY) && (arp_table[i].netif == netif)) {
+  for (i = 0; i < arp_table_size; ++i) {
+    u8_t state = arp_table(i).state;
+    if ((state != ETHARP_STATE_EMPTY) && (arp_table(i).netif == netif)) {
       etharp_free_entry(i);
     }
   }
@@ -599,11 +755,11 @@ void etharp_cleanup_netif(struct netif *netif)
  * @param ip_ret points to return pointer
  * @return table index if found, -1 otherwise
  */
-s8_t
+s16_t
 etharp_find_addr(struct netif *netif, ip_addr_t *ipaddr,
          struct eth_addr **eth_ret, ip_addr_t **ip_ret)
 {
-  s8_t i;
+  s16_t i;
 
   LWIP_ASSERT("eth_ret != NULL && ip_ret != NULL",
     eth_ret != NULL && ip_ret != NULL);
@@ -611,9 +767,9 @@ etharp_find_addr(struct netif *netif, ip_addr_t *ipaddr,
   LWIP_UNUSED_ARG(netif);
 
   i = etharp_find_entry(ipaddr, ETHARP_FLAG_FIND_ONLY);
-  if((i >= 0) && (arp_table[i].state >= ETHARP_STATE_STABLE)) {
-      *eth_ret = &arp_table[i].ethaddr;
-      *ip_ret = &arp_table[i].ipaddr;
+  if((i >= 0) && (arp_table(i).state >= ETHARP_STATE_STABLE)) {
+      *eth_ret = &arp_table(i).ethaddr;
+      *ip_ret = &arp_table(i).ipaddr;
       return i;
   }
   return -1;
@@ -641,8 +797,18 @@ etharp_ip_input(struct netif *netif, struct pbuf *p)
   struct eth_hdr *ethhdr;
   struct ip_hdr *iphdr;
   ip_addr_t iphdr_src;
+  u8_t flags = ETHARP_FLAG_FIND_ONLY;
   LWIP_ERROR("netif != NULL", (netif != NULL), return;);
 
+#ifdef LWIP_HOOK_ETHARP_SNOOP
+  /* the driver decides whether this interface trusts IP frames at all,
+     and those it trusts may add entries, not just refresh them */
+  if (!ETHARP_SNOOP(netif)) {
+    return;
+  }
+  flags = 0;
+#endif /* LWIP_HOOK_ETHARP_SNOOP */
+
   /* Only insert an entry if the source IP address of the
      incoming IP packet comes from a host on the local network. */
   ethhdr = (struct eth_hdr *)p->payload;
@@ -655,8 +821,9 @@ etharp_ip_input(struct netif *netif, struct pbuf *p)
 
   ip_addr_copy(iphdr_src, iphdr->src);
 
-  /* source is not on the local network? */
-  if (!ip_addr_netcmp(&iphdr_src, &(netif->ip_addr), &(netif->netmask))) {
+  /* source is not on the local network, or is us? */
+  if (!ip_addr_netcmp(&iphdr_src, &(netif->ip_addr), &(netif->netmask)) ||
+      ip_addr_cmp(&iphdr_src, &(netif->ip_addr))) {
     /* do nothing */
     return;
   }
@@ -665,7 +832,7 @@ etharp_ip_input(struct netif *netif, struct pbuf *p)
   /* update the source IP address in the cache, if present */
   /* @todo We could use ETHARP_FLAG_TRY_HARD if we think we are going to talk
    * back soon (for example, if the destination IP address is ours. */
-  etharp_update_arp_entry(netif, &iphdr_src, &(ethhdr->src), ETHARP_FLAG_FIND_ONLY);
+  etharp_update_arp_entry(netif, &iphdr_src, &(ethhdr->src), flags);
 }
 #endif /* ETHARP_TRUST_IP_MAC */
 
@@ -757,9 +924,13 @@ etharp_arp_input(struct netif *netif, struct eth_addr *ethaddr, struct pbuf *p)
       -> add IP address in ARP cache; assume requester wants to talk to us,
          can result in directly sending the queued packets for this host.
      ARP message not directed to us?
-      ->  update the source IP address in the cache, if present */
-  etharp_update_arp_entry(netif, &sipaddr, &(hdr->shwaddr),
-                   for_us ? ETHARP_FLAG_TRY_HARD : ETHARP_FLAG_FIND_ONLY);
+      ->  update the source IP address in the cache, if present, or add it
+          if the interface snoops. this is how gratuitous ARPs are learned */
+  if (!ip_addr_cmp(&sipaddr, &(netif->ip_addr))) {
+    etharp_update_arp_entry(netif, &sipaddr, &(hdr->shwaddr),
+                     for_us ? ETHARP_FLAG_TRY_HARD :
+                     (ETHARP_SNOOP(netif) ? 0 : ETHARP_FLAG_FIND_ONLY));
+  }
 
   /* now act on the message itself */
   switch (hdr->opcode) {
@@ -839,22 +1010,24 @@ etharp_arp_input(struct netif *netif, struct eth_addr *ethaddr, struct pbuf *p)
  * in the arp_table specified by the index 'arp_idx'.
  */
 static err_t
-etharp_output_to_arp_index(struct netif *netif, struct pbuf *q, u8_t arp_idx)
+etharp_output_to_arp_index(struct netif *netif, struct pbuf *q, s16_t arp_idx)
 {
-  LWIP_ASSERT("arp_table[arp_idx].state >= ETHARP_STATE_STABLE",
-              arp_table[arp_idx].state >= ETHARP_STATE_STABLE);
+  u16_t maxage = ETHARP_MAXAGE(netif);
+  LWIP_ASSERT("arp_table(arp_idx).state >= ETHARP_STATE_STABLE",
+              arp_table(arp_idx).state >= ETHARP_STATE_STABLE);
   /* if arp table entry is about to expire: re-request it,
      but only if its state is ETHARP_STATE_STABLE to prevent flooding the
      network with ARP requests if this address is used frequently. */
-  if ((arp_table[arp_idx].state == ETHARP_STATE_STABLE) && 
-      (arp_table[arp_idx].ctime >= ARP_AGE_REREQUEST_USED)) {
-    if (etharp_request(netif, &arp_table[arp_idx].ipaddr) == ERR_OK) {
-      arp_table[arp_idx].state = ETHARP_STATE_STABLE_REREQUESTING;
+  if ((arp_table(arp_idx).state == ETHARP_STATE_STABLE) && 
+      (maxage > ARP_AGE_REREQUEST_MARGIN) &&
+      (arp_table(arp_idx).ctime >= maxage - ARP_AGE_REREQUEST_MARGIN)) {
+    if (etharp_request(netif, &arp_table(arp_idx).ipaddr) == ERR_OK) {
+      arp_table(arp_idx).state = ETHARP_STATE_STABLE_REREQUESTING;
     }
   }
   
   return etharp_send_ip(netif, q, (struct eth_addr*)(netif->hwaddr),
-    &arp_table[arp_idx].ethaddr);
+    &arp_table(arp_idx).ethaddr);
 }
 
 /**
@@ -915,7 +1088,7 @@ etharp_output(struct netif *netif, struct pbuf *q, ip_addr_t *ipaddr)
     dest = &mcastaddr;
   /* unicast destination IP address? */
   } else {
-    s8_t i;
+    s16_t i;
     /* outside local network? if so, this can neither be a global broadcast nor
        a subnet broadcast. */
     if (!ip_addr_netcmp(ipaddr, &(netif->ip_addr), &(netif->netmask)) &&
@@ -941,35 +1114,47 @@ etharp_output(struct netif *netif, struct pbuf *q, ip_addr_t *ipaddr)
         }
       }
     }
+#ifdef LWIP_HOOK_ETHARP_RESOLVE
+    {
+      /* addresses the driver knows without asking skip the table */
+      struct eth_addr resolved;
+      if (LWIP_HOOK_ETHARP_RESOLVE(netif, dst_addr, &resolved)) {
+        ETHARP_STATS_INC(etharp.cachehit);
+        return etharp_send_ip(netif, q, (struct eth_addr*)(netif->hwaddr), &resolved);
+      }
+    }
+#endif /* LWIP_HOOK_ETHARP_RESOLVE */
 #if LWIP_NETIF_HWADDRHINT
     if (netif->addr_hint != NULL) {
       /* per-pcb cached entry was given */
-      u8_t etharp_cached_entry = *(netif->addr_hint);
-      if (etharp_cached_entry < ARP_TABLE_SIZE) {
+      s16_t etharp_cached_entry = *(netif->addr_hint);
 #endif /* LWIP_NETIF_HWADDRHINT */
-        if ((arp_table[etharp_cached_entry].state >= ETHARP_STATE_STABLE) &&
-            (ip_addr_cmp(dst_addr, &arp_table[etharp_cached_entry].ipaddr))) {
-          /* the per-pcb-cached entry is stable and the right one! */
-          ETHARP_STATS_INC(etharp.cachehit);
-          return etharp_output_to_arp_index(netif, q, etharp_cached_entry);
-        }
-#if LWIP_NETIF_HWADDRHINT
+      if ((etharp_cached_entry >= 0) && (etharp_cached_entry < arp_table_size) &&
+          (arp_table(etharp_cached_entry).state >= ETHARP_STATE_STABLE) &&
+          (ip_addr_cmp(dst_addr, &arp_table(etharp_cached_entry).ipaddr))) {
+        /* the per-pcb-cached entry is stable and the right one! */
+        ETHARP_STATS_INC(etharp.cachehit);
+        ETHARP_STATS_INC(etharp_cache.hits);
+        etharp_touch_entry(etharp_cached_entry);
+        return etharp_output_to_arp_index(netif, q, etharp_cached_entry);
       }
+#if LWIP_NETIF_HWADDRHINT
     }
 #endif /* LWIP_NETIF_HWADDRHINT */
 
     /* find stable entry: do this here since this is a critical path for
-       throughput and etharp_find_entry() is kind of slow */
-    for (i = 0; i < ARP_TABLE_SIZE; i++) {
-      if ((arp_table[i].state >= ETHARP_STATE_STABLE) &&
-          (ip_addr_cmp(dst_addr, &arp_table[i].ipaddr))) {
-        /* found an existing, stable entry */
-        ETHARP_SET_HINT(netif, i);
-        return etharp_output_to_arp_index(netif, q, i);
-      }
+       throughput and etharp_find_entry() may have to make room */
+    i = etharp_lookup(dst_addr);
+    if ((i >= 0) && (arp_table(i).state >= ETHARP_STATE_STABLE)) {
+      /* found an existing, stable entry */
+      ETHARP_STATS_INC(etharp_cache.hits);
+      ETHARP_SET_HINT(netif, i);
+      etharp_touch_entry(i);
+      return etharp_output_to_arp_index(netif, q, i);
     }
     /* no stable entry found, use the (slower) query function:
        queue on destination Ethernet address belonging to ipaddr */
+    ETHARP_STATS_INC(etharp_cache.misses);
     return etharp_query(netif, dst_addr, q);
   }
 
@@ -1017,7 +1202,7 @@ etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q)
 {
   struct eth_addr * srcaddr = (struct eth_addr *)netif->hwaddr;
   err_t result = ERR_MEM;
-  s8_t i; /* ARP entry index */
+  s16_t i; /* ARP entry index */
 
   /* non-unicast address? */
   if (ip_addr_isbroadcast(ipaddr, netif) ||
@@ -1040,18 +1225,13 @@ etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q)
     return (err_t)i;
   }
 
-  /* mark a fresh entry as pending (we just sent a request) */
-  if (arp_table[i].state == ETHARP_STATE_EMPTY) {
-    arp_table[i].state = ETHARP_STATE_PENDING;
-  }
-
   /* { i is either a STABLE or (new or existing) PENDING entry } */
-  LWIP_ASSERT("arp_table[i].state == PENDING or STABLE",
-  ((arp_table[i].state == ETHARP_STATE_PENDING) ||
-   (arp_table[i].state >= ETHARP_STATE_STABLE)));
+  LWIP_ASSERT("arp_table(i).state == PENDING or STABLE",
+  ((arp_table(i).state == ETHARP_STATE_PENDING) ||
+   (arp_table(i).state >= ETHARP_STATE_STABLE)));
 
   /* do we have a pending entry? or an implicit query request? */
-  if ((arp_table[i].state == ETHARP_STATE_PENDING) || (q == NULL)) {
+  if ((arp_table(i).state == ETHARP_STATE_PENDING) || (q == NULL)) {
     /* try to resolve it; send out ARP request */
     result = etharp_request(netif, ipaddr);
     if (result != ERR_OK) {
@@ -1068,13 +1248,13 @@ etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q)
   /* packet given? */
   LWIP_ASSERT("q != NULL", q != NULL);
   /* stable entry? */
-  if (arp_table[i].state >= ETHARP_STATE_STABLE) {
+  if (arp_table(i).state >= ETHARP_STATE_STABLE) {
     /* we have a valid IP->Ethernet address mapping */
     ETHARP_SET_HINT(netif, i);
     /* send the packet */
-    result = etharp_send_ip(netif, q, srcaddr, &(arp_table[i].ethaddr));
+    result = etharp_send_ip(netif, q, srcaddr, &(arp_table(i).ethaddr));
   /* pending entry? (either just created or already pending */
-  } else if (arp_table[i].state == ETHARP_STATE_PENDING) {
+  } else if (arp_table(i).state == ETHARP_STATE_PENDING) {
     /* entry is still pending, queue the given packet 'q' */
     struct pbuf *p;
     int copy_needed = 0;
@@ -1114,18 +1294,29 @@ etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q)
       if (new_entry != NULL) {
         new_entry->next = 0;
         new_entry->p = p;
-        if(arp_table[i].q != NULL) {
+        if (arp_table(i).qlen >= lwip_sizes.arp_queue_len) {
+          /* queue is full, drop its oldest packet to make room */
+          struct etharp_q_entry *r = arp_table(i).q;
+          LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_query: dropped oldest queued packet %p for ARP entry %"S16_F"\n", (void *)r->p, (s16_t)i));
+          arp_table(i).q = r->next;
+          arp_table(i).qlen--;
+          pbuf_free(r->p);
+          memp_free(MEMP_ARP_QUEUE, r);
+          ETHARP_STATS_INC(etharp.drop);
+        }
+        if(arp_table(i).q != NULL) {
           /* queue was already existent, append the new entry to the end */
           struct etharp_q_entry *r;
-          r = arp_table[i].q;
+          r = arp_table(i).q;
           while (r->next != NULL) {
             r = r->next;
           }
           r->next = new_entry;
         } else {
           /* queue did not exist, first item in queue */
-          arp_table[i].q = new_entry;
+          arp_table(i).q = new_entry;
         }
+        arp_table(i).qlen++;
         LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_query: queued packet %p on ARP entry %"S16_F"\n", (void *)q, (s16_t)i));
         result = ERR_OK;
       } else {
@@ -1136,11 +1327,11 @@ etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q)
       }
 #else /* ARP_QUEUEING */
       /* always queue one packet per ARP request only, freeing a previously queued packet */
-      if (arp_table[i].q != NULL) {
+      if (arp_table(i).q != NULL) {
         LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_query: dropped previously queued packet %p for ARP entry %"S16_F"\n", (void *)q, (s16_t)i));
-        pbuf_free(arp_table[i].q);
+        pbuf_free(arp_table(i).q);
       }
-      arp_table[i].q = p;
+      arp_table(i).q = p;
       result = ERR_OK;
       LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_query: queued packet %p on ARP entry %"S16_F"\n", (void *)q, (s16_t)i));
 #endif /* ARP_QUEUEING */
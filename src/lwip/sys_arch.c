@@ -39,7 +39,7 @@
  *    not created with sys_thread_new().  This includes
  *    the main thread and threads made with pthread_create().
  *
- *  - Catch overflows where more than SYS_MBOX_SIZE messages
+ *  - Catch overflows where more messages than the mbox's size
  *    are waiting to be read.  The sys_mbox_post() routine
  *    will block until there is more room instead of just
  *    leaking messages.
@@ -52,6 +52,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include "lwip/def.h"
 
@@ -82,6 +84,126 @@ get_monotonic_time(struct timespec *ts)
 #endif
 }
 
+/*-----------------------------------------------------------------------------------*/
+/* Virtual clock
+ *
+ * Normally sys_now(), sys_jiffies() and every timed wait follow
+ * CLOCK_MONOTONIC. Once sys_clock_set_virtual() is called, time only moves
+ * when sys_clock_advance() is called, e.g. by a simulated audio channel
+ * advancing by the duration of the samples it just carried. Timed waits are
+ * then registered here and woken when virtual time passes their deadline.
+ *
+ * clock_virtual is read without clock_mutex, so that with the real clock
+ * sys_now(), semaphore signals and timed waits never touch the mutex.
+ */
+struct clock_waiter {
+  struct clock_waiter *next;
+  pthread_cond_t *cond;
+  uint64_t deadline;
+};
+
+static atomic_int clock_virtual = 0;
+static uint64_t clock_virtual_us = 0;
+/* bumped on every semaphore signal while the clock is virtual, lets the
+   clock tell when the stack is idle */
+static atomic_uint clock_activity = 0;
+static struct clock_waiter *clock_waiters = NULL;
+static pthread_mutex_t clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+monotonic_us(void)
+{
+  struct timespec ts;
+
+  get_monotonic_time(&ts);
+  return (uint64_t)ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+void
+sys_clock_set_virtual(int enable)
+{
+  pthread_mutex_lock(&clock_mutex);
+  if (enable && !atomic_load_explicit(&clock_virtual, memory_order_relaxed)) {
+    /* start from the wall clock so that timers already armed don't see time jump */
+    clock_virtual_us = monotonic_us();
+  }
+  atomic_store_explicit(&clock_virtual, enable, memory_order_release);
+  pthread_mutex_unlock(&clock_mutex);
+}
+
+uint64_t
+sys_clock_now_us(void)
+{
+  uint64_t now;
+
+  if (!atomic_load_explicit(&clock_virtual, memory_order_acquire)) {
+    return monotonic_us();
+  }
+  pthread_mutex_lock(&clock_mutex);
+  now = atomic_load_explicit(&clock_virtual, memory_order_relaxed) ? clock_virtual_us : monotonic_us();
+  pthread_mutex_unlock(&clock_mutex);
+  return now;
+}
+
+/* note progress by some thread, for clock_settle() */
+static void
+clock_activity_bump(void)
+{
+  if (atomic_load_explicit(&clock_virtual, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&clock_activity, 1, memory_order_relaxed);
+  }
+}
+
+static u32_t
+clock_activity_read(void)
+{
+  return atomic_load_explicit(&clock_activity, memory_order_relaxed);
+}
+
+/* Wait until no thread has signalled a semaphore for a couple of scheduling
+ * rounds. Every handoff in the stack (mbox posts, API call completion,
+ * socket events) goes through sys_sem_signal(), so this is a good proxy for
+ * "everyone has reacted to the last step". Without it, virtual time could
+ * race ahead of threads that simply haven't been scheduled yet, and TCP would
+ * see phantom delays. */
+static void
+clock_settle(void)
+{
+  int quiet_rounds = 0;
+
+  while (quiet_rounds < 2) {
+    u32_t before = clock_activity_read();
+    sched_yield();
+    if (clock_activity_read() == before) {
+      quiet_rounds++;
+    } else {
+      quiet_rounds = 0;
+    }
+  }
+}
+
+void
+sys_clock_advance(uint64_t usec)
+{
+  struct clock_waiter *waiter;
+
+  clock_settle();
+
+  pthread_mutex_lock(&clock_mutex);
+  clock_virtual_us += usec;
+  /* Waiters stay registered until they wake and unlink themselves, which
+   * needs clock_mutex, so the conds are valid here. Broadcasting without
+   * the waiter's mutex can miss a waiter that registered but hasn't
+   * blocked yet; it is still registered and expired, so the next advance
+   * wakes it. */
+  for (waiter = clock_waiters; waiter != NULL; waiter = waiter->next) {
+    if (waiter->deadline <= clock_virtual_us) {
+      pthread_cond_broadcast(waiter->cond);
+    }
+  }
+  pthread_mutex_unlock(&clock_mutex);
+}
+
 #if !NO_SYS
 
 static struct sys_thread *threads = NULL;
@@ -92,15 +214,17 @@ struct sys_mbox_msg {
   void *msg;
 };
 
+/* slots in an mbox created with size 0, one of which is always empty */
 #define SYS_MBOX_SIZE 128
 
 struct sys_mbox {
   int first, last;
-  void *msgs[SYS_MBOX_SIZE];
+  int size;
   struct sys_sem *not_empty;
   struct sys_sem *not_full;
   struct sys_sem *mutex;
   int wait_send;
+  void *msgs[];
 };
 
 struct sys_sem {
@@ -115,6 +239,16 @@ struct sys_thread {
   pthread_t pthread;
 };
 
+struct sys_mutex {
+  pthread_mutex_t mutex;
+  /* only updated with the mutex held */
+  struct sys_mutex_stats stats;
+};
+
+/* how many times to retry a taken mutex before sleeping on it. critical
+   sections in the stack are short, so the holder is usually about to leave */
+#define SYS_MUTEX_SPINS 100
+
 #if SYS_LIGHTWEIGHT_PROT
 static pthread_mutex_t lwprot_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t lwprot_thread = (pthread_t)0xDEAD;
@@ -178,13 +312,15 @@ err_t
 sys_mbox_new(struct sys_mbox **mb, int size)
 {
   struct sys_mbox *mbox;
-  LWIP_UNUSED_ARG(size);
 
-  mbox = (struct sys_mbox *)malloc(sizeof(struct sys_mbox));
+  /* room for size messages and the empty slot between last and first */
+  size = (size > 0) ? size + 1 : SYS_MBOX_SIZE;
+  mbox = (struct sys_mbox *)malloc(sizeof(struct sys_mbox) + size * sizeof(void *));
   if (mbox == NULL) {
     return ERR_MEM;
   }
   mbox->first = mbox->last = 0;
+  mbox->size = size;
   mbox->not_empty = sys_sem_new_internal(0);
   mbox->not_full = sys_sem_new_internal(0);
   mbox->mutex = sys_sem_new_internal(1);
@@ -225,12 +361,12 @@ sys_mbox_trypost(struct sys_mbox **mb, void *msg)
   LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n",
                           (void *)mbox, (void *)msg));
 
-  if ((mbox->last + 1) >= (mbox->first + SYS_MBOX_SIZE)) {
+  if ((mbox->last + 1) >= (mbox->first + mbox->size)) {
     sys_sem_signal(&mbox->mutex);
     return ERR_MEM;
   }
 
-  mbox->msgs[mbox->last % SYS_MBOX_SIZE] = msg;
+  mbox->msgs[mbox->last % mbox->size] = msg;
 
   if (mbox->last == mbox->first) {
     first = 1;
@@ -261,7 +397,7 @@ sys_mbox_post(struct sys_mbox **mb, void *msg)
 
   LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", (void *)mbox, (void *)msg));
 
-  while ((mbox->last + 1) >= (mbox->first + SYS_MBOX_SIZE)) {
+  while ((mbox->last + 1) >= (mbox->first + mbox->size)) {
     mbox->wait_send++;
     sys_sem_signal(&mbox->mutex);
     sys_arch_sem_wait(&mbox->not_full, 0);
@@ -269,7 +405,7 @@ sys_mbox_post(struct sys_mbox **mb, void *msg)
     mbox->wait_send--;
   }
 
-  mbox->msgs[mbox->last % SYS_MBOX_SIZE] = msg;
+  mbox->msgs[mbox->last % mbox->size] = msg;
 
   if (mbox->last == mbox->first) {
     first = 1;
@@ -302,7 +438,7 @@ sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
 
   if (msg != NULL) {
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p msg %p\n", (void *)mbox, *msg));
-    *msg = mbox->msgs[mbox->first % SYS_MBOX_SIZE];
+    *msg = mbox->msgs[mbox->first % mbox->size];
   }
   else{
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p, null msg\n", (void *)mbox));
@@ -351,7 +487,7 @@ sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
 
   if (msg != NULL) {
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", (void *)mbox, *msg));
-    *msg = mbox->msgs[mbox->first % SYS_MBOX_SIZE];
+    *msg = mbox->msgs[mbox->first % mbox->size];
   }
   else{
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p, null msg\n", (void *)mbox));
@@ -398,6 +534,35 @@ sys_sem_new(struct sys_sem **sem, u8_t count)
 }
 /*-----------------------------------------------------------------------------------*/
 static u32_t
+cond_wait_virtual(pthread_cond_t *cond, pthread_mutex_t *mutex, u32_t timeout)
+{
+  struct clock_waiter waiter;
+  struct clock_waiter **link;
+  uint64_t start, now;
+
+  pthread_mutex_lock(&clock_mutex);
+  start = clock_virtual_us;
+  waiter.cond = cond;
+  waiter.deadline = start + (uint64_t)timeout * 1000L;
+  waiter.next = clock_waiters;
+  clock_waiters = &waiter;
+  pthread_mutex_unlock(&clock_mutex);
+
+  pthread_cond_wait(cond, mutex);
+
+  pthread_mutex_lock(&clock_mutex);
+  for (link = &clock_waiters; *link != &waiter; link = &(*link)->next);
+  *link = waiter.next;
+  now = clock_virtual_us;
+  pthread_mutex_unlock(&clock_mutex);
+
+  if (now >= waiter.deadline) {
+    return SYS_ARCH_TIMEOUT;
+  }
+  return (u32_t)((now - start) / 1000L);
+}
+/*-----------------------------------------------------------------------------------*/
+static u32_t
 cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, u32_t timeout)
 {
   struct timespec rtime1, rtime2, ts;
@@ -408,6 +573,10 @@ cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, u32_t timeout)
     return 0;
   }
 
+  if (atomic_load_explicit(&clock_virtual, memory_order_acquire)) {
+    return cond_wait_virtual(cond, mutex, timeout);
+  }
+
   /* Get a timestamp and add the timeout value. */
   get_monotonic_time(&rtime1);
 #ifdef LWIP_UNIX_MACH
@@ -474,6 +643,8 @@ sys_sem_signal(struct sys_sem **s)
   LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
   sem = *s;
 
+  clock_activity_bump();
+
   pthread_mutex_lock(&(sem->mutex));
   sem->c++;
 
@@ -485,6 +656,140 @@ sys_sem_signal(struct sys_sem **s)
   pthread_mutex_unlock(&(sem->mutex));
 }
 /*-----------------------------------------------------------------------------------*/
+err_t
+sys_mutex_new(struct sys_mutex **mutex)
+{
+  struct sys_mutex *mtx;
+
+  mtx = (struct sys_mutex *)malloc(sizeof(struct sys_mutex));
+  if (mtx == NULL) {
+    return ERR_MEM;
+  }
+  pthread_mutex_init(&(mtx->mutex), NULL);
+  memset(&(mtx->stats), 0, sizeof(mtx->stats));
+  SYS_STATS_INC_USED(mutex);
+  *mutex = mtx;
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_mutex_lock(struct sys_mutex **mutex)
+{
+  struct sys_mutex *mtx;
+  struct timespec start, end;
+  int spins;
+
+  LWIP_ASSERT("invalid mutex", (mutex != NULL) && (*mutex != NULL));
+  mtx = *mutex;
+
+  if (pthread_mutex_trylock(&(mtx->mutex)) != 0) {
+    get_monotonic_time(&start);
+    for (spins = 0; spins < SYS_MUTEX_SPINS; spins++) {
+      if (pthread_mutex_trylock(&(mtx->mutex)) == 0) {
+        break;
+      }
+    }
+    if (spins == SYS_MUTEX_SPINS) {
+      pthread_mutex_lock(&(mtx->mutex));
+    }
+    get_monotonic_time(&end);
+    mtx->stats.contended++;
+    mtx->stats.wait_ns += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000L +
+                          end.tv_nsec - start.tv_nsec;
+
+    /* a thread that was held up is making progress again, which the
+       virtual clock must not run past */
+    clock_activity_bump();
+  }
+  mtx->stats.acquisitions++;
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_mutex_unlock(struct sys_mutex **mutex)
+{
+  LWIP_ASSERT("invalid mutex", (mutex != NULL) && (*mutex != NULL));
+  pthread_mutex_unlock(&((*mutex)->mutex));
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_mutex_free(struct sys_mutex **mutex)
+{
+  if ((mutex != NULL) && (*mutex != NULL)) {
+    SYS_STATS_DEC(mutex.used);
+    pthread_mutex_destroy(&((*mutex)->mutex));
+    free(*mutex);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_mutex_stats(struct sys_mutex **mutex, struct sys_mutex_stats *stats)
+{
+  struct sys_mutex *mtx;
+
+  LWIP_ASSERT("invalid mutex", (mutex != NULL) && (*mutex != NULL));
+  mtx = *mutex;
+
+  /* not through sys_mutex_lock(), so looking doesn't count */
+  pthread_mutex_lock(&(mtx->mutex));
+  *stats = mtx->stats;
+  pthread_mutex_unlock(&(mtx->mutex));
+}
+/*-----------------------------------------------------------------------------------*/
+struct thread_atexit {
+  struct thread_atexit *next;
+  void (*fn)(void *arg);
+  void *arg;
+};
+
+static pthread_key_t thread_atexit_key;
+static pthread_once_t thread_atexit_once = PTHREAD_ONCE_INIT;
+
+static void
+thread_atexit_run(void *value)
+{
+  struct thread_atexit *handler, *next;
+
+  for (handler = (struct thread_atexit *)value; handler != NULL; handler = next) {
+    next = handler->next;
+    handler->fn(handler->arg);
+    free(handler);
+  }
+}
+
+static void
+thread_atexit_init(void)
+{
+  pthread_key_create(&thread_atexit_key, thread_atexit_run);
+}
+
+err_t
+sys_thread_atexit(void (*fn)(void *arg), void *arg)
+{
+  struct thread_atexit *handler, *last;
+
+  pthread_once(&thread_atexit_once, thread_atexit_init);
+
+  handler = (struct thread_atexit *)malloc(sizeof(struct thread_atexit));
+  if (handler == NULL) {
+    return ERR_MEM;
+  }
+  handler->next = NULL;
+  handler->fn = fn;
+  handler->arg = arg;
+
+  /* the list is only ever touched by its own thread */
+  last = (struct thread_atexit *)pthread_getspecific(thread_atexit_key);
+  if (last == NULL) {
+    pthread_setspecific(thread_atexit_key, handler);
+  } else {
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    last->next = handler;
+  }
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
 static void
 sys_sem_free_internal(struct sys_sem *sem)
 {
@@ -507,10 +812,7 @@ sys_sem_free(struct sys_sem **sem)
 u32_t
 sys_now(void)
 {
-  struct timespec ts;
-
-  get_monotonic_time(&ts);
-  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+  return (u32_t)(sys_clock_now_us() / 1000L);
 }
 /*-----------------------------------------------------------------------------------*/
 void
@@ -578,8 +880,5 @@ sys_arch_unprotect(sys_prot_t pval)
 u32_t
 sys_jiffies(void)
 {
-  struct timespec ts;
-
-  get_monotonic_time(&ts);
-  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+  return (u32_t)(sys_clock_now_us() * 1000L);
 }
@@ -0,0 +1,1051 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "quiet-lwip-mux.h"
+#include "quiet-lwip/lwip-socket.h"
+
+// every frame starts with a stream id (u32), a type (u8), a priority (u8,
+//   only meaningful on open) and a payload length (u16), network order
+#define mux_header_len (8)
+// data is framed in pieces no larger than this, so that streams take turns
+//   at a grain finer than the tunnel's buffers
+#define mux_frame_max (1024)
+#define mux_buckets (64)
+#define mux_out_len (1 << 14)
+#define mux_in_len (1 << 14)
+
+enum {
+    mux_frame_data = 0,
+    // payload: the opener's window (u32), then the opener's header
+    mux_frame_open = 1,
+    // payload: bytes the sender has room for beyond what it granted (u32)
+    mux_frame_window = 2,
+    // the sender won't send any more data on the stream
+    mux_frame_close = 3,
+    // the stream is gone, and anything still queued for it is dropped
+    mux_frame_reset = 4,
+};
+
+static const size_t default_window = 1 << 14;
+
+typedef struct mux_buf mux_buf;
+struct mux_buf {
+    mux_buf *next;
+    size_t off;
+    size_t len;
+    uint8_t data[];
+};
+
+struct quiet_lwip_mux_stream {
+    quiet_lwip_mux *mux;
+    uint32_t id;
+    uint8_t priority;
+    // -1 until accepted, or for good once refused
+    int native_fd;
+
+    // opened by the peer and not yet accepted or refused. the mux keeps a
+    //   reference for each of these, so the stream outlives the tunnel
+    bool pending;
+    bool refused;
+
+    // native -> tunnel
+    // bytes the peer has room for
+    size_t send_window;
+    // sent ahead of anything read from native_fd
+    uint8_t *prefix;
+    size_t prefix_len;
+    size_t prefix_off;
+    // the native side has data, as far as poll() knows
+    bool readable;
+    bool native_eof;
+    bool close_sent;
+    // when it was last given a turn, so equal priorities take turns
+    uint64_t served;
+
+    // tunnel -> native
+    // data the native socket hasn't taken yet
+    mux_buf *queue;
+    mux_buf *queue_tail;
+    // bytes the peer may still send us
+    size_t recv_allow;
+    // bytes taken by the native side since the peer was last told
+    size_t unacked;
+    bool peer_closed;
+    bool native_shut;
+
+    bool failed;
+
+    size_t poll_index;
+    quiet_lwip_mux_stream *next_in_bucket;
+};
+
+typedef struct mux_op mux_op;
+struct mux_op {
+    mux_op *next;
+    quiet_lwip_mux_stream *stream;
+    // open/accept: the native socket, or -1 to refuse
+    int native_fd;
+    bool open;
+    // open: the header. accept/refuse: the reply
+    uint8_t *data;
+    size_t data_len;
+};
+
+struct quiet_lwip_mux {
+    int lwip_fd;
+    size_t window;
+    quiet_lwip_mux_open_fn on_open;
+    void *on_open_arg;
+    pthread_t thread;
+    // a byte on this pipe wakes poll() for lwip events and new ops
+    int wake_fds[2];
+
+    // guards everything up to the thread's own state below
+    pthread_mutex_t lock;
+    pthread_cond_t closed_cond;
+    mux_op *ops;
+    mux_op *ops_tail;
+    bool woken;
+    // lwip has news for the tunnel socket
+    bool lwip_ready;
+    bool stopping;
+    bool closed;
+    // one for the owner, and one for each pending stream
+    size_t refs;
+    // ids for streams we open. odd for the initiator, even for the other side
+    uint32_t next_id;
+
+    // polls[0] is the wake pipe, and polls[i] belongs to streams[i]
+    struct pollfd *polls;
+    quiet_lwip_mux_stream **streams;
+    size_t num_polls;
+    size_t polls_cap;
+    quiet_lwip_mux_stream *buckets[mux_buckets];
+
+    // control frames waiting for room in out. they go ahead of data
+    uint8_t *ctl;
+    size_t ctl_len;
+    size_t ctl_cap;
+    // framed bytes on their way to lwip
+    uint8_t out[mux_out_len];
+    size_t out_off;
+    size_t out_len;
+    // bytes from lwip not yet parsed
+    uint8_t in[mux_in_len];
+    size_t in_len;
+    quiet_lwip_mux_stream **order;
+    size_t order_cap;
+    uint64_t serve_seq;
+
+    _Atomic size_t open;
+    _Atomic uint64_t opened;
+    _Atomic uint64_t bytes_sent;
+    _Atomic uint64_t bytes_received;
+    _Atomic uint64_t frames_sent;
+    _Atomic uint64_t sends;
+};
+
+static bool would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+// lwip fails a nonblocking call with ENOMEM when it is short of segments or
+//   pbufs for the moment. it signals the socket again once it has room, as
+//   it does when the send buffer fills, so this is no reason to give up
+static bool lwip_retry_later(int err) {
+    return would_block(err) || err == ENOMEM;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void mux_header(uint8_t *p, uint32_t id, uint8_t type, uint8_t priority, size_t len) {
+    put_u32(p, id);
+    p[4] = type;
+    p[5] = priority;
+    put_u16(p + 6, (uint16_t)len);
+}
+
+// call with the mux's lock held
+static void mux_wake(quiet_lwip_mux *mux) {
+    if (!mux->woken) {
+        mux->woken = true;
+        uint8_t b = 0;
+        // the pipe is nonblocking and holds a single byte at most
+        ssize_t res = write(mux->wake_fds[1], &b, 1);
+        (void)res;
+    }
+}
+
+// lwip -> mux: runs on lwip's thread with lwip's socket table locked. the
+//   mux's thread never calls into lwip while holding its own lock, so
+//   taking it here can't deadlock
+static void mux_lwip_event(int s, void *arg) {
+    (void)s;
+    quiet_lwip_mux *mux = (quiet_lwip_mux*)arg;
+    pthread_mutex_lock(&mux->lock);
+    mux->lwip_ready = true;
+    mux_wake(mux);
+    pthread_mutex_unlock(&mux->lock);
+}
+
+static void mux_free(quiet_lwip_mux *mux) {
+    close(mux->wake_fds[0]);
+    close(mux->wake_fds[1]);
+    pthread_mutex_destroy(&mux->lock);
+    pthread_cond_destroy(&mux->closed_cond);
+    free(mux->polls);
+    free(mux->streams);
+    free(mux->ctl);
+    free(mux->order);
+    free(mux);
+}
+
+// drops a reference taken for a pending stream or by the owner
+static void mux_release(quiet_lwip_mux *mux) {
+    pthread_mutex_lock(&mux->lock);
+    bool last = (--mux->refs == 0);
+    pthread_mutex_unlock(&mux->lock);
+    if (last) {
+        mux_free(mux);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+// streams. these belong to the mux's thread
+
+static quiet_lwip_mux_stream *mux_find(quiet_lwip_mux *mux, uint32_t id) {
+    quiet_lwip_mux_stream *s = mux->buckets[id % mux_buckets];
+    while (s && s->id != id) {
+        s = s->next_in_bucket;
+    }
+    return s;
+}
+
+static quiet_lwip_mux_stream *mux_stream_add(quiet_lwip_mux *mux, uint32_t id, int native_fd, uint8_t priority) {
+    quiet_lwip_mux_stream *s = calloc(1, sizeof(quiet_lwip_mux_stream));
+    s->mux = mux;
+    s->id = id;
+    s->priority = priority;
+    s->native_fd = native_fd;
+    s->recv_allow = mux->window;
+
+    s->next_in_bucket = mux->buckets[id % mux_buckets];
+    mux->buckets[id % mux_buckets] = s;
+
+    if (mux->num_polls == mux->polls_cap) {
+        mux->polls_cap *= 2;
+        mux->polls = realloc(mux->polls, mux->polls_cap * sizeof(struct pollfd));
+        mux->streams = realloc(mux->streams, mux->polls_cap * sizeof(quiet_lwip_mux_stream*));
+    }
+    s->poll_index = mux->num_polls++;
+    mux->streams[s->poll_index] = s;
+    mux->polls[s->poll_index].fd = -1;
+    mux->polls[s->poll_index].events = 0;
+    mux->polls[s->poll_index].revents = 0;
+
+    atomic_fetch_add(&mux->open, 1);
+    atomic_fetch_add(&mux->opened, 1);
+    return s;
+}
+
+static void mux_stream_free(quiet_lwip_mux_stream *s) {
+    while (s->queue) {
+        mux_buf *next = s->queue->next;
+        free(s->queue);
+        s->queue = next;
+    }
+    if (s->native_fd >= 0) {
+        close(s->native_fd);
+    }
+    free(s->prefix);
+    free(s);
+}
+
+// takes the stream out of the mux. a pending stream is left for whoever
+//   accepts or refuses it to free
+static void mux_stream_remove(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s) {
+    quiet_lwip_mux_stream **link = &mux->buckets[s->id % mux_buckets];
+    while (*link != s) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = s->next_in_bucket;
+
+    size_t last = mux->num_polls - 1;
+    mux->polls[s->poll_index] = mux->polls[last];
+    mux->streams[s->poll_index] = mux->streams[last];
+    mux->streams[s->poll_index]->poll_index = s->poll_index;
+    mux->num_polls--;
+
+    atomic_fetch_sub(&mux->open, 1);
+    if (s->pending) {
+        s->failed = true;
+        return;
+    }
+    mux_stream_free(s);
+}
+
+static void mux_ctl_append(quiet_lwip_mux *mux, const uint8_t *frame, size_t len) {
+    if (mux->ctl_len + len > mux->ctl_cap) {
+        mux->ctl_cap = (mux->ctl_len + len) * 2;
+        mux->ctl = realloc(mux->ctl, mux->ctl_cap);
+    }
+    memcpy(mux->ctl + mux->ctl_len, frame, len);
+    mux->ctl_len += len;
+}
+
+static void mux_ctl(quiet_lwip_mux *mux, uint32_t id, uint8_t type) {
+    uint8_t frame[mux_header_len];
+    mux_header(frame, id, type, 0, 0);
+    mux_ctl_append(mux, frame, sizeof(frame));
+}
+
+static void mux_ctl_window(quiet_lwip_mux *mux, uint32_t id, size_t increment) {
+    uint8_t frame[mux_header_len + 4];
+    mux_header(frame, id, mux_frame_window, 0, 4);
+    put_u32(frame + mux_header_len, (uint32_t)increment);
+    mux_ctl_append(mux, frame, sizeof(frame));
+}
+
+static void mux_stream_reset(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s) {
+    mux_ctl(mux, s->id, mux_frame_reset);
+    mux_stream_remove(mux, s);
+}
+
+// the native side has taken len more bytes, or they were thrown away
+static void mux_stream_consumed(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s, size_t len) {
+    s->unacked += len;
+    // grant in batches, so window updates don't take a frame per read
+    if (s->unacked >= mux->window / 2) {
+        mux_ctl_window(mux, s->id, s->unacked);
+        s->recv_allow += s->unacked;
+        s->unacked = 0;
+    }
+}
+
+static void mux_stream_flush(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s) {
+    if (s->native_fd < 0) {
+        return;
+    }
+    while (s->queue) {
+        struct iovec iov[16];
+        int iovcnt = 0;
+        for (mux_buf *b = s->queue; b && iovcnt < 16; b = b->next) {
+            iov[iovcnt].iov_base = b->data + b->off;
+            iov[iovcnt].iov_len = b->len - b->off;
+            iovcnt++;
+        }
+        ssize_t written = writev(s->native_fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!would_block(errno)) {
+                s->failed = true;
+            }
+            return;
+        }
+        mux_stream_consumed(mux, s, written);
+        while (written) {
+            mux_buf *b = s->queue;
+            size_t n = b->len - b->off;
+            if ((size_t)written < n) {
+                b->off += written;
+                break;
+            }
+            written -= n;
+            s->queue = b->next;
+            free(b);
+        }
+        if (!s->queue) {
+            s->queue_tail = NULL;
+        }
+    }
+    if (s->peer_closed && !s->native_shut) {
+        shutdown(s->native_fd, SHUT_WR);
+        s->native_shut = true;
+    }
+}
+
+static void mux_stream_deliver(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s, const uint8_t *data, size_t len) {
+    if (s->refused) {
+        mux_stream_consumed(mux, s, len);
+        return;
+    }
+    // straight through if nothing is waiting ahead of it
+    if (!s->queue && s->native_fd >= 0) {
+        ssize_t written;
+        do {
+            written = write(s->native_fd, data, len);
+        } while (written < 0 && errno == EINTR);
+        if (written < 0) {
+            if (!would_block(errno)) {
+                s->failed = true;
+                return;
+            }
+            written = 0;
+        }
+        mux_stream_consumed(mux, s, written);
+        data += written;
+        len -= written;
+        if (!len) {
+            return;
+        }
+    }
+    mux_buf *b = malloc(sizeof(mux_buf) + len);
+    b->next = NULL;
+    b->off = 0;
+    b->len = len;
+    memcpy(b->data, data, len);
+    if (s->queue_tail) {
+        s->queue_tail->next = b;
+    } else {
+        s->queue = b;
+    }
+    s->queue_tail = b;
+}
+
+static bool mux_stream_done(const quiet_lwip_mux_stream *s) {
+    if (s->failed) {
+        return true;
+    }
+    if (s->pending) {
+        return false;
+    }
+    return s->close_sent && s->peer_closed && !s->queue;
+}
+
+/* ------------------------------------------------------------------------- */
+// the tunnel
+
+// false if the peer broke the protocol
+static bool mux_frame(quiet_lwip_mux *mux, uint32_t id, uint8_t type, uint8_t priority,
+                      const uint8_t *payload, size_t len) {
+    quiet_lwip_mux_stream *s = mux_find(mux, id);
+
+    switch (type) {
+    case mux_frame_data:
+        if (!s) {
+            // reset already, and the peer hadn't heard yet
+            return true;
+        }
+        if (len > s->recv_allow) {
+            mux_stream_reset(mux, s);
+            return true;
+        }
+        s->recv_allow -= len;
+        atomic_fetch_add(&mux->bytes_received, len);
+        mux_stream_deliver(mux, s, payload, len);
+        return true;
+    case mux_frame_open:
+        if (s || len < 4 || (id & 1) == (mux->next_id & 1)) {
+            return false;
+        }
+        s = mux_stream_add(mux, id, -1, priority);
+        s->send_window = get_u32(payload);
+        // room for data the peer sends before we've decided, so it needn't
+        //   wait on us
+        mux_ctl_window(mux, id, mux->window);
+        if (!mux->on_open) {
+            s->refused = true;
+            s->native_eof = true;
+            return true;
+        }
+        pthread_mutex_lock(&mux->lock);
+        mux->refs++;
+        pthread_mutex_unlock(&mux->lock);
+        s->pending = true;
+        mux->on_open(s, payload + 4, len - 4, mux->on_open_arg);
+        return true;
+    case mux_frame_window:
+        if (len != 4) {
+            return false;
+        }
+        if (s) {
+            s->send_window += get_u32(payload);
+        }
+        return true;
+    case mux_frame_close:
+        if (s) {
+            s->peer_closed = true;
+            mux_stream_flush(mux, s);
+        }
+        return true;
+    case mux_frame_reset:
+        if (s) {
+            mux_stream_remove(mux, s);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// false once the tunnel is finished
+static bool mux_receive(quiet_lwip_mux *mux) {
+    for (;;) {
+        int received = lwip_recv(mux->lwip_fd, mux->in + mux->in_len, mux_in_len - mux->in_len, LWIP_MSG_DONTWAIT);
+        if (received == 0) {
+            return false;
+        }
+        if (received < 0) {
+            return lwip_retry_later(lwip_socket_errno(mux->lwip_fd));
+        }
+        mux->in_len += received;
+
+        size_t off = 0;
+        while (mux->in_len - off >= mux_header_len) {
+            const uint8_t *h = mux->in + off;
+            size_t len = get_u16(h + 6);
+            if (len > mux_frame_max + 4) {
+                return false;
+            }
+            if (mux->in_len - off < mux_header_len + len) {
+                break;
+            }
+            if (!mux_frame(mux, get_u32(h), h[4], h[5], h + mux_header_len, len)) {
+                return false;
+            }
+            off += mux_header_len + len;
+        }
+        memmove(mux->in, mux->in + off, mux->in_len - off);
+        mux->in_len -= off;
+    }
+}
+
+// read from a stream's native side straight into the next frame. false if
+//   the stream has nothing more to give for now
+static bool mux_stream_fill(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s) {
+    size_t room = mux_out_len - mux->out_len;
+    if (room <= mux_header_len || !s->send_window) {
+        return false;
+    }
+    size_t want = room - mux_header_len;
+    if (want > mux_frame_max) {
+        want = mux_frame_max;
+    }
+    if (want > s->send_window) {
+        want = s->send_window;
+    }
+
+    uint8_t *frame = mux->out + mux->out_len;
+    size_t n;
+    if (s->prefix_off < s->prefix_len) {
+        n = s->prefix_len - s->prefix_off;
+        if (n > want) {
+            n = want;
+        }
+        memcpy(frame + mux_header_len, s->prefix + s->prefix_off, n);
+        s->prefix_off += n;
+    } else {
+        ssize_t nread = read(s->native_fd, frame + mux_header_len, want);
+        if (nread == 0) {
+            s->native_eof = true;
+            return false;
+        }
+        if (nread < 0) {
+            if (errno == EINTR) {
+                return true;
+            }
+            if (!would_block(errno)) {
+                s->failed = true;
+            }
+            s->readable = false;
+            return false;
+        }
+        n = nread;
+        if (n < want) {
+            // most likely all there was
+            s->readable = false;
+        }
+    }
+
+    mux_header(frame, s->id, mux_frame_data, 0, n);
+    mux->out_len += mux_header_len + n;
+    s->send_window -= n;
+    s->served = ++mux->serve_seq;
+    atomic_fetch_add(&mux->bytes_sent, n);
+    atomic_fetch_add(&mux->frames_sent, 1);
+    return true;
+}
+
+static bool mux_stream_wants_turn(const quiet_lwip_mux_stream *s) {
+    if (s->failed || !s->send_window || s->pending) {
+        return false;
+    }
+    if (s->prefix_off < s->prefix_len) {
+        return true;
+    }
+    return s->native_fd >= 0 && s->readable && !s->native_eof;
+}
+
+static int mux_turn_cmp(const void *a_v, const void *b_v) {
+    const quiet_lwip_mux_stream *a = *(quiet_lwip_mux_stream *const *)a_v;
+    const quiet_lwip_mux_stream *b = *(quiet_lwip_mux_stream *const *)b_v;
+    if (a->priority != b->priority) {
+        return (a->priority < b->priority) ? -1 : 1;
+    }
+    return (a->served < b->served) ? -1 : (a->served > b->served);
+}
+
+// frames control and data into out, as far as it has room
+static void mux_fill(quiet_lwip_mux *mux) {
+    if (mux->out_off == mux->out_len) {
+        mux->out_off = mux->out_len = 0;
+    } else if (mux->out_off > mux_out_len / 2) {
+        memmove(mux->out, mux->out + mux->out_off, mux->out_len - mux->out_off);
+        mux->out_len -= mux->out_off;
+        mux->out_off = 0;
+    }
+
+    size_t n = mux->ctl_len;
+    if (n > mux_out_len - mux->out_len) {
+        n = mux_out_len - mux->out_len;
+    }
+    memcpy(mux->out + mux->out_len, mux->ctl, n);
+    mux->out_len += n;
+    memmove(mux->ctl, mux->ctl + n, mux->ctl_len - n);
+    mux->ctl_len -= n;
+    if (mux->ctl_len) {
+        // a stream's data can't overtake its open
+        return;
+    }
+
+    if (mux->order_cap < mux->num_polls) {
+        mux->order_cap = mux->num_polls;
+        mux->order = realloc(mux->order, mux->order_cap * sizeof(quiet_lwip_mux_stream*));
+    }
+    for (;;) {
+        size_t num_order = 0;
+        for (size_t i = 1; i < mux->num_polls; i++) {
+            if (mux_stream_wants_turn(mux->streams[i])) {
+                mux->order[num_order++] = mux->streams[i];
+            }
+        }
+        if (!num_order) {
+            break;
+        }
+        qsort(mux->order, num_order, sizeof(quiet_lwip_mux_stream*), mux_turn_cmp);
+        // the best stream gets the first turn, and whoever is still waiting
+        //   afterwards is sorted again
+        bool progress = false;
+        for (size_t i = 0; i < num_order; i++) {
+            if (mux_stream_fill(mux, mux->order[i])) {
+                progress = true;
+                break;
+            }
+            if (mux_out_len - mux->out_len <= mux_header_len) {
+                break;
+            }
+        }
+        if (!progress) {
+            break;
+        }
+    }
+
+    // closes go out after the last of their stream's data
+    for (size_t i = 1; i < mux->num_polls; i++) {
+        quiet_lwip_mux_stream *s = mux->streams[i];
+        if (s->native_eof && !s->close_sent && s->prefix_off == s->prefix_len && !s->failed) {
+            mux_ctl(mux, s->id, mux_frame_close);
+            s->close_sent = true;
+        }
+    }
+}
+
+// false once the tunnel is finished
+static bool mux_send(quiet_lwip_mux *mux, bool *sent_any) {
+    *sent_any = false;
+    while (mux->out_off < mux->out_len) {
+        int sent = lwip_send(mux->lwip_fd, mux->out + mux->out_off, mux->out_len - mux->out_off, LWIP_MSG_DONTWAIT);
+        if (sent < 0) {
+            // wait for lwip to say it has room
+            return lwip_retry_later(lwip_socket_errno(mux->lwip_fd));
+        }
+        mux->out_off += sent;
+        *sent_any = true;
+        atomic_fetch_add(&mux->sends, 1);
+    }
+    return true;
+}
+
+// what we're waiting for on each native side. a socket we want nothing from
+//   is left out of poll() altogether so that a hangup doesn't spin it
+static void mux_stream_watch(quiet_lwip_mux *mux, quiet_lwip_mux_stream *s) {
+    struct pollfd *p = mux->polls + s->poll_index;
+    p->events = 0;
+    if (s->native_fd >= 0) {
+        if (!s->readable && !s->native_eof && s->send_window) {
+            p->events |= POLLIN;
+        }
+        if (s->queue) {
+            p->events |= POLLOUT;
+        }
+    }
+    p->fd = p->events ? s->native_fd : -1;
+}
+
+static void mux_apply(quiet_lwip_mux *mux, mux_op *op) {
+    quiet_lwip_mux_stream *s = op->stream;
+    if (op->open) {
+        s = mux_stream_add(mux, s->id, op->native_fd, s->priority);
+        free(op->stream);
+        uint8_t *frame = malloc(mux_header_len + 4 + op->data_len);
+        mux_header(frame, s->id, mux_frame_open, s->priority, 4 + op->data_len);
+        put_u32(frame + mux_header_len, (uint32_t)mux->window);
+        memcpy(frame + mux_header_len + 4, op->data, op->data_len);
+        mux_ctl_append(mux, frame, mux_header_len + 4 + op->data_len);
+        free(frame);
+        free(op->data);
+        return;
+    }
+
+    // accept or refuse. the stream may have been reset meanwhile. the owner
+    //   still holds a reference, so this one is never the last
+    s->pending = false;
+    mux_release(mux);
+    if (s->failed) {
+        if (op->native_fd >= 0) {
+            close(op->native_fd);
+        }
+        free(op->data);
+        mux_stream_free(s);
+        return;
+    }
+    s->prefix = op->data;
+    s->prefix_len = op->data_len;
+    s->native_fd = op->native_fd;
+    if (s->native_fd < 0) {
+        s->refused = true;
+        s->native_eof = true;
+        // anything that came in while it waited goes nowhere
+        while (s->queue) {
+            mux_buf *next = s->queue->next;
+            mux_stream_consumed(mux, s, s->queue->len - s->queue->off);
+            free(s->queue);
+            s->queue = next;
+        }
+        s->queue_tail = NULL;
+    } else {
+        mux_stream_flush(mux, s);
+    }
+}
+
+static void *mux_run(void *mux_v) {
+    quiet_lwip_mux *mux = (quiet_lwip_mux*)mux_v;
+    bool alive = true;
+    bool stopped = false;
+    while (alive) {
+        int res = poll(mux->polls, mux->num_polls, -1);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("mux: poll");
+            break;
+        }
+
+        bool lwip_ready = false;
+        if (mux->polls[0].revents) {
+            uint8_t drain[64];
+            while (read(mux->wake_fds[0], drain, sizeof(drain)) > 0);
+
+            pthread_mutex_lock(&mux->lock);
+            mux->woken = false;
+            lwip_ready = mux->lwip_ready;
+            mux->lwip_ready = false;
+            bool stopping = mux->stopping;
+            mux_op *ops = mux->ops;
+            mux->ops = mux->ops_tail = NULL;
+            pthread_mutex_unlock(&mux->lock);
+
+            for (mux_op *op = ops; op; ) {
+                mux_op *next = op->next;
+                mux_apply(mux, op);
+                free(op);
+                op = next;
+            }
+            if (stopping) {
+                stopped = true;
+                break;
+            }
+        }
+        for (size_t i = 1; i < mux->num_polls; i++) {
+            quiet_lwip_mux_stream *s = mux->streams[i];
+            short revents = mux->polls[i].fd >= 0 ? mux->polls[i].revents : 0;
+            mux->polls[i].revents = 0;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                s->readable = true;
+            }
+            if (revents & (POLLOUT | POLLHUP | POLLERR)) {
+                mux_stream_flush(mux, s);
+            }
+        }
+
+        if (lwip_ready) {
+            alive = mux_receive(mux);
+        }
+        bool sent_any;
+        do {
+            mux_fill(mux);
+            alive = mux_send(mux, &sent_any) && alive;
+        } while (alive && sent_any && (mux->ctl_len || mux->out_off < mux->out_len));
+
+        for (size_t i = 1; i < mux->num_polls; ) {
+            quiet_lwip_mux_stream *s = mux->streams[i];
+            if (mux_stream_done(s)) {
+                if (s->failed && !s->pending) {
+                    mux_ctl(mux, s->id, mux_frame_reset);
+                }
+                // the last stream moves into slot i
+                mux_stream_remove(mux, s);
+                continue;
+            }
+            mux_stream_watch(mux, s);
+            i++;
+        }
+        if (mux->ctl_len) {
+            // resets queued just now
+            mux_fill(mux);
+            alive = mux_send(mux, &sent_any) && alive;
+        }
+    }
+
+    lwip_socket_set_event_callback(mux->lwip_fd, NULL, NULL);
+    if (!stopped) {
+        // the tunnel failed under us. tell the peer about every stream,
+        //   should the tunnel still carry that, and then close it so that
+        //   the peer's mux finishes too rather than waiting on it
+        for (size_t i = 1; i < mux->num_polls; i++) {
+            mux->streams[i]->failed = true;
+            mux_ctl(mux, mux->streams[i]->id, mux_frame_reset);
+        }
+        bool sent_any;
+        mux_fill(mux);
+        mux_send(mux, &sent_any);
+        lwip_shutdown(mux->lwip_fd, SHUT_RDWR);
+    }
+    while (mux->num_polls > 1) {
+        mux_stream_remove(mux, mux->streams[mux->num_polls - 1]);
+    }
+
+    pthread_mutex_lock(&mux->lock);
+    mux->closed = true;
+    // ops that raced with the close are dealt with here, and later ones by
+    //   their callers
+    mux_op *ops = mux->ops;
+    mux->ops = mux->ops_tail = NULL;
+    pthread_cond_broadcast(&mux->closed_cond);
+    pthread_mutex_unlock(&mux->lock);
+
+    for (mux_op *op = ops; op; ) {
+        mux_op *next = op->next;
+        if (op->native_fd >= 0) {
+            close(op->native_fd);
+        }
+        if (op->open) {
+            free(op->stream);
+        } else {
+            mux_stream_free(op->stream);
+            mux_release(mux);
+        }
+        free(op->data);
+        free(op);
+        op = next;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+quiet_lwip_mux *quiet_lwip_mux_create(int lwip_fd, bool initiator, const quiet_lwip_mux_config *conf,
+                                      quiet_lwip_mux_open_fn on_open, void *on_open_arg) {
+    quiet_lwip_mux *mux = calloc(1, sizeof(quiet_lwip_mux));
+    mux->lwip_fd = lwip_fd;
+    mux->window = (conf && conf->window) ? conf->window : default_window;
+    mux->on_open = on_open;
+    mux->on_open_arg = on_open_arg;
+    mux->next_id = initiator ? 1 : 2;
+    mux->refs = 1;
+    atomic_init(&mux->open, 0);
+    atomic_init(&mux->opened, 0);
+    atomic_init(&mux->bytes_sent, 0);
+    atomic_init(&mux->bytes_received, 0);
+    atomic_init(&mux->frames_sent, 0);
+    atomic_init(&mux->sends, 0);
+
+    if (pipe(mux->wake_fds) < 0) {
+        perror("mux: pipe");
+        free(mux);
+        return NULL;
+    }
+    fcntl(mux->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(mux->wake_fds[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&mux->lock, NULL);
+    pthread_cond_init(&mux->closed_cond, NULL);
+    mux->polls_cap = 16;
+    mux->polls = calloc(mux->polls_cap, sizeof(struct pollfd));
+    mux->streams = calloc(mux->polls_cap, sizeof(quiet_lwip_mux_stream*));
+    mux->polls[0].fd = mux->wake_fds[0];
+    mux->polls[0].events = POLLIN;
+    mux->num_polls = 1;
+
+    lwip_fcntl(lwip_fd, F_SETFL, LWIP_O_NONBLOCK);
+    // frames are batched already, and each one is worth sending at once
+    int one = 1;
+    lwip_setsockopt(lwip_fd, LWIP_IPPROTO_TCP, LWIP_TCP_NODELAY, &one, sizeof(one));
+    // the thread picks this up as its first event
+    mux->lwip_ready = true;
+    mux_wake(mux);
+    lwip_socket_set_event_callback(lwip_fd, mux_lwip_event, mux);
+    pthread_create(&mux->thread, NULL, mux_run, mux);
+    return mux;
+}
+
+// false if the mux has closed, in which case op is left to the caller
+static bool mux_push(quiet_lwip_mux *mux, mux_op *op) {
+    pthread_mutex_lock(&mux->lock);
+    if (mux->closed) {
+        pthread_mutex_unlock(&mux->lock);
+        return false;
+    }
+    if (op->open) {
+        op->stream->id = mux->next_id;
+        mux->next_id += 2;
+    }
+    if (mux->ops_tail) {
+        mux->ops_tail->next = op;
+    } else {
+        mux->ops = op;
+    }
+    mux->ops_tail = op;
+    mux_wake(mux);
+    pthread_mutex_unlock(&mux->lock);
+    return true;
+}
+
+static uint8_t *mux_copy(const void *data, size_t len) {
+    if (!len) {
+        return NULL;
+    }
+    uint8_t *copy = malloc(len);
+    memcpy(copy, data, len);
+    return copy;
+}
+
+int quiet_lwip_mux_open(quiet_lwip_mux *mux, int native_fd, uint8_t priority,
+                        const void *hdr, size_t hdr_len) {
+    if (hdr_len > mux_frame_max) {
+        return -1;
+    }
+    fcntl(native_fd, F_SETFL, fcntl(native_fd, F_GETFL) | O_NONBLOCK);
+
+    mux_op *op = calloc(1, sizeof(mux_op));
+    op->open = true;
+    op->native_fd = native_fd;
+    op->data = mux_copy(hdr, hdr_len);
+    op->data_len = hdr_len;
+    // a placeholder for the id and priority until the mux's thread adds it
+    op->stream = calloc(1, sizeof(quiet_lwip_mux_stream));
+    op->stream->priority = priority;
+    if (!mux_push(mux, op)) {
+        free(op->stream);
+        free(op->data);
+        free(op);
+        return -1;
+    }
+    return 0;
+}
+
+static void mux_decide(quiet_lwip_mux_stream *stream, int native_fd, const void *reply, size_t reply_len) {
+    mux_op *op = calloc(1, sizeof(mux_op));
+    op->stream = stream;
+    op->native_fd = native_fd;
+    op->data = mux_copy(reply, reply_len);
+    op->data_len = reply_len;
+
+    // the stream's reference keeps the mux around even if the tunnel has
+    //   closed, in which case the decision is moot
+    quiet_lwip_mux *mux = stream->mux;
+    if (!mux_push(mux, op)) {
+        if (native_fd >= 0) {
+            close(native_fd);
+        }
+        free(op->data);
+        free(op);
+        mux_stream_free(stream);
+        mux_release(mux);
+    }
+}
+
+void quiet_lwip_mux_accept(quiet_lwip_mux_stream *stream, int native_fd, uint8_t priority,
+                           const void *reply, size_t reply_len) {
+    stream->priority = priority;
+    fcntl(native_fd, F_SETFL, fcntl(native_fd, F_GETFL) | O_NONBLOCK);
+    mux_decide(stream, native_fd, reply, reply_len);
+}
+
+void quiet_lwip_mux_refuse(quiet_lwip_mux_stream *stream, const void *reply, size_t reply_len) {
+    mux_decide(stream, -1, reply, reply_len);
+}
+
+void quiet_lwip_mux_wait(quiet_lwip_mux *mux) {
+    pthread_mutex_lock(&mux->lock);
+    while (!mux->closed) {
+        pthread_cond_wait(&mux->closed_cond, &mux->lock);
+    }
+    pthread_mutex_unlock(&mux->lock);
+}
+
+bool quiet_lwip_mux_closed(quiet_lwip_mux *mux) {
+    pthread_mutex_lock(&mux->lock);
+    bool closed = mux->closed;
+    pthread_mutex_unlock(&mux->lock);
+    return closed;
+}
+
+void quiet_lwip_mux_get_stats(quiet_lwip_mux *mux, quiet_lwip_mux_stats *stats) {
+    stats->open = atomic_load(&mux->open);
+    stats->opened = atomic_load(&mux->opened);
+    stats->bytes_sent = atomic_load(&mux->bytes_sent);
+    stats->bytes_received = atomic_load(&mux->bytes_received);
+    stats->frames_sent = atomic_load(&mux->frames_sent);
+    stats->sends = atomic_load(&mux->sends);
+}
+
+void quiet_lwip_mux_destroy(quiet_lwip_mux *mux) {
+    pthread_mutex_lock(&mux->lock);
+    mux->stopping = true;
+    mux_wake(mux);
+    pthread_mutex_unlock(&mux->lock);
+    pthread_join(mux->thread, NULL);
+    lwip_close(mux->lwip_fd);
+    mux_release(mux);
+}
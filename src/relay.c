@@ -0,0 +1,570 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "quiet-lwip-relay.h"
+#include "quiet-lwip/lwip-socket.h"
+
+#define relay_zc_iovs (16)
+
+typedef struct relay_shard relay_shard;
+typedef struct relay_conn relay_conn;
+
+// memory native data is read into and lwip sends from. one reference is
+//   held by the connection filling it, and one by each lwip_send_zc() that
+//   points into it until lwip is done with that part
+typedef struct {
+    _Atomic size_t refs;
+    uint8_t data[];
+} relay_chunk;
+
+struct relay_conn {
+    relay_shard *shard;
+    int native_fd;
+    int lwip_fd;
+
+    // native -> lwip: not copied either. reads land in chunk at chunk_fill,
+    //   and lwip sends from chunk + up_off by reference. lwip holds on to
+    //   what it has queued until it is acked, so chunk_fill only moves
+    //   forward, and the chunk is dropped once it is full or the native side
+    //   runs dry
+    relay_chunk *chunk;
+    size_t chunk_fill;
+    size_t up_off;
+    size_t up_len;
+    // the native side is done sending, and lwip has been told
+    bool up_eof;
+    bool up_shut;
+
+    // lwip -> native: not copied. lwip lends its receive buffers and they
+    //   are writev()d straight out, then released
+    struct lwip_zc_buf *zc;
+    struct iovec zc_iov[relay_zc_iovs];
+    int zc_iovcnt;
+    int zc_iov_pos;
+    bool down_eof;
+
+    bool failed;
+
+    // the rest belongs to the shard's thread, except where noted
+    size_t poll_index;
+    // already in this round's work
+    bool queued;
+    // on the shard's ready list. guarded by the shard's lock
+    bool ready;
+    relay_conn *next_ready;
+    relay_conn *next_incoming;
+};
+
+struct relay_shard {
+    quiet_lwip_relay *relay;
+    pthread_t thread;
+    // a byte on this pipe wakes poll() for lwip events and new connections
+    int wake_fds[2];
+
+    // guards everything up to the thread's own state below
+    pthread_mutex_t lock;
+    // connections lwip has news for
+    relay_conn *ready;
+    // connections added and not yet picked up
+    relay_conn *incoming;
+    // a wake byte is in the pipe
+    bool woken;
+    bool stopping;
+
+    // polls[0] is the wake pipe, the rest are the connections' native
+    //   sockets, with conns[i] owning polls[i]
+    struct pollfd *polls;
+    relay_conn **conns;
+    size_t num_polls;
+    size_t polls_cap;
+    // connections to look at this round
+    relay_conn **work;
+    size_t work_cap;
+    // a chunk no one refers to, kept for the next read
+    relay_chunk *spare;
+};
+
+struct quiet_lwip_relay {
+    relay_shard *shards;
+    size_t num_shards;
+    size_t buf_len;
+    _Atomic size_t next_shard;
+    _Atomic size_t open;
+    _Atomic uint64_t opened;
+    _Atomic uint64_t bytes_to_lwip;
+    _Atomic uint64_t bytes_to_native;
+};
+
+static const size_t default_buf_len = 1 << 13;
+
+static pthread_once_t splice_once = PTHREAD_ONCE_INIT;
+static quiet_lwip_relay *splice_relay;
+
+static bool would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+// lwip fails a nonblocking call with ENOMEM when it is short of segments or
+//   pbufs for the moment. the socket is signalled again once it has room
+static bool lwip_retry_later(int err) {
+    return would_block(err) || err == ENOMEM;
+}
+
+// call with the shard's lock held
+static void relay_shard_wake(relay_shard *shard) {
+    if (!shard->woken) {
+        shard->woken = true;
+        uint8_t b = 0;
+        // the pipe is nonblocking and holds a single byte at most
+        ssize_t res = write(shard->wake_fds[1], &b, 1);
+        (void)res;
+    }
+}
+
+// lwip -> relay: runs on lwip's thread with lwip's socket table locked.
+//   the shard's thread never calls into lwip while holding its own lock,
+//   so taking it here can't deadlock
+static void relay_lwip_event(int s, void *arg) {
+    (void)s;
+    relay_conn *conn = (relay_conn*)arg;
+    relay_shard *shard = conn->shard;
+    pthread_mutex_lock(&shard->lock);
+    if (!conn->ready) {
+        conn->ready = true;
+        conn->next_ready = shard->ready;
+        shard->ready = conn;
+    }
+    relay_shard_wake(shard);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* ------------------------------------------------------------------------- */
+// moving data
+
+static relay_chunk *relay_chunk_get(relay_shard *shard) {
+    relay_chunk *chunk = shard->spare;
+    if (chunk) {
+        shard->spare = NULL;
+        return chunk;
+    }
+    chunk = malloc(sizeof(relay_chunk) + shard->relay->buf_len);
+    atomic_init(&chunk->refs, 1);
+    return chunk;
+}
+
+static void relay_chunk_put(relay_chunk *chunk) {
+    if (atomic_fetch_sub(&chunk->refs, 1) == 1) {
+        free(chunk);
+    }
+}
+
+// lwip -> relay: lwip has let go of part of a chunk. this can run on
+//   lwip's thread, so it only drops the reference
+static void relay_chunk_sent(void *chunk_v) {
+    relay_chunk_put((relay_chunk*)chunk_v);
+}
+
+// the connection is done filling its chunk
+static void relay_conn_drop_chunk(relay_conn *conn) {
+    relay_shard *shard = conn->shard;
+    relay_chunk *chunk = conn->chunk;
+    conn->chunk = NULL;
+    conn->chunk_fill = 0;
+    conn->up_off = 0;
+    // no one else can take a reference once lwip has given all of theirs back
+    if (!shard->spare && atomic_load(&chunk->refs) == 1) {
+        shard->spare = chunk;
+        return;
+    }
+    relay_chunk_put(chunk);
+}
+
+static void relay_conn_up(relay_conn *conn) {
+    quiet_lwip_relay *relay = conn->shard->relay;
+    for (;;) {
+        if (conn->up_len) {
+            atomic_fetch_add(&conn->chunk->refs, 1);
+            int sent = lwip_send_zc(conn->lwip_fd, conn->chunk->data + conn->up_off, conn->up_len,
+                                    LWIP_MSG_DONTWAIT, relay_chunk_sent, conn->chunk);
+            if (sent < 0) {
+                if (!lwip_retry_later(lwip_socket_errno(conn->lwip_fd))) {
+                    conn->failed = true;
+                }
+                // wait for lwip to say it has room
+                return;
+            }
+            conn->up_off += sent;
+            conn->up_len -= sent;
+            atomic_fetch_add(&relay->bytes_to_lwip, sent);
+            if (conn->up_len) {
+                // lwip's send buffer is full
+                return;
+            }
+        }
+        if (conn->chunk && conn->chunk_fill == relay->buf_len) {
+            relay_conn_drop_chunk(conn);
+        }
+        if (conn->up_eof) {
+            if (conn->chunk) {
+                relay_conn_drop_chunk(conn);
+            }
+            if (!conn->up_shut) {
+                lwip_shutdown(conn->lwip_fd, SHUT_WR);
+                conn->up_shut = true;
+            }
+            return;
+        }
+        if (!conn->chunk) {
+            conn->chunk = relay_chunk_get(conn->shard);
+        }
+        ssize_t nread = read(conn->native_fd, conn->chunk->data + conn->chunk_fill,
+                             relay->buf_len - conn->chunk_fill);
+        if (nread > 0) {
+            conn->chunk_fill += nread;
+            conn->up_len = nread;
+        } else if (nread == 0) {
+            conn->up_eof = true;
+        } else if (errno != EINTR) {
+            if (!would_block(errno)) {
+                conn->failed = true;
+            }
+            // an idle connection holds no memory
+            relay_conn_drop_chunk(conn);
+            return;
+        }
+    }
+}
+
+static void relay_conn_down(relay_conn *conn) {
+    quiet_lwip_relay *relay = conn->shard->relay;
+    for (;;) {
+        if (conn->zc) {
+            ssize_t written = writev(conn->native_fd, conn->zc_iov + conn->zc_iov_pos,
+                                     conn->zc_iovcnt - conn->zc_iov_pos);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (!would_block(errno)) {
+                    conn->failed = true;
+                }
+                return;
+            }
+            atomic_fetch_add(&relay->bytes_to_native, written);
+            while (conn->zc_iov_pos < conn->zc_iovcnt) {
+                struct iovec *iov = conn->zc_iov + conn->zc_iov_pos;
+                if ((size_t)written < iov->iov_len) {
+                    iov->iov_base = (uint8_t*)iov->iov_base + written;
+                    iov->iov_len -= written;
+                    break;
+                }
+                written -= iov->iov_len;
+                conn->zc_iov_pos++;
+            }
+            if (conn->zc_iov_pos < conn->zc_iovcnt) {
+                // the native socket's buffer is full
+                return;
+            }
+            lwip_recv_zc_release(conn->zc);
+            conn->zc = NULL;
+        }
+        if (conn->down_eof) {
+            return;
+        }
+        conn->zc_iovcnt = relay_zc_iovs;
+        conn->zc_iov_pos = 0;
+        int received = lwip_recv_zc(conn->lwip_fd, &conn->zc, conn->zc_iov, &conn->zc_iovcnt, LWIP_MSG_DONTWAIT);
+        if (received == 0) {
+            lwip_recv_zc_release(conn->zc);
+            conn->zc = NULL;
+            conn->down_eof = true;
+            shutdown(conn->native_fd, SHUT_WR);
+            return;
+        }
+        if (received < 0) {
+            if (!lwip_retry_later(lwip_socket_errno(conn->lwip_fd))) {
+                conn->failed = true;
+            }
+            // wait for lwip to say it has data
+            return;
+        }
+    }
+}
+
+static bool relay_conn_done(const relay_conn *conn) {
+    return conn->failed || (conn->up_shut && conn->down_eof && !conn->zc);
+}
+
+/* ------------------------------------------------------------------------- */
+// the shard's thread
+
+// what we're waiting for on the native side. a socket we want nothing from
+//   is left out of poll() altogether so that a hangup doesn't spin it
+static void relay_conn_watch(relay_conn *conn) {
+    struct pollfd *p = conn->shard->polls + conn->poll_index;
+    p->events = 0;
+    if (!conn->up_eof && !conn->up_len) {
+        p->events |= POLLIN;
+    }
+    if (conn->zc) {
+        p->events |= POLLOUT;
+    }
+    p->fd = p->events ? conn->native_fd : -1;
+}
+
+static void relay_shard_attach(relay_shard *shard, relay_conn *conn) {
+    if (shard->num_polls == shard->polls_cap) {
+        shard->polls_cap *= 2;
+        shard->polls = realloc(shard->polls, shard->polls_cap * sizeof(struct pollfd));
+        shard->conns = realloc(shard->conns, shard->polls_cap * sizeof(relay_conn*));
+    }
+    conn->poll_index = shard->num_polls++;
+    shard->conns[conn->poll_index] = conn;
+    shard->polls[conn->poll_index].revents = 0;
+    relay_conn_watch(conn);
+    // from here on lwip tells us when there is something to do
+    lwip_socket_set_event_callback(conn->lwip_fd, relay_lwip_event, conn);
+}
+
+static void relay_shard_detach(relay_shard *shard, relay_conn *conn) {
+    // once this returns lwip won't queue conn again
+    lwip_socket_set_event_callback(conn->lwip_fd, NULL, NULL);
+    pthread_mutex_lock(&shard->lock);
+    if (conn->ready) {
+        relay_conn **link = &shard->ready;
+        while (*link != conn) {
+            link = &(*link)->next_ready;
+        }
+        *link = conn->next_ready;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    size_t last = shard->num_polls - 1;
+    shard->polls[conn->poll_index] = shard->polls[last];
+    shard->conns[conn->poll_index] = shard->conns[last];
+    shard->conns[conn->poll_index]->poll_index = conn->poll_index;
+    shard->num_polls--;
+}
+
+static void relay_conn_destroy(relay_conn *conn) {
+    lwip_recv_zc_release(conn->zc);
+    if (conn->chunk) {
+        relay_chunk_put(conn->chunk);
+    }
+    lwip_close(conn->lwip_fd);
+    close(conn->native_fd);
+    atomic_fetch_sub(&conn->shard->relay->open, 1);
+    free(conn);
+}
+
+static void relay_shard_add_work(relay_shard *shard, size_t *num_work, relay_conn *conn) {
+    if (conn->queued) {
+        return;
+    }
+    if (*num_work == shard->work_cap) {
+        shard->work_cap = shard->work_cap ? shard->work_cap * 2 : 16;
+        shard->work = realloc(shard->work, shard->work_cap * sizeof(relay_conn*));
+    }
+    conn->queued = true;
+    shard->work[(*num_work)++] = conn;
+}
+
+static void *relay_shard_run(void *shard_v) {
+    relay_shard *shard = (relay_shard*)shard_v;
+    for (;;) {
+        int res = poll(shard->polls, shard->num_polls, -1);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("relay: poll");
+            break;
+        }
+
+        size_t num_work = 0;
+        if (shard->polls[0].revents) {
+            uint8_t drain[64];
+            while (read(shard->wake_fds[0], drain, sizeof(drain)) > 0);
+
+            pthread_mutex_lock(&shard->lock);
+            shard->woken = false;
+            bool stopping = shard->stopping;
+            relay_conn *ready = shard->ready;
+            shard->ready = NULL;
+            for (relay_conn *conn = ready; conn; conn = conn->next_ready) {
+                conn->ready = false;
+                relay_shard_add_work(shard, &num_work, conn);
+            }
+            relay_conn *incoming = shard->incoming;
+            shard->incoming = NULL;
+            pthread_mutex_unlock(&shard->lock);
+
+            if (stopping) {
+                for (size_t i = 0; i < num_work; i++) {
+                    shard->work[i]->queued = false;
+                }
+                // anything added after stopping was set is refused, so this is all of it
+                for (relay_conn *conn = incoming; conn; ) {
+                    relay_conn *next = conn->next_incoming;
+                    relay_conn_destroy(conn);
+                    conn = next;
+                }
+                break;
+            }
+            for (relay_conn *conn = incoming; conn; ) {
+                relay_conn *next = conn->next_incoming;
+                relay_shard_attach(shard, conn);
+                relay_shard_add_work(shard, &num_work, conn);
+                conn = next;
+            }
+        }
+        for (size_t i = 1; i < shard->num_polls; i++) {
+            if (shard->polls[i].fd >= 0 && shard->polls[i].revents) {
+                relay_shard_add_work(shard, &num_work, shard->conns[i]);
+            }
+        }
+
+        for (size_t i = 0; i < num_work; i++) {
+            relay_conn *conn = shard->work[i];
+            conn->queued = false;
+            if (!conn->failed) {
+                relay_conn_down(conn);
+            }
+            if (!conn->failed) {
+                relay_conn_up(conn);
+            }
+            if (relay_conn_done(conn)) {
+                relay_shard_detach(shard, conn);
+                relay_conn_destroy(conn);
+            } else {
+                relay_conn_watch(conn);
+            }
+        }
+    }
+
+    while (shard->num_polls > 1) {
+        relay_conn *conn = shard->conns[shard->num_polls - 1];
+        relay_shard_detach(shard, conn);
+        relay_conn_destroy(conn);
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+quiet_lwip_relay *quiet_lwip_relay_create(const quiet_lwip_relay_config *conf) {
+    quiet_lwip_relay *relay = calloc(1, sizeof(quiet_lwip_relay));
+    relay->num_shards = conf->num_threads ? conf->num_threads : 1;
+    relay->buf_len = conf->buf_len ? conf->buf_len : default_buf_len;
+    atomic_init(&relay->next_shard, 0);
+    atomic_init(&relay->open, 0);
+    atomic_init(&relay->opened, 0);
+    atomic_init(&relay->bytes_to_lwip, 0);
+    atomic_init(&relay->bytes_to_native, 0);
+
+    relay->shards = calloc(relay->num_shards, sizeof(relay_shard));
+    for (size_t i = 0; i < relay->num_shards; i++) {
+        relay_shard *shard = relay->shards + i;
+        shard->relay = relay;
+        if (pipe(shard->wake_fds) < 0) {
+            perror("relay: pipe");
+            // only the shards before this one are running
+            relay->num_shards = i;
+            quiet_lwip_relay_destroy(relay);
+            return NULL;
+        }
+        fcntl(shard->wake_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(shard->wake_fds[1], F_SETFL, O_NONBLOCK);
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->polls_cap = 16;
+        shard->polls = calloc(shard->polls_cap, sizeof(struct pollfd));
+        shard->conns = calloc(shard->polls_cap, sizeof(relay_conn*));
+        shard->polls[0].fd = shard->wake_fds[0];
+        shard->polls[0].events = POLLIN;
+        shard->num_polls = 1;
+        pthread_create(&shard->thread, NULL, relay_shard_run, shard);
+    }
+    return relay;
+}
+
+int quiet_lwip_relay_add(quiet_lwip_relay *relay, int native_fd, int lwip_fd) {
+    size_t next = atomic_fetch_add(&relay->next_shard, 1);
+    relay_shard *shard = relay->shards + next % relay->num_shards;
+
+    relay_conn *conn = calloc(1, sizeof(relay_conn));
+    conn->shard = shard;
+    conn->native_fd = native_fd;
+    conn->lwip_fd = lwip_fd;
+    fcntl(native_fd, F_SETFL, fcntl(native_fd, F_GETFL) | O_NONBLOCK);
+    lwip_fcntl(lwip_fd, F_SETFL, LWIP_O_NONBLOCK);
+
+    // counted first, as the shard may be done with it before we return
+    atomic_fetch_add(&relay->open, 1);
+    pthread_mutex_lock(&shard->lock);
+    if (shard->stopping) {
+        pthread_mutex_unlock(&shard->lock);
+        atomic_fetch_sub(&relay->open, 1);
+        free(conn);
+        return -1;
+    }
+    conn->next_incoming = shard->incoming;
+    shard->incoming = conn;
+    relay_shard_wake(shard);
+    pthread_mutex_unlock(&shard->lock);
+
+    atomic_fetch_add(&relay->opened, 1);
+    return 0;
+}
+
+void quiet_lwip_relay_get_stats(quiet_lwip_relay *relay, quiet_lwip_relay_stats *stats) {
+    stats->open = atomic_load(&relay->open);
+    stats->opened = atomic_load(&relay->opened);
+    stats->bytes_to_lwip = atomic_load(&relay->bytes_to_lwip);
+    stats->bytes_to_native = atomic_load(&relay->bytes_to_native);
+}
+
+void quiet_lwip_relay_destroy(quiet_lwip_relay *relay) {
+    for (size_t i = 0; i < relay->num_shards; i++) {
+        relay_shard *shard = relay->shards + i;
+        pthread_mutex_lock(&shard->lock);
+        shard->stopping = true;
+        relay_shard_wake(shard);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    for (size_t i = 0; i < relay->num_shards; i++) {
+        relay_shard *shard = relay->shards + i;
+        pthread_join(shard->thread, NULL);
+        close(shard->wake_fds[0]);
+        close(shard->wake_fds[1]);
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->polls);
+        free(shard->conns);
+        free(shard->work);
+        free(shard->spare);
+    }
+    free(relay->shards);
+    free(relay);
+}
+
+static void splice_relay_create() {
+    quiet_lwip_relay_config conf = {0};
+    splice_relay = quiet_lwip_relay_create(&conf);
+}
+
+int quiet_lwip_splice(int native_fd, int lwip_fd) {
+    pthread_once(&splice_once, splice_relay_create);
+    if (!splice_relay) {
+        return -1;
+    }
+    return quiet_lwip_relay_add(splice_relay, native_fd, lwip_fd);
+}
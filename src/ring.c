@@ -0,0 +1,51 @@
+#include "quiet-lwip/ring.h"
+
+sample_ring *sample_ring_create(size_t len) {
+    sample_ring *ring = calloc(1, sizeof(sample_ring));
+    ring->samples = calloc(len, sizeof(quiet_sample_t));
+    ring->len = len;
+    atomic_init(&ring->read_index, 0);
+    atomic_init(&ring->write_index, 0);
+    return ring;
+}
+
+void sample_ring_destroy(sample_ring *ring) {
+    free(ring->samples);
+    free(ring);
+}
+
+size_t sample_ring_readable(sample_ring *ring) {
+    size_t write_index = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    size_t read_index = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    return write_index - read_index;
+}
+
+size_t sample_ring_writable(sample_ring *ring) {
+    size_t write_index = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    size_t read_index = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    return ring->len - (write_index - read_index);
+}
+
+quiet_sample_t *sample_ring_read_span(sample_ring *ring, size_t *span_len) {
+    size_t readable = sample_ring_readable(ring);
+    size_t offset = atomic_load_explicit(&ring->read_index, memory_order_relaxed) % ring->len;
+    size_t until_wrap = ring->len - offset;
+    *span_len = (readable < until_wrap) ? readable : until_wrap;
+    return ring->samples + offset;
+}
+
+void sample_ring_read_commit(sample_ring *ring, size_t len) {
+    atomic_fetch_add_explicit(&ring->read_index, len, memory_order_release);
+}
+
+quiet_sample_t *sample_ring_write_span(sample_ring *ring, size_t *span_len) {
+    size_t writable = sample_ring_writable(ring);
+    size_t offset = atomic_load_explicit(&ring->write_index, memory_order_relaxed) % ring->len;
+    size_t until_wrap = ring->len - offset;
+    *span_len = (writable < until_wrap) ? writable : until_wrap;
+    return ring->samples + offset;
+}
+
+void sample_ring_write_commit(sample_ring *ring, size_t len) {
+    atomic_fetch_add_explicit(&ring->write_index, len, memory_order_release);
+}
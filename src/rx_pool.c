@@ -0,0 +1,111 @@
+#include "quiet-lwip/rx_pool.h"
+
+struct rx_buf {
+    // first, so lwip's pbuf pointer is also the rx_buf
+    struct pbuf_custom custom;
+    rx_pool *pool;
+    rx_buf *next;
+};
+
+// room kept in front of the pad so that lwip prepending a header to a
+//   received packet it turns around (an ICMP echo reply, say) stays well
+//   clear of the bookkeeping above. lwip only checks against struct pbuf
+static const size_t rx_headroom = PBUF_LINK_HLEN;
+
+static const size_t rx_align = 16;
+
+static size_t rx_round_up(size_t len) {
+    return (len + rx_align - 1) & ~(rx_align - 1);
+}
+
+static size_t rx_buf_header_len() {
+    return rx_round_up(sizeof(rx_buf)) + rx_round_up(rx_headroom);
+}
+
+static size_t rx_buf_stride(size_t frame_len) {
+    return rx_buf_header_len() + rx_round_up(ETH_PAD_SIZE + frame_len);
+}
+
+static uint8_t *rx_buf_payload(rx_buf *buf) {
+    return (uint8_t*)buf + rx_buf_header_len();
+}
+
+static void rx_pool_free(rx_pool *pool) {
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->memory);
+    free(pool);
+}
+
+static void rx_pool_put(rx_pool *pool, rx_buf *buf) {
+    pthread_mutex_lock(&pool->lock);
+    buf->next = pool->free;
+    pool->free = buf;
+    pool->out--;
+    bool release = pool->destroyed && !pool->out;
+    pthread_mutex_unlock(&pool->lock);
+    if (release) {
+        rx_pool_free(pool);
+    }
+}
+
+// lwip -> quiet: pbuf_free() on one of our pbufs
+static void rx_buf_free_pbuf(struct pbuf *p) {
+    rx_buf *buf = (rx_buf*)p;
+    rx_pool_put(buf->pool, buf);
+}
+
+rx_pool *rx_pool_create(size_t frame_len, size_t count) {
+    rx_pool *pool = calloc(1, sizeof(rx_pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->frame_len = frame_len;
+
+    size_t stride = rx_buf_stride(frame_len);
+    // the slack lets the first buffer start aligned
+    pool->memory = malloc(count * stride + rx_align);
+    uint8_t *next = (uint8_t*)rx_round_up((uintptr_t)pool->memory);
+    for (size_t i = 0; i < count; i++, next += stride) {
+        rx_buf *buf = (rx_buf*)next;
+        buf->pool = pool;
+        buf->next = pool->free;
+        pool->free = buf;
+    }
+    return pool;
+}
+
+void rx_pool_destroy(rx_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->destroyed = true;
+    bool release = !pool->out;
+    pthread_mutex_unlock(&pool->lock);
+    if (release) {
+        rx_pool_free(pool);
+    }
+}
+
+rx_buf *rx_pool_take(rx_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    rx_buf *buf = pool->free;
+    if (buf) {
+        pool->free = buf->next;
+        pool->out++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return buf;
+}
+
+void rx_pool_give_back(rx_buf *buf) {
+    rx_pool_put(buf->pool, buf);
+}
+
+uint8_t *rx_buf_frame(rx_buf *buf) {
+    return rx_buf_payload(buf) + ETH_PAD_SIZE;
+}
+
+struct pbuf *rx_buf_pbuf(rx_buf *buf, size_t len) {
+    size_t mem_len = ETH_PAD_SIZE + buf->pool->frame_len;
+    // PBUF_POOL so lwip treats the payload as its own, headers included
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, (u16_t)(ETH_PAD_SIZE + len), PBUF_POOL,
+                                         &buf->custom, rx_buf_payload(buf), (u16_t)mem_len);
+    buf->custom.custom_free_function = rx_buf_free_pbuf;
+    return p;
+}
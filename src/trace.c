@@ -0,0 +1,123 @@
+#include "quiet-lwip/trace.h"
+
+#include "lwip/sys.h"
+
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t total_us;
+    _Atomic uint64_t max_us;
+    _Atomic uint64_t buckets[QUIET_LWIP_HISTOGRAM_BUCKETS];
+} stage_histogram;
+
+static _Atomic bool tracing;
+static stage_histogram histograms[quiet_lwip_num_stages];
+
+static const char *stage_names[quiet_lwip_num_stages] = {
+    "socket_send",
+    "tcp_output",
+    "linkoutput",
+    "encoder_queue",
+    "first_sample_emitted",
+    "last_sample_emitted",
+    "first_sample_decoded",
+    "last_sample_decoded",
+    "recv_pbuf",
+    "socket_read",
+};
+
+bool trace_enabled() {
+    return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+uint64_t trace_now() {
+    return trace_enabled() ? sys_clock_now_us() : 0;
+}
+
+static size_t histogram_bucket(uint64_t latency_us) {
+    size_t bucket = 0;
+    while (latency_us && bucket < QUIET_LWIP_HISTOGRAM_BUCKETS - 1) {
+        latency_us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void histogram_add(stage_histogram *h, uint64_t latency_us) {
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total_us, latency_us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[histogram_bucket(latency_us)], 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (latency_us > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max_us, &max, latency_us,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void trace_stage(quiet_lwip_stage stage, uint64_t *stamp, uint64_t now) {
+    if (!now) {
+        return;
+    }
+    if (*stamp) {
+        // sample times are projected forward from the call that carried
+        //   them, so a stage can land a little before the one it follows
+        histogram_add(histograms + stage, (now > *stamp) ? now - *stamp : 0);
+    }
+    *stamp = now;
+}
+
+// lwip -> quiet: LWIP_STAMP_NOW()
+uint64_t quiet_lwip_trace_stamp_now() {
+    return trace_now();
+}
+
+// lwip -> quiet: LWIP_HOOK_STAGE()
+void quiet_lwip_trace_stage_hook(int stage, struct pbuf *p) {
+    if (!p->stamp) {
+        return;
+    }
+    switch (stage) {
+    case PBUF_STAGE_OUTPUT:
+        trace_stage(quiet_lwip_stage_tcp_output, &p->stamp, trace_now());
+        break;
+    case PBUF_STAGE_READ:
+        trace_stage(quiet_lwip_stage_socket_read, &p->stamp, trace_now());
+        // the socket may come back to this pbuf for a partial read
+        p->stamp = 0;
+        break;
+    }
+}
+
+void quiet_lwip_trace_enable(bool enable) {
+    atomic_store(&tracing, enable);
+}
+
+void quiet_lwip_trace_reset() {
+    for (size_t i = 0; i < quiet_lwip_num_stages; i++) {
+        stage_histogram *h = histograms + i;
+        atomic_store(&h->count, 0);
+        atomic_store(&h->total_us, 0);
+        atomic_store(&h->max_us, 0);
+        for (size_t j = 0; j < QUIET_LWIP_HISTOGRAM_BUCKETS; j++) {
+            atomic_store(&h->buckets[j], 0);
+        }
+    }
+}
+
+void quiet_lwip_trace_histograms(quiet_lwip_latency_histogram *hists) {
+    for (size_t i = 0; i < quiet_lwip_num_stages; i++) {
+        stage_histogram *h = histograms + i;
+        hists[i].count = atomic_load(&h->count);
+        hists[i].total_us = atomic_load(&h->total_us);
+        hists[i].max_us = atomic_load(&h->max_us);
+        for (size_t j = 0; j < QUIET_LWIP_HISTOGRAM_BUCKETS; j++) {
+            hists[i].buckets[j] = atomic_load(&h->buckets[j]);
+        }
+    }
+}
+
+const char *quiet_lwip_stage_name(quiet_lwip_stage stage) {
+    if (stage >= quiet_lwip_num_stages) {
+        return NULL;
+    }
+    return stage_names[stage];
+}
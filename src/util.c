@@ -1,4 +1,5 @@
 #include "quiet-lwip/util.h"
+#include "quiet-lwip/trace.h"
 
 size_t pbuf2buf(uint8_t *buf, struct pbuf *p) {
     pbuf_header(p, -ETH_PAD_SIZE);
@@ -21,11 +22,7 @@ struct pbuf *buf2pbuf(const uint8_t *buf, size_t len) {
     if (!p) {
         return NULL;
     }
-    size_t copied = 0;
-    for(struct pbuf *q = p; q != NULL; q = q->next) {
-        memcpy(q->payload, buf + copied, q->len);
-        copied += q->len;
-    }
+    pbuf_take(p, buf, len);
 
     pbuf_header(p, ETH_PAD_SIZE);
 
@@ -35,6 +32,17 @@ struct pbuf *buf2pbuf(const uint8_t *buf, size_t len) {
 void recv_pbuf(struct netif *netif, struct pbuf *p) {
     struct eth_hdr *ethhdr = p->payload;
 
+    trace_stage(quiet_lwip_stage_recv_pbuf, &p->stamp, trace_now());
+
+    // a shared medium delivers every frame to every listener, so drop
+    //   unicast frames meant for some other station like a nic filter would
+    if (!(ethhdr->dest.addr[0] & 0x01) &&
+            memcmp(ethhdr->dest.addr, netif->hwaddr, ETHARP_HWADDR_LEN) != 0) {
+        LINK_STATS_INC(link.drop);
+        pbuf_free(p);
+        return;
+    }
+
     switch (htons(ethhdr->type)) {
     /* IP or ARP packet? */
     case ETHTYPE_IP: